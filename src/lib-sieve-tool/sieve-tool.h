@@ -84,7 +84,8 @@ struct ostream *sieve_tool_open_output_stream(const char *filename);
  */
 
 struct sieve_binary *sieve_tool_script_compile
-	(struct sieve_instance *svinst, const char *filename, const char *name);
+	(struct sieve_instance *svinst, const char *filename, const char *name,
+		enum sieve_compile_flags flags);
 struct sieve_binary *sieve_tool_script_open
 	(struct sieve_instance *svinst, const char *filename);
 void sieve_tool_dump_binary_to
@@ -41,8 +41,6 @@ const struct sieve_command_def cmd_discard = {
 
 static bool cmd_discard_operation_dump
 	(const struct sieve_dumptime_env *denv, sieve_size_t *address);
-static int cmd_discard_operation_execute
-	(const struct sieve_runtime_env *renv, sieve_size_t *address);
 
 const struct sieve_operation_def cmd_discard_operation = {
 	.mnemonic = "DISCARD",
@@ -106,7 +104,7 @@ static bool cmd_discard_operation_dump
  * Interpretation
  */
 
-static int cmd_discard_operation_execute
+int cmd_discard_operation_execute
 (const struct sieve_runtime_env *renv ATTR_UNUSED,
 	sieve_size_t *address ATTR_UNUSED)
 {
@@ -243,8 +243,8 @@ static bool cmd_if_generate
 		 * anyway.
 		 */
 		if ( !sieve_command_block_exits_unconditionally(cmd) ) {
-			sieve_operation_emit(sblock, NULL, &sieve_jmp_operation);
-			cmd_data->exit_jump = sieve_binary_emit_offset(sblock, 0);
+			cmd_data->exit_jump =
+				sieve_generate_jump(cgenv, &sieve_jmp_operation);
 			cmd_data->jump_generated = TRUE;
 		}
 	}
@@ -40,8 +40,6 @@ const struct sieve_command_def cmd_keep = {
 
 static bool cmd_keep_operation_dump
 	(const struct sieve_dumptime_env *denv, sieve_size_t *address);
-static int cmd_keep_operation_execute
-	(const struct sieve_runtime_env *renv, sieve_size_t *address);
 
 const struct sieve_operation_def cmd_keep_operation = {
 	.mnemonic = "KEEP",
@@ -81,7 +79,7 @@ static bool cmd_keep_operation_dump
  * Interpretation
  */
 
-static int cmd_keep_operation_execute
+int cmd_keep_operation_execute
 (const struct sieve_runtime_env *renv, sieve_size_t *address)
 {
 	struct sieve_side_effects_list *slist = NULL;
@@ -58,8 +58,6 @@ const struct sieve_command_def cmd_redirect = {
 
 static bool cmd_redirect_operation_dump
 	(const struct sieve_dumptime_env *denv, sieve_size_t *address);
-static int cmd_redirect_operation_execute
-	(const struct sieve_runtime_env *renv, sieve_size_t *address);
 
 const struct sieve_operation_def cmd_redirect_operation = {
 	.mnemonic = "REDIRECT",
@@ -79,6 +77,8 @@ static int act_redirect_check_duplicate
 	(const struct sieve_runtime_env *renv,
 		const struct sieve_action *act,
 		const struct sieve_action *act_other);
+static const char *act_redirect_duplicate_key
+	(const struct sieve_script_env *senv, const struct sieve_action *act);
 static void act_redirect_print
 	(const struct sieve_action *action, const struct sieve_result_print_env *rpenv,
 		bool *keep);
@@ -91,6 +91,7 @@ const struct sieve_action_def act_redirect = {
 	.flags = SIEVE_ACTFLAG_TRIES_DELIVER,
 	.equals = act_redirect_equals,
 	.check_duplicate = act_redirect_check_duplicate,
+	.duplicate_key = act_redirect_duplicate_key,
 	.print = act_redirect_print,
 	.commit = act_redirect_commit
 };
@@ -184,7 +185,7 @@ static bool cmd_redirect_operation_dump
  * Code execution
  */
 
-static int cmd_redirect_operation_execute
+int cmd_redirect_operation_execute
 (const struct sieve_runtime_env *renv, sieve_size_t *address)
 {
 	struct sieve_instance *svinst = renv->svinst;
@@ -272,6 +273,17 @@ static int act_redirect_check_duplicate
 	return ( act_redirect_equals(renv->scriptenv, act, act_other) ? 1 : 0 );
 }
 
+static const char *act_redirect_duplicate_key
+(const struct sieve_script_env *senv ATTR_UNUSED,
+	const struct sieve_action *act)
+{
+	struct act_redirect_context *rd_ctx =
+		(struct act_redirect_context *) act->context;
+
+	/* Addresses are compared case-insensitively */
+	return t_str_lcase(rd_ctx->to_address);
+}
+
 static void act_redirect_print
 (const struct sieve_action *action,
 	const struct sieve_result_print_env *rpenv, bool *keep)
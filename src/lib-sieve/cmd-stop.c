@@ -35,13 +35,10 @@ const struct sieve_command_def cmd_stop = {
  * Stop operation
  */
 
-static int opc_stop_execute
-	(const struct sieve_runtime_env *renv, sieve_size_t *address);
-
 const struct sieve_operation_def cmd_stop_operation = {
 	.mnemonic = "STOP",
 	.code = SIEVE_OPERATION_STOP,
-	.execute = opc_stop_execute
+	.execute = cmd_stop_operation_execute
 };
 
 /*
@@ -73,7 +70,7 @@ static bool cmd_stop_generate
  * Code execution
  */
 
-static int opc_stop_execute
+int cmd_stop_operation_execute
 (const struct sieve_runtime_env *renv,  sieve_size_t *address ATTR_UNUSED)
 {
 	sieve_runtime_trace(renv, SIEVE_TRLVL_COMMANDS,
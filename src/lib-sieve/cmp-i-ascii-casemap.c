@@ -6,6 +6,7 @@
  */
 
 #include "lib.h"
+#include "str.h"
 
 #include "sieve-common.h"
 #include "sieve-comparators.h"
@@ -24,6 +25,9 @@ static int cmp_i_ascii_casemap_compare
 static bool cmp_i_ascii_casemap_char_match
 	(const struct sieve_comparator *cmp, const char **val1, const char *val1_end,
 		const char **val2, const char *val2_end);
+static bool cmp_i_ascii_casemap_normalize
+	(const struct sieve_comparator *cmp,
+		const char *val, size_t val_size, string_t *result);
 
 /*
  * Comparator object
@@ -39,7 +43,8 @@ const struct sieve_comparator_def i_ascii_casemap_comparator = {
 		SIEVE_COMPARATOR_FLAG_PREFIX_MATCH,
 	.compare = cmp_i_ascii_casemap_compare,
 	.char_match = cmp_i_ascii_casemap_char_match,
-	.char_skip = sieve_comparator_octet_skip
+	.char_skip = sieve_comparator_octet_skip,
+	.normalize = cmp_i_ascii_casemap_normalize
 };
 
 /*
@@ -96,4 +101,22 @@ static bool cmp_i_ascii_casemap_char_match
 	return TRUE;
 }
 
+static bool cmp_i_ascii_casemap_normalize
+	(const struct sieve_comparator *cmp ATTR_UNUSED,
+		const char *val, size_t val_size, string_t *result)
+{
+	unsigned char *data;
+	size_t i;
+
+	/* Comparison stops at the first NUL, which cannot be expressed as octet
+	   comparison */
+	if ( memchr(val, '\0', val_size) != NULL )
+		return FALSE;
+
+	data = buffer_append_space_unsafe(result, val_size);
+	for ( i = 0; i < val_size; i++ )
+		data[i] = i_tolower(val[i]);
+
+	return TRUE;
+}
 
@@ -36,9 +36,104 @@ const struct sieve_match_type_def contains_match_type = {
  * Match-type implementation
  */
 
-/* FIXME: Naive substring match implementation. Should switch to more
- * efficient algorithm if large values need to be searched (e.g. message body).
+/* Values shorter than this are scanned directly; building the Horspool shift
+ * table only pays off for larger values, such as a message body.
  */
+#define MCHT_CONTAINS_HORSPOOL_MIN_SIZE 256
+
+static inline unsigned char mcht_contains_fold
+(unsigned char c, bool casemap)
+{
+	return ( casemap ? (unsigned char)i_tolower(c) : c );
+}
+
+static inline int mcht_contains_memcmp
+(const unsigned char *p1, const unsigned char *p2, size_t size, bool casemap)
+{
+	return ( casemap ? i_memcasecmp(p1, p2, size) : memcmp(p1, p2, size) );
+}
+
+static bool mcht_contains_horspool
+(const unsigned char *val, size_t val_size,
+	const unsigned char *key, size_t key_size, bool casemap)
+{
+	size_t shift[256];
+	size_t last = key_size - 1;
+	size_t pos, i;
+	unsigned char kc, vc;
+
+	/* Shift table is indexed by folded character */
+	for ( i = 0; i < N_ELEMENTS(shift); i++ )
+		shift[i] = key_size;
+	for ( i = 0; i < last; i++ )
+		shift[mcht_contains_fold(key[i], casemap)] = last - i;
+
+	kc = mcht_contains_fold(key[last], casemap);
+	for ( pos = 0; pos <= val_size - key_size; pos += shift[vc] ) {
+		vc = mcht_contains_fold(val[pos + last], casemap);
+		if ( vc != kc )
+			continue;
+
+		if ( mcht_contains_memcmp(val + pos, key, last, casemap) == 0 )
+			return TRUE;
+	}
+	return FALSE;
+}
+
+static bool mcht_contains_scan
+(const unsigned char *val, size_t val_size,
+	const unsigned char *key, size_t key_size, bool casemap)
+{
+	const unsigned char *vp = val;
+	const unsigned char *vend = val + (val_size - key_size) + 1;
+	unsigned char lc = key[0], uc = key[0];
+
+	if ( casemap ) {
+		lc = (unsigned char)i_tolower(key[0]);
+		uc = (unsigned char)i_toupper(key[0]);
+	}
+
+	if ( lc == uc ) {
+		/* Let memchr() find candidates for the first key character */
+		while ( vp < vend &&
+			(vp = memchr(vp, key[0], vend - vp)) != NULL ) {
+			if ( mcht_contains_memcmp
+				(vp + 1, key + 1, key_size - 1, casemap) == 0 )
+				return TRUE;
+			vp++;
+		}
+		return FALSE;
+	}
+
+	for ( ; vp < vend; vp++ ) {
+		if ( (*vp == lc || *vp == uc) &&
+			i_memcasecmp(vp + 1, key + 1, key_size - 1) == 0 )
+			return TRUE;
+	}
+	return FALSE;
+}
+
+static int mcht_contains_find
+(const char *val, size_t val_size, const char *key, size_t key_size,
+	bool casemap)
+{
+	const unsigned char *uval = (const unsigned char *)val;
+	const unsigned char *ukey = (const unsigned char *)key;
+
+	if ( key_size == 0 )
+		return 1;
+	if ( key_size > val_size )
+		return 0;
+
+	if ( key_size > 1 && val_size >= MCHT_CONTAINS_HORSPOOL_MIN_SIZE ) {
+		return ( mcht_contains_horspool
+			(uval, val_size, ukey, key_size, casemap) ? 1 : 0 );
+	}
+
+	return ( mcht_contains_scan
+		(uval, val_size, ukey, key_size, casemap) ? 1 : 0 );
+}
+
 static int mcht_contains_match_key
 (struct sieve_match_context *mctx, const char *val, size_t val_size,
 	const char *key, size_t key_size)
@@ -52,6 +147,13 @@ static int mcht_contains_match_key
 	if ( val_size == 0 )
 		return ( key_size == 0 ? 1 : 0 );
 
+	/* Dedicated substring search for the core comparators */
+	if ( sieve_comparator_is(cmp, i_octet_comparator) )
+		return mcht_contains_find(val, val_size, key, key_size, FALSE);
+	if ( sieve_comparator_is(cmp, i_ascii_casemap_comparator) )
+		return mcht_contains_find(val, val_size, key, key_size, TRUE);
+
+	/* Naive substring match for any other comparator */
 	if ( cmp->def == NULL || cmp->def->char_match == NULL )
 		return 0;
 
@@ -62,5 +164,3 @@ static int mcht_contains_match_key
 
 	return ( kp == kend ? 1 : 0 );
 }
-
-
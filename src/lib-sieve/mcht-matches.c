@@ -5,11 +5,15 @@
  */
 
 #include "lib.h"
+#include "buffer.h"
 #include "str.h"
 
+#include "sieve-binary.h"
+#include "sieve-interpreter.h"
 #include "sieve-match-types.h"
 #include "sieve-comparators.h"
 #include "sieve-match.h"
+#include "sieve-match-keyset.h"
 
 #include <string.h>
 #include <stdio.h>
@@ -45,6 +49,410 @@ const struct sieve_match_type_def matches_match_type = {
 #define debug_printf(...)
 #endif
 
+/*
+ * Compiled pattern
+ */
+
+/* The pattern is compiled into a sequence of tokens. The tokens between two
+ * '*' wildcards form a block of fixed length, which is matched at the
+ * leftmost position where it fits. Since each '*' matches as little as
+ * possible, this never needs to backtrack.
+ */
+
+enum mcht_matches_token_type {
+	MCHT_MATCHES_TOKEN_TEXT,
+	MCHT_MATCHES_TOKEN_ANY,  /* '?' */
+	MCHT_MATCHES_TOKEN_STAR  /* '*' */
+};
+
+struct mcht_matches_token {
+	enum mcht_matches_token_type type;
+
+	/* Text without escapes (case-folded for i;ascii-casemap) */
+	const unsigned char *text;
+	size_t size;
+
+	/* Horspool shift table for text that starts a block after '*' */
+	const unsigned char *shift;
+};
+
+struct sieve_match_pattern {
+	const struct mcht_matches_token *tokens;
+	unsigned int count;
+
+	/* Number of '?' and '*' wildcards */
+	unsigned int wildcards;
+	bool casemap:1;
+};
+
+/* Minimum text size for which a shift table is built */
+#define MCHT_MATCHES_SHIFT_MIN_SIZE 3
+
+static inline unsigned char mcht_matches_fold
+(unsigned char c, bool casemap)
+{
+	return ( casemap ? (unsigned char)i_tolower(c) : c );
+}
+
+static const unsigned char *mcht_matches_shift_create
+(pool_t pool, const unsigned char *text, size_t size)
+{
+	unsigned char *shift;
+	size_t last = size - 1, i;
+
+	/* Shifts are capped at 255, which only makes skipping less effective */
+	shift = p_malloc(pool, 256);
+	memset(shift, (size > 255 ? 255 : size), 256);
+	for ( i = (last > 255 ? last - 255 : 0); i < last; i++ )
+		shift[text[i]] = last - i;
+	return shift;
+}
+
+static struct sieve_match_pattern *mcht_matches_pattern_compile
+(pool_t pool, const char *key, size_t key_size, bool casemap)
+{
+	struct sieve_match_pattern *pattern;
+	ARRAY(struct mcht_matches_token) tokens;
+	struct mcht_matches_token *token = NULL;
+	buffer_t *text = NULL;
+	const char *kp = key, *kend = key + key_size;
+	bool after_star = FALSE;
+
+	pattern = p_new(pool, struct sieve_match_pattern, 1);
+	pattern->casemap = casemap;
+	p_array_init(&tokens, pool, 8);
+
+	while ( kp < kend ) {
+		if ( *kp == '*' || *kp == '?' ) {
+			if ( token != NULL ) {
+				/* Finish text token */
+				token->size = text->used;
+				token->text = p_memdup(pool, text->data, text->used);
+				if ( after_star && token->size >= MCHT_MATCHES_SHIFT_MIN_SIZE ) {
+					token->shift = mcht_matches_shift_create
+						(pool, token->text, token->size);
+				}
+				after_star = FALSE;
+				token = NULL;
+			}
+
+			token = array_append_space(&tokens);
+			if ( *kp == '*' ) {
+				token->type = MCHT_MATCHES_TOKEN_STAR;
+				after_star = TRUE;
+			} else {
+				token->type = MCHT_MATCHES_TOKEN_ANY;
+			}
+			token = NULL;
+			pattern->wildcards++;
+			kp++;
+			continue;
+		}
+
+		if ( *kp == '\\' ) {
+			/* Escaped character; a trailing backslash is ignored */
+			if ( ++kp == kend )
+				break;
+		}
+
+		if ( token == NULL ) {
+			token = array_append_space(&tokens);
+			token->type = MCHT_MATCHES_TOKEN_TEXT;
+			if ( text == NULL )
+				text = buffer_create_dynamic(pool_datastack_create(), 64);
+			else
+				buffer_set_used_size(text, 0);
+		}
+		buffer_append_c(text, mcht_matches_fold(*kp, casemap));
+		kp++;
+	}
+
+	if ( token != NULL ) {
+		token->size = text->used;
+		token->text = p_memdup(pool, text->data, text->used);
+		if ( after_star && token->size >= MCHT_MATCHES_SHIFT_MIN_SIZE ) {
+			token->shift = mcht_matches_shift_create
+				(pool, token->text, token->size);
+		}
+	}
+
+	pattern->tokens = array_get(&tokens, &pattern->count);
+	return pattern;
+}
+
+static struct sieve_match_pattern *mcht_matches_pattern_get
+(struct sieve_match_context *mctx, const char *key, size_t key_size,
+	bool casemap)
+{
+	struct sieve_match_keyset *kset = mctx->keyset;
+	struct sieve_match_pattern *pattern;
+
+	/* Only literal keys are compiled once; these are the same each time the
+	   binary is executed */
+	if ( kset == NULL ) {
+		return mcht_matches_pattern_compile
+			(pool_datastack_create(), key, key_size, casemap);
+	}
+
+	pattern = sieve_match_keyset_get_key_context(kset, mctx->key_index);
+	if ( pattern == NULL ) {
+		pattern = mcht_matches_pattern_compile
+			(sieve_match_keyset_pool(kset), key, key_size, casemap);
+		sieve_match_keyset_set_key_context(kset, mctx->key_index, pattern);
+		return pattern;
+	}
+
+	/* The pattern was compiled for another comparator */
+	if ( pattern->casemap != casemap ) {
+		return mcht_matches_pattern_compile
+			(pool_datastack_create(), key, key_size, casemap);
+	}
+	return pattern;
+}
+
+/*
+ * Pattern matching
+ */
+
+struct mcht_matches_capture {
+	const char *value;
+	size_t size;
+};
+
+static inline unsigned int mcht_matches_block_end
+(const struct sieve_match_pattern *pattern, unsigned int start,
+	size_t *size_r)
+{
+	unsigned int i;
+
+	*size_r = 0;
+	for ( i = start; i < pattern->count; i++ ) {
+		const struct mcht_matches_token *token = &pattern->tokens[i];
+
+		if ( token->type == MCHT_MATCHES_TOKEN_STAR )
+			break;
+		*size_r += ( token->type == MCHT_MATCHES_TOKEN_TEXT ? token->size : 1 );
+	}
+	return i;
+}
+
+/* Match the block of tokens [start, end) right at the value pointer, which
+   must have enough characters left */
+static bool mcht_matches_block_at
+(const struct sieve_match_pattern *pattern, unsigned int start,
+	unsigned int end, const char *vp, struct mcht_matches_capture *captures,
+	unsigned int capture)
+{
+	unsigned int i;
+
+	for ( i = start; i < end; i++ ) {
+		const struct mcht_matches_token *token = &pattern->tokens[i];
+
+		if ( token->type == MCHT_MATCHES_TOKEN_ANY ) {
+			captures[capture].value = vp;
+			captures[capture++].size = 1;
+			vp++;
+			continue;
+		}
+
+		if ( pattern->casemap ) {
+			if ( i_memcasecmp(vp, token->text, token->size) != 0 )
+				return FALSE;
+		} else {
+			if ( memcmp(vp, token->text, token->size) != 0 )
+				return FALSE;
+		}
+		vp += token->size;
+	}
+	return TRUE;
+}
+
+/* Find the leftmost occurrence of a text token starting in [vp, vlast] */
+static const char *mcht_matches_find_text
+(const struct sieve_match_pattern *pattern,
+	const struct mcht_matches_token *token, const char *vp, const char *vlast)
+{
+	const unsigned char *text = token->text;
+	size_t last = token->size - 1;
+	unsigned char c;
+
+	if ( token->shift != NULL ) {
+		while ( vp <= vlast ) {
+			c = mcht_matches_fold(vp[last], pattern->casemap);
+			if ( c == text[last] &&
+				mcht_matches_block_at(pattern, token - pattern->tokens,
+					token - pattern->tokens + 1, vp, NULL, 0) )
+				return vp;
+			vp += token->shift[c];
+		}
+		return NULL;
+	}
+
+	for ( ; vp <= vlast; vp++ ) {
+		c = mcht_matches_fold(*vp, pattern->casemap);
+		if ( c == text[0] &&
+			mcht_matches_block_at(pattern, token - pattern->tokens,
+				token - pattern->tokens + 1, vp, NULL, 0) )
+			return vp;
+	}
+	return NULL;
+}
+
+/* Find the leftmost position in [vp, vlast] where the block [start, end)
+   matches */
+static const char *mcht_matches_find_block
+(const struct sieve_match_pattern *pattern, unsigned int start,
+	unsigned int end, const char *vp, const char *vlast,
+	struct mcht_matches_capture *captures, unsigned int capture)
+{
+	unsigned int i, lead = 0;
+	const char *tp;
+
+	/* Locate the first text token of the block; the '?' wildcards before it
+	   only shift the position */
+	for ( i = start; i < end; i++ ) {
+		if ( pattern->tokens[i].type == MCHT_MATCHES_TOKEN_TEXT )
+			break;
+		lead++;
+	}
+
+	if ( i == end ) {
+		/* Only '?' wildcards */
+		return ( vp <= vlast &&
+			mcht_matches_block_at(pattern, start, end, vp, captures, capture) ?
+			vp : NULL );
+	}
+
+	while ( vp <= vlast ) {
+		tp = mcht_matches_find_text
+			(pattern, &pattern->tokens[i], vp + lead, vlast + lead);
+		if ( tp == NULL )
+			return NULL;
+
+		vp = tp - lead;
+		if ( mcht_matches_block_at(pattern, start, end, vp, captures, capture) )
+			return vp;
+		vp++;
+	}
+	return NULL;
+}
+
+static unsigned int mcht_matches_block_anys
+(const struct sieve_match_pattern *pattern, unsigned int start,
+	unsigned int end)
+{
+	unsigned int i, count = 0;
+
+	for ( i = start; i < end; i++ ) {
+		if ( pattern->tokens[i].type == MCHT_MATCHES_TOKEN_ANY )
+			count++;
+	}
+	return count;
+}
+
+static bool mcht_matches_pattern_match
+(const struct sieve_match_pattern *pattern, const char *val, size_t val_size,
+	struct mcht_matches_capture *captures)
+{
+	const char *vp = val, *vend = val + val_size, *vlimit, *bp;
+	unsigned int i, end, last_star, capture = 0;
+	size_t size, tail_size;
+
+	/* Leading block must match at the beginning */
+	end = mcht_matches_block_end(pattern, 0, &size);
+	if ( end == pattern->count ) {
+		/* No '*' wildcard: block must match the value exactly */
+		return ( size == val_size &&
+			mcht_matches_block_at(pattern, 0, end, vp, captures, capture) );
+	}
+	if ( size > val_size ||
+		!mcht_matches_block_at(pattern, 0, end, vp, captures, capture) )
+		return FALSE;
+	vp += size;
+	capture += mcht_matches_block_anys(pattern, 0, end);
+
+	/* Trailing block must match at the end */
+	for ( last_star = pattern->count - 1;
+		pattern->tokens[last_star].type != MCHT_MATCHES_TOKEN_STAR;
+		last_star-- );
+	(void)mcht_matches_block_end(pattern, last_star + 1, &tail_size);
+	if ( tail_size > (size_t)(vend - vp) )
+		return FALSE;
+	vlimit = vend - tail_size;
+
+	/* Blocks between '*' wildcards are matched at the leftmost position */
+	for ( i = end; i < last_star; i = end ) {
+		unsigned int star = capture++;
+
+		end = mcht_matches_block_end(pattern, i + 1, &size);
+		if ( size > (size_t)(vlimit - vp) )
+			return FALSE;
+
+		bp = vp;
+		if ( end > i + 1 ) {
+			bp = mcht_matches_find_block
+				(pattern, i + 1, end, vp, vlimit - size, captures, capture);
+			if ( bp == NULL )
+				return FALSE;
+		}
+
+		captures[star].value = vp;
+		captures[star].size = bp - vp;
+		capture += mcht_matches_block_anys(pattern, i + 1, end);
+		vp = bp + size;
+	}
+
+	/* Last '*' takes whatever remains before the trailing block */
+	captures[capture].value = vp;
+	captures[capture].size = vlimit - vp;
+	capture++;
+
+	return mcht_matches_block_at
+		(pattern, last_star + 1, pattern->count, vlimit, captures, capture);
+}
+
+static int mcht_matches_match_key_compiled
+(struct sieve_match_context *mctx, const char *val, size_t val_size,
+	const char *key, size_t key_size, bool casemap)
+{
+	const struct sieve_match_pattern *pattern;
+	struct mcht_matches_capture *captures;
+	struct sieve_match_values *mvalues;
+	unsigned int i;
+
+	pattern = mcht_matches_pattern_get(mctx, key, key_size, casemap);
+	captures = t_new(struct mcht_matches_capture, pattern->wildcards + 1);
+
+	if ( !mcht_matches_pattern_match(pattern, val, val_size, captures) )
+		return 0;
+
+	/* Activate new match values after successful match */
+	if ( (mvalues = sieve_match_values_start(mctx->runenv)) != NULL ) {
+		string_t *mvalue;
+
+		/* Set ${0} */
+		mvalue = str_new_const(pool_datastack_create(), val, val_size);
+		sieve_match_values_add(mvalues, mvalue);
+
+		/* Set ${1}... */
+		for ( i = 0; i < pattern->wildcards; i++ ) {
+			mvalue = str_new_const(pool_datastack_create(),
+				captures[i].value, captures[i].size);
+			sieve_match_values_add(mvalues, mvalue);
+		}
+
+		/* Commit new match values */
+		sieve_match_values_commit(mctx->runenv, &mvalues);
+	}
+	return 1;
+}
+
+/*
+ * Generic implementation
+ */
+
+/* Used for comparators other than i;octet and i;ascii-casemap */
+
 /* FIXME: Naive implementation, substitute this with dovecot src/lib/str-find.c
  */
 static inline bool _string_find(const struct sieve_comparator *cmp,
@@ -80,7 +488,7 @@ static char _scan_key_section
 	return '\0';
 }
 
-static int mcht_matches_match_key
+static int mcht_matches_match_key_generic
 (struct sieve_match_context *mctx, const char *val, size_t val_size,
 	const char *key, size_t key_size)
 {
@@ -438,3 +846,22 @@ static int mcht_matches_match_key
 	return 0;
 }
 
+
+static int mcht_matches_match_key
+(struct sieve_match_context *mctx, const char *val, size_t val_size,
+	const char *key, size_t key_size)
+{
+	const struct sieve_comparator *cmp = mctx->comparator;
+
+	if ( sieve_comparator_is(cmp, i_octet_comparator) ) {
+		return mcht_matches_match_key_compiled
+			(mctx, val, val_size, key, key_size, FALSE);
+	}
+	if ( sieve_comparator_is(cmp, i_ascii_casemap_comparator) ) {
+		return mcht_matches_match_key_compiled
+			(mctx, val, val_size, key, key_size, TRUE);
+	}
+
+	return mcht_matches_match_key_generic
+		(mctx, val, val_size, key, key_size);
+}
@@ -13,6 +13,7 @@
 #include "sieve-stringlist.h"
 #include "sieve-code.h"
 #include "sieve-message.h"
+#include "sieve-match.h"
 #include "sieve-interpreter.h"
 
 #include "ext-body-common.h"
@@ -100,3 +101,102 @@ static void ext_body_stringlist_reset
 
 	strlist->body_parts_iter = strlist->body_parts;
 }
+
+/*
+ * Body part matching
+ */
+
+struct ext_body_match_sink {
+	struct sieve_message_body_sink sink;
+
+	struct sieve_match_stream *mstream;
+};
+
+static bool ext_body_match_sink_part_more
+(struct sieve_message_body_sink *_sink, const unsigned char *data,
+	size_t size)
+{
+	struct ext_body_match_sink *sink = (struct ext_body_match_sink *)_sink;
+
+	return ( sieve_match_stream_more(sink->mstream, data, size) != 0 );
+}
+
+static bool ext_body_match_sink_part_end
+(struct sieve_message_body_sink *_sink)
+{
+	struct ext_body_match_sink *sink = (struct ext_body_match_sink *)_sink;
+
+	return ( sieve_match_stream_value_end(sink->mstream) != 0 );
+}
+
+static void ext_body_match_sink_reset
+(struct sieve_message_body_sink *_sink)
+{
+	struct ext_body_match_sink *sink = (struct ext_body_match_sink *)_sink;
+
+	sieve_match_stream_reset(sink->mstream);
+}
+
+int ext_body_match
+(const struct sieve_runtime_env *renv, enum tst_body_transform transform,
+	const char * const *content_types, const struct sieve_match_type *mcht,
+	const struct sieve_comparator *cmp, struct sieve_stringlist *key_list,
+	int *exec_status)
+{
+	static const char * const _no_content_types[] = { "", NULL };
+	struct sieve_stringlist *value_list;
+	struct sieve_match_context *mctx;
+	struct ext_body_match_sink sink;
+	int match, ret;
+
+	*exec_status = SIEVE_EXEC_OK;
+
+	if ( !sieve_match_stream_supported(mcht, cmp) ) {
+		/* Extract requested parts */
+		if ( (ret=ext_body_get_part_list
+			(renv, transform, content_types, &value_list)) <= 0 ) {
+			*exec_status = ret;
+			return -1;
+		}
+
+		return sieve_match(renv, mcht, cmp, value_list, key_list, exec_status);
+	}
+
+	/* Match the body parts while these are read from the message, so that
+	   large parts are never held in memory as a whole */
+
+	if ( content_types == NULL ) content_types = _no_content_types;
+
+	if ( (mctx=sieve_match_begin(renv, mcht, cmp)) == NULL )
+		return 0;
+
+	i_zero(&sink);
+	sink.sink.part_more = ext_body_match_sink_part_more;
+	sink.sink.part_end = ext_body_match_sink_part_end;
+	sink.sink.reset = ext_body_match_sink_reset;
+	sink.mstream = sieve_match_stream_begin(mctx, key_list);
+
+	switch ( transform ) {
+	case TST_BODY_TRANSFORM_RAW:
+		ret = sieve_message_body_stream_raw(renv, &sink.sink);
+		break;
+	case TST_BODY_TRANSFORM_CONTENT:
+		ret = sieve_message_body_stream_content
+			(renv, content_types, &sink.sink);
+		break;
+	case TST_BODY_TRANSFORM_TEXT:
+		ret = sieve_message_body_stream_text(renv, &sink.sink);
+		break;
+	default:
+		i_unreached();
+	}
+
+	sieve_match_stream_end(&sink.mstream);
+	match = sieve_match_end(&mctx, exec_status);
+
+	if ( ret <= 0 ) {
+		*exec_status = ret;
+		return -1;
+	}
+	return match;
+}
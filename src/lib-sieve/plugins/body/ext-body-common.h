@@ -40,4 +40,12 @@ int ext_body_get_part_list
 	(const struct sieve_runtime_env *renv, enum tst_body_transform transform,
 		const char * const *content_types, struct sieve_stringlist **strlist_r);
 
+/* Matches the requested body parts against the key list; the parts are
+   streamed when the match allows for it */
+int ext_body_match
+	(const struct sieve_runtime_env *renv, enum tst_body_transform transform,
+		const char * const *content_types, const struct sieve_match_type *mcht,
+		const struct sieve_comparator *cmp, struct sieve_stringlist *key_list,
+		int *exec_status);
+
 #endif /* __EXT_BODY_COMMON_H */
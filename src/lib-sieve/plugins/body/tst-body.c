@@ -302,7 +302,7 @@ static int ext_body_operation_execute
 	struct sieve_match_type mcht =
 		SIEVE_MATCH_TYPE_DEFAULT(is_match_type);
 	unsigned int transform = TST_BODY_TRANSFORM_TEXT;
-	struct sieve_stringlist *ctype_list, *value_list, *key_list;
+	struct sieve_stringlist *ctype_list, *key_list;
 	bool mvalues_active;
 	const char * const *content_types = NULL;
 	int match, ret;
@@ -362,16 +362,12 @@ static int ext_body_operation_execute
 
 	sieve_runtime_trace(renv, SIEVE_TRLVL_TESTS, "body test");
 
-	/* Extract requested parts */
-	if ( (ret=ext_body_get_part_list(renv,
-		(enum tst_body_transform) transform, content_types,&value_list)) <= 0 )
-		return ret;
-
 	/* Disable match values processing as required by RFC */
 	mvalues_active = sieve_match_values_set_enabled(renv, FALSE);
 
-	/* Perform match */
-	match = sieve_match(renv, &mcht, &cmp, value_list, key_list, &ret);
+	/* Perform match on the requested parts */
+	match = ext_body_match(renv, (enum tst_body_transform) transform,
+		content_types, &mcht, &cmp, key_list, &ret);
 
 	/* Restore match values processing */
 	(void)sieve_match_values_set_enabled(renv, mvalues_active);
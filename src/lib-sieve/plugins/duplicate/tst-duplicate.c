@@ -235,8 +235,19 @@ static bool tst_duplicate_registered
 static bool tst_duplicate_generate
 (const struct sieve_codegen_env *cgenv, struct sieve_command *cmd)
 {
+	struct sieve_ast_argument *arg;
+
 	sieve_operation_emit(cgenv->sblock, cmd->ext, &tst_duplicate_operation);
 
+	/* Record the header field accessed through the :header argument */
+	arg = sieve_command_first_argument(cmd);
+	while ( arg != NULL ) {
+		if ( sieve_ast_argument_type(arg) != SAAT_TAG &&
+			arg->argument != NULL && arg->argument->id_code == OPT_HEADER )
+			sieve_generate_header_names(cgenv, arg);
+		arg = sieve_ast_argument_next(arg);
+	}
+
 	if ( !sieve_generate_arguments(cgenv, cmd, NULL) )
 		return FALSE;
 
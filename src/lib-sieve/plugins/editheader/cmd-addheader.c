@@ -201,6 +201,9 @@ static bool cmd_addheader_generate
 {
 	(void)sieve_operation_emit(cgenv->sblock, cmd->ext, &addheader_operation);
 
+	/* Editing the header needs the whole header of the message */
+	sieve_generate_header_names(cgenv, NULL);
+
 	/* Generate arguments */
 	return sieve_generate_arguments(cgenv, cmd, NULL);
 }
@@ -297,6 +297,9 @@ static bool cmd_deleteheader_generate
 {
 	sieve_operation_emit(cgenv->sblock, cmd->ext, &deleteheader_operation);
 
+	/* Editing the header needs the whole header of the message */
+	sieve_generate_header_names(cgenv, NULL);
+
  	/* Generate arguments */
 	if ( !sieve_generate_arguments(cgenv, cmd, NULL) )
 		return FALSE;
@@ -53,10 +53,23 @@ const struct sieve_binary_extension include_binary_ext = {
  * Binary context management
  */
 
+struct ext_include_binary_storage {
+	/* Generation of the storage when the binary was compiled; NULL when the
+	 * storage had none.
+	 */
+	const char *generation;
+
+	bool used:1;
+};
+
 struct ext_include_binary_context {
+	const struct sieve_extension *ext;
 	struct sieve_binary *binary;
 	struct sieve_binary_block *dependency_block;
 
+	/* Storages the included scripts were read from, indexed by location */
+	struct ext_include_binary_storage storages[EXT_INCLUDE_LOCATION_INVALID];
+
 	HASH_TABLE(struct sieve_script *,
 		   struct ext_include_script_info *) included_scripts;
 	ARRAY(struct ext_include_script_info *) include_index;
@@ -64,6 +77,8 @@ struct ext_include_binary_context {
 	struct sieve_variable_scope_binary *global_vars;
 
 	bool outdated:1;
+	/* Dependencies were just checked when the binary was opened */
+	bool verified:1;
 };
 
 static struct ext_include_binary_context *ext_include_binary_create_context
@@ -74,6 +89,7 @@ static struct ext_include_binary_context *ext_include_binary_create_context
 	struct ext_include_binary_context *ctx =
 		p_new(pool, struct ext_include_binary_context, 1);
 
+	ctx->ext = this_ext;
 	ctx->binary = sbin;
 	hash_table_create(&ctx->included_scripts, pool, 0,
 		sieve_script_hash, sieve_script_cmp);
@@ -143,6 +159,24 @@ struct ext_include_script_info *ext_include_binary_script_include
 	/* Unreferenced on binary_free */
 	sieve_script_ref(script);
 
+	/* Record the generation of the storage before any script is read from it
+	 * for this binary, so that a later change is noticed for certain.
+	 */
+	if ( !sieve_binary_loaded(binctx->binary) &&
+		!binctx->storages[location].used ) {
+		struct ext_include_binary_storage *bstorage =
+			&binctx->storages[location];
+		struct sieve_storage *storage;
+		const char *generation;
+
+		bstorage->used = TRUE;
+		storage = ext_include_get_script_storage
+			(binctx->ext, location, sieve_script_name(script), NULL);
+		if ( storage != NULL &&
+			sieve_storage_get_generation(storage, &generation) > 0 )
+			bstorage->generation = p_strdup(pool, generation);
+	}
+
 	hash_table_insert(binctx->included_scripts, script, incscript);
 	array_append(&binctx->include_index, &incscript, 1);
 
@@ -210,17 +244,39 @@ static bool ext_include_binary_pre_save
 		(struct ext_include_binary_context *) context;
 	struct ext_include_script_info *const *scripts;
 	struct sieve_binary_block *sblock = binctx->dependency_block;
-	unsigned int script_count, i;
+	unsigned int script_count, storage_count, i;
 	bool result = TRUE;
 
 	sieve_binary_block_clear(sblock);
 
+	/* Storage generations */
+	storage_count = 0;
+	for ( i = 0; i < EXT_INCLUDE_LOCATION_INVALID; i++ ) {
+		if ( binctx->storages[i].used )
+			storage_count++;
+	}
+
+	sieve_binary_emit_unsigned(sblock, storage_count);
+
+	for ( i = 0; i < EXT_INCLUDE_LOCATION_INVALID; i++ ) {
+		const char *generation = binctx->storages[i].generation;
+
+		if ( !binctx->storages[i].used )
+			continue;
+
+		sieve_binary_emit_byte(sblock, i);
+		sieve_binary_emit_cstring(sblock,
+			( generation == NULL ? "" : generation ));
+	}
+
+	/* Included scripts */
 	scripts = array_get(&binctx->include_index, &script_count);
 
 	sieve_binary_emit_unsigned(sblock, script_count);
 
 	for ( i = 0; i < script_count; i++ ) {
 		struct ext_include_script_info *incscript = scripts[i];
+		sieve_size_t metadata_address;
 
 		if ( incscript->block != NULL ) {
 			sieve_binary_emit_unsigned
@@ -231,7 +287,11 @@ static bool ext_include_binary_pre_save
 		sieve_binary_emit_byte(sblock, incscript->location);
 		sieve_binary_emit_cstring(sblock, sieve_script_name(incscript->script));
 		sieve_binary_emit_byte(sblock, incscript->flags);
+
+		/* The metadata is skipped when the storages did not change */
+		metadata_address = sieve_binary_emit_offset(sblock, 0);
 		sieve_script_binary_write_metadata(incscript->script, sblock);
+		sieve_binary_resolve_offset(sblock, metadata_address);
 	}
 
 	result = ext_include_variables_save(sblock, binctx->global_vars, error_r);
@@ -239,6 +299,105 @@ static bool ext_include_binary_pre_save
 	return result;
 }
 
+static bool ext_include_binary_storages_unchanged
+(struct ext_include_binary_context *binctx)
+{
+	unsigned int i;
+
+	for ( i = 0; i < EXT_INCLUDE_LOCATION_INVALID; i++ ) {
+		struct ext_include_binary_storage *bstorage = &binctx->storages[i];
+		struct sieve_storage *storage;
+		const char *generation;
+
+		if ( !bstorage->used )
+			continue;
+		if ( bstorage->generation == NULL )
+			return FALSE;
+
+		storage = ext_include_get_script_storage
+			(binctx->ext, i, "", NULL);
+		if ( storage == NULL ||
+			sieve_storage_get_generation(storage, &generation) <= 0 ||
+			strcmp(generation, bstorage->generation) != 0 )
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+static struct sieve_script *ext_include_binary_get_script
+(const struct sieve_extension *ext,
+	enum ext_include_script_location location, const char *script_name)
+{
+	struct sieve_storage *storage;
+	enum sieve_error error;
+
+	/* Can we find the script dependency ? */
+	storage = ext_include_get_script_storage
+		(ext, location, script_name, &error);
+	if ( storage == NULL ) {
+		// FIXME: handle ':optional' in this case
+		return NULL;
+	}
+
+	return sieve_storage_get_script(storage, script_name, &error);
+}
+
+static int ext_include_binary_check_script
+(const struct sieve_extension *ext, struct sieve_binary *sbin,
+	struct sieve_binary_block *sblock, struct sieve_script *script,
+	enum ext_include_flags flags, struct sieve_binary_block *inc_block,
+	sieve_size_t metadata_offset)
+{
+	struct sieve_instance *svinst = ext->svinst;
+	enum sieve_error error;
+	int ret;
+
+	/* Can we open the script dependency ? */
+	if ( sieve_script_open(script, &error) < 0 ) {
+		if ( error != SIEVE_ERROR_NOT_FOUND )
+			return 0;
+
+		if ( (flags & EXT_INCLUDE_FLAG_OPTIONAL) == 0 ) {
+			/* Not supposed to be missing, recompile */
+			if ( svinst->debug ) {
+				sieve_sys_debug(svinst,
+					"include: script '%s' included in binary %s is missing, "
+					"so recompile", sieve_script_name(script),
+					sieve_binary_path(sbin));
+			}
+			return 0;
+		}
+		return 1;
+	}
+
+	if (inc_block == NULL) {
+		/* Script exists, but it is missing from the binary, recompile no matter
+		 * what.
+		 */
+		if ( svinst->debug ) {
+			sieve_sys_debug(svinst,
+				"include: script '%s' is missing in binary %s, but is now available, "
+				"so recompile", sieve_script_name(script), sieve_binary_path(sbin));
+		}
+		return 0;
+	}
+
+	/* Can we read script metadata ? */
+	if ( (ret=sieve_script_binary_read_metadata
+		(script, sblock, &metadata_offset)) < 0 ) {
+		/* Binary is corrupt, recompile */
+		sieve_sys_error(svinst,
+			"include: dependency block %d of binary %s "
+			"contains invalid script metadata for script %s",
+			sieve_binary_block_get_id(sblock), sieve_binary_path(sbin),
+			sieve_script_location(script));
+		return -1;
+	}
+
+	return ret;
+}
+
 static bool ext_include_binary_open
 (const struct sieve_extension *ext, struct sieve_binary *sbin, void *context)
 {
@@ -248,14 +407,54 @@ static bool ext_include_binary_open
 	struct ext_include_binary_context *binctx =
 		(struct ext_include_binary_context *) context;
 	struct sieve_binary_block *sblock;
-	unsigned int depcount, i, block_id;
+	unsigned int storage_count, depcount, i, block_id;
 	sieve_size_t offset;
+	bool unchanged;
 
 	sblock = sieve_binary_extension_get_block(sbin, ext);
 	block_id = sieve_binary_block_get_id(sblock);
+	binctx->dependency_block = sblock;
 
 	offset = 0;
 
+	/* Read storage generations */
+	if ( !sieve_binary_read_unsigned(sblock, &offset, &storage_count) ||
+		storage_count > EXT_INCLUDE_LOCATION_INVALID ) {
+		sieve_sys_error(svinst,
+			"include: failed to read storage count "
+			"for dependency block %d of binary %s", block_id,
+			sieve_binary_path(sbin));
+		return FALSE;
+	}
+
+	for ( i = 0; i < storage_count; i++ ) {
+		struct ext_include_binary_storage *bstorage;
+		unsigned int location;
+		string_t *generation;
+
+		if ( !sieve_binary_read_byte(sblock, &offset, &location) ||
+			location >= EXT_INCLUDE_LOCATION_INVALID ||
+			!sieve_binary_read_string(sblock, &offset, &generation) ) {
+			sieve_sys_error(svinst,
+				"include: failed to read storage generation "
+				"from dependency block %d of binary %s", block_id,
+				sieve_binary_path(sbin));
+			return FALSE;
+		}
+
+		bstorage = &binctx->storages[location];
+		bstorage->used = TRUE;
+		if ( str_len(generation) > 0 ) {
+			bstorage->generation =
+				p_strdup(sieve_binary_pool(sbin), str_c(generation));
+		}
+	}
+
+	/* When none of the storages changed since the binary was compiled, the
+	 * included scripts need not be checked one by one.
+	 */
+	unchanged = ext_include_binary_storages_unchanged(binctx);
+
 	if ( !sieve_binary_read_unsigned(sblock, &offset, &depcount) ) {
 		sieve_sys_error(svinst,
 			"include: failed to read include count "
@@ -276,11 +475,12 @@ static bool ext_include_binary_open
 	for ( i = 0; i < depcount; i++ ) {
 		unsigned int inc_block_id;
 		struct sieve_binary_block *inc_block = NULL;
+		struct ext_include_script_info *incscript;
 		unsigned int location, flags;
 		string_t *script_name;
-		struct sieve_storage *storage;
 		struct sieve_script *script;
-		enum sieve_error error;
+		sieve_size_t metadata_offset;
+		sieve_offset_t metadata_size;
 		int ret;
 
 		if (
@@ -296,6 +496,19 @@ static bool ext_include_binary_open
 			return FALSE;
 		}
 
+		metadata_offset = offset;
+		if ( !sieve_binary_read_offset(sblock, &metadata_offset, &metadata_size) ||
+			metadata_size < 4 ||
+			offset + metadata_size > sieve_binary_block_get_size(sblock) ) {
+			/* Binary is corrupt, recompile */
+			sieve_sys_error(svinst,
+				"include: failed to read script metadata size "
+				"from dependency block %d of binary %s", block_id,
+				sieve_binary_path(sbin));
+			return FALSE;
+		}
+		offset += metadata_size;
+
 		if ( inc_block_id != 0 &&
 			(inc_block=sieve_binary_block_get(sbin, inc_block_id)) == NULL ) {
 			sieve_sys_error(svinst,
@@ -314,68 +527,26 @@ static bool ext_include_binary_open
 			return FALSE;
 		}
 
-		/* Can we find the script dependency ? */
-		storage = ext_include_get_script_storage
-			(ext, location, str_c(script_name), &error);
-		if ( storage == NULL ) {
-			/* No, recompile */
-			// FIXME: handle ':optional' in this case
-			return FALSE;
-		}
-
-		/* Can we open the script dependency ? */
-		script = sieve_storage_get_script
-			(storage, str_c(script_name), &error);
+		script = ext_include_binary_get_script(ext, location, str_c(script_name));
 		if ( script == NULL ) {
 			/* No, recompile */
 			return FALSE;
 		}
-		if ( sieve_script_open(script, &error) < 0 ) {
-			if ( error != SIEVE_ERROR_NOT_FOUND ) {
-				/* No, recompile */
-				return FALSE;
-			}
 
-			if ( (flags & EXT_INCLUDE_FLAG_OPTIONAL) == 0 ) {
-				/* Not supposed to be missing, recompile */
-				if ( svinst->debug ) {
-					sieve_sys_debug(svinst,
-						"include: script '%s' included in binary %s is missing, "
-						"so recompile", str_c(script_name), sieve_binary_path(sbin));
-				}
+		if ( !unchanged ) {
+			ret = ext_include_binary_check_script(ext, sbin, sblock,
+				script, flags, inc_block, metadata_offset);
+			if ( ret < 0 ) {
+				sieve_script_unref(&script);
 				return FALSE;
 			}
-
-		} else if (inc_block == NULL) {
-			/* Script exists, but it is missing from the binary, recompile no matter
-			 * what.
-			 */
-			if ( svinst->debug ) {
-				sieve_sys_debug(svinst,
-					"include: script '%s' is missing in binary %s, but is now available, "
-					"so recompile", str_c(script_name), sieve_binary_path(sbin));
-			}
-			sieve_script_unref(&script);
-			return FALSE;
+			if ( ret == 0 )
+				binctx->outdated = TRUE;
 		}
 
-		/* Can we read script metadata ? */
-		if ( (ret=sieve_script_binary_read_metadata
-			(script, sblock, &offset))	< 0 ) {
-			/* Binary is corrupt, recompile */
-			sieve_sys_error(svinst,
-				"include: dependency block %d of binary %s "
-				"contains invalid script metadata for script %s",
-				block_id, sieve_binary_path(sbin), sieve_script_location(script));
-			sieve_script_unref(&script);
-			return FALSE;
-		}
-
-		if ( ret == 0 )
-			binctx->outdated = TRUE;
-
-		(void)ext_include_binary_script_include
+		incscript = ext_include_binary_script_include
 			(binctx, location, flags, script, inc_block);
+		incscript->metadata_offset = metadata_offset;
 
 		sieve_script_unref(&script);
 	}
@@ -384,18 +555,54 @@ static bool ext_include_binary_open
 		(ext, sblock, &offset, &binctx->global_vars) )
 		return FALSE;
 
+	binctx->verified = TRUE;
 	return TRUE;
 }
 
 static bool ext_include_binary_up_to_date
-(const struct sieve_extension *ext ATTR_UNUSED,
-	struct sieve_binary *sbin ATTR_UNUSED, void *context,
-	enum sieve_compile_flags cpflags ATTR_UNUSED)
+(const struct sieve_extension *ext, struct sieve_binary *sbin,
+	void *context, enum sieve_compile_flags cpflags ATTR_UNUSED)
 {
 	struct ext_include_binary_context *binctx =
 		(struct ext_include_binary_context *) context;
+	struct ext_include_script_info *const *scripts;
+	unsigned int script_count, i;
+	bool up_to_date = TRUE;
+
+	if ( binctx->outdated )
+		return FALSE;
+
+	/* Checked just now when the binary was opened */
+	if ( binctx->verified ) {
+		binctx->verified = FALSE;
+		return TRUE;
+	}
+
+	/* The binary was opened earlier; check the dependencies once more */
+	if ( ext_include_binary_storages_unchanged(binctx) )
+		return TRUE;
+
+	scripts = array_get(&binctx->include_index, &script_count);
+	for ( i = 0; up_to_date && i < script_count; i++ ) {
+		struct ext_include_script_info *incscript = scripts[i];
+		struct sieve_script *script;
+
+		script = ext_include_binary_get_script
+			(ext, incscript->location, sieve_script_name(incscript->script));
+		if ( script == NULL )
+			return FALSE;
+
+		if ( ext_include_binary_check_script(ext, sbin,
+			binctx->dependency_block, script, incscript->flags,
+			incscript->block, incscript->metadata_offset) <= 0 )
+			up_to_date = FALSE;
+
+		sieve_script_unref(&script);
+	}
 
-	return !binctx->outdated;
+	if ( !up_to_date )
+		binctx->outdated = TRUE;
+	return up_to_date;
 }
 
 static void ext_include_binary_free
@@ -37,6 +37,11 @@ struct ext_include_script_info {
 	enum ext_include_script_location location;
 
 	struct sieve_binary_block *block;
+
+	/* Offset of the script metadata in the dependency block of a loaded
+	 * binary
+	 */
+	sieve_size_t metadata_offset;
 };
 
 struct ext_include_script_info *ext_include_binary_script_include
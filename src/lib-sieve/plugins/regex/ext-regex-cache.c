@@ -0,0 +1,181 @@
+/* Copyright (c) 2002-2017 Pigeonhole authors, see the included COPYING file
+ */
+
+#include "lib.h"
+#include "llist.h"
+#include "hash.h"
+#include "str.h"
+
+#include "sieve-common.h"
+
+#include "ext-regex-common.h"
+
+#include <sys/types.h>
+#include <regex.h>
+
+/*
+ * Compiled regular expression cache
+ *
+ *   The cache is shared by all Sieve instances in the process. It is created
+ *   when the regex extension is first loaded and it is kept when instances go
+ *   away, because LDA and LMTP create a new instance for each delivery. It is
+ *   only freed by sieve_process_deinit(). Expressions are indexed by their
+ *   engine, compile flags and source string.
+ */
+
+struct ext_regex_cache_entry {
+	struct ext_regex_cache_entry *prev, *next;
+
+	/* "<engine>:<cflags>:<expression>" */
+	char *key;
+	const struct ext_regex_engine *engine;
+	void *regexp;
+
+	int refcount;
+	bool cached:1;
+};
+
+struct ext_regex_cache {
+	HASH_TABLE(const char *, struct ext_regex_cache_entry *) entries;
+
+	/* Least recently used entry is at the tail */
+	struct ext_regex_cache_entry *head, *tail;
+	unsigned int count, max_entries;
+
+	unsigned int hits, misses;
+};
+
+static struct ext_regex_cache *ext_regex_cache = NULL;
+
+static void ext_regex_cache_entry_free(struct ext_regex_cache_entry *entry)
+{
+	entry->engine->free(entry->regexp);
+	i_free(entry->key);
+	i_free(entry);
+}
+
+static void ext_regex_cache_evict
+(struct ext_regex_cache *cache, struct ext_regex_cache_entry *entry)
+{
+	i_assert( entry->cached );
+
+	hash_table_remove(cache->entries, entry->key);
+	DLLIST2_REMOVE(&cache->head, &cache->tail, entry);
+	cache->count--;
+
+	entry->cached = FALSE;
+	if ( entry->refcount == 0 )
+		ext_regex_cache_entry_free(entry);
+}
+
+void ext_regex_cache_init(unsigned int max_entries)
+{
+	struct ext_regex_cache *cache = ext_regex_cache;
+
+	if ( cache == NULL ) {
+		cache = ext_regex_cache = i_new(struct ext_regex_cache, 1);
+		hash_table_create(&cache->entries, default_pool, 0, str_hash, strcmp);
+	}
+
+	/* Most recently loaded instance determines the size */
+	cache->max_entries = max_entries;
+	while ( cache->count > cache->max_entries )
+		ext_regex_cache_evict(cache, cache->tail);
+}
+
+void ext_regex_cache_deinit(void)
+{
+	struct ext_regex_cache *cache = ext_regex_cache;
+
+	if ( cache == NULL )
+		return;
+
+	/* Entries still referenced are freed once they are released */
+	while ( cache->head != NULL )
+		ext_regex_cache_evict(cache, cache->head);
+	hash_table_destroy(&cache->entries);
+	i_free(cache);
+
+	ext_regex_cache = NULL;
+}
+
+int ext_regex_cache_compile
+(const struct ext_regex_engine *engine, const char *regex_str, int cflags,
+	struct ext_regex_cache_entry **entry_r, const char **error_r)
+{
+	struct ext_regex_cache *cache = ext_regex_cache;
+	struct ext_regex_cache_entry *entry;
+	const char *key;
+	void *regexp;
+
+	*entry_r = NULL;
+	*error_r = NULL;
+
+	i_assert( cache != NULL );
+
+	key = t_strdup_printf("%s:%d:%s", engine->name, cflags, regex_str);
+	entry = hash_table_lookup(cache->entries, key);
+	if ( entry != NULL ) {
+		/* Move to front of LRU list */
+		DLLIST2_REMOVE(&cache->head, &cache->tail, entry);
+		DLLIST2_PREPEND(&cache->head, &cache->tail, entry);
+
+		cache->hits++;
+		entry->refcount++;
+		*entry_r = entry;
+		return 1;
+	}
+
+	cache->misses++;
+
+	if ( (regexp=engine->compile(regex_str, cflags, error_r)) == NULL )
+		return -1;
+
+	entry = i_new(struct ext_regex_cache_entry, 1);
+	entry->engine = engine;
+	entry->regexp = regexp;
+	entry->key = i_strdup(key);
+	entry->refcount = 1;
+
+	if ( cache->max_entries > 0 ) {
+		if ( cache->count >= cache->max_entries )
+			ext_regex_cache_evict(cache, cache->tail);
+
+		hash_table_insert(cache->entries, entry->key, entry);
+		DLLIST2_PREPEND(&cache->head, &cache->tail, entry);
+		cache->count++;
+		entry->cached = TRUE;
+	}
+
+	*entry_r = entry;
+	return 0;
+}
+
+void ext_regex_cache_entry_unref(struct ext_regex_cache_entry **_entry)
+{
+	struct ext_regex_cache_entry *entry = *_entry;
+
+	*_entry = NULL;
+
+	i_assert( entry->refcount > 0 );
+	if ( --entry->refcount > 0 || entry->cached )
+		return;
+
+	ext_regex_cache_entry_free(entry);
+}
+
+int ext_regex_cache_entry_exec
+(struct ext_regex_cache_entry *entry, const char *str,
+	size_t nmatch, regmatch_t pmatch[])
+{
+	return entry->engine->exec(entry->regexp, str, nmatch, pmatch);
+}
+
+void ext_regex_cache_get_stats
+(unsigned int *hits_r, unsigned int *misses_r)
+{
+	struct ext_regex_cache *cache = ext_regex_cache;
+
+	*hits_r = ( cache == NULL ? 0 : cache->hits );
+	*misses_r = ( cache == NULL ? 0 : cache->misses );
+}
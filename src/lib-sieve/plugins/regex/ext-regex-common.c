@@ -1,6 +1,10 @@
 /* Copyright (c) 2002-2017 Pigeonhole authors, see the included COPYING file
  */
 
+#include "lib.h"
+#include "buffer.h"
+#include "str.h"
+
 #include "sieve-common.h"
 #include "sieve-match-types.h"
 
@@ -20,3 +24,84 @@ const struct sieve_operand_def regex_match_type_operand = {
 	.interface = &ext_match_types
 };
 
+
+/*
+ * Regular expression engines
+ */
+
+static const struct ext_regex_engine *ext_regex_engines[] = {
+	&ext_regex_engine_posix,
+	&ext_regex_engine_dfa
+};
+
+const struct ext_regex_engine *ext_regex_engine_find(const char *name)
+{
+	unsigned int i;
+
+	for ( i = 0; i < N_ELEMENTS(ext_regex_engines); i++ ) {
+		if ( strcasecmp(ext_regex_engines[i]->name, name) == 0 )
+			return ext_regex_engines[i];
+	}
+	return NULL;
+}
+
+/* Wrapper around the regerror function for easy access */
+const char *ext_regex_error(const regex_t *regexp, int errorcode)
+{
+	size_t errsize = regerror(errorcode, regexp, NULL, 0);
+
+	if ( errsize > 0 ) {
+		char *errbuf;
+
+		buffer_t *error_buf =
+			buffer_create_dynamic(pool_datastack_create(), errsize);
+		errbuf = buffer_get_space_unsafe(error_buf, 0, errsize);
+
+		errsize = regerror(errorcode, regexp, errbuf, errsize);
+
+		/* We don't want the error to start with a capital letter */
+		errbuf[0] = i_tolower(errbuf[0]);
+
+		buffer_append_space_unsafe(error_buf, errsize);
+
+		return str_c(error_buf);
+	}
+
+	return "";
+}
+
+/* System regex library */
+
+static void *ext_regex_posix_compile
+(const char *regex_str, int cflags, const char **error_r)
+{
+	regex_t *regexp = i_new(regex_t, 1);
+	int ret;
+
+	if ( (ret=regcomp(regexp, regex_str, cflags)) != 0 ) {
+		*error_r = ext_regex_error(regexp, ret);
+		regfree(regexp);
+		i_free(regexp);
+		return NULL;
+	}
+	return regexp;
+}
+
+static int ext_regex_posix_exec
+(void *regexp, const char *str, size_t nmatch, regmatch_t pmatch[])
+{
+	return ( regexec((regex_t *)regexp, str, nmatch, pmatch, 0) == 0 ? 1 : 0 );
+}
+
+static void ext_regex_posix_free(void *regexp)
+{
+	regfree((regex_t *)regexp);
+	i_free(regexp);
+}
+
+const struct ext_regex_engine ext_regex_engine_posix = {
+	.name = "posix",
+	.compile = ext_regex_posix_compile,
+	.exec = ext_regex_posix_exec,
+	.free = ext_regex_posix_free
+};
@@ -4,12 +4,29 @@
 #ifndef __EXT_REGEX_COMMON_H
 #define __EXT_REGEX_COMMON_H
 
+#include <sys/types.h>
+#include <regex.h>
+
+/*
+ * Configuration
+ */
+
+#define EXT_REGEX_DEFAULT_CACHE_SIZE 256
+#define EXT_REGEX_DEFAULT_ENGINE "posix"
+
 /*
  * Extension
  */
 
 extern const struct sieve_extension_def regex_extension;
 
+struct ext_regex_context {
+	const struct ext_regex_engine *engine;
+};
+
+const struct ext_regex_engine *ext_regex_get_engine
+	(const struct sieve_extension *ext);
+
 /*
  * Operand
  */
@@ -22,6 +39,57 @@ extern const struct sieve_operand_def regex_match_type_operand;
 
 extern const struct sieve_match_type_def regex_match_type;
 
+/*
+ * Regular expression engines
+ */
+
+/* Expressions are compiled with the REG_* flags of regcomp(); exec() returns
+   1 when str matches and 0 otherwise, filling in pmatch like regexec() */
+struct ext_regex_engine {
+	const char *name;
+
+	void *(*compile)
+		(const char *regex_str, int cflags, const char **error_r);
+	int (*exec)
+		(void *regexp, const char *str, size_t nmatch, regmatch_t pmatch[]);
+	void (*free)(void *regexp);
+};
+
+/* System regex library */
+extern const struct ext_regex_engine ext_regex_engine_posix;
+/* In-tree linear-time engine (ext-regex-dfa.c) */
+extern const struct ext_regex_engine ext_regex_engine_dfa;
+
+const struct ext_regex_engine *ext_regex_engine_find(const char *name);
+
+const char *ext_regex_error(const regex_t *regexp, int errorcode);
+
+/*
+ * Compiled expression cache
+ */
+
+struct ext_regex_cache_entry;
+
+/* Creates the process-wide cache or resizes it; it is freed by
+   ext_regex_cache_deinit() from sieve_process_deinit() */
+void ext_regex_cache_init(unsigned int max_entries);
+void ext_regex_cache_deinit(void);
+
+/* Returns 1 when the expression was cached, 0 when it was compiled and -1
+   when compilation failed */
+int ext_regex_cache_compile
+	(const struct ext_regex_engine *engine, const char *regex_str,
+		int cflags, struct ext_regex_cache_entry **entry_r,
+		const char **error_r);
+void ext_regex_cache_entry_unref(struct ext_regex_cache_entry **_entry);
+
+int ext_regex_cache_entry_exec
+	(struct ext_regex_cache_entry *entry, const char *str,
+		size_t nmatch, regmatch_t pmatch[]);
+
+void ext_regex_cache_get_stats
+	(unsigned int *hits_r, unsigned int *misses_r);
+
 #endif /* __EXT_REGEX_COMMON_H */
 
 
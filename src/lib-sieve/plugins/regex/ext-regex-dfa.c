@@ -0,0 +1,1418 @@
+/* Copyright (c) 2002-2017 Pigeonhole authors, see the included COPYING file
+ */
+
+/* Linear-time regular expression engine
+ *
+ *   POSIX extended regular expressions are compiled into a Thompson NFA
+ *   program. Whether a value matches is determined by running the program as
+ *   a lazily constructed DFA, which needs only one state transition for each
+ *   character of the value. Only when match values are needed, the program is
+ *   run once more as an NFA simulation that tracks the subexpression
+ *   boundaries. Both take time linear in the length of the value, no matter
+ *   what the expression looks like.
+ *
+ *   The overall match is the leftmost-longest match required by POSIX. In
+ *   ambiguous cases, subexpressions are assigned in left-to-right order of
+ *   preference, which may differ from what the system regex library does.
+ *   Back-references and the GNU word and buffer anchors cannot be matched in
+ *   linear time and are rejected at compile time.
+ *
+ *   Should the DFA ever report a match that the NFA simulation cannot
+ *   reproduce, the mismatch is logged and the expression is handed over to
+ *   the system regex library for the rest of its lifetime.
+ */
+
+#include "lib.h"
+#include "array.h"
+#include "hash.h"
+#include "str-sanitize.h"
+
+#include "sieve-common.h"
+
+#include "ext-regex-common.h"
+
+#include <ctype.h>
+
+/*
+ * Configuration
+ */
+
+/* Maximum number of program instructions */
+#define EXT_REGEX_DFA_MAX_PROGRAM_SIZE 8192
+/* Maximum count in a {m,n} bound */
+#define EXT_REGEX_DFA_MAX_REPEAT 32767
+/* Maximum nesting depth of subexpressions and repetitions */
+#define EXT_REGEX_DFA_MAX_NESTING 128
+/* Maximum number of DFA states kept at once; all states are discarded and
+   constructed anew when this is reached */
+#define EXT_REGEX_DFA_MAX_STATES 256
+/* Maximum total number of program positions kept in memoized closures */
+#define EXT_REGEX_DFA_MAX_CLOSURE_CACHE 65536
+
+/*
+ * Types
+ */
+
+/* Program */
+
+enum ext_regex_dfa_opcode {
+	/* Consume one character contained in class arg1 */
+	EXT_REGEX_DFA_OP_CLASS = 0,
+	/* Continue at arg1 (preferred) and at arg2 */
+	EXT_REGEX_DFA_OP_SPLIT,
+	/* Continue at arg1 */
+	EXT_REGEX_DFA_OP_JMP,
+	/* Record current position in capture slot arg1 */
+	EXT_REGEX_DFA_OP_SAVE,
+	/* Assert beginning/end of value */
+	EXT_REGEX_DFA_OP_BOL,
+	EXT_REGEX_DFA_OP_EOL,
+	EXT_REGEX_DFA_OP_MATCH
+};
+
+struct ext_regex_dfa_inst {
+	enum ext_regex_dfa_opcode opcode;
+	unsigned int arg1, arg2;
+};
+
+struct ext_regex_dfa_class {
+	unsigned char bits[32];
+};
+
+/* Syntax tree */
+
+enum ext_regex_dfa_node_type {
+	EXT_REGEX_DFA_NODE_EMPTY = 0,
+	EXT_REGEX_DFA_NODE_CLASS,
+	EXT_REGEX_DFA_NODE_BOL,
+	EXT_REGEX_DFA_NODE_EOL,
+	EXT_REGEX_DFA_NODE_CONCAT,
+	EXT_REGEX_DFA_NODE_ALTERNATE,
+	EXT_REGEX_DFA_NODE_REPEAT,
+	EXT_REGEX_DFA_NODE_GROUP
+};
+
+struct ext_regex_dfa_node {
+	enum ext_regex_dfa_node_type type;
+
+	/* Children of concatenation, alternation, repetition and group */
+	struct ext_regex_dfa_node *child, *next;
+
+	unsigned int class_idx;
+	unsigned int group;
+	/* Repetition; max < 0 means unbounded */
+	int min, max;
+};
+
+/* Lazy DFA */
+
+struct ext_regex_dfa_set {
+	unsigned int *dense, *sparse;
+	unsigned int count;
+};
+
+/* Pending CLASS, EOL and MATCH instructions reachable from a program position
+   without consuming a character, away from the start and end of the value */
+struct ext_regex_dfa_closure {
+	unsigned int *pcs;
+	unsigned int count;
+};
+
+struct ext_regex_dfa_state {
+	/* Sorted program positions of the pending CLASS, EOL and MATCH
+	   instructions */
+	unsigned int *pcs;
+	unsigned int count;
+
+	unsigned int idx;
+	/* Index+1 of the next state for each character; 0 if not known yet */
+	unsigned short next[256];
+
+	bool initial:1;
+	bool match:1;
+	bool end_checked:1;
+	bool end_match:1;
+};
+
+/* Compiled expression */
+
+struct ext_regex_dfa {
+	pool_t pool;
+
+	ARRAY(struct ext_regex_dfa_inst) program;
+	ARRAY(struct ext_regex_dfa_class) classes;
+	unsigned int nsub;
+
+	/* Constructed DFA states */
+	pool_t state_pool;
+	HASH_TABLE(struct ext_regex_dfa_state *,
+		struct ext_regex_dfa_state *) state_index;
+	ARRAY(struct ext_regex_dfa_state *) states;
+	unsigned int initial_state, generation;
+
+	/* Memoized closures, indexed by program position */
+	struct ext_regex_dfa_closure **closures;
+	unsigned int closure_cache_size;
+
+	/* Scratch space for state construction */
+	struct ext_regex_dfa_set set, closure_set;
+	unsigned int *stack;
+
+	/* System regex library takes over after a mismatch */
+	char *source;
+	int cflags;
+	void *fallback;
+
+	bool icase:1;
+	bool nosub:1;
+	bool mismatch:1;
+	bool fallback_failed:1;
+};
+
+/*
+ * Character classes
+ */
+
+static inline void ext_regex_dfa_class_add
+(struct ext_regex_dfa_class *cls, unsigned char c)
+{
+	cls->bits[c >> 3] |= (1 << (c & 7));
+}
+
+static inline bool ext_regex_dfa_class_contains
+(const struct ext_regex_dfa_class *cls, unsigned char c)
+{
+	return ( (cls->bits[c >> 3] & (1 << (c & 7))) != 0 );
+}
+
+static void ext_regex_dfa_class_finish
+(struct ext_regex_dfa_class *cls, bool icase, bool negate)
+{
+	unsigned int c;
+
+	if ( icase ) {
+		for ( c = 0; c < 256; c++ ) {
+			if ( ext_regex_dfa_class_contains(cls, c) ) {
+				ext_regex_dfa_class_add(cls, (unsigned char)tolower(c));
+				ext_regex_dfa_class_add(cls, (unsigned char)toupper(c));
+			}
+		}
+	}
+
+	if ( negate ) {
+		for ( c = 0; c < sizeof(cls->bits); c++ )
+			cls->bits[c] = ~cls->bits[c];
+	}
+}
+
+static bool ext_regex_dfa_class_add_named
+(struct ext_regex_dfa_class *cls, const char *name, size_t len)
+{
+	static const struct {
+		const char *name;
+		int (*func)(int c);
+	} named_classes[] = {
+		{ "alnum", isalnum }, { "alpha", isalpha }, { "blank", isblank },
+		{ "cntrl", iscntrl }, { "digit", isdigit }, { "graph", isgraph },
+		{ "lower", islower }, { "print", isprint }, { "punct", ispunct },
+		{ "space", isspace }, { "upper", isupper }, { "xdigit", isxdigit }
+	};
+	unsigned int i, c;
+
+	for ( i = 0; i < N_ELEMENTS(named_classes); i++ ) {
+		if ( strlen(named_classes[i].name) == len &&
+			memcmp(named_classes[i].name, name, len) == 0 )
+			break;
+	}
+	if ( i == N_ELEMENTS(named_classes) )
+		return FALSE;
+
+	for ( c = 0; c < 256; c++ ) {
+		if ( named_classes[i].func((int)c) != 0 )
+			ext_regex_dfa_class_add(cls, c);
+	}
+	return TRUE;
+}
+
+/*
+ * Parser
+ */
+
+struct ext_regex_dfa_parser {
+	struct ext_regex_dfa *regexp;
+
+	const unsigned char *p, *pend;
+	unsigned int depth;
+
+	const char *error;
+};
+
+static struct ext_regex_dfa_node *ext_regex_dfa_parse_alternation
+	(struct ext_regex_dfa_parser *parser);
+
+static struct ext_regex_dfa_node *ext_regex_dfa_node_create
+(enum ext_regex_dfa_node_type type)
+{
+	struct ext_regex_dfa_node *node;
+
+	node = t_new(struct ext_regex_dfa_node, 1);
+	node->type = type;
+	return node;
+}
+
+static struct ext_regex_dfa_node *ext_regex_dfa_node_create_class
+(struct ext_regex_dfa_parser *parser, struct ext_regex_dfa_class **cls_r)
+{
+	struct ext_regex_dfa *regexp = parser->regexp;
+	struct ext_regex_dfa_node *node;
+
+	node = ext_regex_dfa_node_create(EXT_REGEX_DFA_NODE_CLASS);
+	node->class_idx = array_count(&regexp->classes);
+	*cls_r = array_append_space(&regexp->classes);
+	return node;
+}
+
+static struct ext_regex_dfa_node *ext_regex_dfa_parse_bracket
+(struct ext_regex_dfa_parser *parser)
+{
+	struct ext_regex_dfa_node *node;
+	struct ext_regex_dfa_class *cls;
+	const unsigned char *name;
+	unsigned int start, end, c;
+	bool negate = FALSE, first = TRUE;
+
+	node = ext_regex_dfa_node_create_class(parser, &cls);
+
+	if ( parser->p < parser->pend && *parser->p == '^' ) {
+		negate = TRUE;
+		parser->p++;
+	}
+
+	for (;;) {
+		if ( parser->p >= parser->pend ) {
+			parser->error = "unmatched [ or [^";
+			return NULL;
+		}
+		if ( *parser->p == ']' && !first ) {
+			parser->p++;
+			break;
+		}
+		first = FALSE;
+
+		/* Start of range or single character */
+		if ( *parser->p == '[' && parser->p + 1 < parser->pend &&
+			(parser->p[1] == ':' || parser->p[1] == '=' ||
+				parser->p[1] == '.') ) {
+			unsigned char delim = parser->p[1];
+
+			name = parser->p + 2;
+			for ( parser->p = name; parser->p + 1 < parser->pend; parser->p++ ) {
+				if ( parser->p[0] == delim && parser->p[1] == ']' )
+					break;
+			}
+			if ( parser->p + 1 >= parser->pend ) {
+				parser->error = "unmatched [ or [^";
+				return NULL;
+			}
+
+			if ( delim == ':' ) {
+				if ( !ext_regex_dfa_class_add_named
+					(cls, (const char *)name, parser->p - name) ) {
+					parser->error = "invalid character class name";
+					return NULL;
+				}
+				parser->p += 2;
+				if ( parser->p + 1 < parser->pend && parser->p[0] == '-' &&
+					parser->p[1] != ']' ) {
+					parser->error = "invalid range end";
+					return NULL;
+				}
+				continue;
+			}
+
+			/* Only single-character collating elements are supported */
+			if ( parser->p - name != 1 ) {
+				parser->error = "invalid collation character";
+				return NULL;
+			}
+			start = *name;
+			parser->p += 2;
+		} else {
+			start = *parser->p++;
+		}
+
+		/* End of range */
+		end = start;
+		if ( parser->p + 1 < parser->pend && parser->p[0] == '-' &&
+			parser->p[1] != ']' ) {
+			parser->p++;
+			if ( *parser->p == '[' && parser->p + 1 < parser->pend &&
+				parser->p[1] == '.' ) {
+				name = parser->p + 2;
+				if ( name + 2 >= parser->pend ||
+					name[1] != '.' || name[2] != ']' ) {
+					parser->error = "invalid collation character";
+					return NULL;
+				}
+				end = *name;
+				parser->p = name + 3;
+			} else {
+				end = *parser->p++;
+			}
+			if ( end < start ) {
+				parser->error = "invalid range end";
+				return NULL;
+			}
+		}
+
+		for ( c = start; c <= end; c++ )
+			ext_regex_dfa_class_add(cls, c);
+	}
+
+	ext_regex_dfa_class_finish(cls, parser->regexp->icase, negate);
+	return node;
+}
+
+static struct ext_regex_dfa_node *ext_regex_dfa_parse_escape
+(struct ext_regex_dfa_parser *parser)
+{
+	struct ext_regex_dfa_node *node;
+	struct ext_regex_dfa_class *cls;
+	unsigned char c;
+	unsigned int i;
+
+	if ( parser->p >= parser->pend ) {
+		parser->error = "trailing backslash (\\)";
+		return NULL;
+	}
+
+	c = *parser->p++;
+	switch ( c ) {
+	case '1': case '2': case '3': case '4': case '5':
+	case '6': case '7': case '8': case '9':
+		parser->error = "back-references are not supported";
+		return NULL;
+	case 'b': case 'B': case '<': case '>': case '`': case '\'':
+		parser->error = "word and buffer anchors are not supported";
+		return NULL;
+	case 'w': case 'W':
+		node = ext_regex_dfa_node_create_class(parser, &cls);
+		for ( i = 0; i < 256; i++ ) {
+			if ( isalnum(i) || i == '_' )
+				ext_regex_dfa_class_add(cls, i);
+		}
+		ext_regex_dfa_class_finish(cls, FALSE, c == 'W');
+		return node;
+	case 's': case 'S':
+		node = ext_regex_dfa_node_create_class(parser, &cls);
+		for ( i = 0; i < 256; i++ ) {
+			if ( isspace(i) )
+				ext_regex_dfa_class_add(cls, i);
+		}
+		ext_regex_dfa_class_finish(cls, FALSE, c == 'S');
+		return node;
+	default:
+		break;
+	}
+
+	/* Escaped literal */
+	node = ext_regex_dfa_node_create_class(parser, &cls);
+	ext_regex_dfa_class_add(cls, c);
+	ext_regex_dfa_class_finish(cls, parser->regexp->icase, FALSE);
+	return node;
+}
+
+static struct ext_regex_dfa_node *ext_regex_dfa_parse_atom
+(struct ext_regex_dfa_parser *parser)
+{
+	struct ext_regex_dfa *regexp = parser->regexp;
+	struct ext_regex_dfa_node *node, *child;
+	struct ext_regex_dfa_class *cls;
+	unsigned char c = *parser->p++;
+
+	switch ( c ) {
+	case '(':
+		if ( ++parser->depth > EXT_REGEX_DFA_MAX_NESTING ) {
+			parser->error = "subexpressions nested too deeply";
+			return NULL;
+		}
+
+		node = ext_regex_dfa_node_create(EXT_REGEX_DFA_NODE_GROUP);
+		node->group = ++regexp->nsub;
+
+		if ( (child=ext_regex_dfa_parse_alternation(parser)) == NULL )
+			return NULL;
+		if ( parser->p >= parser->pend || *parser->p != ')' ) {
+			parser->error = "unmatched ( or \\(";
+			return NULL;
+		}
+		parser->p++;
+		parser->depth--;
+
+		node->child = child;
+		return node;
+	case '*': case '+': case '?': case '{':
+		parser->error = "invalid preceding regular expression";
+		return NULL;
+	case '^':
+		return ext_regex_dfa_node_create(EXT_REGEX_DFA_NODE_BOL);
+	case '$':
+		return ext_regex_dfa_node_create(EXT_REGEX_DFA_NODE_EOL);
+	case '.':
+		node = ext_regex_dfa_node_create_class(parser, &cls);
+		ext_regex_dfa_class_finish(cls, FALSE, TRUE);
+		return node;
+	case '[':
+		return ext_regex_dfa_parse_bracket(parser);
+	case '\\':
+		return ext_regex_dfa_parse_escape(parser);
+	default:
+		break;
+	}
+
+	node = ext_regex_dfa_node_create_class(parser, &cls);
+	ext_regex_dfa_class_add(cls, c);
+	ext_regex_dfa_class_finish(cls, regexp->icase, FALSE);
+	return node;
+}
+
+static bool ext_regex_dfa_parse_number
+(struct ext_regex_dfa_parser *parser, int *number_r)
+{
+	int number = 0;
+
+	if ( parser->p >= parser->pend || !i_isdigit(*parser->p) )
+		return FALSE;
+
+	while ( parser->p < parser->pend && i_isdigit(*parser->p) ) {
+		number = number * 10 + (*parser->p - '0');
+		if ( number > EXT_REGEX_DFA_MAX_REPEAT ) {
+			parser->error = "regular expression too big";
+			return FALSE;
+		}
+		parser->p++;
+	}
+
+	*number_r = number;
+	return TRUE;
+}
+
+static struct ext_regex_dfa_node *ext_regex_dfa_parse_piece
+(struct ext_regex_dfa_parser *parser)
+{
+	struct ext_regex_dfa_node *node, *atom;
+	unsigned int depth = parser->depth;
+	int min, max;
+
+	if ( (atom=ext_regex_dfa_parse_atom(parser)) == NULL )
+		return NULL;
+
+	/* Anchors cannot be repeated */
+	if ( (atom->type == EXT_REGEX_DFA_NODE_BOL ||
+		atom->type == EXT_REGEX_DFA_NODE_EOL) && parser->p < parser->pend &&
+		strchr("*+?{", *parser->p) != NULL ) {
+		parser->error = "invalid preceding regular expression";
+		return NULL;
+	}
+
+	while ( parser->p < parser->pend ) {
+		switch ( *parser->p ) {
+		case '*':
+			min = 0; max = -1;
+			break;
+		case '+':
+			min = 1; max = -1;
+			break;
+		case '?':
+			min = 0; max = 1;
+			break;
+		case '{':
+			parser->p++;
+			min = 0;
+			if ( (parser->p >= parser->pend || *parser->p != ',') &&
+				!ext_regex_dfa_parse_number(parser, &min) ) {
+				if ( parser->error == NULL )
+					parser->error = "invalid content of \\{\\}";
+				return NULL;
+			}
+			max = min;
+			if ( parser->p < parser->pend && *parser->p == ',' ) {
+				parser->p++;
+				max = -1;
+				if ( parser->p < parser->pend && *parser->p != '}' &&
+					!ext_regex_dfa_parse_number(parser, &max) ) {
+					if ( parser->error == NULL )
+						parser->error = "invalid content of \\{\\}";
+					return NULL;
+				}
+			}
+			if ( parser->p >= parser->pend || *parser->p != '}' ) {
+				parser->error = "unmatched \\{";
+				return NULL;
+			}
+			if ( max >= 0 && max < min ) {
+				parser->error = "invalid content of \\{\\}";
+				return NULL;
+			}
+			break;
+		default:
+			parser->depth = depth;
+			return atom;
+		}
+		parser->p++;
+
+		if ( ++parser->depth > EXT_REGEX_DFA_MAX_NESTING ) {
+			parser->error = "repetitions nested too deeply";
+			return NULL;
+		}
+
+		node = ext_regex_dfa_node_create(EXT_REGEX_DFA_NODE_REPEAT);
+		node->child = atom;
+		node->min = min;
+		node->max = max;
+		atom = node;
+	}
+
+	parser->depth = depth;
+	return atom;
+}
+
+static struct ext_regex_dfa_node *ext_regex_dfa_parse_branch
+(struct ext_regex_dfa_parser *parser)
+{
+	struct ext_regex_dfa_node *node, *piece, **tail;
+
+	node = ext_regex_dfa_node_create(EXT_REGEX_DFA_NODE_CONCAT);
+	tail = &node->child;
+
+	while ( parser->p < parser->pend && *parser->p != '|' &&
+		(*parser->p != ')' || parser->depth == 0) ) {
+		if ( (piece=ext_regex_dfa_parse_piece(parser)) == NULL )
+			return NULL;
+		*tail = piece;
+		tail = &piece->next;
+	}
+
+	if ( node->child == NULL )
+		node->type = EXT_REGEX_DFA_NODE_EMPTY;
+	return node;
+}
+
+static struct ext_regex_dfa_node *ext_regex_dfa_parse_alternation
+(struct ext_regex_dfa_parser *parser)
+{
+	struct ext_regex_dfa_node *node, *branch, **tail;
+
+	if ( (branch=ext_regex_dfa_parse_branch(parser)) == NULL )
+		return NULL;
+	if ( parser->p >= parser->pend || *parser->p != '|' )
+		return branch;
+
+	node = ext_regex_dfa_node_create(EXT_REGEX_DFA_NODE_ALTERNATE);
+	node->child = branch;
+	tail = &branch->next;
+
+	while ( parser->p < parser->pend && *parser->p == '|' ) {
+		parser->p++;
+		if ( (branch=ext_regex_dfa_parse_branch(parser)) == NULL )
+			return NULL;
+		*tail = branch;
+		tail = &branch->next;
+	}
+	return node;
+}
+
+/*
+ * Code generation
+ */
+
+static unsigned int ext_regex_dfa_emit
+(struct ext_regex_dfa *regexp, enum ext_regex_dfa_opcode opcode,
+	unsigned int arg1, unsigned int arg2)
+{
+	struct ext_regex_dfa_inst *inst;
+	unsigned int pc = array_count(&regexp->program);
+
+	inst = array_append_space(&regexp->program);
+	inst->opcode = opcode;
+	inst->arg1 = arg1;
+	inst->arg2 = arg2;
+	return pc;
+}
+
+static inline struct ext_regex_dfa_inst *ext_regex_dfa_inst_get
+(struct ext_regex_dfa *regexp, unsigned int pc)
+{
+	return array_idx_modifiable(&regexp->program, pc);
+}
+
+static bool ext_regex_dfa_generate
+(struct ext_regex_dfa *regexp, const struct ext_regex_dfa_node *node)
+{
+	const struct ext_regex_dfa_node *child;
+	unsigned int pc, split, jmp_count, *jmps;
+	int i;
+
+	if ( array_count(&regexp->program) > EXT_REGEX_DFA_MAX_PROGRAM_SIZE )
+		return FALSE;
+
+	switch ( node->type ) {
+	case EXT_REGEX_DFA_NODE_EMPTY:
+		break;
+	case EXT_REGEX_DFA_NODE_CLASS:
+		(void)ext_regex_dfa_emit
+			(regexp, EXT_REGEX_DFA_OP_CLASS, node->class_idx, 0);
+		break;
+	case EXT_REGEX_DFA_NODE_BOL:
+		(void)ext_regex_dfa_emit(regexp, EXT_REGEX_DFA_OP_BOL, 0, 0);
+		break;
+	case EXT_REGEX_DFA_NODE_EOL:
+		(void)ext_regex_dfa_emit(regexp, EXT_REGEX_DFA_OP_EOL, 0, 0);
+		break;
+	case EXT_REGEX_DFA_NODE_GROUP:
+		(void)ext_regex_dfa_emit
+			(regexp, EXT_REGEX_DFA_OP_SAVE, 2 * node->group, 0);
+		if ( !ext_regex_dfa_generate(regexp, node->child) )
+			return FALSE;
+		(void)ext_regex_dfa_emit
+			(regexp, EXT_REGEX_DFA_OP_SAVE, 2 * node->group + 1, 0);
+		break;
+	case EXT_REGEX_DFA_NODE_CONCAT:
+		for ( child = node->child; child != NULL; child = child->next ) {
+			if ( !ext_regex_dfa_generate(regexp, child) )
+				return FALSE;
+		}
+		break;
+	case EXT_REGEX_DFA_NODE_ALTERNATE:
+		/*     SPLIT L1, L2
+		 * L1: <branch 1>
+		 *     JMP END
+		 * L2: SPLIT L3, L4
+		 *     ...
+		 * Ln: <branch n>
+		 * END:
+		 */
+		jmp_count = 0;
+		for ( child = node->child; child != NULL; child = child->next )
+			jmp_count++;
+		jmps = t_new(unsigned int, jmp_count);
+
+		jmp_count = 0;
+		for ( child = node->child; child != NULL; child = child->next ) {
+			split = 0;
+			if ( child->next != NULL ) {
+				split = ext_regex_dfa_emit
+					(regexp, EXT_REGEX_DFA_OP_SPLIT, 0, 0);
+				ext_regex_dfa_inst_get(regexp, split)->arg1 = split + 1;
+			}
+			if ( !ext_regex_dfa_generate(regexp, child) )
+				return FALSE;
+			if ( child->next != NULL ) {
+				jmps[jmp_count++] = ext_regex_dfa_emit
+					(regexp, EXT_REGEX_DFA_OP_JMP, 0, 0);
+				ext_regex_dfa_inst_get(regexp, split)->arg2 =
+					array_count(&regexp->program);
+			}
+		}
+
+		pc = array_count(&regexp->program);
+		while ( jmp_count > 0 )
+			ext_regex_dfa_inst_get(regexp, jmps[--jmp_count])->arg1 = pc;
+		break;
+	case EXT_REGEX_DFA_NODE_REPEAT:
+		/* Mandatory occurrences; the last one is looped when the repetition
+		 * is unbounded:
+		 *
+		 * L1: <child>
+		 *     SPLIT L1, END
+		 * END:
+		 */
+		for ( i = 0; i < node->min; i++ ) {
+			pc = array_count(&regexp->program);
+			if ( !ext_regex_dfa_generate(regexp, node->child) )
+				return FALSE;
+			if ( node->max < 0 && i == node->min - 1 ) {
+				split = ext_regex_dfa_emit
+					(regexp, EXT_REGEX_DFA_OP_SPLIT, pc, 0);
+				ext_regex_dfa_inst_get(regexp, split)->arg2 = split + 1;
+			}
+		}
+
+		if ( node->max < 0 ) {
+			if ( node->min > 0 )
+				break;
+
+			/* L1: SPLIT L2, END
+			 * L2: <child>
+			 *     JMP L1
+			 * END:
+			 */
+			split = ext_regex_dfa_emit(regexp, EXT_REGEX_DFA_OP_SPLIT, 0, 0);
+			ext_regex_dfa_inst_get(regexp, split)->arg1 = split + 1;
+			if ( !ext_regex_dfa_generate(regexp, node->child) )
+				return FALSE;
+			(void)ext_regex_dfa_emit(regexp, EXT_REGEX_DFA_OP_JMP, split, 0);
+			ext_regex_dfa_inst_get(regexp, split)->arg2 =
+				array_count(&regexp->program);
+			break;
+		}
+
+		/* Optional occurrences; skipping one skips all that follow:
+		 *
+		 *     SPLIT L1, END
+		 * L1: <child>
+		 *     SPLIT L2, END
+		 * L2: <child>
+		 *     ...
+		 * END:
+		 */
+		jmp_count = node->max - node->min;
+		if ( jmp_count > EXT_REGEX_DFA_MAX_PROGRAM_SIZE )
+			return FALSE;
+		jmps = t_new(unsigned int, jmp_count + 1);
+		for ( i = 0; i < (int)jmp_count; i++ ) {
+			split = ext_regex_dfa_emit(regexp, EXT_REGEX_DFA_OP_SPLIT, 0, 0);
+			ext_regex_dfa_inst_get(regexp, split)->arg1 = split + 1;
+			jmps[i] = split;
+			if ( !ext_regex_dfa_generate(regexp, node->child) )
+				return FALSE;
+		}
+
+		pc = array_count(&regexp->program);
+		while ( jmp_count > 0 )
+			ext_regex_dfa_inst_get(regexp, jmps[--jmp_count])->arg2 = pc;
+		break;
+	}
+
+	return ( array_count(&regexp->program) <= EXT_REGEX_DFA_MAX_PROGRAM_SIZE );
+}
+
+/*
+ * Lazy DFA
+ */
+
+static unsigned int ext_regex_dfa_state_hash
+(const struct ext_regex_dfa_state *state)
+{
+	unsigned int i, hash = ( state->initial ? 1 : 0 );
+
+	for ( i = 0; i < state->count; i++ )
+		hash = hash * 31 + state->pcs[i];
+	return hash;
+}
+
+static int ext_regex_dfa_state_cmp
+(const struct ext_regex_dfa_state *state1,
+	const struct ext_regex_dfa_state *state2)
+{
+	if ( state1->initial != state2->initial )
+		return ( state1->initial ? 1 : -1 );
+	if ( state1->count != state2->count )
+		return ( state1->count < state2->count ? -1 : 1 );
+	return memcmp(state1->pcs, state2->pcs,
+		state1->count * sizeof(state1->pcs[0]));
+}
+
+static inline void ext_regex_dfa_set_clear(struct ext_regex_dfa_set *set)
+{
+	set->count = 0;
+}
+
+static inline bool ext_regex_dfa_set_contains
+(const struct ext_regex_dfa_set *set, unsigned int pc)
+{
+	unsigned int idx = set->sparse[pc];
+
+	return ( idx < set->count && set->dense[idx] == pc );
+}
+
+static inline bool ext_regex_dfa_set_add
+(struct ext_regex_dfa_set *set, unsigned int pc)
+{
+	if ( ext_regex_dfa_set_contains(set, pc) )
+		return FALSE;
+
+	set->sparse[pc] = set->count;
+	set->dense[set->count++] = pc;
+	return TRUE;
+}
+
+/* Adds all instructions reachable from pc without consuming a character to
+   the set */
+static void ext_regex_dfa_closure
+(struct ext_regex_dfa *regexp, struct ext_regex_dfa_set *set,
+	unsigned int pc, bool at_start, bool at_end)
+{
+	const struct ext_regex_dfa_inst *program =
+		array_idx(&regexp->program, 0);
+	unsigned int *stack = regexp->stack, sp = 0;
+
+	stack[sp++] = pc;
+	while ( sp > 0 ) {
+		pc = stack[--sp];
+
+		while ( ext_regex_dfa_set_add(set, pc) ) {
+			const struct ext_regex_dfa_inst *inst = &program[pc];
+
+			if ( inst->opcode == EXT_REGEX_DFA_OP_JMP ) {
+				pc = inst->arg1;
+			} else if ( inst->opcode == EXT_REGEX_DFA_OP_SPLIT ) {
+				stack[sp++] = inst->arg2;
+				pc = inst->arg1;
+			} else if ( inst->opcode == EXT_REGEX_DFA_OP_SAVE ||
+				(inst->opcode == EXT_REGEX_DFA_OP_BOL && at_start) ||
+				(inst->opcode == EXT_REGEX_DFA_OP_EOL && at_end) ) {
+				pc++;
+			} else {
+				break;
+			}
+		}
+	}
+}
+
+static inline bool ext_regex_dfa_is_pending
+(const struct ext_regex_dfa_inst *inst)
+{
+	return ( inst->opcode == EXT_REGEX_DFA_OP_CLASS ||
+		inst->opcode == EXT_REGEX_DFA_OP_EOL ||
+		inst->opcode == EXT_REGEX_DFA_OP_MATCH );
+}
+
+/* Adds the pending instructions reachable from pc to the current set; the
+   closure is computed once and memoized while the budget allows */
+static void ext_regex_dfa_closure_add
+(struct ext_regex_dfa *regexp, unsigned int pc)
+{
+	const struct ext_regex_dfa_inst *program =
+		array_idx(&regexp->program, 0);
+	struct ext_regex_dfa_closure *closure = regexp->closures[pc];
+	struct ext_regex_dfa_set *cset = &regexp->closure_set;
+	const unsigned int *pcs;
+	unsigned int count, i;
+
+	if ( closure != NULL ) {
+		pcs = closure->pcs;
+		count = closure->count;
+	} else {
+		ext_regex_dfa_set_clear(cset);
+		ext_regex_dfa_closure(regexp, cset, pc, FALSE, FALSE);
+
+		/* Compact the pending instructions in the dense array; the set is
+		   not used as a set anymore after this */
+		count = 0;
+		for ( i = 0; i < cset->count; i++ ) {
+			if ( ext_regex_dfa_is_pending(&program[cset->dense[i]]) )
+				cset->dense[count++] = cset->dense[i];
+		}
+		cset->count = 0;
+		pcs = cset->dense;
+
+		if ( regexp->closure_cache_size + count <=
+			EXT_REGEX_DFA_MAX_CLOSURE_CACHE ) {
+			closure = p_new(regexp->pool, struct ext_regex_dfa_closure, 1);
+			closure->pcs = p_memdup(regexp->pool, pcs, count * sizeof(pcs[0]));
+			closure->count = count;
+			regexp->closures[pc] = closure;
+			regexp->closure_cache_size += count;
+		}
+	}
+
+	for ( i = 0; i < count; i++ )
+		(void)ext_regex_dfa_set_add(&regexp->set, pcs[i]);
+}
+
+static int ext_regex_dfa_pc_cmp(const void *p1, const void *p2)
+{
+	unsigned int pc1 = *(const unsigned int *)p1;
+	unsigned int pc2 = *(const unsigned int *)p2;
+
+	if ( pc1 == pc2 )
+		return 0;
+	return ( pc1 < pc2 ? -1 : 1 );
+}
+
+static void ext_regex_dfa_states_flush(struct ext_regex_dfa *regexp)
+{
+	hash_table_clear(regexp->state_index, TRUE);
+	array_clear(&regexp->states);
+	p_clear(regexp->state_pool);
+	regexp->initial_state = 0;
+	regexp->generation++;
+}
+
+/* Returns the state for the current set */
+static unsigned int ext_regex_dfa_state_get
+(struct ext_regex_dfa *regexp, bool initial)
+{
+	const struct ext_regex_dfa_inst *program =
+		array_idx(&regexp->program, 0);
+	struct ext_regex_dfa_set *set = &regexp->set;
+	struct ext_regex_dfa_state key, *state;
+	unsigned int *pcs, count, i;
+
+	/* Keep only the instructions that wait for the next character or for
+	   the end of the value, in program order */
+	pcs = t_new(unsigned int, set->count + 1);
+	count = 0;
+	for ( i = 0; i < set->count; i++ ) {
+		if ( ext_regex_dfa_is_pending(&program[set->dense[i]]) )
+			pcs[count++] = set->dense[i];
+	}
+	qsort(pcs, count, sizeof(pcs[0]), ext_regex_dfa_pc_cmp);
+
+	i_zero(&key);
+	key.pcs = pcs;
+	key.count = count;
+	key.initial = initial;
+
+	state = hash_table_lookup(regexp->state_index, &key);
+	if ( state != NULL )
+		return state->idx;
+
+	if ( array_count(&regexp->states) >= EXT_REGEX_DFA_MAX_STATES )
+		ext_regex_dfa_states_flush(regexp);
+
+	state = p_new(regexp->state_pool, struct ext_regex_dfa_state, 1);
+	state->pcs = p_memdup(regexp->state_pool, pcs, count * sizeof(pcs[0]));
+	state->count = count;
+	state->initial = initial;
+	for ( i = 0; i < count; i++ ) {
+		if ( program[pcs[i]].opcode == EXT_REGEX_DFA_OP_MATCH )
+			state->match = TRUE;
+	}
+
+	state->idx = array_count(&regexp->states);
+	array_append(&regexp->states, &state, 1);
+	hash_table_insert(regexp->state_index, state, state);
+	return state->idx;
+}
+
+static struct ext_regex_dfa_state *ext_regex_dfa_state_initial
+(struct ext_regex_dfa *regexp)
+{
+	unsigned int idx;
+
+	if ( regexp->initial_state == 0 ) {
+		ext_regex_dfa_set_clear(&regexp->set);
+		ext_regex_dfa_closure(regexp, &regexp->set, 0, TRUE, FALSE);
+		T_BEGIN {
+			idx = ext_regex_dfa_state_get(regexp, TRUE);
+		} T_END;
+		regexp->initial_state = idx + 1;
+	}
+	return *array_idx(&regexp->states, regexp->initial_state - 1);
+}
+
+static struct ext_regex_dfa_state *ext_regex_dfa_state_next
+(struct ext_regex_dfa *regexp, struct ext_regex_dfa_state *state,
+	unsigned char c)
+{
+	const struct ext_regex_dfa_inst *program =
+		array_idx(&regexp->program, 0);
+	const struct ext_regex_dfa_class *classes =
+		array_idx(&regexp->classes, 0);
+	unsigned int i, generation, idx;
+
+	if ( state->next[c] > 0 )
+		return *array_idx(&regexp->states, state->next[c] - 1);
+
+	ext_regex_dfa_set_clear(&regexp->set);
+	for ( i = 0; i < state->count; i++ ) {
+		const struct ext_regex_dfa_inst *inst = &program[state->pcs[i]];
+
+		if ( inst->opcode == EXT_REGEX_DFA_OP_CLASS &&
+			ext_regex_dfa_class_contains(&classes[inst->arg1], c) )
+			ext_regex_dfa_closure_add(regexp, state->pcs[i] + 1);
+	}
+
+	/* A new match attempt starts at every position */
+	ext_regex_dfa_closure_add(regexp, 0);
+
+	generation = regexp->generation;
+	T_BEGIN {
+		idx = ext_regex_dfa_state_get(regexp, FALSE);
+	} T_END;
+
+	/* The current state is gone when the states were flushed */
+	if ( regexp->generation == generation )
+		state->next[c] = idx + 1;
+	return *array_idx(&regexp->states, idx);
+}
+
+static bool ext_regex_dfa_state_matches_at_end
+(struct ext_regex_dfa *regexp, struct ext_regex_dfa_state *state)
+{
+	const struct ext_regex_dfa_inst *program =
+		array_idx(&regexp->program, 0);
+	unsigned int i;
+
+	if ( state->match )
+		return TRUE;
+	if ( state->end_checked )
+		return state->end_match;
+
+	ext_regex_dfa_set_clear(&regexp->set);
+	for ( i = 0; i < state->count; i++ ) {
+		if ( program[state->pcs[i]].opcode == EXT_REGEX_DFA_OP_EOL ) {
+			ext_regex_dfa_closure(regexp, &regexp->set,
+				state->pcs[i], state->initial, TRUE);
+		}
+	}
+
+	state->end_checked = TRUE;
+	for ( i = 0; i < regexp->set.count; i++ ) {
+		if ( program[regexp->set.dense[i]].opcode == EXT_REGEX_DFA_OP_MATCH )
+			state->end_match = TRUE;
+	}
+	return state->end_match;
+}
+
+static bool ext_regex_dfa_search
+(struct ext_regex_dfa *regexp, const unsigned char *str, size_t len)
+{
+	struct ext_regex_dfa_state *state;
+	size_t i;
+
+	state = ext_regex_dfa_state_initial(regexp);
+	for ( i = 0; i < len; i++ ) {
+		if ( state->match )
+			return TRUE;
+
+		/* No match attempt can succeed anymore (e.g. anchored at start) */
+		if ( state->count == 0 )
+			return FALSE;
+
+		state = ext_regex_dfa_state_next(regexp, state, str[i]);
+	}
+
+	return ext_regex_dfa_state_matches_at_end(regexp, state);
+}
+
+/*
+ * NFA simulation with subexpression tracking
+ */
+
+struct ext_regex_dfa_threads {
+	unsigned int *dense, *sparse;
+	unsigned int count;
+
+	/* Capture slots of the thread at each program position */
+	regoff_t *slots;
+};
+
+struct ext_regex_dfa_job {
+	unsigned int pc;
+	/* Restore slot to value when slot >= 0 */
+	int slot;
+	regoff_t value;
+};
+
+struct ext_regex_dfa_vm {
+	struct ext_regex_dfa *regexp;
+	const struct ext_regex_dfa_inst *program;
+	const struct ext_regex_dfa_class *classes;
+
+	size_t len;
+	unsigned int nslots;
+
+	struct ext_regex_dfa_job *jobs;
+};
+
+static void ext_regex_dfa_threads_init
+(struct ext_regex_dfa_threads *threads, unsigned int program_size,
+	unsigned int nslots)
+{
+	threads->dense = t_new(unsigned int, program_size);
+	threads->sparse = t_new(unsigned int, program_size);
+	threads->slots = t_new(regoff_t, program_size * nslots);
+	threads->count = 0;
+}
+
+static void ext_regex_dfa_vm_add_thread
+(struct ext_regex_dfa_vm *vm, struct ext_regex_dfa_threads *threads,
+	unsigned int pc, regoff_t *slots, size_t pos)
+{
+	struct ext_regex_dfa_job *jobs = vm->jobs;
+	unsigned int njobs = 0, idx;
+
+	jobs[njobs].pc = pc;
+	jobs[njobs++].slot = -1;
+
+	while ( njobs > 0 ) {
+		struct ext_regex_dfa_job *job = &jobs[--njobs];
+
+		if ( job->slot >= 0 ) {
+			slots[job->slot] = job->value;
+			continue;
+		}
+
+		pc = job->pc;
+		for (;;) {
+			const struct ext_regex_dfa_inst *inst = &vm->program[pc];
+
+			/* Higher-priority thread got here first */
+			idx = threads->sparse[pc];
+			if ( idx < threads->count && threads->dense[idx] == pc )
+				break;
+			threads->sparse[pc] = threads->count;
+			threads->dense[threads->count++] = pc;
+
+			if ( inst->opcode == EXT_REGEX_DFA_OP_JMP ) {
+				pc = inst->arg1;
+			} else if ( inst->opcode == EXT_REGEX_DFA_OP_SPLIT ) {
+				jobs[njobs].pc = inst->arg2;
+				jobs[njobs++].slot = -1;
+				pc = inst->arg1;
+			} else if ( inst->opcode == EXT_REGEX_DFA_OP_SAVE ) {
+				if ( inst->arg1 < vm->nslots ) {
+					jobs[njobs].slot = inst->arg1;
+					jobs[njobs++].value = slots[inst->arg1];
+					slots[inst->arg1] = (regoff_t)pos;
+				}
+				pc++;
+			} else if ( (inst->opcode == EXT_REGEX_DFA_OP_BOL && pos == 0) ||
+				(inst->opcode == EXT_REGEX_DFA_OP_EOL && pos == vm->len) ) {
+				pc++;
+			} else {
+				if ( inst->opcode == EXT_REGEX_DFA_OP_CLASS ||
+					inst->opcode == EXT_REGEX_DFA_OP_MATCH ) {
+					memcpy(&threads->slots[pc * vm->nslots], slots,
+						vm->nslots * sizeof(regoff_t));
+				}
+				break;
+			}
+		}
+	}
+}
+
+static bool ext_regex_dfa_vm_run
+(struct ext_regex_dfa *regexp, const unsigned char *str, size_t len,
+	unsigned int nslots, regoff_t *match)
+{
+	unsigned int program_size = array_count(&regexp->program);
+	struct ext_regex_dfa_threads threads[2], *clist, *nlist, *tmp;
+	struct ext_regex_dfa_vm vm;
+	regoff_t *slots, *tslots;
+	bool matched = FALSE;
+	unsigned int i, s;
+	size_t pos;
+
+	i_zero(&vm);
+	vm.regexp = regexp;
+	vm.program = array_idx(&regexp->program, 0);
+	vm.classes = array_idx(&regexp->classes, 0);
+	vm.len = len;
+	vm.nslots = nslots;
+	vm.jobs = t_new(struct ext_regex_dfa_job, 2 * program_size + 1);
+
+	ext_regex_dfa_threads_init(&threads[0], program_size, nslots);
+	ext_regex_dfa_threads_init(&threads[1], program_size, nslots);
+	clist = &threads[0];
+	nlist = &threads[1];
+	slots = t_new(regoff_t, nslots);
+
+	for ( pos = 0; ; pos++ ) {
+		/* Start a new match attempt at this position, with the lowest
+		   priority; not needed once a match is found further left */
+		if ( !matched ) {
+			for ( s = 0; s < nslots; s++ )
+				slots[s] = -1;
+			ext_regex_dfa_vm_add_thread(&vm, clist, 0, slots, pos);
+		}
+		if ( clist->count == 0 )
+			break;
+
+		/* Threads are ordered by start position */
+		nlist->count = 0;
+		for ( i = 0; i < clist->count; i++ ) {
+			unsigned int pc = clist->dense[i];
+			const struct ext_regex_dfa_inst *inst = &vm.program[pc];
+
+			if ( inst->opcode != EXT_REGEX_DFA_OP_CLASS &&
+				inst->opcode != EXT_REGEX_DFA_OP_MATCH )
+				continue;
+
+			tslots = &clist->slots[pc * nslots];
+			if ( matched && tslots[0] > match[0] )
+				break;
+
+			if ( inst->opcode == EXT_REGEX_DFA_OP_MATCH ) {
+				/* Keep the leftmost-longest match */
+				if ( !matched || tslots[0] < match[0] ||
+					(tslots[0] == match[0] && tslots[1] > match[1]) ) {
+					memcpy(match, tslots, nslots * sizeof(regoff_t));
+					matched = TRUE;
+				}
+			} else if ( pos < len &&
+				ext_regex_dfa_class_contains(&vm.classes[inst->arg1], str[pos]) ) {
+				memcpy(slots, tslots, nslots * sizeof(regoff_t));
+				ext_regex_dfa_vm_add_thread(&vm, nlist, pc + 1, slots, pos + 1);
+			}
+		}
+
+		if ( pos >= len )
+			break;
+
+		tmp = clist; clist = nlist; nlist = tmp;
+	}
+
+	return matched;
+}
+
+/*
+ * Engine
+ */
+
+static void *ext_regex_dfa_compile
+(const char *regex_str, int cflags, const char **error_r)
+{
+	struct ext_regex_dfa_parser parser;
+	struct ext_regex_dfa *regexp;
+	struct ext_regex_dfa_node *root;
+	unsigned int program_size;
+	pool_t pool;
+	bool success = TRUE;
+
+	pool = pool_alloconly_create("ext_regex_dfa", 1024);
+	regexp = p_new(pool, struct ext_regex_dfa, 1);
+	regexp->pool = pool;
+	regexp->icase = ( (cflags & REG_ICASE) != 0 );
+	regexp->nosub = ( (cflags & REG_NOSUB) != 0 );
+	regexp->source = p_strdup(pool, regex_str);
+	regexp->cflags = cflags;
+	p_array_init(&regexp->program, pool, 64);
+	p_array_init(&regexp->classes, pool, 16);
+
+	T_BEGIN {
+		i_zero(&parser);
+		parser.regexp = regexp;
+		parser.p = (const unsigned char *)regex_str;
+		parser.pend = parser.p + strlen(regex_str);
+
+		root = ext_regex_dfa_parse_alternation(&parser);
+		if ( root == NULL ) {
+			*error_r = t_strdup(parser.error);
+			success = FALSE;
+		} else {
+			/* Whole match is subexpression 0 */
+			(void)ext_regex_dfa_emit(regexp, EXT_REGEX_DFA_OP_SAVE, 0, 0);
+			if ( !ext_regex_dfa_generate(regexp, root) ) {
+				*error_r = "regular expression too big";
+				success = FALSE;
+			} else {
+				(void)ext_regex_dfa_emit(regexp, EXT_REGEX_DFA_OP_SAVE, 1, 0);
+				(void)ext_regex_dfa_emit(regexp, EXT_REGEX_DFA_OP_MATCH, 0, 0);
+			}
+		}
+	} T_END;
+
+	if ( !success ) {
+		pool_unref(&pool);
+		return NULL;
+	}
+
+	program_size = array_count(&regexp->program);
+	regexp->set.dense = p_new(pool, unsigned int, program_size);
+	regexp->set.sparse = p_new(pool, unsigned int, program_size);
+	regexp->closure_set.dense = p_new(pool, unsigned int, program_size);
+	regexp->closure_set.sparse = p_new(pool, unsigned int, program_size);
+	regexp->closures =
+		p_new(pool, struct ext_regex_dfa_closure *, program_size);
+	regexp->stack = p_new(pool, unsigned int, program_size + 1);
+
+	regexp->state_pool = pool_alloconly_create("ext_regex_dfa_states", 4096);
+	hash_table_create(&regexp->state_index, default_pool, 0,
+		ext_regex_dfa_state_hash, ext_regex_dfa_state_cmp);
+	p_array_init(&regexp->states, pool, 16);
+	return regexp;
+}
+
+static int ext_regex_dfa_exec_fallback
+(struct ext_regex_dfa *regexp, const char *str, size_t nmatch,
+	regmatch_t pmatch[])
+{
+	const char *error;
+
+	if ( regexp->fallback == NULL ) {
+		if ( regexp->fallback_failed )
+			return 0;
+		regexp->fallback = ext_regex_engine_posix.compile
+			(regexp->source, regexp->cflags, &error);
+		if ( regexp->fallback == NULL ) {
+			i_error("sieve: regex: dfa: "
+				"failed to compile `%s' with the system regex library: %s",
+				str_sanitize(regexp->source, 80), error);
+			regexp->fallback_failed = TRUE;
+			return 0;
+		}
+	}
+	return ext_regex_engine_posix.exec(regexp->fallback, str, nmatch, pmatch);
+}
+
+static int ext_regex_dfa_exec
+(void *_regexp, const char *str, size_t nmatch, regmatch_t pmatch[])
+{
+	struct ext_regex_dfa *regexp = (struct ext_regex_dfa *)_regexp;
+	const unsigned char *ustr = (const unsigned char *)str;
+	size_t len = strlen(str), i;
+	unsigned int nslots;
+	bool matched;
+
+	if ( regexp->mismatch )
+		return ext_regex_dfa_exec_fallback(regexp, str, nmatch, pmatch);
+
+	if ( !ext_regex_dfa_search(regexp, ustr, len) )
+		return 0;
+	if ( regexp->nosub || nmatch == 0 )
+		return 1;
+
+	/* Determine subexpression boundaries */
+	nslots = 2 * I_MIN(nmatch, regexp->nsub + 1);
+	T_BEGIN {
+		regoff_t *match = t_new(regoff_t, nslots);
+
+		matched = ext_regex_dfa_vm_run(regexp, ustr, len, nslots, match);
+		for ( i = 0; matched && i < nmatch; i++ ) {
+			if ( 2 * i < nslots && match[2 * i] >= 0 &&
+				match[2 * i + 1] >= 0 ) {
+				pmatch[i].rm_so = match[2 * i];
+				pmatch[i].rm_eo = match[2 * i + 1];
+			} else {
+				pmatch[i].rm_so = -1;
+				pmatch[i].rm_eo = -1;
+			}
+		}
+	} T_END;
+
+	if ( !matched ) {
+		/* The engines disagree; this is a bug, but it should not take the
+		   delivery down with it */
+		i_error("sieve: regex: dfa: "
+			"DFA and NFA simulation disagree on `%s' for value `%s'; "
+			"using the system regex library for this expression from now on",
+			str_sanitize(regexp->source, 80), str_sanitize(str, 80));
+		regexp->mismatch = TRUE;
+		return ext_regex_dfa_exec_fallback(regexp, str, nmatch, pmatch);
+	}
+
+	return 1;
+}
+
+static void ext_regex_dfa_free(void *_regexp)
+{
+	struct ext_regex_dfa *regexp = (struct ext_regex_dfa *)_regexp;
+	pool_t pool = regexp->pool;
+
+	if ( regexp->fallback != NULL )
+		ext_regex_engine_posix.free(regexp->fallback);
+	hash_table_destroy(&regexp->state_index);
+	pool_unref(&regexp->state_pool);
+	pool_unref(&pool);
+}
+
+const struct ext_regex_engine ext_regex_engine_dfa = {
+	.name = "dfa",
+	.compile = ext_regex_dfa_compile,
+	.exec = ext_regex_dfa_exec,
+	.free = ext_regex_dfa_free
+};
@@ -11,11 +11,10 @@
  *
  */
 
-/* FIXME: Regular expressions are compiled during compilation and
- * again during interpretation. This is suboptimal and should be
- * changed. This requires dumping the compiled regex to the binary.
- * Most likely, this will only be possible when we implement regular
- * expressions ourselves.
+/* Regular expressions cannot be stored in the binary, so they are compiled
+ * during validation and again during interpretation. The compiled expressions
+ * are kept in a process-wide cache (see ext-regex-cache.c), so each distinct
+ * expression is normally only compiled once.
  *
  */
 
@@ -24,6 +23,8 @@
 #include "buffer.h"
 
 #include "sieve-common.h"
+#include "sieve-settings.h"
+#include "sieve-error.h"
 
 #include "sieve-code.h"
 #include "sieve-extensions.h"
@@ -45,15 +46,89 @@
  * Extension
  */
 
+static bool ext_regex_load
+	(const struct sieve_extension *ext, void **context);
+static void ext_regex_unload
+	(const struct sieve_extension *ext);
 static bool ext_regex_validator_load
 	(const struct sieve_extension *ext, struct sieve_validator *validator);
 
 const struct sieve_extension_def regex_extension = {
 	.name = "regex",
+	.load = ext_regex_load,
+	.unload = ext_regex_unload,
 	.validator_load = ext_regex_validator_load,
 	SIEVE_EXT_DEFINE_OPERAND(regex_match_type_operand)
 };
 
+static bool ext_regex_load
+(const struct sieve_extension *ext, void **context)
+{
+	struct sieve_instance *svinst = ext->svinst;
+	struct ext_regex_context *ctx;
+	unsigned long long int cache_size;
+	const char *engine;
+
+	if ( *context != NULL ) {
+		ext_regex_unload(ext);
+	}
+
+	ctx = i_new(struct ext_regex_context, 1);
+
+	engine = sieve_setting_get(svinst, "sieve_regex_engine");
+	if ( engine != NULL && *engine != '\0' ) {
+		ctx->engine = ext_regex_engine_find(engine);
+		if ( ctx->engine == NULL ) {
+			sieve_sys_warning(svinst,
+				"Invalid value for setting "
+				"`sieve_regex_engine': `%s'", engine);
+		}
+	}
+	if ( ctx->engine == NULL )
+		ctx->engine = ext_regex_engine_find(EXT_REGEX_DEFAULT_ENGINE);
+
+	if ( !sieve_setting_get_uint_value
+		(svinst, "sieve_regex_cache_size", &cache_size) )
+		cache_size = EXT_REGEX_DEFAULT_CACHE_SIZE;
+
+	ext_regex_cache_init((unsigned int)cache_size);
+
+	*context = (void *)ctx;
+	return TRUE;
+}
+
+static void ext_regex_unload
+(const struct sieve_extension *ext)
+{
+	struct sieve_instance *svinst = ext->svinst;
+	struct ext_regex_context *ctx =
+		(struct ext_regex_context *)ext->context;
+	unsigned int hits, misses;
+
+	if ( ctx == NULL )
+		return;
+
+	if ( svinst->debug ) {
+		ext_regex_cache_get_stats(&hits, &misses);
+		sieve_sys_debug(svinst, "regex: "
+			"compiled expression cache: %u hits, %u misses",
+			hits, misses);
+	}
+
+	/* The cache itself outlives this instance */
+	i_free(ctx);
+}
+
+const struct ext_regex_engine *ext_regex_get_engine
+(const struct sieve_extension *ext)
+{
+	struct ext_regex_context *ctx =
+		(struct ext_regex_context *)ext->context;
+
+	i_assert( ctx != NULL );
+	return ctx->engine;
+}
+
 static bool ext_regex_validator_load
 (const struct sieve_extension *ext, struct sieve_validator *valdtr)
 {
@@ -60,50 +60,28 @@ const struct sieve_match_type_def regex_match_type = {
  * Match type validation
  */
 
-/* Wrapper around the regerror function for easy access */
-static const char *_regexp_error(regex_t *regexp, int errorcode)
-{
-	size_t errsize = regerror(errorcode, regexp, NULL, 0);
-
-	if ( errsize > 0 ) {
-		char *errbuf;
-
-		buffer_t *error_buf =
-			buffer_create_dynamic(pool_datastack_create(), errsize);
-		errbuf = buffer_get_space_unsafe(error_buf, 0, errsize);
-
-		errsize = regerror(errorcode, regexp, errbuf, errsize);
-
-		/* We don't want the error to start with a capital letter */
-		errbuf[0] = i_tolower(errbuf[0]);
-
-		buffer_append_space_unsafe(error_buf, errsize);
-
-		return str_c(error_buf);
-	}
-
-	return "";
-}
-
 static int mcht_regex_validate_regexp
 (struct sieve_validator *valdtr,
-	struct sieve_match_type_context *mtctx ATTR_UNUSED,
+	struct sieve_match_type_context *mtctx,
 	struct sieve_ast_argument *key, int cflags)
 {
-	int ret;
-	regex_t regexp;
+	const struct ext_regex_engine *engine =
+		ext_regex_get_engine(mtctx->match_type->object.ext);
+	struct ext_regex_cache_entry *entry;
 	const char *regex_str = sieve_ast_argument_strc(key);
+	const char *error;
 
-	if ( (ret=regcomp(&regexp, regex_str, cflags)) != 0 ) {
+	/* Compiling through the cache saves compiling the expression again
+	   when the script is executed right away */
+	if ( ext_regex_cache_compile
+		(engine, regex_str, cflags, &entry, &error) < 0 ) {
 		sieve_argument_validate_error(valdtr, key,
 			"invalid regular expression '%s' for regex match: %s",
-			str_sanitize(regex_str, 128), _regexp_error(&regexp, ret));
-
-		regfree(&regexp);
+			str_sanitize(regex_str, 128), error);
 		return -1;
 	}
 
-	regfree(&regexp);
+	ext_regex_cache_entry_unref(&entry);
 	return 1;
 }
 
@@ -170,11 +148,12 @@ static bool mcht_regex_validate_context
  */
 
 struct mcht_regex_key {
-	regex_t regexp;
+	struct ext_regex_cache_entry *entry;
 	int status;
 };
 
 struct mcht_regex_context {
+	const struct ext_regex_engine *engine;
 	ARRAY(struct mcht_regex_key) reg_expressions;
 	regmatch_t *pmatch;
 	size_t nmatch;
@@ -189,6 +168,7 @@ static void mcht_regex_match_init
 
 	/* Create context */
 	ctx = p_new(pool, struct mcht_regex_context, 1);
+	ctx->engine = ext_regex_get_engine(mctx->match_type->object.ext);
 
 	/* Create storage for match values if match values are requested */
 	if ( sieve_match_values_are_enabled(mctx->runenv) ) {
@@ -205,18 +185,18 @@ static void mcht_regex_match_init
 
 static int mcht_regex_match_key
 (struct sieve_match_context *mctx, const char *val,
-	const regex_t *regexp)
+	struct ext_regex_cache_entry *entry)
 {
 	struct mcht_regex_context *ctx = (struct mcht_regex_context *) mctx->data;
 	int ret;
 
 	/* Execute regex */
 
-	ret = regexec(regexp, val, ctx->nmatch, ctx->pmatch, 0);
+	ret = ext_regex_cache_entry_exec(entry, val, ctx->nmatch, ctx->pmatch);
 
 	/* Handle match values if necessary */
 
-	if ( ret == 0 ) {
+	if ( ret > 0 ) {
 		if ( ctx->nmatch > 0 ) {
 			struct sieve_match_values *mvalues;
 			size_t i;
@@ -298,34 +278,40 @@ static int mcht_regex_match_keys
 
 					if ( rkey->status >= 0 ) {
 						const char *regex_str = str_c(key_item);
+						const char *error;
 						int rxret;
 
 						/* Indicate whether match values need to be produced */
 						if ( ctx->nmatch == 0 ) cflags |= REG_NOSUB;
 
-						/* Compile regular expression */
-						if ( (rxret=regcomp(&rkey->regexp, regex_str, cflags)) != 0 ) {
+						/* Compile regular expression (or fetch it from cache) */
+						if ( (rxret=ext_regex_cache_compile(ctx->engine,
+							regex_str, cflags, &rkey->entry, &error)) < 0 ) {
 							sieve_runtime_error(renv, NULL,
 								"invalid regular expression '%s' for regex match: %s",
-								str_sanitize(regex_str, 128),
-								_regexp_error(&rkey->regexp, rxret));
+								str_sanitize(regex_str, 128), error);
 							rkey->status = -1;
 						} else {
+							if ( trace ) {
+								sieve_runtime_trace(renv, 0,
+									"regex `%s' [id=%u] %s",
+									str_sanitize(regex_str, 80), i,
+									( rxret > 0 ? "found in cache" : "compiled" ));
+							}
 							rkey->status = 1;
 						}
 					}
 				} else {
-					rkey = array_idx_modifiable(&ctx->reg_expressions, 1);
+					rkey = array_idx_modifiable(&ctx->reg_expressions, i);
 				}
 
 				if ( rkey->status > 0 ) {
-					match = mcht_regex_match_key(mctx, val, &rkey->regexp);
+					match = mcht_regex_match_key(mctx, val, rkey->entry);
 
 					if ( trace ) {
 						sieve_runtime_trace(renv, 0,
-							"with regex `%s' [id=%d] => %d",
-							str_sanitize(str_c(key_item), 80),
-							array_count(&ctx->reg_expressions)-1, match);
+							"with regex `%s' [id=%u] => %d",
+							str_sanitize(str_c(key_item), 80), i, match);
 					}
 				}
 			} T_END;
@@ -352,7 +338,7 @@ static int mcht_regex_match_keys
 		match = 0;
 		while ( match == 0 && i < count ) {
 			if ( rkeys[i].status > 0 ) {
-				match = mcht_regex_match_key(mctx, val, &rkeys[i].regexp);
+				match = mcht_regex_match_key(mctx, val, rkeys[i].entry);
 
 				if ( trace ) {
 					sieve_runtime_trace(renv, 0,
@@ -378,7 +364,8 @@ void mcht_regex_match_deinit
 	if ( array_is_created(&ctx->reg_expressions) ) {
 		rkeys = array_get_modifiable(&ctx->reg_expressions, &count);
 		for ( i = 0; i < count; i++ ) {
-			regfree(&rkeys[i].regexp);
+			if ( rkeys[i].entry != NULL )
+				ext_regex_cache_entry_unref(&rkeys[i].entry);
 		}
 	}
 }
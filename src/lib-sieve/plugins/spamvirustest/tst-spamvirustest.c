@@ -191,6 +191,9 @@ static bool tst_spamvirustest_generate
 	else
 		i_unreached();
 
+	/* The tested header fields are only known from the settings */
+	sieve_generate_header_names(cgenv, NULL);
+
 	/* Generate arguments */
 	return sieve_generate_arguments(cgenv, tst, NULL);
 }
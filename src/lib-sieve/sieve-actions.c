@@ -2,6 +2,7 @@
  */
 
 #include "lib.h"
+#include "hash.h"
 #include "str.h"
 #include "strfuncs.h"
 #include "ioloop.h"
@@ -188,6 +189,8 @@ static int act_store_check_duplicate
 	(const struct sieve_runtime_env *renv,
 		const struct sieve_action *act,
 		const struct sieve_action *act_other);
+static const char *act_store_duplicate_key
+	(const struct sieve_script_env *senv, const struct sieve_action *act);
 static void act_store_print
 	(const struct sieve_action *action,
 		const struct sieve_result_print_env *rpenv, bool *keep);
@@ -214,6 +217,7 @@ const struct sieve_action_def act_store = {
 		SIEVE_ACTFLAG_MAIL_STORAGE,
 	.equals = act_store_equals,
 	.check_duplicate = act_store_check_duplicate,
+	.duplicate_key = act_store_duplicate_key,
 	.print = act_store_print,
 	.start = act_store_start,
 	.execute = act_store_execute,
@@ -328,6 +332,21 @@ static int act_store_check_duplicate
 	return ( act_store_equals(renv->scriptenv, act, act_other) ? 1 : 0 );
 }
 
+static const char *act_store_duplicate_key
+(const struct sieve_script_env *senv, const struct sieve_action *act)
+{
+	struct act_store_context *st_ctx =
+		(struct act_store_context *) act->context;
+	const char *mailbox;
+
+	/* Must match act_store_equals() */
+	mailbox = ( st_ctx == NULL ?
+		SIEVE_SCRIPT_DEFAULT_MAILBOX(senv) : st_ctx->mailbox );
+	if ( strcasecmp(mailbox, "INBOX") == 0 )
+		return "INBOX";
+	return mailbox;
+}
+
 /* Result printing */
 
 static void act_store_print
@@ -390,6 +409,149 @@ static bool act_store_mailbox_open
 	return TRUE;
 }
 
+/* Store cache */
+
+struct sieve_store_cache_mailbox {
+	struct mailbox *box;
+	struct mailbox_transaction_context *trans;
+};
+
+struct sieve_store_cache {
+	pool_t pool;
+	HASH_TABLE(const char *, struct sieve_store_cache_mailbox *) mailboxes;
+
+	unsigned int batch_size;
+	unsigned int pending_saves;
+};
+
+struct sieve_store_cache *sieve_store_cache_create(unsigned int batch_size)
+{
+	struct sieve_store_cache *cache;
+	pool_t pool;
+
+	pool = pool_alloconly_create("sieve_store_cache", 1024);
+	cache = p_new(pool, struct sieve_store_cache, 1);
+	cache->pool = pool;
+	cache->batch_size = batch_size;
+	hash_table_create(&cache->mailboxes, pool, 0, str_hash, strcmp);
+
+	return cache;
+}
+
+void sieve_store_cache_destroy(struct sieve_store_cache **_cache)
+{
+	struct sieve_store_cache *cache = *_cache;
+	struct hash_iterate_context *hctx;
+	struct sieve_store_cache_mailbox *cbox;
+	const char *name;
+
+	*_cache = NULL;
+
+	sieve_store_cache_rollback(cache);
+
+	hctx = hash_table_iterate_init(cache->mailboxes);
+	while ( hash_table_iterate(hctx, cache->mailboxes, &name, &cbox) )
+		mailbox_free(&cbox->box);
+	hash_table_iterate_deinit(&hctx);
+
+	hash_table_destroy(&cache->mailboxes);
+	pool_unref(&cache->pool);
+}
+
+static struct mailbox *sieve_store_cache_lookup
+(struct sieve_store_cache *cache, const char *mailbox)
+{
+	struct sieve_store_cache_mailbox *cbox;
+
+	cbox = hash_table_lookup(cache->mailboxes, mailbox);
+	return ( cbox == NULL ? NULL : cbox->box );
+}
+
+static void sieve_store_cache_add
+(struct sieve_store_cache *cache, const char *mailbox, struct mailbox *box)
+{
+	struct sieve_store_cache_mailbox *cbox;
+
+	cbox = p_new(cache->pool, struct sieve_store_cache_mailbox, 1);
+	cbox->box = box;
+	hash_table_insert(cache->mailboxes, p_strdup(cache->pool, mailbox), cbox);
+}
+
+static struct mailbox_transaction_context *sieve_store_cache_transaction
+(struct sieve_store_cache *cache, const char *mailbox)
+{
+	struct sieve_store_cache_mailbox *cbox;
+
+	cbox = hash_table_lookup(cache->mailboxes, mailbox);
+	i_assert( cbox != NULL );
+
+	if ( cbox->trans == NULL ) {
+		cbox->trans = mailbox_transaction_begin
+			(cbox->box, MAILBOX_TRANSACTION_FLAG_EXTERNAL);
+	}
+	return cbox->trans;
+}
+
+int sieve_store_cache_message_finished
+(struct sieve_store_cache *cache, const char **error_r)
+{
+	*error_r = NULL;
+
+	if ( cache->batch_size == 0 || cache->pending_saves < cache->batch_size )
+		return 0;
+	return sieve_store_cache_commit(cache, error_r);
+}
+
+int sieve_store_cache_commit
+(struct sieve_store_cache *cache, const char **error_r)
+{
+	struct hash_iterate_context *hctx;
+	struct sieve_store_cache_mailbox *cbox;
+	const char *name;
+	int ret = 0;
+
+	*error_r = NULL;
+
+	hctx = hash_table_iterate_init(cache->mailboxes);
+	while ( hash_table_iterate(hctx, cache->mailboxes, &name, &cbox) ) {
+		if ( cbox->trans == NULL )
+			continue;
+
+		if ( mailbox_transaction_commit(&cbox->trans) < 0 ) {
+			/* Report the first failure */
+			if ( ret == 0 ) {
+				*error_r = t_strdup_printf(
+					"failed to commit messages stored into mailbox '%s': %s",
+					str_sanitize(name, 128),
+					mailbox_get_last_error(cbox->box, NULL));
+			}
+			ret = -1;
+		}
+	}
+	hash_table_iterate_deinit(&hctx);
+
+	cache->pending_saves = 0;
+	return ret;
+}
+
+void sieve_store_cache_rollback(struct sieve_store_cache *cache)
+{
+	struct hash_iterate_context *hctx;
+	struct sieve_store_cache_mailbox *cbox;
+	const char *name;
+
+	hctx = hash_table_iterate_init(cache->mailboxes);
+	while ( hash_table_iterate(hctx, cache->mailboxes, &name, &cbox) ) {
+		if ( cbox->trans != NULL )
+			mailbox_transaction_rollback(&cbox->trans);
+	}
+	hash_table_iterate_deinit(&hctx);
+
+	cache->pending_saves = 0;
+}
+
+/* Action implementation */
+
 static int act_store_start
 (const struct sieve_action *action,
 	const struct sieve_action_exec_env *aenv, void **tr_context)
@@ -401,7 +563,7 @@ static int act_store_start
 	pool_t pool = sieve_result_pool(aenv->result);
 	const char *error = NULL;
 	enum mail_error error_code = MAIL_ERROR_NONE;
-	bool disabled = FALSE, open_failed = FALSE;
+	bool disabled = FALSE, open_failed = FALSE, cached = FALSE;
 
 	/* If context is NULL, the store action is the result of (implicit) keep */
 	if ( ctx == NULL ) {
@@ -415,9 +577,17 @@ static int act_store_start
 	 * to NULL. This implementation will then skip actually storing the message.
 	 */
 	if ( senv->user != NULL ) {
-		if ( !act_store_mailbox_open
+		if ( senv->store_cache != NULL && (box=sieve_store_cache_lookup
+			(senv->store_cache, ctx->mailbox)) != NULL ) {
+			aenv->exec_status->last_storage = mailbox_get_storage(box);
+			cached = TRUE;
+		} else if ( !act_store_mailbox_open
 			(aenv, ctx->mailbox, &box, &error_code, &error) ) {
 			open_failed = TRUE;
+		} else if ( senv->store_cache != NULL ) {
+			/* Keep it open for subsequent messages */
+			sieve_store_cache_add(senv->store_cache, ctx->mailbox, box);
+			cached = TRUE;
 		}
 	} else {
 		disabled = TRUE;
@@ -431,6 +601,7 @@ static int act_store_start
 	trans->flags = 0;
 
 	trans->disabled = disabled;
+	trans->cached = cached;
 
 	if ( open_failed  ) {
 		trans->error = error;
@@ -476,6 +647,40 @@ static struct mail_keywords *act_store_keywords_create
 	return box_keywords;
 }
 
+static int act_store_save
+(const struct sieve_action_exec_env *aenv,
+	struct act_store_transaction *trans, struct mail *mail)
+{
+	struct mail_save_context *save_ctx;
+	struct mail_keywords *keywords = NULL;
+	int status = SIEVE_EXEC_OK;
+
+	/* Store the message */
+	save_ctx = mailbox_save_alloc(trans->mail_trans);
+
+	/* Apply keywords and flags that side-effects may have added */
+	if ( trans->flags_altered ) {
+		keywords = act_store_keywords_create(aenv, &trans->keywords, trans->box);
+
+		mailbox_save_set_flags(save_ctx, trans->flags, keywords);
+	} else {
+		mailbox_save_copy_flags(save_ctx, mail);
+	}
+
+	if ( mailbox_save_using_mail(&save_ctx, mail) < 0 ) {
+		sieve_act_store_get_storage_error(aenv, trans);
+		status = ( trans->error_code == MAIL_ERROR_TEMP ?
+			SIEVE_EXEC_TEMP_FAILURE : SIEVE_EXEC_FAILURE );
+	}
+
+	/* Deallocate keywords */
+ 	if ( keywords != NULL ) {
+ 		mailbox_keywords_unref(&keywords);
+ 	}
+
+	return status;
+}
+
 static int act_store_execute
 (const struct sieve_action *action,
 	const struct sieve_action_exec_env *aenv, void *tr_context)
@@ -484,10 +689,8 @@ static int act_store_execute
 		(struct act_store_transaction *) tr_context;
 	struct mail *mail =	( action->mail != NULL ?
 		action->mail : aenv->msgdata->mail );
-	struct mail_save_context *save_ctx;
 	struct mail_keywords *keywords = NULL;
 	bool backends_equal = FALSE;
-	int status = SIEVE_EXEC_OK;
 
 	/* Verify transaction */
 	if ( trans == NULL ) return SIEVE_EXEC_FAILURE;
@@ -564,34 +767,17 @@ static int act_store_execute
 	 */
 	aenv->exec_status->last_storage = mailbox_get_storage(trans->box);
 
+	/* The shared transaction of a cached mailbox cannot be rolled back for
+	   this message alone, so the message is saved only at commit */
+	if ( trans->cached )
+		return SIEVE_EXEC_OK;
+
 	/* Start mail transaction */
 	trans->mail_trans = mailbox_transaction_begin
 		(trans->box, MAILBOX_TRANSACTION_FLAG_EXTERNAL);
 
 	/* Store the message */
-	save_ctx = mailbox_save_alloc(trans->mail_trans);
-
-	/* Apply keywords and flags that side-effects may have added */
-	if ( trans->flags_altered ) {
-		keywords = act_store_keywords_create(aenv, &trans->keywords, trans->box);
-
-		mailbox_save_set_flags(save_ctx, trans->flags, keywords);
-	} else {
-		mailbox_save_copy_flags(save_ctx, mail);
-	}
-
-	if ( mailbox_save_using_mail(&save_ctx, mail) < 0 ) {
-		sieve_act_store_get_storage_error(aenv, trans);
-		status = ( trans->error_code == MAIL_ERROR_TEMP ?
-			SIEVE_EXEC_TEMP_FAILURE : SIEVE_EXEC_FAILURE );
-	}
-
-	/* Deallocate keywords */
- 	if ( keywords != NULL ) {
- 		mailbox_keywords_unref(&keywords);
- 	}
-
-	return status;
+	return act_store_save(aenv, trans, mail);
 }
 
 static void act_store_log_status
@@ -664,8 +850,17 @@ static void act_store_log_status
 	}
 }
 
+static void act_store_close(struct act_store_transaction *trans)
+{
+	/* Cached mailboxes stay open */
+	if ( trans->cached )
+		trans->box = NULL;
+	else if ( trans->box != NULL )
+		mailbox_free(&trans->box);
+}
+
 static int act_store_commit
-(const struct sieve_action *action ATTR_UNUSED,
+(const struct sieve_action *action,
 	const struct sieve_action_exec_env *aenv, void *tr_context, bool *keep)
 {
 	struct act_store_transaction *trans =
@@ -679,15 +874,13 @@ static int act_store_commit
 	if ( trans->disabled ) {
 		act_store_log_status(trans, aenv, FALSE, status);
 		*keep = FALSE;
-		if ( trans->box != NULL )
-			mailbox_free(&trans->box);
+		act_store_close(trans);
 		return SIEVE_EXEC_OK;
 	} else if ( trans->redundant ) {
 		act_store_log_status(trans, aenv, FALSE, status);
 		aenv->exec_status->keep_original = TRUE;
 		aenv->exec_status->message_saved = TRUE;
-		if ( trans->box != NULL )
-			mailbox_free(&trans->box);
+		act_store_close(trans);
 		return SIEVE_EXEC_OK;
 	}
 
@@ -696,8 +889,24 @@ static int act_store_commit
 	 */
 	aenv->exec_status->last_storage = mailbox_get_storage(trans->box);
 
-	/* Commit mailbox transaction */
-	status = ( mailbox_transaction_commit(&trans->mail_trans) == 0 );
+	if ( trans->cached ) {
+		struct sieve_store_cache *cache = aenv->scriptenv->store_cache;
+		struct mail *mail =	( action->mail != NULL ?
+			action->mail : aenv->msgdata->mail );
+
+		/* Save into the transaction of the cached mailbox, which is committed
+		   later by the owner of the cache */
+		trans->mail_trans = sieve_store_cache_transaction
+			(cache, trans->context->mailbox);
+		status = ( act_store_save(aenv, trans, mail) == SIEVE_EXEC_OK );
+		trans->mail_trans = NULL;
+
+		if ( status )
+			cache->pending_saves++;
+	} else {
+		/* Commit mailbox transaction */
+		status = ( mailbox_transaction_commit(&trans->mail_trans) == 0 );
+	}
 
 	/* Note the fact that the message was stored at least once */
 	if ( status )
@@ -712,8 +921,7 @@ static int act_store_commit
 	*keep = !status;
 
 	/* Close mailbox */
-	if ( trans->box != NULL )
-		mailbox_free(&trans->box);
+	act_store_close(trans);
 
 	if (status)
 		return SIEVE_EXEC_OK;
@@ -744,7 +952,7 @@ static void act_store_rollback
 		mailbox_transaction_rollback(&trans->mail_trans);
 
 	/* Close the mailbox */
-	mailbox_free(&trans->box);
+	act_store_close(trans);
 }
 
 /*
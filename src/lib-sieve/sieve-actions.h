@@ -64,6 +64,12 @@ struct sieve_action_def {
 			const struct sieve_action *act,
 			const struct sieve_action *act_other);
 
+	/* Optional: returns a key that is equal for exactly those actions that
+	   check_duplicate() considers duplicates. This allows finding duplicates
+	   without comparing the action to all others in the result. */
+	const char *(*duplicate_key)
+		(const struct sieve_script_env *senv, const struct sieve_action *act);
+
 	/* Result printing */
 
 	void (*print)
@@ -238,6 +244,7 @@ struct act_store_transaction {
 	bool flags_altered:1;
 	bool disabled:1;
 	bool redundant:1;
+	bool cached:1;
 };
 
 int sieve_act_store_add_to_result
@@ -251,6 +258,31 @@ void sieve_act_store_add_flags
 void sieve_act_store_get_storage_error
 	(const struct sieve_action_exec_env *aenv, struct act_store_transaction *trans);
 
+/*
+ * Store cache
+ *
+ *   For batch runs over many messages, such as sieve-filter. The store action
+ *   keeps the target mailboxes open in the cache and saves messages into a
+ *   transaction that stays open across messages. The owner of the cache
+ *   commits these transactions in batches.
+ */
+
+struct sieve_store_cache;
+
+/* A batch_size of 0 means that transactions are only committed by an
+   explicit sieve_store_cache_commit() */
+struct sieve_store_cache *sieve_store_cache_create(unsigned int batch_size);
+/* Rolls back whatever was not committed */
+void sieve_store_cache_destroy(struct sieve_store_cache **_cache);
+
+/* To be called after each message; commits the transactions once the batch
+   is complete. Returns -1 when a commit failed. */
+int sieve_store_cache_message_finished
+	(struct sieve_store_cache *cache, const char **error_r);
+int sieve_store_cache_commit
+	(struct sieve_store_cache *cache, const char **error_r);
+void sieve_store_cache_rollback(struct sieve_store_cache *cache);
+
 /*
  * Redirect action
  */
@@ -0,0 +1,381 @@
+/* Copyright (c) 2002-2017 Pigeonhole authors, see the included COPYING file
+ */
+
+#include "lib.h"
+#include "llist.h"
+#include "hash.h"
+#include "mmap-util.h"
+
+#include "sieve-common.h"
+#include "sieve-error.h"
+#include "sieve-script.h"
+
+#include "sieve-binary-private.h"
+#include "sieve-binary-cache.h"
+
+#include <unistd.h>
+
+/*
+ * Loaded binary cache
+ */
+
+struct sieve_binary_cache_entry {
+	struct sieve_binary_cache_entry *prev, *next;
+
+	char *path;
+	struct stat st;
+
+	void *data;
+	size_t size;
+	/* Data is a read-only mapping of the file rather than a copy */
+	bool mapped:1;
+
+	/* Binary object last opened from this file */
+	struct sieve_binary *sbin;
+
+	/* Held by binary files opened from the entry */
+	int refcount;
+	bool cached:1;
+};
+
+struct sieve_binary_cache {
+	HASH_TABLE(const char *, struct sieve_binary_cache_entry *) entries;
+
+	/* Least recently used entry is at the tail */
+	struct sieve_binary_cache_entry *head, *tail;
+	unsigned int count, max_entries;
+
+	unsigned int hits, misses, evictions;
+};
+
+static struct sieve_binary_cache *sieve_binary_cache = NULL;
+
+static void sieve_binary_cache_entry_free
+(struct sieve_binary_cache_entry *entry)
+{
+	i_assert( entry->sbin == NULL );
+
+	if ( !entry->mapped )
+		i_free(entry->data);
+	else if ( munmap(entry->data, entry->size) < 0 )
+		i_error("sieve: binary cache: munmap(%s) failed: %m", entry->path);
+	i_free(entry->path);
+	i_free(entry);
+}
+
+static void sieve_binary_cache_entry_drop_binary
+(struct sieve_binary_cache_entry *entry)
+{
+	struct sieve_binary *sbin = entry->sbin;
+
+	if ( sbin == NULL )
+		return;
+
+	/* The binary's file may hold the last reference to the entry */
+	entry->sbin = NULL;
+	entry->refcount++;
+	sieve_binary_unref(&sbin);
+	sieve_binary_cache_entry_unref(&entry);
+}
+
+static void sieve_binary_cache_evict
+(struct sieve_binary_cache *cache, struct sieve_binary_cache_entry *entry)
+{
+	i_assert( entry->cached );
+
+	hash_table_remove(cache->entries, entry->path);
+	DLLIST2_REMOVE(&cache->head, &cache->tail, entry);
+	cache->count--;
+
+	entry->cached = FALSE;
+	entry->refcount++;
+	sieve_binary_cache_entry_drop_binary(entry);
+	sieve_binary_cache_entry_unref(&entry);
+}
+
+void sieve_binary_cache_init(struct sieve_instance *svinst)
+{
+	struct sieve_binary_cache *cache = sieve_binary_cache;
+
+	if ( cache == NULL ) {
+		if ( svinst->binary_cache_size == 0 )
+			return;
+		cache = sieve_binary_cache = i_new(struct sieve_binary_cache, 1);
+		hash_table_create(&cache->entries, default_pool, 0, str_hash, strcmp);
+	}
+
+	/* Most recently created instance determines the size */
+	cache->max_entries = svinst->binary_cache_size;
+	while ( cache->count > cache->max_entries )
+		sieve_binary_cache_evict(cache, cache->tail);
+}
+
+void sieve_binary_cache_instance_deinit(struct sieve_instance *svinst)
+{
+	struct sieve_binary_cache *cache = sieve_binary_cache;
+	struct sieve_binary_cache_entry *entry;
+
+	if ( cache == NULL )
+		return;
+
+	/* Binary objects cannot outlive the instance they were opened for */
+	for ( entry = cache->head; entry != NULL; entry = entry->next ) {
+		if ( entry->sbin != NULL && entry->sbin->svinst == svinst )
+			sieve_binary_cache_entry_drop_binary(entry);
+	}
+
+	if ( svinst->debug ) {
+		sieve_sys_debug(svinst, "binary cache: "
+			"%u hits, %u misses, %u evictions in this process",
+			cache->hits, cache->misses, cache->evictions);
+	}
+}
+
+void sieve_binary_cache_deinit(void)
+{
+	struct sieve_binary_cache *cache = sieve_binary_cache;
+
+	if ( cache == NULL )
+		return;
+
+	/* Entries still referenced are freed once they are released */
+	while ( cache->head != NULL )
+		sieve_binary_cache_evict(cache, cache->head);
+	hash_table_destroy(&cache->entries);
+	i_free(cache);
+
+	sieve_binary_cache = NULL;
+}
+
+bool sieve_binary_cache_enabled(struct sieve_instance *svinst)
+{
+	return ( sieve_binary_cache != NULL && svinst->binary_cache_size > 0 &&
+		sieve_binary_cache->max_entries > 0 );
+}
+
+static inline bool sieve_binary_cache_stat_equals
+(const struct stat *st1, const struct stat *st2)
+{
+	return ( st1->st_dev == st2->st_dev && st1->st_ino == st2->st_ino &&
+		st1->st_size == st2->st_size && st1->st_mtime == st2->st_mtime &&
+		ST_MTIME_NSEC(*st1) == ST_MTIME_NSEC(*st2) &&
+		st1->st_uid == st2->st_uid && st1->st_mode == st2->st_mode );
+}
+
+static bool sieve_binary_cache_map
+(struct sieve_instance *svinst, struct sieve_binary_cache_entry *entry,
+	int fd)
+{
+	void *data;
+
+	/* Binaries are replaced by renaming a new file over the old one, so the
+	   mapping stays valid for as long as the entry exists */
+	data = mmap_ro_file(fd, &entry->size);
+	if ( data == MAP_FAILED ) {
+		sieve_sys_error(svinst,
+			"binary open: mmap(%s) failed: %m", entry->path);
+		entry->size = 0;
+		return FALSE;
+	}
+
+	entry->data = data;
+	entry->mapped = TRUE;
+	return TRUE;
+}
+
+static bool sieve_binary_cache_copy
+(struct sieve_instance *svinst, struct sieve_binary_cache_entry *entry,
+	int fd)
+{
+	unsigned char *data;
+	size_t size;
+	ssize_t ret;
+
+	entry->size = size = entry->st.st_size;
+	entry->data = data = i_malloc(entry->size);
+
+	while ( size > 0 ) {
+		if ( (ret=read(fd, data, size)) <= 0 ) {
+			if ( ret == 0 ) {
+				sieve_sys_error(svinst,
+					"binary read: binary %s is truncated (more data expected)",
+					entry->path);
+			} else {
+				sieve_sys_error(svinst,
+					"binary read: failed to read from binary %s: %m",
+					entry->path);
+			}
+			return FALSE;
+		}
+
+		data += ret;
+		size -= ret;
+	}
+	return TRUE;
+}
+
+static struct sieve_binary_cache_entry *sieve_binary_cache_read
+(struct sieve_instance *svinst, const char *path, enum sieve_error *error_r)
+{
+	struct sieve_binary_cache_entry *entry;
+	struct sieve_binary_file file;
+	bool success;
+
+	i_zero(&file);
+	if ( !sieve_binary_file_open(&file, svinst, path, error_r) )
+		return NULL;
+
+	entry = i_new(struct sieve_binary_cache_entry, 1);
+	entry->path = i_strdup(path);
+	entry->st = file.st;
+	entry->refcount = 1;
+
+	/* A mapping shares the page cache with other processes using the
+	   binary, rather than keeping a private copy in each of them */
+	if ( svinst->binary_mmap )
+		success = sieve_binary_cache_map(svinst, entry, file.fd);
+	else
+		success = sieve_binary_cache_copy(svinst, entry, file.fd);
+
+	if ( close(file.fd) < 0 ) {
+		sieve_sys_error(svinst,
+			"binary open: close(fd=%s) failed: %m", path);
+	}
+
+	if ( !success ) {
+		sieve_binary_cache_entry_unref(&entry);
+		if ( error_r != NULL )
+			*error_r = SIEVE_ERROR_TEMP_FAILURE;
+		return NULL;
+	}
+
+	return entry;
+}
+
+struct sieve_binary_cache_entry *sieve_binary_cache_open
+(struct sieve_instance *svinst, const char *path, bool *cached_r,
+	enum sieve_error *error_r)
+{
+	struct sieve_binary_cache *cache = sieve_binary_cache;
+	struct sieve_binary_cache_entry *entry;
+	struct stat st;
+
+	*cached_r = FALSE;
+
+	i_assert( cache != NULL );
+
+	entry = hash_table_lookup(cache->entries, path);
+	if ( entry != NULL ) {
+		/* Binaries are replaced by renaming a new file over the old one, so
+		   any change shows in the file's identity */
+		if ( stat(path, &st) == 0 &&
+			sieve_binary_cache_stat_equals(&st, &entry->st) ) {
+			/* Move to front of LRU list */
+			DLLIST2_REMOVE(&cache->head, &cache->tail, entry);
+			DLLIST2_PREPEND(&cache->head, &cache->tail, entry);
+
+			cache->hits++;
+			entry->refcount++;
+			*cached_r = TRUE;
+			return entry;
+		}
+
+		if ( svinst->debug ) {
+			sieve_sys_debug(svinst, "binary cache: "
+				"cached binary %s changed on disk", path);
+		}
+		sieve_binary_cache_evict(cache, entry);
+	}
+
+	cache->misses++;
+
+	if ( (entry=sieve_binary_cache_read(svinst, path, error_r)) == NULL )
+		return NULL;
+
+	if ( cache->count >= cache->max_entries ) {
+		sieve_binary_cache_evict(cache, cache->tail);
+		cache->evictions++;
+	}
+
+	hash_table_insert(cache->entries, entry->path, entry);
+	DLLIST2_PREPEND(&cache->head, &cache->tail, entry);
+	cache->count++;
+	entry->cached = TRUE;
+
+	return entry;
+}
+
+void sieve_binary_cache_entry_ref(struct sieve_binary_cache_entry *entry)
+{
+	i_assert( entry->refcount > 0 );
+	entry->refcount++;
+}
+
+void sieve_binary_cache_entry_unref(struct sieve_binary_cache_entry **_entry)
+{
+	struct sieve_binary_cache_entry *entry = *_entry;
+
+	*_entry = NULL;
+
+	i_assert( entry->refcount > 0 );
+	if ( --entry->refcount > 0 || entry->cached )
+		return;
+
+	sieve_binary_cache_entry_free(entry);
+}
+
+const void *sieve_binary_cache_entry_get_data
+(struct sieve_binary_cache_entry *entry, size_t *size_r,
+	const struct stat **st_r)
+{
+	*size_r = entry->size;
+	*st_r = &entry->st;
+	return entry->data;
+}
+
+struct sieve_binary *sieve_binary_cache_entry_get_binary
+(struct sieve_binary_cache_entry *entry, struct sieve_instance *svinst,
+	struct sieve_script *script)
+{
+	struct sieve_binary *sbin = entry->sbin;
+
+	if ( sbin == NULL || sbin->svinst != svinst )
+		return NULL;
+
+	if ( script == NULL ) {
+		if ( sbin->script != NULL )
+			return NULL;
+	} else {
+		if ( sbin->script != NULL && !sieve_script_equals(sbin->script, script) )
+			return NULL;
+
+		/* The script the binary was opened for reflects the state of the
+		   script at that time; use the one that was just opened instead. */
+		sieve_binary_set_script(sbin, script);
+	}
+
+	sbin->cached = TRUE;
+	sieve_binary_ref(sbin);
+	return sbin;
+}
+
+void sieve_binary_cache_entry_set_binary
+(struct sieve_binary_cache_entry *entry, struct sieve_binary *sbin)
+{
+	if ( !entry->cached || entry->sbin == sbin )
+		return;
+
+	sieve_binary_ref(sbin);
+	sieve_binary_cache_entry_drop_binary(entry);
+	entry->sbin = sbin;
+}
+
+void sieve_binary_cache_get_stats
+(unsigned int *hits_r, unsigned int *misses_r, unsigned int *evictions_r)
+{
+	struct sieve_binary_cache *cache = sieve_binary_cache;
+
+	*hits_r = ( cache == NULL ? 0 : cache->hits );
+	*misses_r = ( cache == NULL ? 0 : cache->misses );
+	*evictions_r = ( cache == NULL ? 0 : cache->evictions );
+}
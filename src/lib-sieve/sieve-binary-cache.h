@@ -0,0 +1,57 @@
+/* Copyright (c) 2002-2017 Pigeonhole authors, see the included COPYING file
+ */
+
+#ifndef __SIEVE_BINARY_CACHE_H
+#define __SIEVE_BINARY_CACHE_H
+
+#include "sieve-common.h"
+
+#include <sys/stat.h>
+
+/*
+ * Loaded binary cache
+ *
+ *   The contents of binary files read from storage are kept by the process,
+ *   so that long-lived processes opening the same binaries over and over do
+ *   not need to read them each time. The contents are a read-only mapping of
+ *   the file when sieve_binary_mmap is enabled and a private copy otherwise. The cache outlives the Sieve instances,
+ *   because LDA and LMTP create a new instance for each delivery; it is only
+ *   freed by sieve_process_deinit(). A cached file is only used while the file
+ *   on disk still has the same inode, size, modification time, owner and
+ *   mode. The binary object last opened from a cached file is reused as well,
+ *   but only by the instance it was opened for.
+ */
+
+struct sieve_binary_cache_entry;
+
+void sieve_binary_cache_init(struct sieve_instance *svinst);
+void sieve_binary_cache_instance_deinit(struct sieve_instance *svinst);
+void sieve_binary_cache_deinit(void);
+
+bool sieve_binary_cache_enabled(struct sieve_instance *svinst);
+
+/* Returns a referenced entry holding the current contents of the binary file,
+   or NULL when it cannot be read. The cached_r argument indicates whether the
+   contents were already cached. */
+struct sieve_binary_cache_entry *sieve_binary_cache_open
+	(struct sieve_instance *svinst, const char *path, bool *cached_r,
+		enum sieve_error *error_r);
+void sieve_binary_cache_entry_ref(struct sieve_binary_cache_entry *entry);
+void sieve_binary_cache_entry_unref(struct sieve_binary_cache_entry **_entry);
+
+const void *sieve_binary_cache_entry_get_data
+	(struct sieve_binary_cache_entry *entry, size_t *size_r,
+		const struct stat **st_r);
+
+/* Returns a new reference to the binary object last opened from the entry,
+   or NULL when it belongs to another instance or script */
+struct sieve_binary *sieve_binary_cache_entry_get_binary
+	(struct sieve_binary_cache_entry *entry, struct sieve_instance *svinst,
+		struct sieve_script *script);
+void sieve_binary_cache_entry_set_binary
+	(struct sieve_binary_cache_entry *entry, struct sieve_binary *sbin);
+
+void sieve_binary_cache_get_stats
+	(unsigned int *hits_r, unsigned int *misses_r, unsigned int *evictions_r);
+
+#endif /* __SIEVE_BINARY_CACHE_H */
@@ -11,6 +11,7 @@
 #include "ostream.h"
 
 #include "sieve-common.h"
+#include "sieve-limits.h"
 #include "sieve-error.h"
 #include "sieve-extensions.h"
 #include "sieve-code.h"
@@ -34,6 +35,9 @@ static inline sieve_size_t sieve_binary_emit_dynamic_data
 static inline void _sieve_binary_emit_data
 (struct sieve_binary_block *sblock, const void *data, sieve_size_t size)
 {
+	_sieve_binary_block_caches_clear(sblock);
+	if ( sblock->readonly )
+		sieve_binary_block_make_writable(sblock);
 	buffer_append(sblock->data, data, size);
 }
 
@@ -47,6 +51,9 @@ static inline void _sieve_binary_update_data
 (struct sieve_binary_block *sblock, sieve_size_t address, const void *data,
 	sieve_size_t size)
 {
+	_sieve_binary_block_caches_clear(sblock);
+	if ( sblock->readonly )
+		sieve_binary_block_make_writable(sblock);
 	buffer_write(sblock->data, address, data, size);
 }
 
@@ -96,17 +103,13 @@ sieve_size_t sieve_binary_emit_offset
 	return address;
 }
 
-void sieve_binary_resolve_offset
-(struct sieve_binary_block *sblock, sieve_size_t address)
+void sieve_binary_update_offset
+(struct sieve_binary_block *sblock, sieve_size_t address,
+	sieve_offset_t offset)
 {
-	sieve_size_t cur_address = _sieve_binary_block_get_size(sblock);
-	sieve_offset_t offset;
 	uint8_t encoded[sizeof(offset)];
 	int i;
 
-	i_assert(cur_address > address);
-	i_assert((cur_address - address) <= (sieve_offset_t)-1);
-	offset = cur_address - address;
 	for ( i = sizeof(offset)-1; i >= 0; i-- ) {
 		encoded[i] = (uint8_t)offset;
 		offset >>= 8;
@@ -116,6 +119,17 @@ void sieve_binary_resolve_offset
 		(sblock, address, encoded, sizeof(offset));
 }
 
+void sieve_binary_resolve_offset
+(struct sieve_binary_block *sblock, sieve_size_t address)
+{
+	sieve_size_t cur_address = _sieve_binary_block_get_size(sblock);
+
+	i_assert(cur_address > address);
+	i_assert((cur_address - address) <= (sieve_offset_t)-1);
+
+	sieve_binary_update_offset(sblock, address, cur_address - address);
+}
+
 /* Literal emission */
 
 sieve_size_t sieve_binary_emit_integer
@@ -402,3 +416,90 @@ const void *sieve_binary_read_extension_object
 
 	return ((const void *const *) objs->objects)[code];
 }
+
+/*
+ * Decoded operations
+ */
+
+bool sieve_binary_read_decoded_operation
+(struct sieve_binary_block *sblock, sieve_size_t *address,
+	struct sieve_operation *oprtn)
+{
+	const struct sieve_binary_operation *bop;
+
+	if ( *address >= sblock->operations_count )
+		return FALSE;
+
+	bop = &sblock->operations[*address];
+	if ( bop->size == 0 )
+		return FALSE;
+
+	oprtn->address = *address;
+	oprtn->def = bop->def;
+	oprtn->ext = bop->ext;
+	*address += bop->size;
+	return TRUE;
+}
+
+void sieve_binary_add_decoded_operation
+(struct sieve_binary_block *sblock, const struct sieve_operation *oprtn,
+	sieve_size_t end_address)
+{
+	struct sieve_binary_operation *bop;
+
+	/* Blocks of a binary that is being generated still change */
+	if ( sblock->sbin->file == NULL )
+		return;
+
+	i_assert( end_address > oprtn->address &&
+		end_address <= _sieve_binary_block_get_size(sblock) );
+
+	/* Operation codes are a few bytes at most */
+	if ( end_address - oprtn->address > (uint8_t)-1 )
+		return;
+
+	if ( sblock->operations == NULL ) {
+		sblock->operations_count = _sieve_binary_block_get_size(sblock);
+		sblock->operations = i_new
+			(struct sieve_binary_operation, sblock->operations_count);
+	}
+
+	bop = &sblock->operations[oprtn->address];
+	bop->def = oprtn->def;
+	bop->ext = oprtn->ext;
+	bop->size = (uint8_t)(end_address - oprtn->address);
+}
+
+/*
+ * Match key sets
+ */
+
+/* The address is offset by one in the key, since address 0 would otherwise
+   yield a NULL key. */
+#define SIEVE_BINARY_ADDRESS_KEY(address) \
+	POINTER_CAST((address) + 1)
+
+struct sieve_match_keyset *sieve_binary_get_match_keyset
+(struct sieve_binary_block *sblock, sieve_size_t address)
+{
+	if ( !hash_table_is_created(sblock->keysets) )
+		return NULL;
+
+	return hash_table_lookup(sblock->keysets,
+		SIEVE_BINARY_ADDRESS_KEY(address));
+}
+
+void sieve_binary_add_match_keyset
+(struct sieve_binary_block *sblock, sieve_size_t address,
+	struct sieve_match_keyset *kset)
+{
+	struct sieve_binary *sbin = sblock->sbin;
+
+	i_assert( address < _sieve_binary_block_get_size(sblock) );
+
+	if ( !hash_table_is_created(sblock->keysets) )
+		hash_table_create_direct(&sblock->keysets, sbin->pool, 0);
+
+	hash_table_insert(sblock->keysets,
+		SIEVE_BINARY_ADDRESS_KEY(address), kset);
+}
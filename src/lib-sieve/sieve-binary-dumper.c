@@ -101,6 +101,9 @@ bool sieve_binary_dumper_run
 	struct sieve_dumptime_env *denv = &(dumper->dumpenv);
 	struct sieve_binary_block *sblock;
 	bool success = TRUE;
+	const char *const *header_names;
+	unsigned int header_count;
+	const char *source_digest;
 	sieve_size_t offset;
 	int count, i;
 
@@ -160,6 +163,27 @@ bool sieve_binary_dumper_run
 		}
 	}
 
+	/* Dump list of accessed header fields */
+
+	sieve_binary_dump_sectionf
+		(denv, "Header names (block: %d)", SBIN_SYSBLOCK_HEADER_NAMES);
+
+	if ( !sieve_binary_get_header_names(sbin, &header_names, &header_count) ) {
+		sieve_binary_dumpf(denv, "  (any)\n");
+	} else {
+		for ( i = 0; i < (int)header_count; i++ )
+			sieve_binary_dumpf(denv, "%3d: %s\n", i, header_names[i]);
+	}
+
+	/* Dump shared binary store digest */
+
+	source_digest = sieve_binary_get_source_digest(sbin);
+	if ( source_digest != NULL ) {
+		sieve_binary_dump_sectionf
+			(denv, "Source digest (block: %d)", SBIN_SYSBLOCK_SOURCE_DIGEST);
+		sieve_binary_dumpf(denv, "  %s\n", source_digest);
+	}
+
 	/* Dump extension-specific elements of the binary */
 
 	count = sieve_binary_extensions_count(sbin);
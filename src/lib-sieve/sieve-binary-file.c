@@ -11,6 +11,7 @@
 #include "ostream.h"
 #include "eacces-error.h"
 #include "safe-mkstemp.h"
+#include "mmap-util.h"
 
 #include "sieve-common.h"
 #include "sieve-error.h"
@@ -19,6 +20,7 @@
 #include "sieve-script.h"
 
 #include "sieve-binary-private.h"
+#include "sieve-binary-cache.h"
 
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -242,6 +244,14 @@ static bool _sieve_binary_save
 		sieve_binary_emit_unsigned(ext_block, (*ext)->block_id);
 	}
 
+	/* Create block containing the header names accessed by the script */
+
+	sieve_binary_header_names_write(sbin);
+
+	/* Create block containing the digest of a shared binary */
+
+	sieve_binary_source_digest_write(sbin);
+
 	/* Save all blocks into the binary */
 
 	for ( i = 0; i < blk_count; i++ ) {
@@ -451,6 +461,9 @@ bool sieve_binary_file_open
 
 void sieve_binary_file_close(struct sieve_binary_file **file)
 {
+	if ( (*file)->close != NULL )
+		(*file)->close(*file);
+
 	if ( (*file)->fd != -1 ) {
 		if ( close((*file)->fd) < 0 ) {
 			sieve_sys_error((*file)->svinst,
@@ -578,6 +591,192 @@ static struct sieve_binary_file *_file_memory_open(const char *path)
 
 #endif /* file_memory is currently unused */
 
+/* File mapped read-only into memory (blocks point straight into the mapping)
+ */
+
+struct _file_mmap {
+	struct sieve_binary_file binfile;
+
+	void *mmap_base;
+	size_t mmap_size;
+};
+
+static const void *_file_mmap_load_data
+(struct sieve_binary_file *file, off_t *offset, size_t size)
+{
+	struct _file_mmap *fmap = (struct _file_mmap *) file;
+	const void *data;
+
+	*offset = SIEVE_BINARY_ALIGN(*offset);
+
+	if ( (uoff_t)*offset > fmap->mmap_size ||
+		size > fmap->mmap_size - *offset ) {
+		sieve_sys_error(file->svinst,
+			"binary read: binary %s is truncated (more data expected)",
+			file->path);
+		return NULL;
+	}
+
+	data = CONST_PTR_OFFSET(fmap->mmap_base, *offset);
+	*offset += size;
+	file->offset = *offset;
+
+	return data;
+}
+
+static buffer_t *_file_mmap_load_buffer
+(struct sieve_binary_file *file, off_t *offset, size_t size)
+{
+	const void *data = _file_mmap_load_data(file, offset, size);
+
+	if ( data == NULL )
+		return NULL;
+
+	/* The block is copied once it is modified; see
+	   sieve_binary_block_make_writable() */
+	return buffer_create_const_data(file->pool, data, size);
+}
+
+static void _file_mmap_close(struct sieve_binary_file *file)
+{
+	struct _file_mmap *fmap = (struct _file_mmap *) file;
+
+	if ( fmap->mmap_base != NULL &&
+		munmap(fmap->mmap_base, fmap->mmap_size) < 0 ) {
+		sieve_sys_error(file->svinst,
+			"binary close: munmap(%s) failed: %m", file->path);
+	}
+	fmap->mmap_base = NULL;
+}
+
+static struct sieve_binary_file *_file_mmap_open
+(struct sieve_instance *svinst, const char *path, enum sieve_error *error_r)
+{
+	pool_t pool;
+	struct _file_mmap *file;
+
+	pool = pool_alloconly_create("sieve_binary_file_mmap", 1024);
+	file = p_new(pool, struct _file_mmap, 1);
+	file->binfile.pool = pool;
+	file->binfile.path = p_strdup(pool, path);
+	file->binfile.load_data = _file_mmap_load_data;
+	file->binfile.load_buffer = _file_mmap_load_buffer;
+	file->binfile.close = _file_mmap_close;
+	file->binfile.readonly_buffers = TRUE;
+
+	if ( !sieve_binary_file_open(&file->binfile, svinst, path, error_r) ) {
+		pool_unref(&pool);
+		return NULL;
+	}
+
+	/* Binaries are always replaced by renaming a new file over the old one
+	   and never rewritten in place, so the mapping stays valid for as long as
+	   the binary is in use. */
+	file->mmap_base = mmap_ro_file(file->binfile.fd, &file->mmap_size);
+	if ( file->mmap_base == MAP_FAILED ) {
+		struct sieve_binary_file *binfile = &file->binfile;
+
+		sieve_sys_error(svinst,
+			"binary open: mmap(%s) failed: %m", path);
+		file->mmap_base = NULL;
+		sieve_binary_file_close(&binfile);
+		if ( error_r != NULL )
+			*error_r = SIEVE_ERROR_TEMP_FAILURE;
+		return NULL;
+	}
+
+	/* The descriptor is no longer needed once the file is mapped */
+	if ( close(file->binfile.fd) < 0 ) {
+		sieve_sys_error(svinst,
+			"binary open: close(fd=%s) failed: %m", path);
+	}
+	file->binfile.fd = -1;
+
+	return &file->binfile;
+}
+
+/* File held in the binary cache (blocks point straight into the cached data)
+ */
+
+struct _file_cached {
+	struct sieve_binary_file binfile;
+
+	struct sieve_binary_cache_entry *entry;
+	const void *data;
+	size_t size;
+};
+
+static const void *_file_cached_load_data
+(struct sieve_binary_file *file, off_t *offset, size_t size)
+{
+	struct _file_cached *fcache = (struct _file_cached *) file;
+	const void *data;
+
+	*offset = SIEVE_BINARY_ALIGN(*offset);
+
+	if ( (uoff_t)*offset > fcache->size ||
+		size > fcache->size - *offset ) {
+		sieve_sys_error(file->svinst,
+			"binary read: binary %s is truncated (more data expected)",
+			file->path);
+		return NULL;
+	}
+
+	data = CONST_PTR_OFFSET(fcache->data, *offset);
+	*offset += size;
+	file->offset = *offset;
+
+	return data;
+}
+
+static buffer_t *_file_cached_load_buffer
+(struct sieve_binary_file *file, off_t *offset, size_t size)
+{
+	const void *data = _file_cached_load_data(file, offset, size);
+
+	if ( data == NULL )
+		return NULL;
+
+	/* The block is copied once it is modified; see
+	   sieve_binary_block_make_writable() */
+	return buffer_create_const_data(file->pool, data, size);
+}
+
+static void _file_cached_close(struct sieve_binary_file *file)
+{
+	struct _file_cached *fcache = (struct _file_cached *) file;
+
+	sieve_binary_cache_entry_unref(&fcache->entry);
+}
+
+static struct sieve_binary_file *_file_cached_open
+(struct sieve_instance *svinst, const char *path,
+	struct sieve_binary_cache_entry *entry)
+{
+	pool_t pool;
+	struct _file_cached *file;
+	const struct stat *st;
+
+	pool = pool_alloconly_create("sieve_binary_file_cached", 1024);
+	file = p_new(pool, struct _file_cached, 1);
+	file->binfile.pool = pool;
+	file->binfile.path = p_strdup(pool, path);
+	file->binfile.svinst = svinst;
+	file->binfile.fd = -1;
+	file->binfile.load_data = _file_cached_load_data;
+	file->binfile.load_buffer = _file_cached_load_buffer;
+	file->binfile.close = _file_cached_close;
+	file->binfile.readonly_buffers = TRUE;
+
+	file->data = sieve_binary_cache_entry_get_data(entry, &file->size, &st);
+	file->binfile.st = *st;
+
+	sieve_binary_cache_entry_ref(entry);
+	file->entry = entry;
+
+	return &file->binfile;
+}
+
 /* File open in lazy mode (only read what is needed into memory) */
 
 static bool _file_lazy_read
@@ -705,6 +904,7 @@ bool sieve_binary_load_block
 	}
 
 	sblock->data = sbin->file->load_buffer(sbin->file, &offset, header->size);
+	sblock->readonly = sbin->file->readonly_buffers;
 	if ( sblock->data == NULL ) {
 		sieve_sys_error(sbin->svinst,
 			"binary load: failed to read block %d of binary %s (size=%d)",
@@ -894,20 +1094,44 @@ struct sieve_binary *sieve_binary_open
 	unsigned int ext_count, i;
 	struct sieve_binary *sbin;
 	struct sieve_binary_file *file;
+	struct sieve_binary_cache_entry *centry = NULL;
+	bool cached = FALSE;
 
 	i_assert( script == NULL || sieve_script_svinst(script) == svinst );
 
 	//file = _file_memory_open(path);
-	if ( (file=_file_lazy_open(svinst, path, error_r)) == NULL )
+	if ( sieve_binary_cache_enabled(svinst) ) {
+		centry = sieve_binary_cache_open(svinst, path, &cached, error_r);
+		if ( centry == NULL )
+			return NULL;
+
+		/* Reuse the binary object this instance opened before */
+		if ( cached &&
+			(sbin=sieve_binary_cache_entry_get_binary
+				(centry, svinst, script)) != NULL ) {
+			sieve_binary_cache_entry_unref(&centry);
+			return sbin;
+		}
+
+		file = _file_cached_open(svinst, path, centry);
+	} else if ( svinst->binary_mmap ) {
+		file = _file_mmap_open(svinst, path, error_r);
+	} else {
+		file = _file_lazy_open(svinst, path, error_r);
+	}
+	if ( file == NULL )
 		return NULL;
 
 	/* Create binary object */
 	sbin = sieve_binary_create(svinst, script);
 	sbin->path = p_strdup(sbin->pool, path);
 	sbin->file = file;
+	sbin->cached = cached;
 
 	if ( !_sieve_binary_open(sbin) ) {
 		sieve_binary_unref(&sbin);
+		if ( centry != NULL )
+			sieve_binary_cache_entry_unref(&centry);
 		if ( error_r != NULL )
 			*error_r = SIEVE_ERROR_NOT_VALID;
 		return NULL;
@@ -928,9 +1152,16 @@ struct sieve_binary *sieve_binary_open
 				*error_r = SIEVE_ERROR_NOT_VALID;
 
 			sieve_binary_unref(&sbin);
+			if ( centry != NULL )
+				sieve_binary_cache_entry_unref(&centry);
 			return NULL;
 		}
 	}
 
+	if ( centry != NULL ) {
+		sieve_binary_cache_entry_set_binary(centry, sbin);
+		sieve_binary_cache_entry_unref(&centry);
+	}
+
 	return sbin;
 }
@@ -4,6 +4,8 @@
 #ifndef __SIEVE_BINARY_PRIVATE_H
 #define __SIEVE_BINARY_PRIVATE_H
 
+#include "hash.h"
+
 #include "sieve-common.h"
 #include "sieve-binary.h"
 #include "sieve-extensions.h"
@@ -27,6 +29,10 @@ struct sieve_binary_file {
 		(struct sieve_binary_file *file, off_t *offset, size_t size);
 	buffer_t *(*load_buffer)
 		(struct sieve_binary_file *file, off_t *offset, size_t size);
+	void (*close)(struct sieve_binary_file *file);
+
+	/* Buffers returned by load_buffer() point into the file's memory */
+	bool readonly_buffers:1;
 };
 
 bool sieve_binary_file_open
@@ -60,6 +66,16 @@ struct sieve_binary_extension_reg {
 	unsigned int block_id;
 };
 
+/* Decoded operation */
+
+struct sieve_binary_operation {
+	const struct sieve_operation_def *def;
+	const struct sieve_extension *ext;
+
+	/* Number of bytes taken by the operation code; 0 when not decoded yet */
+	uint8_t size;
+};
+
 /* Block */
 
 struct sieve_binary_block {
@@ -70,6 +86,23 @@ struct sieve_binary_block {
 	buffer_t *data;
 
 	uoff_t offset;
+
+	/* The data points into the loaded binary file and is copied before it is
+	 * first modified.
+	 */
+	bool readonly:1;
+
+	/* Operations of a loaded block, indexed by their address. The array is
+	 * allocated for the whole block when the first operation is read and each
+	 * entry is filled the first time the operation at that address is decoded.
+	 * Only the operation's execute() function knows where its operands end,
+	 * so the block cannot be decoded in advance.
+	 */
+	struct sieve_binary_operation *operations;
+	size_t operations_count;
+
+	/* Literal key lists compiled for matching, indexed by their address */
+	HASH_TABLE(void *, struct sieve_match_keyset *) keysets;
 };
 
 /*
@@ -108,6 +141,24 @@ struct sieve_binary {
 
 	/* Blocks */
 	ARRAY(struct sieve_binary_block *) blocks;
+
+	/* Header fields the script can access; read from the header names block
+	 * when first needed for a loaded binary.
+	 */
+	ARRAY_TYPE(const_string) header_names;
+	bool header_names_loaded:1;
+	bool any_header:1;
+
+	/* Digest the binary was stored under in the shared binary store; read
+	 * from the source digest block when first needed for a loaded binary.
+	 */
+	const char *source_digest;
+	bool source_digest_loaded:1;
+
+	/* Loaded from the shared binary store */
+	bool shared:1;
+	/* Handed out by the loaded binary cache */
+	bool cached:1;
 };
 
 struct sieve_binary *sieve_binary_create
@@ -138,12 +189,31 @@ static inline size_t _sieve_binary_block_get_size
 	return buffer_get_used_size(sblock->data);
 }
 
+static inline void _sieve_binary_block_caches_clear
+(struct sieve_binary_block *sblock)
+{
+	if ( sblock->operations != NULL ) {
+		i_free(sblock->operations);
+		sblock->operations_count = 0;
+	}
+	if ( hash_table_is_created(sblock->keysets) )
+		hash_table_clear(sblock->keysets, TRUE);
+}
+
 struct sieve_binary_block *sieve_binary_block_create_id
 	(struct sieve_binary *sbin, unsigned int id);
 
+void sieve_binary_block_make_writable
+	(struct sieve_binary_block *sblock);
+
 buffer_t *sieve_binary_block_get_buffer
 	(struct sieve_binary_block *sblock);
 
+/* Header names */
+
+void sieve_binary_header_names_write(struct sieve_binary *sbin);
+void sieve_binary_source_digest_write(struct sieve_binary *sbin);
+
 /* Extension registration */
 
 static inline struct sieve_binary_extension_reg *
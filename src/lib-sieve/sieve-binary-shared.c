@@ -0,0 +1,381 @@
+/* Copyright (c) 2002-2017 Pigeonhole authors, see the included COPYING file
+ */
+
+#include "lib.h"
+#include "str.h"
+#include "istream.h"
+#include "sha1.h"
+#include "hex-binary.h"
+#include "safe-mkstemp.h"
+#include "write-full.h"
+
+#include "sieve-common.h"
+#include "sieve-error.h"
+#include "sieve-extensions.h"
+#include "sieve-script-private.h"
+#include "sieve-storage-private.h"
+#include "sieve-settings.h"
+
+#include "sieve-binary-private.h"
+#include "sieve-binary-shared.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+/*
+ * Shared binary store
+ */
+
+/* Settings that are used while validating or generating code. A script may
+   compile differently, or not at all, when any of these differ, so their
+   values are part of the digest. Include scripts are never shared, so the
+   include settings are not listed here.
+ */
+static const char *const sieve_binary_shared_settings[] = {
+	"sieve_extensions",
+	"sieve_global_extensions",
+	"sieve_implicit_extensions",
+	"sieve_plugins",
+	"sieve_max_script_size",
+	"sieve_editheader_max_header_size",
+	"sieve_editheader_protected",
+	"sieve_editheader_forbid_add",
+	"sieve_editheader_forbid_delete",
+	"sieve_vacation_min_period",
+	"sieve_vacation_max_period",
+	"sieve_regex_engine",
+	NULL
+};
+
+static const char *sieve_binary_shared_hash_source
+(struct sieve_script *script)
+{
+	struct sieve_instance *svinst = sieve_script_svinst(script);
+	struct istream *input;
+	struct sha1_ctxt ctx;
+	unsigned char digest[SHA1_RESULTLEN];
+	const unsigned char *data;
+	size_t size;
+	ssize_t ret;
+
+	if ( sieve_script_get_stream(script, &input, NULL) < 0 )
+		return NULL;
+
+	sha1_init(&ctx);
+
+	i_stream_seek(input, 0);
+	while ( (ret=i_stream_read_more(input, &data, &size)) > 0 ) {
+		sha1_loop(&ctx, data, size);
+		i_stream_skip(input, size);
+	}
+	i_assert( ret == -1 );
+
+	if ( input->stream_errno != 0 ) {
+		sieve_sys_error(svinst,
+			"binary shared: failed to read script %s: %s",
+			sieve_script_location(script), i_stream_get_error(input));
+		return NULL;
+	}
+
+	/* The script is read once more when it is compiled */
+	i_stream_seek(input, 0);
+
+	sha1_result(&ctx, digest);
+	return binary_to_hex(digest, sizeof(digest));
+}
+
+/*
+ * Source reference
+ */
+
+/* Hashing the source means reading the whole script, so the digest of the
+   source is recorded next to the user's binaries along with the modification
+   time and size the script had. As long as those still match, the source is
+   not read again. Only file scripts have a modification time to check.
+ */
+
+static const char *sieve_binary_shared_reference_path
+(struct sieve_script *script, struct stat *st_r)
+{
+	const char *script_path, *prefix;
+
+	script_path = sieve_file_script_get_path(script);
+	prefix = sieve_script_binary_get_prefix(script);
+	if ( script_path == NULL || prefix == NULL )
+		return NULL;
+
+	if ( stat(script_path, st_r) < 0 )
+		return NULL;
+
+	return t_strconcat(prefix, ".svshared", NULL);
+}
+
+static const char *sieve_binary_shared_reference_key
+(const struct stat *st)
+{
+	return t_strdup_printf("%ld.%lu %llu ",
+		(long)st->st_mtime, (unsigned long)ST_MTIME_NSEC(*st),
+		(unsigned long long)st->st_size);
+}
+
+static const char *sieve_binary_shared_reference_read
+(struct sieve_script *script, const char *path, const struct stat *st)
+{
+	struct sieve_instance *svinst = sieve_script_svinst(script);
+	const char *key = sieve_binary_shared_reference_key(st);
+	size_t key_len = strlen(key);
+	char buf[128];
+	ssize_t ret;
+	int fd;
+
+	if ( (fd=open(path, O_RDONLY)) < 0 ) {
+		if ( errno != ENOENT ) {
+			sieve_sys_error(svinst,
+				"binary shared: open(%s) failed: %m", path);
+		}
+		return NULL;
+	}
+
+	ret = read(fd, buf, sizeof(buf) - 1);
+	if ( ret < 0 ) {
+		sieve_sys_error(svinst,
+			"binary shared: read(%s) failed: %m", path);
+	}
+	if ( close(fd) < 0 ) {
+		sieve_sys_error(svinst,
+			"binary shared: close(%s) failed: %m", path);
+	}
+
+	/* Key, followed by the hex digest and a newline */
+	if ( ret != (ssize_t)(key_len + SHA1_RESULTLEN * 2 + 1) ||
+		memcmp(buf, key, key_len) != 0 || buf[ret - 1] != '\n' ) {
+		if ( svinst->debug ) {
+			sieve_sys_debug(svinst,
+				"binary shared: source reference %s is outdated", path);
+		}
+		return NULL;
+	}
+
+	return t_strndup(buf + key_len, SHA1_RESULTLEN * 2);
+}
+
+static void sieve_binary_shared_reference_write
+(struct sieve_script *script, const char *path, const struct stat *st,
+	const char *source_digest)
+{
+	struct sieve_instance *svinst = sieve_script_svinst(script);
+	struct sieve_storage *storage = script->storage;
+	string_t *temp_path, *data;
+	int fd;
+
+	if ( storage->bin_dir != NULL &&
+		sieve_storage_setup_bindir(storage, 0700) < 0 )
+		return;
+
+	data = t_str_new(128);
+	str_append(data, sieve_binary_shared_reference_key(st));
+	str_append(data, source_digest);
+	str_append_c(data, '\n');
+
+	/* Replaced atomically, just like binaries */
+	temp_path = t_str_new(256);
+	str_append(temp_path, path);
+	str_append_c(temp_path, '.');
+	fd = safe_mkstemp_hostpid(temp_path, 0600, (uid_t)-1, (gid_t)-1);
+	if ( fd < 0 ) {
+		sieve_sys_error(svinst,
+			"binary shared: failed to create temporary file: "
+			"open(%s) failed: %m", str_c(temp_path));
+		return;
+	}
+
+	if ( write_full(fd, str_data(data), str_len(data)) < 0 ) {
+		sieve_sys_error(svinst,
+			"binary shared: write(%s) failed: %m", str_c(temp_path));
+		i_close_fd(&fd);
+	} else if ( close(fd) < 0 ) {
+		sieve_sys_error(svinst,
+			"binary shared: close(%s) failed: %m", str_c(temp_path));
+	} else if ( rename(str_c(temp_path), path) < 0 ) {
+		sieve_sys_error(svinst,
+			"binary shared: rename(%s, %s) failed: %m",
+			str_c(temp_path), path);
+	} else {
+		return;
+	}
+
+	if ( unlink(str_c(temp_path)) < 0 && errno != ENOENT ) {
+		sieve_sys_error(svinst,
+			"binary shared: unlink(%s) failed: %m", str_c(temp_path));
+	}
+}
+
+/*
+ * Shared binaries
+ */
+
+const char *sieve_binary_shared_get_digest
+(struct sieve_script *script, enum sieve_compile_flags cpflags)
+{
+	struct sieve_instance *svinst = sieve_script_svinst(script);
+	const char *const *setting;
+	const char *ref_path, *source_digest = NULL;
+	struct sha1_ctxt ctx;
+	unsigned char digest[SHA1_RESULTLEN];
+	struct stat st;
+	string_t *config;
+
+	if ( svinst->binary_shared_dir == NULL )
+		return NULL;
+
+	ref_path = sieve_binary_shared_reference_path(script, &st);
+	if ( ref_path != NULL ) {
+		source_digest =
+			sieve_binary_shared_reference_read(script, ref_path, &st);
+	}
+	if ( source_digest == NULL ) {
+		source_digest = sieve_binary_shared_hash_source(script);
+		if ( source_digest == NULL )
+			return NULL;
+		if ( ref_path != NULL ) {
+			sieve_binary_shared_reference_write
+				(script, ref_path, &st, source_digest);
+		}
+	}
+
+	/* Anything that changes the outcome of compiling the same source */
+	config = t_str_new(256);
+	str_printfa(config, "%d.%d:%x:%s",
+		SIEVE_BINARY_VERSION_MAJOR, SIEVE_BINARY_VERSION_MINOR,
+		(unsigned int)cpflags, sieve_extensions_get_string(svinst));
+	for ( setting = sieve_binary_shared_settings; *setting != NULL; setting++ ) {
+		const char *value = sieve_setting_get(svinst, *setting);
+
+		/* Unset and empty are not necessarily the same */
+		if ( value == NULL )
+			str_printfa(config, "\n%s!", *setting);
+		else
+			str_printfa(config, "\n%s=%s", *setting, value);
+	}
+	str_printfa(config, "\nsource=%s", source_digest);
+
+	sha1_init(&ctx);
+	sha1_loop(&ctx, str_data(config), str_len(config));
+	sha1_result(&ctx, digest);
+	return binary_to_hex(digest, sizeof(digest));
+}
+
+const char *sieve_binary_shared_get_path
+(struct sieve_instance *svinst, const char *digest)
+{
+	i_assert( svinst->binary_shared_dir != NULL );
+
+	return t_strconcat(svinst->binary_shared_dir, "/",
+		sieve_binfile_from_name(digest), NULL);
+}
+
+static bool sieve_binary_shared_check_stat
+(struct sieve_instance *svinst, const char *path, const struct stat *st)
+{
+	/* Only a binary that this user stored, and that nobody else could have
+	   modified since, can be trusted */
+	if ( st->st_uid != geteuid() ) {
+		sieve_sys_warning(svinst,
+			"binary shared: ignoring shared binary %s, "
+			"because it is owned by uid %lu rather than uid %lu", path,
+			(unsigned long)st->st_uid, (unsigned long)geteuid());
+		return FALSE;
+	}
+	if ( !S_ISREG(st->st_mode) || (st->st_mode & 0077) != 0 ) {
+		sieve_sys_warning(svinst,
+			"binary shared: ignoring shared binary %s, "
+			"because its mode is %04o rather than 0600 or stricter", path,
+			(unsigned int)(st->st_mode & 07777));
+		return FALSE;
+	}
+	return TRUE;
+}
+
+struct sieve_binary *sieve_binary_shared_open
+(struct sieve_script *script, const char *digest)
+{
+	struct sieve_instance *svinst = sieve_script_svinst(script);
+	const char *path = sieve_binary_shared_get_path(svinst, digest);
+	const char *bin_digest;
+	struct sieve_binary *sbin;
+	enum sieve_error error;
+	struct stat st;
+
+	/* Check before opening, so that a binary that cannot be read is not
+	   reported as an error */
+	if ( stat(path, &st) < 0 ) {
+		if ( errno != ENOENT ) {
+			sieve_sys_error(svinst,
+				"binary shared: stat(%s) failed: %m", path);
+		}
+		return NULL;
+	}
+	if ( !sieve_binary_shared_check_stat(svinst, path, &st) )
+		return NULL;
+
+	/* The name of the binary already ties it to the same source, so it is not
+	   checked against the script's metadata */
+	sbin = sieve_binary_open(svinst, path, script, &error);
+	if ( sbin == NULL ) {
+		if ( error != SIEVE_ERROR_NOT_FOUND && svinst->debug ) {
+			sieve_sys_debug(svinst,
+				"binary shared: failed to open shared binary %s", path);
+		}
+		return NULL;
+	}
+
+	/* The file may have been replaced after the first check */
+	if ( !sieve_binary_shared_check_stat
+		(svinst, path, sieve_binary_stat(sbin)) ) {
+		sieve_binary_unref(&sbin);
+		return NULL;
+	}
+
+	/* Make sure the name was not just given to another binary */
+	bin_digest = sieve_binary_get_source_digest(sbin);
+	if ( bin_digest == NULL || strcmp(bin_digest, digest) != 0 ) {
+		sieve_sys_warning(svinst,
+			"binary shared: ignoring shared binary %s, "
+			"because it was not stored for this script", path);
+		sieve_binary_unref(&sbin);
+		return NULL;
+	}
+
+	if ( !sieve_binary_is_self_contained(sbin) ) {
+		sieve_sys_warning(svinst,
+			"binary shared: ignoring shared binary %s, "
+			"because it depends on other scripts", path);
+		sieve_binary_unref(&sbin);
+		return NULL;
+	}
+
+	sbin->shared = TRUE;
+	return sbin;
+}
+
+int sieve_binary_shared_save
+(struct sieve_binary *sbin, const char *digest)
+{
+	const char *path = sieve_binary_shared_get_path(sbin->svinst, digest);
+
+	/* Binaries of scripts that include others are bound to the user */
+	if ( !sieve_binary_is_self_contained(sbin) )
+		return 0;
+
+	/* The digest is checked against the name of the binary when it is
+	   opened */
+	sieve_binary_set_source_digest(sbin, digest);
+
+	/* Saving writes a temporary file that is renamed into place, so
+	   concurrent processes saving the same binary do not interfere. Only
+	   processes running as the same user may use the binary. */
+	if ( sieve_binary_save(sbin, path, TRUE, 0600, NULL) < 0 )
+		return -1;
+	return 1;
+}
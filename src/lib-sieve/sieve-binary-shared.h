@@ -0,0 +1,36 @@
+/* Copyright (c) 2002-2017 Pigeonhole authors, see the included COPYING file
+ */
+
+#ifndef __SIEVE_BINARY_SHARED_H
+#define __SIEVE_BINARY_SHARED_H
+
+#include "sieve-common.h"
+
+/*
+ * Shared binary store
+ *
+ *   When the sieve_binary_shared_dir setting is configured, binaries of
+ *   scripts that depend on nothing but their own source are stored in that
+ *   directory under a digest of the source and the compile configuration.
+ *   Users with identical scripts then share a single binary, rather than each
+ *   compiling and storing their own. The digest is also recorded inside the
+ *   binary. The digest of a file script's source is recorded where the user's
+ *   own binary would be, so the script is only hashed again when it changes.
+ *   A shared binary is only used when it is owned by the user of the process
+ *   and not accessible by anyone else, so it is only shared between users
+ *   that are served by the same system user.
+ */
+
+/* Returns the digest the script's binary is stored under, or NULL when the
+   shared store is not configured or the script cannot be read */
+const char *sieve_binary_shared_get_digest
+	(struct sieve_script *script, enum sieve_compile_flags cpflags);
+const char *sieve_binary_shared_get_path
+	(struct sieve_instance *svinst, const char *digest);
+
+struct sieve_binary *sieve_binary_shared_open
+	(struct sieve_script *script, const char *digest);
+int sieve_binary_shared_save
+	(struct sieve_binary *sbin, const char *digest);
+
+#endif /* __SIEVE_BINARY_SHARED_H */
@@ -11,6 +11,8 @@
 #include "ostream.h"
 #include "eacces-error.h"
 #include "safe-mkstemp.h"
+#include "sha1.h"
+#include "hex-binary.h"
 
 #include "sieve-error.h"
 #include "sieve-extensions.h"
@@ -84,6 +86,10 @@ struct sieve_binary *sieve_binary_create_new(struct sieve_script *script)
 	sblock = sieve_binary_block_create(sbin);
 	sieve_script_binary_write_metadata(script, sblock);
 
+	/* Header names are collected by the generator */
+	sbin->header_names_loaded = TRUE;
+	sbin->source_digest_loaded = TRUE;
+
 	/* Create other system blocks */
 	for ( i = 1; i < SBIN_SYSBLOCK_LAST; i++ ) {
 		(void) sieve_binary_block_create(sbin);
@@ -112,6 +118,21 @@ static inline void sieve_binary_extensions_free(struct sieve_binary *sbin)
 	}
 }
 
+static inline void sieve_binary_blocks_free(struct sieve_binary *sbin)
+{
+	struct sieve_binary_block *const *blocks;
+	unsigned int count, i;
+
+	blocks = array_get(&sbin->blocks, &count);
+	for ( i = 0; i < count; i++ ) {
+		if ( blocks[i] == NULL )
+			continue;
+		i_free(blocks[i]->operations);
+		if ( hash_table_is_created(blocks[i]->keysets) )
+			hash_table_destroy(&blocks[i]->keysets);
+	}
+}
+
 void sieve_binary_unref(struct sieve_binary **sbin)
 {
 	i_assert((*sbin)->refcount > 0);
@@ -120,6 +141,7 @@ void sieve_binary_unref(struct sieve_binary **sbin)
 		return;
 
 	sieve_binary_extensions_free(*sbin);
+	sieve_binary_blocks_free(*sbin);
 
 	if ( (*sbin)->file != NULL )
 		sieve_binary_file_close(&(*sbin)->file);
@@ -146,6 +168,21 @@ struct sieve_script *sieve_binary_script(struct sieve_binary *sbin)
 	return sbin->script;
 }
 
+void sieve_binary_set_script
+(struct sieve_binary *sbin, struct sieve_script *script)
+{
+	i_assert( sbin->script == NULL ||
+		sieve_script_equals(sbin->script, script) );
+
+	if ( sbin->script == script )
+		return;
+
+	sieve_script_ref(script);
+	if ( sbin->script != NULL )
+		sieve_script_unref(&sbin->script);
+	sbin->script = script;
+}
+
 const char *sieve_binary_path(struct sieve_binary *sbin)
 {
 	return sbin->path;
@@ -161,6 +198,16 @@ bool sieve_binary_loaded(struct sieve_binary *sbin)
 	return ( sbin->file != NULL );
 }
 
+bool sieve_binary_shared(struct sieve_binary *sbin)
+{
+	return sbin->shared;
+}
+
+bool sieve_binary_cached(struct sieve_binary *sbin)
+{
+	return sbin->cached;
+}
+
 const char *sieve_binary_source(struct sieve_binary *sbin)
 {
 	if ( sbin->script != NULL && (sbin->path == NULL || sbin->file == NULL) )
@@ -207,6 +254,36 @@ const char *sieve_binfile_from_name(const char *name)
 	return t_strconcat(name, "."SIEVE_BINARY_FILEEXT, NULL);
 }
 
+const char *sieve_binary_get_digest(struct sieve_binary *sbin)
+{
+	struct sha1_ctxt ctx;
+	unsigned char digest[SHA1_RESULTLEN];
+	unsigned int count, id;
+
+	sha1_init(&ctx);
+
+	/* The script data and source digest blocks only describe where the
+	   binary came from */
+	count = sieve_binary_block_count(sbin);
+	for ( id = SBIN_SYSBLOCK_EXTENSIONS; id < count; id++ ) {
+		struct sieve_binary_block *sblock;
+		uint32_t hdr[2];
+
+		if ( id == SBIN_SYSBLOCK_SOURCE_DIGEST )
+			continue;
+		if ( (sblock=sieve_binary_block_get(sbin, id)) == NULL )
+			return NULL;
+
+		hdr[0] = id;
+		hdr[1] = sblock->data->used;
+		sha1_loop(&ctx, hdr, sizeof(hdr));
+		sha1_loop(&ctx, sblock->data->data, sblock->data->used);
+	}
+
+	sha1_result(&ctx, digest);
+	return binary_to_hex(digest, sizeof(digest));
+}
+
 /*
  * Block management
  */
@@ -278,9 +355,29 @@ struct sieve_binary_block *sieve_binary_block_get
 	return sblock;
 }
 
+void sieve_binary_block_make_writable
+(struct sieve_binary_block *sblock)
+{
+	buffer_t *data;
+
+	i_assert( sblock->readonly );
+
+	data = buffer_create_dynamic
+		(sblock->sbin->pool, I_MAX(sblock->data->used, 64));
+	buffer_append_buf(data, sblock->data, 0, (size_t)-1);
+	sblock->data = data;
+	sblock->readonly = FALSE;
+}
+
 void sieve_binary_block_clear
 (struct sieve_binary_block *sblock)
 {
+	_sieve_binary_block_caches_clear(sblock);
+	if ( sblock->readonly ) {
+		sblock->data = buffer_create_dynamic(sblock->sbin->pool, 64);
+		sblock->readonly = FALSE;
+		return;
+	}
 	buffer_set_used_size(sblock->data, 0);
 }
 
@@ -361,6 +458,24 @@ bool sieve_binary_up_to_date
 	return TRUE;
 }
 
+bool sieve_binary_is_self_contained(struct sieve_binary *sbin)
+{
+	struct sieve_binary_extension_reg *const *regs;
+	unsigned int ext_count, i;
+
+	/* Extensions that need to verify whether the binary is up-to-date depend
+	   on something other than the script itself */
+	regs = array_get(&sbin->extensions, &ext_count);
+	for ( i = 0; i < ext_count; i++ ) {
+		const struct sieve_binary_extension *binext = regs[i]->binext;
+
+		if ( binext != NULL && binext->binary_up_to_date != NULL )
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
 /*
  * Activate the binary (after code generation)
  */
@@ -487,3 +602,156 @@ int sieve_binary_extensions_count(struct sieve_binary *sbin)
 {
 	return (int) array_count(&sbin->extensions);
 }
+
+/*
+ * Header names
+ */
+
+void sieve_binary_add_header_name
+(struct sieve_binary *sbin, const char *name)
+{
+	const char *const *hdrp;
+
+	if ( !array_is_created(&sbin->header_names) )
+		p_array_init(&sbin->header_names, sbin->pool, 8);
+
+	array_foreach(&sbin->header_names, hdrp) {
+		if ( strcasecmp(*hdrp, name) == 0 )
+			return;
+	}
+
+	name = p_strdup(sbin->pool, name);
+	array_append(&sbin->header_names, &name, 1);
+}
+
+void sieve_binary_add_any_header(struct sieve_binary *sbin)
+{
+	sbin->any_header = TRUE;
+}
+
+static bool sieve_binary_header_names_read(struct sieve_binary *sbin)
+{
+	struct sieve_binary_block *sblock;
+	sieve_size_t offset = 0;
+	unsigned int any, count, i;
+	bool result = TRUE;
+
+	sblock = sieve_binary_block_get(sbin, SBIN_SYSBLOCK_HEADER_NAMES);
+	if ( sblock == NULL ||
+		!sieve_binary_read_unsigned(sblock, &offset, &any) ||
+		!sieve_binary_read_unsigned(sblock, &offset, &count) )
+		return FALSE;
+
+	if ( any > 0 )
+		sbin->any_header = TRUE;
+
+	for ( i = 0; result && i < count; i++ ) {
+		T_BEGIN {
+			string_t *name;
+
+			if ( sieve_binary_read_string(sblock, &offset, &name) )
+				sieve_binary_add_header_name(sbin, str_c(name));
+			else
+				result = FALSE;
+		} T_END;
+	}
+
+	return result;
+}
+
+bool sieve_binary_get_header_names
+(struct sieve_binary *sbin, const char *const **names_r,
+	unsigned int *count_r)
+{
+	if ( !sbin->header_names_loaded ) {
+		sbin->header_names_loaded = TRUE;
+
+		if ( sbin->file != NULL && !sieve_binary_header_names_read(sbin) ) {
+			sieve_sys_error(sbin->svinst,
+				"binary %s is corrupt: failed to read header names block",
+				sbin->path);
+			sbin->any_header = TRUE;
+		}
+	}
+
+	*names_r = NULL;
+	*count_r = 0;
+
+	if ( sbin->any_header )
+		return FALSE;
+
+	if ( array_is_created(&sbin->header_names) )
+		*names_r = array_get(&sbin->header_names, count_r);
+	return TRUE;
+}
+
+void sieve_binary_header_names_write(struct sieve_binary *sbin)
+{
+	struct sieve_binary_block *sblock;
+	const char *const *names;
+	unsigned int count, i;
+
+	/* For a loaded binary, this reads the block before it is rewritten */
+	(void)sieve_binary_get_header_names(sbin, &names, &count);
+
+	sblock = sieve_binary_block_get(sbin, SBIN_SYSBLOCK_HEADER_NAMES);
+	i_assert( sblock != NULL );
+	sieve_binary_block_clear(sblock);
+
+	sieve_binary_emit_unsigned(sblock, ( sbin->any_header ? 1 : 0 ));
+	sieve_binary_emit_unsigned(sblock, count);
+	for ( i = 0; i < count; i++ )
+		sieve_binary_emit_cstring(sblock, names[i]);
+}
+
+/*
+ * Source digest
+ */
+
+void sieve_binary_set_source_digest
+(struct sieve_binary *sbin, const char *digest)
+{
+	sbin->source_digest = p_strdup_empty(sbin->pool, digest);
+	sbin->source_digest_loaded = TRUE;
+}
+
+const char *sieve_binary_get_source_digest(struct sieve_binary *sbin)
+{
+	struct sieve_binary_block *sblock;
+	sieve_size_t offset = 0;
+	string_t *digest;
+
+	if ( sbin->source_digest_loaded )
+		return sbin->source_digest;
+	sbin->source_digest_loaded = TRUE;
+
+	if ( sbin->file == NULL )
+		return NULL;
+
+	sblock = sieve_binary_block_get(sbin, SBIN_SYSBLOCK_SOURCE_DIGEST);
+	if ( sblock == NULL ||
+		!sieve_binary_read_string(sblock, &offset, &digest) ) {
+		sieve_sys_error(sbin->svinst,
+			"binary %s is corrupt: failed to read source digest block",
+			sbin->path);
+		return NULL;
+	}
+
+	sbin->source_digest = p_strdup_empty(sbin->pool, str_c(digest));
+	return sbin->source_digest;
+}
+
+void sieve_binary_source_digest_write(struct sieve_binary *sbin)
+{
+	struct sieve_binary_block *sblock;
+	const char *digest;
+
+	/* For a loaded binary, this reads the block before it is rewritten */
+	digest = sieve_binary_get_source_digest(sbin);
+
+	sblock = sieve_binary_block_get(sbin, SBIN_SYSBLOCK_SOURCE_DIGEST);
+	i_assert( sblock != NULL );
+	sieve_binary_block_clear(sblock);
+
+	sieve_binary_emit_cstring(sblock, ( digest == NULL ? "" : digest ));
+}
@@ -13,7 +13,7 @@
  */
 
 #define SIEVE_BINARY_VERSION_MAJOR     1
-#define SIEVE_BINARY_VERSION_MINOR     4
+#define SIEVE_BINARY_VERSION_MINOR     6
 
 /*
  * Binary object
@@ -33,6 +33,8 @@ pool_t sieve_binary_pool(struct sieve_binary *sbin);
 struct sieve_instance *sieve_binary_svinst(struct sieve_binary *sbin);
 const char *sieve_binary_path(struct sieve_binary *sbin);
 struct sieve_script *sieve_binary_script(struct sieve_binary *sbin);
+void sieve_binary_set_script
+	(struct sieve_binary *sbin, struct sieve_script *script);
 
 time_t sieve_binary_mtime(struct sieve_binary *sbin);
 const struct stat *sieve_binary_stat
@@ -44,6 +46,8 @@ const char *sieve_binary_script_location(struct sieve_binary *sbin);
 const char *sieve_binary_source(struct sieve_binary *sbin);
 bool sieve_binary_loaded(struct sieve_binary *sbin);
 bool sieve_binary_saved(struct sieve_binary *sbin);
+bool sieve_binary_shared(struct sieve_binary *sbin);
+bool sieve_binary_cached(struct sieve_binary *sbin);
 
 /*
  * Utility
@@ -51,6 +55,10 @@ bool sieve_binary_saved(struct sieve_binary *sbin);
 
 const char *sieve_binfile_from_name(const char *name);
 
+/* Returns a hex SHA1 digest of the compiled code, or NULL when the binary
+   cannot be read */
+const char *sieve_binary_get_digest(struct sieve_binary *sbin);
+
 /*
  * Activation after code generation
  */
@@ -74,6 +82,15 @@ struct sieve_binary *sieve_binary_open
 		struct sieve_script *script, enum sieve_error *error_r);
 bool sieve_binary_up_to_date
 	(struct sieve_binary *sbin, enum sieve_compile_flags cpflags);
+/* Returns FALSE when the binary depends on more than its own script source,
+   e.g. on included scripts */
+bool sieve_binary_is_self_contained(struct sieve_binary *sbin);
+
+/* Digest of the script source and compile configuration that the binary was
+   stored under in the shared binary store, or NULL for other binaries */
+void sieve_binary_set_source_digest
+	(struct sieve_binary *sbin, const char *digest);
+const char *sieve_binary_get_source_digest(struct sieve_binary *sbin);
 
 /*
  * Block management
@@ -83,6 +100,8 @@ enum sieve_binary_system_block {
 	SBIN_SYSBLOCK_SCRIPT_DATA,
 	SBIN_SYSBLOCK_EXTENSIONS,
 	SBIN_SYSBLOCK_MAIN_PROGRAM,
+	SBIN_SYSBLOCK_HEADER_NAMES,
+	SBIN_SYSBLOCK_SOURCE_DIGEST,
 	SBIN_SYSBLOCK_LAST
 };
 
@@ -155,6 +174,21 @@ int sieve_binary_extension_get_index
 	(struct sieve_binary *sbin, const struct sieve_extension *ext);
 int sieve_binary_extensions_count(struct sieve_binary *sbin);
 
+/*
+ * Header names
+ */
+
+/* Registers a header field the script can access; the generator calls
+   sieve_binary_add_any_header() when a header name is only known at runtime.
+ */
+void sieve_binary_add_header_name
+	(struct sieve_binary *sbin, const char *name);
+void sieve_binary_add_any_header(struct sieve_binary *sbin);
+
+/* Returns FALSE when the script can access any header field */
+bool sieve_binary_get_header_names
+	(struct sieve_binary *sbin, const char *const **names_r,
+		unsigned int *count_r);
 
 /*
  * Code emission
@@ -174,6 +208,9 @@ void sieve_binary_update_data
 
 sieve_size_t sieve_binary_emit_offset
 	(struct sieve_binary_block *sblock, sieve_offset_t offset);
+void sieve_binary_update_offset
+	(struct sieve_binary_block *sblock, sieve_size_t address,
+		sieve_offset_t offset);
 void sieve_binary_resolve_offset
 	(struct sieve_binary_block *sblock, sieve_size_t address);
 
@@ -247,6 +284,25 @@ const void *sieve_binary_read_extension_object
 	(struct sieve_binary_block *sblock, sieve_size_t *address,
     const struct sieve_extension_objects *objs);
 
+/* Decoded operations */
+
+bool sieve_binary_read_decoded_operation
+	(struct sieve_binary_block *sblock, sieve_size_t *address,
+		struct sieve_operation *oprtn);
+void sieve_binary_add_decoded_operation
+	(struct sieve_binary_block *sblock, const struct sieve_operation *oprtn,
+		sieve_size_t end_address);
+
+/* Match key sets */
+
+struct sieve_match_keyset;
+
+struct sieve_match_keyset *sieve_binary_get_match_keyset
+	(struct sieve_binary_block *sblock, sieve_size_t address);
+void sieve_binary_add_match_keyset
+	(struct sieve_binary_block *sblock, sieve_size_t address,
+		struct sieve_match_keyset *kset);
+
 /*
  * Debug info
  */
@@ -115,6 +115,23 @@ static int sieve_code_stringlist_get_length
 	return strlist->length;
 }
 
+/* Code stringlist inspection */
+
+bool sieve_code_stringlist_get_address
+(struct sieve_stringlist *_strlist, sieve_size_t *address_r,
+	unsigned int *length_r)
+{
+	struct sieve_code_stringlist *strlist;
+
+	if ( _strlist->next_item != sieve_code_stringlist_next_item )
+		return FALSE;
+
+	strlist = (struct sieve_code_stringlist *) _strlist;
+	*address_r = strlist->start_address;
+	*length_r = (unsigned int) strlist->length;
+	return TRUE;
+}
+
 static bool sieve_code_stringlist_dump
 (const struct sieve_dumptime_env *denv, sieve_size_t *address,
 	unsigned int length, sieve_size_t end, const char *field_name)
@@ -999,34 +1016,27 @@ static int opr_catenated_string_read
 static bool opc_jmp_dump
 	(const struct sieve_dumptime_env *denv, sieve_size_t *address);
 
-static int opc_jmp_execute
-	(const struct sieve_runtime_env *renv, sieve_size_t *address);
-static int opc_jmptrue_execute
-	(const struct sieve_runtime_env *renv, sieve_size_t *address);
-static int opc_jmpfalse_execute
-	(const struct sieve_runtime_env *renv, sieve_size_t *address);
-
 /* Operation objects defined in this file */
 
 const struct sieve_operation_def sieve_jmp_operation = {
 	.mnemonic = "JMP",
 	.code = SIEVE_OPERATION_JMP,
 	.dump = opc_jmp_dump,
-	.execute = opc_jmp_execute
+	.execute = sieve_jmp_operation_execute
 };
 
 const struct sieve_operation_def sieve_jmptrue_operation = {
 	.mnemonic = "JMPTRUE",
 	.code = SIEVE_OPERATION_JMPTRUE,
 	.dump = opc_jmp_dump,
-	.execute = opc_jmptrue_execute
+	.execute = sieve_jmptrue_operation_execute
 };
 
 const struct sieve_operation_def sieve_jmpfalse_operation = {
 	.mnemonic = "JMPFALSE",
 	.code = SIEVE_OPERATION_JMPFALSE,
 	.dump = opc_jmp_dump,
-	.execute = opc_jmpfalse_execute
+	.execute = sieve_jmpfalse_operation_execute
 };
 
 /* Operation objects defined in other files */
@@ -1094,6 +1104,10 @@ bool sieve_operation_read
 {
 	unsigned int code = sieve_operation_count;
 
+	/* Operations decoded before are looked up by their address */
+	if ( sieve_binary_read_decoded_operation(sblock, address, oprtn) )
+		return TRUE;
+
 	oprtn->address = *address;
 	oprtn->def = NULL;
 	oprtn->ext = NULL;
@@ -1105,15 +1119,17 @@ bool sieve_operation_read
 		if ( code < sieve_operation_count ) {
 			oprtn->def = sieve_operations[code];
 		}
-
-		return ( oprtn->def != NULL );
+	} else {
+		oprtn->def = (const struct sieve_operation_def *)
+			sieve_binary_read_extension_object(sblock, address,
+				&oprtn->ext->def->operations);
 	}
 
-	oprtn->def = (const struct sieve_operation_def *)
-		sieve_binary_read_extension_object(sblock, address,
-			&oprtn->ext->def->operations);
+	if ( oprtn->def == NULL )
+		return FALSE;
 
-	return ( oprtn->def != NULL );
+	sieve_binary_add_decoded_operation(sblock, oprtn, *address);
+	return TRUE;
 }
 
 /*
@@ -1140,13 +1156,13 @@ static bool opc_jmp_dump
 
 /* Code execution */
 
-static int opc_jmp_execute
+int sieve_jmp_operation_execute
 (const struct sieve_runtime_env *renv, sieve_size_t *address ATTR_UNUSED)
 {
 	return sieve_interpreter_program_jump(renv->interp, TRUE, FALSE);
 }
 
-static int opc_jmptrue_execute
+int sieve_jmptrue_operation_execute
 (const struct sieve_runtime_env *renv, sieve_size_t *address ATTR_UNUSED)
 {
 	bool result = sieve_interpreter_get_test_result(renv->interp);
@@ -1157,7 +1173,7 @@ static int opc_jmptrue_execute
 	return sieve_interpreter_program_jump(renv->interp, result, FALSE);
 }
 
-static int opc_jmpfalse_execute
+int sieve_jmpfalse_operation_execute
 (const struct sieve_runtime_env *renv, sieve_size_t *address ATTR_UNUSED)
 {
 	bool result = sieve_interpreter_get_test_result(renv->interp);
@@ -266,6 +266,12 @@ int sieve_opr_stringlist_read_ex
 	(const struct sieve_runtime_env *renv, sieve_size_t *address,
 		const char *field_name, bool optional, struct sieve_stringlist **strlist_r);
 
+/* Yields the address and length of the list items if the stringlist is read
+   directly from the binary */
+bool sieve_code_stringlist_get_address
+	(struct sieve_stringlist *strlist, sieve_size_t *address_r,
+		unsigned int *length_r);
+
 static inline bool sieve_operand_is_stringlist
 (const struct sieve_operand *operand)
 {
@@ -351,4 +357,33 @@ extern const struct sieve_operation_def sieve_jmpfalse_operation;
 extern const struct sieve_operation_def *sieve_operations[];
 extern const unsigned int sieve_operations_count;
 
+/* Execution functions; these are called directly by the threaded interpreter
+ * loop, rather than through the operation objects.
+ */
+
+int sieve_jmp_operation_execute
+	(const struct sieve_runtime_env *renv, sieve_size_t *address);
+int sieve_jmptrue_operation_execute
+	(const struct sieve_runtime_env *renv, sieve_size_t *address);
+int sieve_jmpfalse_operation_execute
+	(const struct sieve_runtime_env *renv, sieve_size_t *address);
+
+int cmd_stop_operation_execute
+	(const struct sieve_runtime_env *renv, sieve_size_t *address);
+int cmd_keep_operation_execute
+	(const struct sieve_runtime_env *renv, sieve_size_t *address);
+int cmd_discard_operation_execute
+	(const struct sieve_runtime_env *renv, sieve_size_t *address);
+int cmd_redirect_operation_execute
+	(const struct sieve_runtime_env *renv, sieve_size_t *address);
+
+int tst_address_operation_execute
+	(const struct sieve_runtime_env *renv, sieve_size_t *address);
+int tst_header_operation_execute
+	(const struct sieve_runtime_env *renv, sieve_size_t *address);
+int tst_exists_operation_execute
+	(const struct sieve_runtime_env *renv, sieve_size_t *address);
+int tst_size_operation_execute
+	(const struct sieve_runtime_env *renv, sieve_size_t *address);
+
 #endif
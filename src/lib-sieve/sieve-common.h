@@ -201,11 +201,27 @@ struct sieve_instance {
 	size_t max_script_size;
 	unsigned int max_actions;
 	unsigned int max_redirects;
+	size_t body_max_scan_size;
 	const struct sieve_address *user_email;
 	struct sieve_address_source redirect_from;
 	unsigned int redirect_duplicate_period;
+	bool threaded_interpreter;
+	unsigned int binary_cache_size;
+	const char *binary_shared_dir;
+	bool storage_generation;
+	bool binary_mmap;
+
+	/* Execution profile; NULL unless enabled */
+	struct sieve_profile *profile;
 };
 
+/*
+ * Profiling
+ */
+
+/* Monotonic clock for struct sieve_profile */
+long long sieve_profile_usecs(void);
+
 /*
  * Script trace log
  */
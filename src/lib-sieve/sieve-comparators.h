@@ -56,6 +56,15 @@ struct sieve_comparator_def {
 		const char **key, const char *key_end);
 	bool (*char_skip)(const struct sieve_comparator *cmp,
 		const char **val, const char *val_end);
+
+	/* Normalization */
+
+	/* Appends the normalized form of the value to result. Normalized values
+	 * compare and match like the originals do, but using the i;octet
+	 * comparator. Returns FALSE when the value cannot be normalized.
+	 */
+	bool (*normalize)(const struct sieve_comparator *cmp,
+		const char *val, size_t val_size, string_t *result);
 };
 
 /*
@@ -297,6 +297,14 @@ void sieve_extensions_deinit(struct sieve_instance *svinst)
 	sieve_capability_registry_deinit(svinst);
 }
 
+extern void ext_regex_cache_deinit(void);
+
+void sieve_extensions_process_deinit(void)
+{
+	/* Process-wide state of the builtin extensions */
+	ext_regex_cache_deinit();
+}
+
 /*
  * Pre-loaded extensions
  */
@@ -117,6 +117,7 @@ struct sieve_extension {
 bool sieve_extensions_init(struct sieve_instance *svinst);
 void sieve_extensions_configure(struct sieve_instance *svinst);
 void sieve_extensions_deinit(struct sieve_instance *svinst);
+void sieve_extensions_process_deinit(void);
 
 /*
  * Pre-loaded extensions
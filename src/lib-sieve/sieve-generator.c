@@ -62,6 +62,13 @@ void sieve_jumplist_resolve(struct sieve_jumplist *jlist)
  * Code Generator
  */
 
+struct sieve_generator_jump {
+	const struct sieve_operation_def *op_def;
+
+	sieve_size_t op_address;
+	sieve_size_t offset_address;
+};
+
 struct sieve_generator {
 	pool_t pool;
 
@@ -72,6 +79,9 @@ struct sieve_generator {
 	struct sieve_codegen_env genenv;
 	struct sieve_binary_debug_writer *dwriter;
 
+	/* All core jump operations emitted so far, in order of address */
+	ARRAY(struct sieve_generator_jump) jumps;
+
 	ARRAY(void *) ext_contexts;
 };
 
@@ -105,6 +115,8 @@ struct sieve_generator *sieve_generator_create
 	/* Setup storage for extension contexts */
 	p_array_init(&gentr->ext_contexts, pool, sieve_extensions_get_count(svinst));
 
+	p_array_init(&gentr->jumps, pool, 16);
+
 	return gentr;
 }
 
@@ -361,6 +373,63 @@ bool sieve_generate_argument_parameters
 	return TRUE;
 }
 
+sieve_size_t sieve_generate_jump
+(const struct sieve_codegen_env *cgenv,
+	const struct sieve_operation_def *jmp_op)
+{
+	struct sieve_generator *gentr = cgenv->gentr;
+	struct sieve_generator_jump *jump;
+
+	i_assert( jmp_op == &sieve_jmp_operation ||
+		jmp_op == &sieve_jmptrue_operation ||
+		jmp_op == &sieve_jmpfalse_operation );
+
+	jump = array_append_space(&gentr->jumps);
+	jump->op_def = jmp_op;
+	jump->op_address = sieve_operation_emit(cgenv->sblock, NULL, jmp_op);
+	jump->offset_address = sieve_binary_emit_offset(cgenv->sblock, 0);
+
+	return jump->offset_address;
+}
+
+static void sieve_generate_header_name
+(const struct sieve_codegen_env *cgenv, struct sieve_ast_argument *arg)
+{
+	/* Names involving variable substitutions are only known at runtime */
+	if ( arg->argument == NULL || !sieve_argument_is_string_literal(arg) ) {
+		sieve_binary_add_any_header(cgenv->sbin);
+		return;
+	}
+
+	sieve_binary_add_header_name(cgenv->sbin, sieve_ast_argument_strc(arg));
+}
+
+void sieve_generate_header_names
+(const struct sieve_codegen_env *cgenv, struct sieve_ast_argument *arg)
+{
+	struct sieve_ast_argument *stritem;
+
+	if ( arg == NULL ) {
+		sieve_binary_add_any_header(cgenv->sbin);
+		return;
+	}
+
+	switch ( sieve_ast_argument_type(arg) ) {
+	case SAAT_STRING:
+		sieve_generate_header_name(cgenv, arg);
+		break;
+	case SAAT_STRING_LIST:
+		stritem = sieve_ast_strlist_first(arg);
+		while ( stritem != NULL ) {
+			sieve_generate_header_name(cgenv, stritem);
+			stritem = sieve_ast_strlist_next(stritem);
+		}
+		break;
+	default:
+		sieve_binary_add_any_header(cgenv->sbin);
+	}
+}
+
 bool sieve_generate_test
 (const struct sieve_codegen_env *cgenv, struct sieve_ast_node *tst_node,
 	struct sieve_jumplist *jlist, bool jump_true)
@@ -387,11 +456,13 @@ bool sieve_generate_test
 
 		if ( tst_def->generate(cgenv, test) ) {
 
-			if ( jump_true )
-				sieve_operation_emit(cgenv->sblock, NULL, &sieve_jmptrue_operation);
-			else
-				sieve_operation_emit(cgenv->sblock, NULL, &sieve_jmpfalse_operation);
-			sieve_jumplist_add(jlist, sieve_binary_emit_offset(cgenv->sblock, 0));
+			if ( jump_true ) {
+				sieve_jumplist_add(jlist,
+					sieve_generate_jump(cgenv, &sieve_jmptrue_operation));
+			} else {
+				sieve_jumplist_add(jlist,
+					sieve_generate_jump(cgenv, &sieve_jmpfalse_operation));
+			}
 
 			return TRUE;
 		}
@@ -422,9 +493,22 @@ static bool sieve_generate_command
 	return TRUE;
 }
 
+static bool sieve_generate_block_exits
+(struct sieve_ast_node *block, struct sieve_ast_node *cmd_node)
+{
+	struct sieve_command *command = cmd_node->command;
+
+	if ( sieve_command_is(command, cmd_stop) )
+		return TRUE;
+
+	return ( block->command != NULL &&
+		block->command->block_exit_command == command );
+}
+
 bool sieve_generate_block
 (const struct sieve_codegen_env *cgenv, struct sieve_ast_node *block)
 {
+	bool optimize = ( (cgenv->flags & SIEVE_COMPILE_FLAG_OPTIMIZE) != 0 );
 	bool result = TRUE;
 	struct sieve_ast_node *cmd_node;
 
@@ -432,6 +516,13 @@ bool sieve_generate_block
 		cmd_node = sieve_ast_command_first(block);
 		while ( result && cmd_node != NULL ) {
 			result = sieve_generate_command(cgenv, cmd_node);
+
+			/* Commands following an unconditional exit from this block are
+			 * never executed; skip them when optimizing.
+			 */
+			if ( optimize && sieve_generate_block_exits(block, cmd_node) )
+				break;
+
 			cmd_node = sieve_ast_command_next(cmd_node);
 		}
 	} T_END;
@@ -439,6 +530,84 @@ bool sieve_generate_block
 	return result;
 }
 
+/*
+ * Jump threading
+ */
+
+static const struct sieve_generator_jump *sieve_generator_jump_at
+(struct sieve_generator *gentr, sieve_size_t address)
+{
+	const struct sieve_generator_jump *jumps;
+	unsigned int count, left, right, idx;
+
+	/* Jumps are recorded in order of address */
+	jumps = array_get(&gentr->jumps, &count);
+	left = 0; right = count;
+	while ( left < right ) {
+		idx = (left + right) / 2;
+
+		if ( jumps[idx].op_address < address )
+			left = idx + 1;
+		else if ( jumps[idx].op_address > address )
+			right = idx;
+		else
+			return &jumps[idx];
+	}
+	return NULL;
+}
+
+static sieve_size_t sieve_generator_jump_target
+(struct sieve_binary_block *sblock, const struct sieve_generator_jump *jump)
+{
+	sieve_size_t address = jump->offset_address;
+	sieve_offset_t offset = 0;
+
+	if ( !sieve_binary_read_offset(sblock, &address, &offset) )
+		i_unreached();
+	return jump->offset_address + offset;
+}
+
+/* Redirect jumps that land on another jump operation straight to the final
+ * destination. This is performed backwards, so that the jumps further on in
+ * the code are already threaded when they are encountered as a target.
+ */
+static void sieve_generator_thread_jumps(struct sieve_generator *gentr)
+{
+	struct sieve_binary_block *sblock = gentr->genenv.sblock;
+	const struct sieve_generator_jump *jumps;
+	unsigned int count, i, hops;
+
+	jumps = array_get(&gentr->jumps, &count);
+	for ( i = count; i > 0; i-- ) {
+		const struct sieve_generator_jump *jump = &jumps[i-1], *next;
+		sieve_size_t target, new_target;
+
+		target = new_target = sieve_generator_jump_target(sblock, jump);
+		for ( hops = 0; hops < count; hops++ ) {
+			next = sieve_generator_jump_at(gentr, new_target);
+			if ( next == NULL || next == jump )
+				break;
+
+			if ( next->op_def == &sieve_jmp_operation ||
+				next->op_def == jump->op_def ) {
+				/* The next jump is always taken */
+				new_target = sieve_generator_jump_target(sblock, next);
+			} else if ( jump->op_def != &sieve_jmp_operation ) {
+				/* The next jump is a conditional jump with the opposite
+				   condition, so it is never taken */
+				new_target = next->offset_address + sizeof(sieve_offset_t);
+			} else {
+				break;
+			}
+		}
+
+		if ( new_target != target ) {
+			sieve_binary_update_offset(sblock, jump->offset_address,
+				new_target - jump->offset_address);
+		}
+	}
+}
+
 struct sieve_binary *sieve_generator_run
 (struct sieve_generator *gentr, struct sieve_binary_block **sblock_r)
 {
@@ -499,10 +668,14 @@ struct sieve_binary *sieve_generator_run
 
 	if ( result ) {
 		if ( !sieve_generate_block
-			(&gentr->genenv, sieve_ast_root(gentr->genenv.ast)))
+			(&gentr->genenv, sieve_ast_root(gentr->genenv.ast))) {
 			result = FALSE;
-		else if ( topmost )
-			sieve_binary_activate(sbin);
+		} else {
+			if ( (gentr->genenv.flags & SIEVE_COMPILE_FLAG_OPTIMIZE) != 0 )
+				sieve_generator_thread_jumps(gentr);
+			if ( topmost )
+				sieve_binary_activate(sbin);
+		}
 	}
 
 	/* Cleanup */
@@ -102,6 +102,15 @@ bool sieve_generate_argument_parameters
 	(const struct sieve_codegen_env *cgenv, struct sieve_command *cmd,
 		struct sieve_ast_argument *arg);
 
+sieve_size_t sieve_generate_jump
+	(const struct sieve_codegen_env *cgenv,
+		const struct sieve_operation_def *jmp_op);
+
+/* Records the header fields named by a header name argument in the binary. A
+   NULL argument indicates that any header field can be accessed. */
+void sieve_generate_header_names
+	(const struct sieve_codegen_env *cgenv, struct sieve_ast_argument *arg);
+
 bool sieve_generate_block
 	(const struct sieve_codegen_env *cgenv, struct sieve_ast_node *block);
 bool sieve_generate_test
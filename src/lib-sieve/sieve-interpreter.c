@@ -348,6 +348,12 @@ void sieve_interpreter_set_result
 	sieve_result_ref(result);
 }
 
+const struct sieve_runtime_env *sieve_interpreter_get_runtime_env
+(struct sieve_interpreter *interp)
+{
+	return &interp->runenv;
+}
+
 /*
  * Error handling
  */
@@ -924,6 +930,219 @@ static int sieve_interpreter_operation_execute
 	return SIEVE_EXEC_BIN_CORRUPT;
 }
 
+/*
+ * Threaded code loop
+ */
+
+/* The threaded code loop is an alternative to the classic execution loop
+   implemented in sieve_interpreter_continue() below. Each core operation has
+   its own handler, which calls the operation's execute function directly and
+   then dispatches the next operation by itself using computed gotos, when
+   the compiler supports that. Only extension operations are executed through
+   their operation objects.
+
+   Rather than allocating a data stack frame for each operation, straight-line
+   code shares a single frame. The frame is released after each jump and after
+   SIEVE_INTERPRETER_FRAME_OPERATIONS operations, so that loops and long runs
+   of operations cannot accumulate data stack memory.
+ */
+
+#if defined(__GNUC__) && !defined(SIEVE_INTERPRETER_NO_COMPUTED_GOTO)
+#  define SIEVE_INTERPRETER_COMPUTED_GOTO
+#endif
+
+#define SIEVE_INTERPRETER_FRAME_OPERATIONS 16
+
+/* The handler is selected by the core operation code; code 0 is invalid in
+   the binary and used here to end execution. */
+#define SIEVE_DISPATCH_END SIEVE_OPERATION_INVALID
+#define SIEVE_DISPATCH_EXTENSION SIEVE_OPERATION_CUSTOM
+
+static inline enum sieve_operation_code
+sieve_interpreter_fetch(struct sieve_interpreter *interp,
+	sieve_size_t code_size, int *ret_r)
+{
+	const struct sieve_runtime_env *renv = &interp->runenv;
+	struct sieve_operation *oprtn = &(interp->oprtn);
+	sieve_size_t *address = &(interp->runenv.pc);
+
+	if ( interp->interrupted || *address >= code_size )
+		return SIEVE_DISPATCH_END;
+
+	if ( interp->loop_limit != 0 && *address > interp->loop_limit ) {
+		sieve_runtime_trace_error(renv,
+			"program crossed loop boundary");
+		*ret_r = SIEVE_EXEC_BIN_CORRUPT;
+		return SIEVE_DISPATCH_END;
+	}
+
+	sieve_runtime_trace_toplevel(renv);
+
+	/* Read the operation */
+	if ( !sieve_operation_read(renv->sblock, address, oprtn) ) {
+		/* Binary corrupt */
+		sieve_runtime_trace_error(renv, "Encountered invalid operation");
+		*ret_r = SIEVE_EXEC_BIN_CORRUPT;
+		return SIEVE_DISPATCH_END;
+	}
+
+	/* Reset cached command location */
+	interp->command_line = 0;
+
+	if ( oprtn->ext != NULL )
+		return SIEVE_DISPATCH_EXTENSION;
+	return (enum sieve_operation_code) oprtn->def->code;
+}
+
+/* Executes operations within the current data stack frame. Returns TRUE when
+   execution ended and FALSE when the frame needs to be released first. */
+static bool sieve_interpreter_run_threaded
+(struct sieve_interpreter *interp, int *ret_r)
+{
+	const struct sieve_runtime_env *renv = &interp->runenv;
+	sieve_size_t *address = &(interp->runenv.pc);
+	sieve_size_t code_size = sieve_binary_block_get_size(renv->sblock);
+	unsigned int count = 0;
+	int ret = SIEVE_EXEC_OK;
+#ifdef SIEVE_INTERPRETER_COMPUTED_GOTO
+#  define SIEVE_DISPATCH_LABEL(code) [code] = &&dispatch_##code
+	static const void *const dispatch_table[] = {
+		SIEVE_DISPATCH_LABEL(SIEVE_DISPATCH_END),
+		SIEVE_DISPATCH_LABEL(SIEVE_OPERATION_JMP),
+		SIEVE_DISPATCH_LABEL(SIEVE_OPERATION_JMPTRUE),
+		SIEVE_DISPATCH_LABEL(SIEVE_OPERATION_JMPFALSE),
+		SIEVE_DISPATCH_LABEL(SIEVE_OPERATION_STOP),
+		SIEVE_DISPATCH_LABEL(SIEVE_OPERATION_KEEP),
+		SIEVE_DISPATCH_LABEL(SIEVE_OPERATION_DISCARD),
+		SIEVE_DISPATCH_LABEL(SIEVE_OPERATION_REDIRECT),
+		SIEVE_DISPATCH_LABEL(SIEVE_OPERATION_ADDRESS),
+		SIEVE_DISPATCH_LABEL(SIEVE_OPERATION_HEADER),
+		SIEVE_DISPATCH_LABEL(SIEVE_OPERATION_EXISTS),
+		SIEVE_DISPATCH_LABEL(SIEVE_OPERATION_SIZE_OVER),
+		SIEVE_DISPATCH_LABEL(SIEVE_OPERATION_SIZE_UNDER),
+		SIEVE_DISPATCH_LABEL(SIEVE_DISPATCH_EXTENSION)
+	};
+#  undef SIEVE_DISPATCH_LABEL
+#  define SIEVE_DISPATCH_CASE(code) dispatch_##code
+#  define SIEVE_DISPATCH_FETCH \
+	goto *dispatch_table[sieve_interpreter_fetch(interp, code_size, &ret)]
+
+	SIEVE_DISPATCH_FETCH;
+#else
+#  define SIEVE_DISPATCH_CASE(code) case code
+#  define SIEVE_DISPATCH_FETCH continue
+
+	for (;;) {
+		switch ( sieve_interpreter_fetch(interp, code_size, &ret) ) {
+#endif
+
+/* Dispatches the next operation, unless the current one failed or the data
+   stack frame was used long enough */
+#define SIEVE_DISPATCH_NEXT \
+	if ( ret != SIEVE_EXEC_OK ) \
+		goto finished; \
+	if ( ++count >= SIEVE_INTERPRETER_FRAME_OPERATIONS ) \
+		return FALSE; \
+	SIEVE_DISPATCH_FETCH
+
+/* Releases the data stack frame after a jump */
+#define SIEVE_DISPATCH_JUMPED \
+	if ( ret != SIEVE_EXEC_OK ) \
+		goto finished; \
+	return FALSE
+
+	SIEVE_DISPATCH_CASE(SIEVE_OPERATION_JMP):
+		ret = sieve_jmp_operation_execute(renv, address);
+		SIEVE_DISPATCH_JUMPED;
+
+	SIEVE_DISPATCH_CASE(SIEVE_OPERATION_JMPTRUE):
+		ret = sieve_jmptrue_operation_execute(renv, address);
+		SIEVE_DISPATCH_JUMPED;
+
+	SIEVE_DISPATCH_CASE(SIEVE_OPERATION_JMPFALSE):
+		ret = sieve_jmpfalse_operation_execute(renv, address);
+		SIEVE_DISPATCH_JUMPED;
+
+	SIEVE_DISPATCH_CASE(SIEVE_OPERATION_STOP):
+		ret = cmd_stop_operation_execute(renv, address);
+		SIEVE_DISPATCH_NEXT;
+
+	SIEVE_DISPATCH_CASE(SIEVE_OPERATION_KEEP):
+		ret = cmd_keep_operation_execute(renv, address);
+		SIEVE_DISPATCH_NEXT;
+
+	SIEVE_DISPATCH_CASE(SIEVE_OPERATION_DISCARD):
+		ret = cmd_discard_operation_execute(renv, address);
+		SIEVE_DISPATCH_NEXT;
+
+	SIEVE_DISPATCH_CASE(SIEVE_OPERATION_REDIRECT):
+		ret = cmd_redirect_operation_execute(renv, address);
+		SIEVE_DISPATCH_NEXT;
+
+	SIEVE_DISPATCH_CASE(SIEVE_OPERATION_ADDRESS):
+		ret = tst_address_operation_execute(renv, address);
+		SIEVE_DISPATCH_NEXT;
+
+	SIEVE_DISPATCH_CASE(SIEVE_OPERATION_HEADER):
+		ret = tst_header_operation_execute(renv, address);
+		SIEVE_DISPATCH_NEXT;
+
+	SIEVE_DISPATCH_CASE(SIEVE_OPERATION_EXISTS):
+		ret = tst_exists_operation_execute(renv, address);
+		SIEVE_DISPATCH_NEXT;
+
+	SIEVE_DISPATCH_CASE(SIEVE_OPERATION_SIZE_OVER):
+	SIEVE_DISPATCH_CASE(SIEVE_OPERATION_SIZE_UNDER):
+		ret = tst_size_operation_execute(renv, address);
+		SIEVE_DISPATCH_NEXT;
+
+	SIEVE_DISPATCH_CASE(SIEVE_DISPATCH_EXTENSION):
+		if ( interp->oprtn.def->execute != NULL ) {
+			ret = interp->oprtn.def->execute(renv, address);
+		} else {
+			sieve_runtime_trace(renv, SIEVE_TRLVL_COMMANDS, "OP: %s (NOOP)",
+				sieve_operation_mnemonic(&interp->oprtn));
+		}
+		SIEVE_DISPATCH_NEXT;
+
+	SIEVE_DISPATCH_CASE(SIEVE_DISPATCH_END):
+		goto finished;
+
+#ifndef SIEVE_INTERPRETER_COMPUTED_GOTO
+		default:
+			i_unreached();
+		}
+	}
+#endif
+
+#undef SIEVE_DISPATCH_CASE
+#undef SIEVE_DISPATCH_FETCH
+#undef SIEVE_DISPATCH_NEXT
+#undef SIEVE_DISPATCH_JUMPED
+
+finished:
+	*ret_r = ret;
+	return TRUE;
+}
+
+static int sieve_interpreter_continue_threaded
+(struct sieve_interpreter *interp)
+{
+	int ret = SIEVE_EXEC_OK;
+	bool finished = FALSE;
+
+	while ( !finished ) {
+		T_BEGIN {
+			finished = sieve_interpreter_run_threaded(interp, &ret);
+		} T_END;
+	}
+	return ret;
+}
+
+/*
+ * Code loop
+ */
+
 int sieve_interpreter_continue
 (struct sieve_interpreter *interp, bool *interrupted)
 {
@@ -937,16 +1156,20 @@ int sieve_interpreter_continue
 	if ( interrupted != NULL )
 		*interrupted = FALSE;
 
-	while ( ret == SIEVE_EXEC_OK && !interp->interrupted &&
-		*address < sieve_binary_block_get_size(renv->sblock) ) {
-		if ( interp->loop_limit != 0 && *address > interp->loop_limit ) {
-			sieve_runtime_trace_error(renv,
-				"program crossed loop boundary");
-			ret = SIEVE_EXEC_BIN_CORRUPT;
-			break;
-		}
+	if ( renv->svinst->threaded_interpreter ) {
+		ret = sieve_interpreter_continue_threaded(interp);
+	} else {
+		while ( ret == SIEVE_EXEC_OK && !interp->interrupted &&
+			*address < sieve_binary_block_get_size(renv->sblock) ) {
+			if ( interp->loop_limit != 0 && *address > interp->loop_limit ) {
+				sieve_runtime_trace_error(renv,
+					"program crossed loop boundary");
+				ret = SIEVE_EXEC_BIN_CORRUPT;
+				break;
+			}
 
-		ret = sieve_interpreter_operation_execute(interp);
+			ret = sieve_interpreter_operation_execute(interp);
+		}
 	}
 
 	if ( ret != SIEVE_EXEC_OK ) {
@@ -55,6 +55,12 @@ struct sieve_instance *sieve_interpreter_svinst
 void sieve_interpreter_set_result
 	(struct sieve_interpreter *interp, struct sieve_result *result);
 
+/* Only meant for tools that drive runtime code directly, such as the matching
+ * benchmark.
+ */
+const struct sieve_runtime_env *sieve_interpreter_get_runtime_env
+	(struct sieve_interpreter *interp);
+
 /*
  * Loop handling
  */
@@ -14,6 +14,8 @@
 
 #define SIEVE_MAX_LOOP_DEPTH           4
 
+#define SIEVE_DEFAULT_BINARY_CACHE_SIZE 16
+
 /*
  * Lexer
  */
@@ -0,0 +1,473 @@
+/* Copyright (c) 2002-2017 Pigeonhole authors, see the included COPYING file
+ */
+
+#include "lib.h"
+#include "array.h"
+#include "str.h"
+
+#include "sieve-common.h"
+#include "sieve-stringlist.h"
+#include "sieve-code.h"
+#include "sieve-binary.h"
+#include "sieve-interpreter.h"
+#include "sieve-comparators.h"
+#include "sieve-match-types.h"
+#include "sieve-match.h"
+
+#include "sieve-match-keyset.h"
+
+/* Key lists shorter than this are matched one key at a time; for only a few
+ * keys the normal per-key match is as fast.
+ */
+#define SIEVE_MATCH_KEYSET_MIN_KEYS 4
+
+/*
+ * Types
+ */
+
+enum sieve_match_keyset_type {
+	/* Key list cannot be matched as a set */
+	SIEVE_MATCH_KEYSET_NONE = 0,
+	/* Normalized keys only; matched one at a time */
+	SIEVE_MATCH_KEYSET_LIST,
+	/* :is - sorted key table */
+	SIEVE_MATCH_KEYSET_TABLE,
+	/* :contains - Aho-Corasick automaton */
+	SIEVE_MATCH_KEYSET_AUTOMATON
+};
+
+ARRAY_DEFINE_TYPE(sieve_match_keyset_key, struct sieve_match_keyset_key);
+
+struct sieve_match_keyset_state {
+	/* Trie structure; index 0 (the root) doubles as `none' */
+	unsigned int first_child, next_sibling;
+	/* Longest proper suffix that is also in the trie */
+	unsigned int fail;
+
+	unsigned char chr;
+	/* A key ends here or at one of the fail states */
+	bool output:1;
+};
+
+struct sieve_match_keyset {
+	pool_t pool;
+	enum sieve_match_keyset_type type;
+
+	const struct sieve_match_type_def *mcht_def;
+	const struct sieve_comparator_def *cmp_def;
+
+	/* Literal keys, normalized when the comparator supports it; sorted
+	   for :is */
+	ARRAY_TYPE(sieve_match_keyset_key) keys;
+
+	/* Data associated with each literal key by the match type, in key list
+	   order */
+	void **key_contexts;
+
+	/* :contains */
+	ARRAY(struct sieve_match_keyset_state) states;
+	unsigned int root_next[256];
+
+	bool casemap:1;
+	bool normalized:1;
+	bool literal:1;
+	bool empty_key:1;
+};
+
+static inline unsigned char sieve_match_keyset_fold
+(const struct sieve_match_keyset *kset, unsigned char c)
+{
+	return ( kset->casemap ? (unsigned char)i_tolower(c) : c );
+}
+
+/*
+ * Key table (:is)
+ */
+
+static int sieve_match_keyset_key_cmp
+(const struct sieve_match_keyset_key *key1,
+	const struct sieve_match_keyset_key *key2)
+{
+	size_t size = I_MIN(key1->size, key2->size);
+	int ret;
+
+	if ( (ret=memcmp(key1->data, key2->data, size)) != 0 )
+		return ret;
+	if ( key1->size == key2->size )
+		return 0;
+	return ( key1->size < key2->size ? -1 : 1 );
+}
+
+static bool sieve_match_keyset_table_lookup
+(struct sieve_match_keyset *kset, const unsigned char *value,
+	size_t value_size)
+{
+	const struct sieve_match_keyset_key *keys;
+	struct sieve_match_keyset_key vkey;
+	unsigned int count, left, right, idx;
+	unsigned char *folded;
+	size_t i;
+	int ret;
+
+	vkey.data = (const char *)value;
+	vkey.size = value_size;
+	if ( kset->casemap ) {
+		folded = t_malloc(value_size + 1);
+		for ( i = 0; i < value_size; i++ )
+			folded[i] = sieve_match_keyset_fold(kset, value[i]);
+		vkey.data = (const char *)folded;
+	}
+
+	keys = array_get(&kset->keys, &count);
+	left = 0; right = count;
+	while ( left < right ) {
+		idx = (left + right) / 2;
+
+		ret = sieve_match_keyset_key_cmp(&vkey, &keys[idx]);
+		if ( ret > 0 )
+			left = idx + 1;
+		else if ( ret < 0 )
+			right = idx;
+		else
+			return TRUE;
+	}
+	return FALSE;
+}
+
+/*
+ * Aho-Corasick automaton (:contains)
+ */
+
+static unsigned int sieve_match_keyset_goto
+(struct sieve_match_keyset *kset, unsigned int state, unsigned char chr)
+{
+	const struct sieve_match_keyset_state *states;
+	unsigned int child;
+
+	if ( state == 0 )
+		return kset->root_next[chr];
+
+	states = array_idx(&kset->states, 0);
+	for ( child = states[state].first_child; child != 0;
+		child = states[child].next_sibling ) {
+		if ( states[child].chr == chr )
+			return child;
+	}
+	return 0;
+}
+
+/* Key must be case-folded already */
+static void sieve_match_keyset_automaton_add
+(struct sieve_match_keyset *kset, const unsigned char *key, size_t key_size)
+{
+	struct sieve_match_keyset_state *parent, *child;
+	unsigned int state = 0, next;
+	unsigned char chr;
+	size_t i;
+
+	for ( i = 0; i < key_size; i++ ) {
+		chr = key[i];
+		next = sieve_match_keyset_goto(kset, state, chr);
+		if ( next == 0 ) {
+			next = array_count(&kset->states);
+			child = array_append_space(&kset->states);
+			child->chr = chr;
+
+			parent = array_idx_modifiable(&kset->states, state);
+			child = array_idx_modifiable(&kset->states, next);
+			if ( state == 0 )
+				kset->root_next[chr] = next;
+			child->next_sibling = parent->first_child;
+			parent->first_child = next;
+		}
+		state = next;
+	}
+
+	child = array_idx_modifiable(&kset->states, state);
+	child->output = TRUE;
+}
+
+static void sieve_match_keyset_automaton_link
+(struct sieve_match_keyset *kset)
+{
+	struct sieve_match_keyset_state *states;
+	unsigned int *queue;
+	unsigned int count, head, tail, state, child, fail, next;
+
+	/* Breadth-first traversal to compute the fail links */
+	states = array_get_modifiable(&kset->states, &count);
+	queue = t_new(unsigned int, count);
+	head = tail = 0;
+
+	for ( child = states[0].first_child; child != 0;
+		child = states[child].next_sibling ) {
+		states[child].fail = 0;
+		queue[tail++] = child;
+	}
+
+	while ( head < tail ) {
+		state = queue[head++];
+
+		for ( child = states[state].first_child; child != 0;
+			child = states[child].next_sibling ) {
+			fail = states[state].fail;
+			while ( (next=sieve_match_keyset_goto
+				(kset, fail, states[child].chr)) == 0 && fail != 0 )
+				fail = states[fail].fail;
+
+			states[child].fail = next;
+			if ( states[next].output )
+				states[child].output = TRUE;
+			queue[tail++] = child;
+		}
+	}
+}
+
+static bool sieve_match_keyset_automaton_run
+(struct sieve_match_keyset *kset, const unsigned char *value,
+	size_t value_size)
+{
+	const struct sieve_match_keyset_state *states;
+	unsigned int state = 0, next;
+	unsigned char chr;
+	size_t i;
+
+	states = array_idx(&kset->states, 0);
+	for ( i = 0; i < value_size; i++ ) {
+		chr = sieve_match_keyset_fold(kset, value[i]);
+
+		while ( (next=sieve_match_keyset_goto(kset, state, chr)) == 0 &&
+			state != 0 )
+			state = states[state].fail;
+
+		state = next;
+		if ( states[state].output )
+			return TRUE;
+	}
+	return FALSE;
+}
+
+/*
+ * Key set construction
+ */
+
+static int sieve_match_keyset_read
+(struct sieve_match_keyset *kset, struct sieve_stringlist *key_list,
+	const struct sieve_comparator *cmp, pool_t pool)
+{
+	const struct sieve_runtime_env *renv = key_list->runenv;
+	struct sieve_match_keyset_key *key;
+	sieve_size_t address;
+	unsigned int length, i;
+	string_t *str, *nstr;
+	char *data;
+	bool literal;
+
+	if ( !sieve_code_stringlist_get_address(key_list, &address, &length) )
+		return 0;
+
+	nstr = t_str_new(128);
+	p_array_init(&kset->keys, pool, length);
+	for ( i = 0; i < length; i++ ) {
+		if ( sieve_opr_string_read_ex(renv, &address, NULL, FALSE,
+			&str, &literal) != SIEVE_EXEC_OK )
+			return -1;
+		if ( !literal )
+			return 0;
+
+		if ( kset->normalized ) {
+			str_truncate(nstr, 0);
+			if ( !cmp->def->normalize
+				(cmp, str_c(str), str_len(str), nstr) )
+				return 0;
+			str = nstr;
+		}
+
+		data = p_malloc(pool, str_len(str) + 1);
+		memcpy(data, str_data(str), str_len(str));
+
+		key = array_append_space(&kset->keys);
+		key->data = data;
+		key->size = str_len(str);
+		key->index = i;
+	}
+	return 1;
+}
+
+static struct sieve_match_keyset *sieve_match_keyset_create
+(struct sieve_match_context *mctx, struct sieve_stringlist *key_list,
+	pool_t pool)
+{
+	const struct sieve_match_type *mcht = mctx->match_type;
+	const struct sieve_comparator *cmp = mctx->comparator;
+	struct sieve_match_keyset *kset;
+	const struct sieve_match_keyset_key *keys;
+	unsigned int count, i;
+	bool as_set;
+	int ret;
+
+	kset = p_new(pool, struct sieve_match_keyset, 1);
+	kset->pool = pool;
+	kset->mcht_def = mcht->def;
+	kset->cmp_def = cmp->def;
+	kset->normalized = ( cmp->def->normalize != NULL );
+
+	/* Check whether this match can be performed with a key set */
+	as_set = ( sieve_match_type_is(mcht, is_match_type) ||
+		sieve_match_type_is(mcht, contains_match_type) );
+	if ( sieve_comparator_is(cmp, i_ascii_casemap_comparator) )
+		kset->casemap = TRUE;
+	else if ( !sieve_comparator_is(cmp, i_octet_comparator) )
+		as_set = FALSE;
+
+	/* Read the literal keys (normalized if possible) */
+	if ( (ret=sieve_match_keyset_read(kset, key_list, cmp, pool)) <= 0 ) {
+		kset->normalized = FALSE;
+		return ( ret < 0 ? NULL : kset );
+	}
+	kset->literal = TRUE;
+
+	if ( !as_set || array_count(&kset->keys) < SIEVE_MATCH_KEYSET_MIN_KEYS ) {
+		kset->type = ( kset->normalized ?
+			SIEVE_MATCH_KEYSET_LIST : SIEVE_MATCH_KEYSET_NONE );
+		return kset;
+	}
+
+	if ( sieve_match_type_is(mcht, is_match_type) ) {
+		array_sort(&kset->keys, sieve_match_keyset_key_cmp);
+
+		kset->type = SIEVE_MATCH_KEYSET_TABLE;
+		return kset;
+	}
+
+	p_array_init(&kset->states, pool, 64);
+	(void)array_append_space(&kset->states);
+
+	keys = array_get(&kset->keys, &count);
+	for ( i = 0; i < count; i++ ) {
+		if ( keys[i].size == 0 ) {
+			kset->empty_key = TRUE;
+			continue;
+		}
+		sieve_match_keyset_automaton_add
+			(kset, (const unsigned char *)keys[i].data, keys[i].size);
+	}
+	sieve_match_keyset_automaton_link(kset);
+
+	kset->type = SIEVE_MATCH_KEYSET_AUTOMATON;
+	return kset;
+}
+
+struct sieve_match_keyset *sieve_match_keyset_get
+(struct sieve_match_context *mctx, struct sieve_stringlist *key_list)
+{
+	const struct sieve_runtime_env *renv = key_list->runenv;
+	struct sieve_binary_block *sblock = renv->sblock;
+	struct sieve_match_keyset *kset;
+	sieve_size_t address;
+	unsigned int length;
+
+	if ( !sieve_code_stringlist_get_address(key_list, &address, &length) )
+		return NULL;
+
+	kset = sieve_binary_get_match_keyset(sblock, address);
+	if ( kset == NULL ) {
+		T_BEGIN {
+			kset = sieve_match_keyset_create(mctx, key_list,
+				sieve_binary_pool(sieve_binary_block_get_binary(sblock)));
+		} T_END;
+
+		/* Corrupt key lists are left to the normal match loop */
+		if ( kset == NULL )
+			return NULL;
+
+		sieve_binary_add_match_keyset(sblock, address, kset);
+	}
+
+	if ( kset->mcht_def != mctx->match_type->def ||
+		kset->cmp_def != mctx->comparator->def )
+		return NULL;
+	return kset;
+}
+
+/*
+ * Key contexts
+ */
+
+bool sieve_match_keyset_is_literal(struct sieve_match_keyset *kset)
+{
+	return kset->literal;
+}
+
+pool_t sieve_match_keyset_pool(struct sieve_match_keyset *kset)
+{
+	return kset->pool;
+}
+
+void *sieve_match_keyset_get_key_context
+(struct sieve_match_keyset *kset, unsigned int index)
+{
+	i_assert( kset->literal );
+	i_assert( index < array_count(&kset->keys) );
+
+	if ( kset->key_contexts == NULL )
+		return NULL;
+	return kset->key_contexts[index];
+}
+
+void sieve_match_keyset_set_key_context
+(struct sieve_match_keyset *kset, unsigned int index, void *context)
+{
+	unsigned int count = array_count(&kset->keys);
+
+	i_assert( kset->literal );
+	i_assert( index < count );
+
+	if ( kset->key_contexts == NULL )
+		kset->key_contexts = p_new(kset->pool, void *, count);
+	kset->key_contexts[index] = context;
+}
+
+/*
+ * Matching
+ */
+
+bool sieve_match_keyset_get_normalized
+(struct sieve_match_keyset *kset,
+	const struct sieve_match_keyset_key **keys_r, unsigned int *count_r)
+{
+	if ( !kset->normalized )
+		return FALSE;
+
+	*keys_r = array_get(&kset->keys, count_r);
+	return TRUE;
+}
+
+bool sieve_match_keyset_match
+(struct sieve_match_keyset *kset, const char *value, size_t value_size,
+	int *match_r)
+{
+	const unsigned char *uvalue = (const unsigned char *)value;
+	bool match = FALSE;
+
+	switch ( kset->type ) {
+	case SIEVE_MATCH_KEYSET_TABLE:
+		/* Comparator compares up to the first NUL */
+		if ( kset->casemap && memchr(value, '\0', value_size) != NULL )
+			return FALSE;
+
+		T_BEGIN {
+			match = sieve_match_keyset_table_lookup(kset, uvalue, value_size);
+		} T_END;
+		break;
+	case SIEVE_MATCH_KEYSET_AUTOMATON:
+		match = ( kset->empty_key ||
+			sieve_match_keyset_automaton_run(kset, uvalue, value_size) );
+		break;
+	default:
+		return FALSE;
+	}
+
+	*match_r = ( match ? 1 : 0 );
+	return TRUE;
+}
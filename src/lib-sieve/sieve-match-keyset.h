@@ -0,0 +1,58 @@
+/* Copyright (c) 2002-2017 Pigeonhole authors, see the included COPYING file
+ */
+
+#ifndef __SIEVE_MATCH_KEYSET_H
+#define __SIEVE_MATCH_KEYSET_H
+
+#include "sieve-common.h"
+
+/*
+ * Match key set
+ *
+ *   A literal key list used by an :is or :contains match with the i;octet or
+ *   i;ascii-casemap comparator is compiled once per loaded binary. For :is a
+ *   sorted key table is built and for :contains an Aho-Corasick automaton,
+ *   so that each value is matched against all keys in a single pass.
+ *
+ *   For comparators that can normalize values, any literal key list is kept in
+ *   normalized form, so that the keys need not be normalized at each match.
+ *
+ *   Match types can associate data with the keys of a literal key list, such as
+ *   a compiled form of each key. This data lives as long as the binary.
+ */
+
+struct sieve_match_keyset;
+
+struct sieve_match_keyset_key {
+	const char *data;
+	size_t size;
+
+	/* Position in the key list */
+	unsigned int index;
+};
+
+/* Returns NULL when the key list is not read from the binary */
+struct sieve_match_keyset *sieve_match_keyset_get
+	(struct sieve_match_context *mctx, struct sieve_stringlist *key_list);
+
+/* Returns FALSE when the value needs to be matched the normal way */
+bool sieve_match_keyset_match
+	(struct sieve_match_keyset *kset, const char *value, size_t value_size,
+		int *match_r);
+
+/* Returns FALSE when the keys are not available in normalized form */
+bool sieve_match_keyset_get_normalized
+	(struct sieve_match_keyset *kset,
+		const struct sieve_match_keyset_key **keys_r, unsigned int *count_r);
+
+/* Data associated with a key of a literal key list; keys are identified by
+   their position in the key list */
+bool sieve_match_keyset_is_literal(struct sieve_match_keyset *kset);
+pool_t sieve_match_keyset_pool(struct sieve_match_keyset *kset);
+
+void *sieve_match_keyset_get_key_context
+	(struct sieve_match_keyset *kset, unsigned int index);
+void sieve_match_keyset_set_key_context
+	(struct sieve_match_keyset *kset, unsigned int index, void *context);
+
+#endif /* __SIEVE_MATCH_KEYSET_H */
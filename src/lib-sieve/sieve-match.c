@@ -5,6 +5,7 @@
 #include "mempool.h"
 #include "hash.h"
 #include "array.h"
+#include "str.h"
 #include "str-sanitize.h"
 
 #include "sieve-extensions.h"
@@ -20,6 +21,7 @@
 #include "sieve-match-types.h"
 #include "sieve-runtime-trace.h"
 
+#include "sieve-match-keyset.h"
 #include "sieve-match.h"
 
 /*
@@ -65,14 +67,86 @@ struct sieve_match_context *sieve_match_begin
 	return mctx;
 }
 
+static const struct sieve_comparator sieve_match_octet_comparator =
+	SIEVE_COMPARATOR_DEFAULT(i_octet_comparator);
+
+/* Matches the normalized value against the normalized keys using the i;octet
+   comparator; returns FALSE when the value cannot be normalized */
+static bool sieve_match_value_normalized
+(struct sieve_match_context *mctx, const char *value, size_t value_size,
+	struct sieve_stringlist *key_list, struct sieve_match_keyset *kset,
+	int *match_r)
+{
+	const struct sieve_match_type *mcht = mctx->match_type;
+	const struct sieve_comparator *cmp = mctx->comparator;
+	bool normalized = FALSE;
+	int match = 0;
+
+	T_BEGIN {
+		const struct sieve_match_keyset_key *keys;
+		string_t *nvalue, *nkey, *key_item = NULL;
+		unsigned int count, i;
+		int ret;
+
+		nvalue = t_str_new(value_size + 1);
+		if ( cmp->def->normalize(cmp, value, value_size, nvalue) ) {
+			normalized = TRUE;
+
+			if ( kset != NULL &&
+				sieve_match_keyset_get_normalized(kset, &keys, &count) ) {
+				/* Keys were normalized when first used */
+				mctx->comparator = &sieve_match_octet_comparator;
+				for ( i = 0; match == 0 && i < count; i++ ) {
+					mctx->key_index = keys[i].index;
+					match = mcht->def->match_key(mctx, str_c(nvalue),
+						str_len(nvalue), keys[i].data, keys[i].size);
+				}
+			} else {
+				nkey = t_str_new(128);
+				mctx->key_index = 0;
+				while ( match == 0 &&
+					(ret=sieve_stringlist_next_item(key_list, &key_item)) > 0 ) {
+					str_truncate(nkey, 0);
+					if ( cmp->def->normalize
+						(cmp, str_c(key_item), str_len(key_item), nkey) ) {
+						mctx->comparator = &sieve_match_octet_comparator;
+						match = mcht->def->match_key(mctx, str_c(nvalue),
+							str_len(nvalue), str_c(nkey), str_len(nkey));
+					} else {
+						mctx->comparator = cmp;
+						match = mcht->def->match_key(mctx, value, value_size,
+							str_c(key_item), str_len(key_item));
+					}
+					mctx->key_index++;
+				}
+
+				if ( ret < 0 ) {
+					mctx->exec_status = key_list->exec_status;
+					match = -1;
+				}
+			}
+			mctx->comparator = cmp;
+		}
+	} T_END;
+
+	*match_r = match;
+	return normalized;
+}
+
 int sieve_match_value
 (struct sieve_match_context *mctx, const char *value, size_t value_size,
 	struct sieve_stringlist *key_list)
 {
 	const struct sieve_match_type *mcht = mctx->match_type;
 	const struct sieve_runtime_env *renv = mctx->runenv;
+	struct sieve_profile *profile = renv->svinst->profile;
+	struct sieve_match_keyset *kset = NULL;
+	long long start = 0;
 	int match, ret;
 
+	if ( profile != NULL )
+		start = sieve_profile_usecs();
+
 	if ( mctx->trace ) {
 		sieve_runtime_trace(renv, 0,
 			"matching value `%s'", str_sanitize(value, 80));
@@ -87,14 +161,33 @@ int sieve_match_value
 
 	sieve_runtime_trace_descend(renv);
 
+	/* Key lists read from the binary have a key set */
+	mctx->keyset = NULL;
+	if ( mcht->def->match_keys == NULL &&
+		(kset=sieve_match_keyset_get(mctx, key_list)) != NULL &&
+		sieve_match_keyset_is_literal(kset) )
+		mctx->keyset = kset;
+
 	if ( mcht->def->match_keys != NULL ) {
 		/* Call match-type's own key match handler */
 		match = mcht->def->match_keys(mctx, value, value_size, key_list);
+	} else if ( !mctx->trace && kset != NULL &&
+		sieve_match_keyset_match(kset, value, value_size, &match) ) {
+		/* Matched against all literal keys in one pass */
+	} else if ( !mctx->trace && mctx->comparator->def->normalize != NULL &&
+		(!sieve_match_type_is(mcht, matches_match_type) ||
+			!sieve_match_values_are_enabled(renv)) &&
+		sieve_match_value_normalized
+			(mctx, value, value_size, key_list, kset, &match) ) {
+		/* Value and keys are normalized only once, rather than at each
+		   comparison. Not used when :matches produces match values, since
+		   these are taken from the original value. */
 	} else {
 		string_t *key_item = NULL;
 
 		/* Default key match loop */
 		match = 0;
+		mctx->key_index = 0;
 		while ( match == 0 &&
 			(ret=sieve_stringlist_next_item(key_list, &key_item)) > 0 ) {
 			T_BEGIN {
@@ -107,6 +200,7 @@ int sieve_match_value
 						match);
 				}
 			} T_END;
+			mctx->key_index++;
 		}
 
 		if ( ret < 0 ) {
@@ -122,6 +216,9 @@ int sieve_match_value
 	else
 		mctx->match_status =
 			( mctx->match_status > match ? mctx->match_status : match );
+
+	if ( profile != NULL )
+		profile->match_usecs += sieve_profile_usecs() - start;
 	return match;
 }
 
@@ -195,6 +292,140 @@ int sieve_match
 	return match;
 }
 
+/*
+ * Streaming value matching
+ */
+
+/* Data is collected into chunks of at least this size before it is matched */
+#define SIEVE_MATCH_STREAM_CHUNK_SIZE 8192
+
+struct sieve_match_stream {
+	struct sieve_match_context *mctx;
+	struct sieve_stringlist *key_list;
+
+	/* Tail of the previous chunk, followed by at most one chunk of pending
+	   data. Any key occurrence that crosses a chunk boundary starts within
+	   the retained tail, since it is one octet shorter than the longest
+	   key. */
+	string_t *window;
+	size_t tail_size, max_key_size;
+
+	int match;
+	bool have_data:1;
+};
+
+bool sieve_match_stream_supported
+(const struct sieve_match_type *mcht, const struct sieve_comparator *cmp)
+{
+	return ( sieve_match_type_is(mcht, contains_match_type) &&
+		(sieve_comparator_is(cmp, i_octet_comparator) ||
+			sieve_comparator_is(cmp, i_ascii_casemap_comparator)) );
+}
+
+struct sieve_match_stream *sieve_match_stream_begin
+(struct sieve_match_context *mctx, struct sieve_stringlist *key_list)
+{
+	struct sieve_match_stream *mstream;
+	string_t *key_item = NULL;
+	int ret;
+
+	i_assert( sieve_match_stream_supported
+		(mctx->match_type, mctx->comparator) );
+
+	mstream = p_new(mctx->pool, struct sieve_match_stream, 1);
+	mstream->mctx = mctx;
+	mstream->key_list = key_list;
+	mstream->window = str_new(mctx->pool, SIEVE_MATCH_STREAM_CHUNK_SIZE + 256);
+
+	/* Determine how much of each chunk needs to be retained */
+	sieve_stringlist_reset(key_list);
+	while ( (ret=sieve_stringlist_next_item(key_list, &key_item)) > 0 ) {
+		if ( str_len(key_item) > mstream->max_key_size )
+			mstream->max_key_size = str_len(key_item);
+	}
+
+	if ( ret < 0 ) {
+		mctx->exec_status = key_list->exec_status;
+		mctx->match_status = mstream->match = -1;
+	}
+	return mstream;
+}
+
+static void sieve_match_stream_flush(struct sieve_match_stream *mstream)
+{
+	string_t *window = mstream->window;
+	size_t tail_size;
+
+	mstream->match = sieve_match_value(mstream->mctx,
+		str_c(window), str_len(window), mstream->key_list);
+
+	tail_size = ( mstream->max_key_size > 0 ?
+		I_MIN(str_len(window), mstream->max_key_size - 1) : 0 );
+	str_delete(window, 0, str_len(window) - tail_size);
+	mstream->tail_size = tail_size;
+}
+
+int sieve_match_stream_more
+(struct sieve_match_stream *mstream, const unsigned char *data, size_t size)
+{
+	size_t pending, append;
+
+	if ( mstream->match != 0 )
+		return mstream->match;
+
+	mstream->have_data = TRUE;
+
+	/* Blocks larger than a chunk are split, so that the window doesn't grow
+	   along with the blocks provided by the caller */
+	while ( size > 0 && mstream->match == 0 ) {
+		pending = str_len(mstream->window) - mstream->tail_size;
+		append = I_MIN(size, SIEVE_MATCH_STREAM_CHUNK_SIZE - pending);
+
+		str_append_data(mstream->window, data, append);
+		data += append;
+		size -= append;
+
+		if ( pending + append >= SIEVE_MATCH_STREAM_CHUNK_SIZE )
+			sieve_match_stream_flush(mstream);
+	}
+	return mstream->match;
+}
+
+int sieve_match_stream_value_end(struct sieve_match_stream *mstream)
+{
+	int match;
+
+	/* An empty value is matched too */
+	if ( mstream->match == 0 && (!mstream->have_data ||
+		str_len(mstream->window) > mstream->tail_size) )
+		sieve_match_stream_flush(mstream);
+	match = mstream->match;
+
+	/* Start next value */
+	str_truncate(mstream->window, 0);
+	mstream->tail_size = 0;
+	mstream->have_data = FALSE;
+	if ( mstream->match > 0 )
+		mstream->match = 0;
+	return match;
+}
+
+void sieve_match_stream_reset(struct sieve_match_stream *mstream)
+{
+	str_truncate(mstream->window, 0);
+	mstream->tail_size = 0;
+	mstream->have_data = FALSE;
+	if ( mstream->match > 0 )
+		mstream->match = 0;
+	if ( mstream->mctx->match_status > 0 )
+		mstream->mctx->match_status = 0;
+}
+
+void sieve_match_stream_end(struct sieve_match_stream **_mstream)
+{
+	*_mstream = NULL;
+}
+
 /*
  * Reading match operands
  */
@@ -20,6 +20,11 @@ struct sieve_match_context {
 
 	void *data;
 
+	/* Literal key list being matched, or NULL when it contains keys that are
+	   not literal, and the position of the current key in that list */
+	struct sieve_match_keyset *keyset;
+	unsigned int key_index;
+
 	int match_status;
 	int exec_status;
 
@@ -49,6 +54,25 @@ int sieve_match
 		struct sieve_stringlist *key_list,
 		int *exec_status);
 
+/* Streaming value matching (for values that are too large to keep in memory
+   as a whole). Only supported for :contains with a comparator that compares
+   individual octets. */
+struct sieve_match_stream;
+
+bool sieve_match_stream_supported
+	(const struct sieve_match_type *mcht, const struct sieve_comparator *cmp);
+
+struct sieve_match_stream *sieve_match_stream_begin
+	(struct sieve_match_context *mctx, struct sieve_stringlist *key_list);
+/* Both return the match result for the current value thus far */
+int sieve_match_stream_more
+	(struct sieve_match_stream *mstream,
+		const unsigned char *data, size_t size);
+int sieve_match_stream_value_end(struct sieve_match_stream *mstream);
+/* Discards all values matched thus far */
+void sieve_match_stream_reset(struct sieve_match_stream *mstream);
+void sieve_match_stream_end(struct sieve_match_stream **mstream);
+
 /*
  * Read matching operands
  */
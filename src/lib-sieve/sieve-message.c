@@ -5,6 +5,7 @@
 #include "ioloop.h"
 #include "mempool.h"
 #include "array.h"
+#include "hash.h"
 #include "str.h"
 #include "str-sanitize.h"
 #include "istream.h"
@@ -77,6 +78,11 @@ struct sieve_message_part {
 	bool epilogue:1;  /* this is a multipart epilogue */
 };
 
+struct sieve_message_header_cache {
+	/* Right-trimmed field values; NULL until first requested */
+	string_t **values, **utf8_values;
+};
+
 struct sieve_message_version {
 	struct mail *mail;
 	struct mailbox *box;
@@ -112,6 +118,13 @@ struct sieve_message_context {
 
 	ARRAY(void *) ext_contexts;
 
+	/* Header field values of the current message version, indexed by field
+	   name; cleared once the message is edited or substituted */
+
+	pool_t header_pool;
+	HASH_TABLE(const char *,
+		struct sieve_message_header_cache *) header_cache;
+
 	/* Body */
 
 	ARRAY(struct sieve_message_part *) cached_body_parts;
@@ -119,6 +132,7 @@ struct sieve_message_context {
 	buffer_t *raw_body;
 
 	bool edit_snapshot:1;
+	bool body_parts_partial:1; /* parsing stopped before the end */
 	bool substitute_snapshot:1;
 };
 
@@ -161,6 +175,80 @@ static inline void sieve_message_version_free
 	}
 }
 
+/*
+ * Header cache
+ */
+
+static void sieve_message_header_cache_clear
+(struct sieve_message_context *msgctx)
+{
+	if ( msgctx->header_pool == NULL )
+		return;
+
+	hash_table_destroy(&msgctx->header_cache);
+	pool_unref(&msgctx->header_pool);
+}
+
+static string_t *_header_right_trim(pool_t pool, const char *raw)
+{
+	const char *p, *pend;
+
+	pend = raw + strlen(raw);
+	for ( p = pend; p > raw; p-- ) {
+		if ( p[-1] != ' ' && p[-1] != '\t' ) break;
+	}
+
+	/* The value is returned as a read-only view on the cached copy */
+	return str_new_const(pool, p_strndup(pool, raw, p - raw), p - raw);
+}
+
+static int sieve_message_header_cache_get
+(struct sieve_message_context *msgctx, struct mail *mail,
+	const char *field_name, bool mime_decode, string_t *const **values_r)
+{
+	struct sieve_message_header_cache *hcache;
+	const char *const *headers;
+	string_t ***valuesp, **values;
+	unsigned int count, i;
+	int ret;
+
+	if ( msgctx->header_pool == NULL ) {
+		msgctx->header_pool =
+			pool_alloconly_create("sieve_message_headers", 4096);
+		hash_table_create(&msgctx->header_cache, msgctx->header_pool, 0,
+			strcase_hash, strcasecmp);
+	}
+
+	hcache = hash_table_lookup(msgctx->header_cache, field_name);
+	if ( hcache == NULL ) {
+		hcache = p_new(msgctx->header_pool,
+			struct sieve_message_header_cache, 1);
+		hash_table_insert(msgctx->header_cache,
+			p_strdup(msgctx->header_pool, t_str_lcase(field_name)), hcache);
+	}
+
+	valuesp = ( mime_decode ? &hcache->utf8_values : &hcache->values );
+	if ( *valuesp == NULL ) {
+		/* Fetch all matching headers from the e-mail */
+		if ( mime_decode )
+			ret = mail_get_headers_utf8(mail, field_name, &headers);
+		else
+			ret = mail_get_headers(mail, field_name, &headers);
+		if ( ret < 0 )
+			return -1;
+
+		count = ( ret == 0 || headers == NULL ?
+			0 : str_array_length(headers) );
+		values = p_new(msgctx->header_pool, string_t *, count + 1);
+		for ( i = 0; i < count; i++ )
+			values[i] = _header_right_trim(msgctx->header_pool, headers[i]);
+		*valuesp = values;
+	}
+
+	*values_r = *valuesp;
+	return 0;
+}
+
 /*
  * Message context object
  */
@@ -223,6 +311,7 @@ void sieve_message_context_unref(struct sieve_message_context **msgctx)
 		mail_user_unref(&(*msgctx)->raw_mail_user);
 
 	sieve_message_context_clear(*msgctx);
+	sieve_message_header_cache_clear(*msgctx);
 
 	if ( (*msgctx)->context_pool != NULL )
 		pool_unref(&((*msgctx)->context_pool));
@@ -235,6 +324,8 @@ static void sieve_message_context_flush(struct sieve_message_context *msgctx)
 {
 	pool_t pool;
 
+	sieve_message_header_cache_clear(msgctx);
+
 	if ( msgctx->context_pool != NULL )
 		pool_unref(&(msgctx->context_pool));
 
@@ -247,6 +338,7 @@ static void sieve_message_context_flush(struct sieve_message_context *msgctx)
 	p_array_init(&msgctx->cached_body_parts, pool, 8);
 	p_array_init(&msgctx->return_body_parts, pool, 8);
 	msgctx->raw_body = NULL;
+	msgctx->body_parts_partial = FALSE;
 }
 
 void sieve_message_context_reset(struct sieve_message_context *msgctx)
@@ -485,6 +577,9 @@ struct edit_mail *sieve_message_edit
 
 	version = sieve_message_version_get(msgctx);
 
+	/* The caller is about to modify the message */
+	sieve_message_header_cache_clear(msgctx);
+
 	if ( version->edit_mail == NULL ) {
 		version->edit_mail = edit_mail_wrap
 			(( version->mail == NULL ? msgctx->msgdata->mail : version->mail ));
@@ -526,7 +621,7 @@ struct sieve_message_header_list {
 	struct sieve_stringlist *field_names;
 
 	const char *header_name;
-	const char *const *headers;
+	string_t *const *headers;
 	int headers_index;
 
 	bool mime_decode:1;
@@ -551,25 +646,6 @@ struct sieve_header_list *sieve_message_header_list_create
 	return &hdrlist->hdrlist;
 }
 
-// NOTE: get rid of this once we have a proper Sieve string type
-static inline string_t *_header_right_trim(const char *raw)
-{
-	string_t *result;
-	const char *p, *pend;
-
-	pend = raw + strlen(raw);
-	if (raw == pend) {
-		result = t_str_new(1);
-	} else {
-		for ( p = pend-1; p >= raw; p-- ) {
-			if ( *p != ' ' && *p != '\t' ) break;
-		}
-		result = t_str_new(p - raw + 1);
-		str_append_n(result, raw, p - raw + 1);
-	}
-	return result;
-}
-
 /* String list implementation */
 
 static int sieve_message_header_list_next_item
@@ -579,6 +655,7 @@ static int sieve_message_header_list_next_item
 	struct sieve_message_header_list *hdrlist =
 		(struct sieve_message_header_list *) _hdrlist;
 	const struct sieve_runtime_env *renv = _hdrlist->strlist.runenv;
+	struct sieve_profile *profile = renv->svinst->profile;
 	struct mail *mail = sieve_message_get_mail(renv->msgctx);
 
 	if ( name_r != NULL )
@@ -596,6 +673,7 @@ static int sieve_message_header_list_next_item
 	/* Fetch next header */
 	while ( hdrlist->headers == NULL ) {
 		string_t *hdr_item = NULL;
+		long long start = 0;
 		int ret;
 
 		/* Read next header name from source list */
@@ -612,22 +690,19 @@ static int sieve_message_header_list_next_item
 		}
 
 		/* Fetch all matching headers from the e-mail */
-		if ( hdrlist->mime_decode ) {
-			ret = mail_get_headers_utf8(mail,
-				str_c(hdr_item), &hdrlist->headers);
-		} else {
-			ret = mail_get_headers(mail,
-				str_c(hdr_item), &hdrlist->headers);
-		}
-
-		if (ret < 0) {
+		if ( profile != NULL )
+			start = sieve_profile_usecs();
+		if ( sieve_message_header_cache_get(renv->msgctx, mail,
+			str_c(hdr_item), hdrlist->mime_decode, &hdrlist->headers) < 0 ) {
 			_hdrlist->strlist.exec_status =
 				sieve_runtime_mail_error(renv, mail,
 					"failed to read header field `%s'", str_c(hdr_item));
 			return -1;
 		}
+		if ( profile != NULL )
+			profile->header_usecs += sieve_profile_usecs() - start;
 
-		if ( ret == 0 || hdrlist->headers[0] == NULL ) {
+		if ( hdrlist->headers[0] == NULL ) {
 			/* Try next item when no headers found */
 			hdrlist->headers = NULL;
 		}
@@ -636,7 +711,7 @@ static int sieve_message_header_list_next_item
 	/* Return next item */
 	if ( name_r != NULL )
 		*name_r = hdrlist->header_name;
-	*value_r = _header_right_trim(hdrlist->headers[hdrlist->headers_index++]);
+	*value_r = hdrlist->headers[hdrlist->headers_index++];
 	return 1;
 }
 
@@ -994,9 +1069,10 @@ static bool sieve_message_body_get_return_parts
 	unsigned int i, count;
 	struct sieve_message_part_data *return_part;
 
-	/* Check whether any body parts are cached already */
+	/* Check whether any body parts are cached already. When the last parse
+	   stopped early, parts beyond that point may be missing altogether */
 	body_parts = array_get(&msgctx->cached_body_parts, &count);
-	if ( count == 0 )
+	if ( count == 0 || msgctx->body_parts_partial )
 		return FALSE;
 
 	/* Clear result array */
@@ -1147,18 +1223,97 @@ _parse_content_disposition(const struct message_header_line *hdr)
 	return str_c(content_disp);
 }
 
-/* sieve_message_parts_add_missing():
- *   Add requested message body parts to the cache that are missing.
+static bool sieve_message_is_edited(struct sieve_message_context *msgctx)
+{
+	const struct sieve_message_version *versions;
+	unsigned int count;
+
+	versions = array_get(&msgctx->versions, &count);
+	return ( count > 0 && versions[count-1].edit_mail != NULL );
+}
+
+static struct message_part *sieve_message_parts_copy
+(const struct message_part *src, struct message_part *parent)
+{
+	struct message_part *first = NULL, **dest_p = &first;
+
+	/* The parser below keeps its own state in the part contexts, so it
+	   cannot use the parts tree owned by the mail */
+	for ( ; src != NULL; src = src->next ) {
+		struct message_part *dest = t_new(struct message_part, 1);
+
+		*dest = *src;
+		dest->parent = parent;
+		dest->next = NULL;
+		dest->context = NULL;
+		dest->children = sieve_message_parts_copy(src->children, dest);
+
+		*dest_p = dest;
+		dest_p = &dest->next;
+	}
+	return first;
+}
+
+static bool sieve_message_part_stream
+(struct sieve_message_body_sink *sink, struct mail_html2text *html2text,
+	buffer_t *text_buf, const unsigned char *data, size_t size)
+{
+	if ( html2text == NULL )
+		return sink->part_more(sink, data, size);
+
+	/* Remove HTML markup */
+	buffer_set_used_size(text_buf, 0);
+	mail_html2text_more(html2text, data, size, text_buf);
+	if ( text_buf->used == 0 )
+		return FALSE;
+	return sink->part_more(sink, text_buf->data, text_buf->used);
+}
+
+static bool sieve_message_part_stream_end
+(struct sieve_message_body_sink *sink, struct sieve_message_part *body_part,
+	struct mail_html2text **html2text)
+{
+	if ( *html2text != NULL )
+		mail_html2text_deinit(html2text);
+
+	/* Part has no body; it is not included in the result */
+	if ( !body_part->have_body )
+		return FALSE;
+	return sink->part_end(sink);
+}
+
+static bool sieve_message_part_stream_headers
+(struct sieve_message_body_sink *sink, buffer_t *buf,
+	struct sieve_message_part *header_part, const char *const *content_types)
+{
+	bool done = FALSE;
+
+	if ( header_part->have_body && _is_wanted_content_type
+		(content_types, header_part->content_type) ) {
+		done = ( sink->part_more(sink, buf->data, buf->used) ||
+			sink->part_end(sink) );
+	}
+
+	buffer_set_used_size(buf, 0);
+	return done;
+}
+
+/* sieve_message_parts_parse():
+ *   Parse the message into the body part cache. When mparts is not NULL, that
+ *   MIME structure is reused rather than parsing the message structure again.
+ *   If it turns out not to match the message, parts_broken_r is set. When sink
+ *   is not NULL, the requested body parts are passed to it rather than being
+ *   added to the cache.
  */
-static int sieve_message_parts_add_missing
-(const struct sieve_runtime_env *renv,
-	const char *const *content_types,
-	bool extract_text, bool iter_all)
-	ATTR_NULL(2)
+static int sieve_message_parts_parse
+(const struct sieve_runtime_env *renv, struct mail *mail,
+	struct message_part *mparts, const char *const *content_types,
+	bool extract_text, bool iter_all, struct sieve_message_body_sink *sink,
+	bool *parts_broken_r)
+	ATTR_NULL(3, 4, 7)
 {
 	struct sieve_message_context *msgctx = renv->msgctx;
 	pool_t pool = msgctx->context_pool;
-	struct mail *mail = sieve_message_get_mail(renv->msgctx);
 	enum message_parser_flags mparser_flags =
 		MESSAGE_PARSER_FLAG_INCLUDE_MULTIPART_BLOCKS;
 	enum message_header_parser_flags hparser_flags =
@@ -1168,32 +1323,28 @@ static int sieve_message_parts_add_missing
 	struct message_parser_ctx *parser;
 	struct message_decoder_context *decoder;
 	struct message_block block, decoded;
-	struct message_part *mparts, *prev_mpart = NULL;
-	buffer_t *buf;
+	struct message_part *prev_mpart = NULL;
+	struct mail_html2text *html2text = NULL;
+	buffer_t *buf, *text_buf = NULL;
 	struct istream *input;
+	size_t max_scan_size = renv->svinst->body_max_scan_size;
+	size_t part_scanned = 0;
 	unsigned int idx = 0;
-	bool save_body = FALSE, have_all;
+	bool save_body = FALSE, done = FALSE, part_truncated = FALSE, have_all;
 	string_t *hdr_content = NULL;
 	int ret;
 
-	/* First check whether any are missing */
-	if ( !iter_all && sieve_message_body_get_return_parts
-		(renv, content_types, extract_text) ) {
-		/* Cache hit; all are present */
-		return SIEVE_EXEC_OK;
-	}
+	*parts_broken_r = FALSE;
 
 	/* Get the message stream */
 	if ( mail_get_stream(mail, NULL, NULL, &input) < 0 ) {
 		return sieve_runtime_mail_error(renv, mail,
 			"failed to open input message");
 	}
-	if (mail_get_parts(mail, &mparts) < 0) {
-		return sieve_runtime_mail_error(renv, mail,
-			"failed to parse input message parts");
-	}
 
 	buf = buffer_create_dynamic(default_pool, 4096);
+	if ( sink != NULL && extract_text )
+		text_buf = buffer_create_dynamic(default_pool, 4096);
 	body_part = header_part = last_part = NULL;
 
 	if (iter_all) {
@@ -1207,12 +1358,15 @@ static int sieve_message_parts_add_missing
 	/* Initialize body decoder */
 	decoder = message_decoder_init(NULL, 0);
 
-	// FIXME: currently not tested with edit-mail.
-		//parser = message_parser_init_from_parts(parts, input,
-		// hparser_flags, mparser_flags);
-	parser = message_parser_init(pool_datastack_create(),
-		input, hparser_flags, mparser_flags);
-	while ( (ret=message_parser_parse_next_block
+	if ( mparts != NULL ) {
+		parser = message_parser_init_from_parts
+			(sieve_message_parts_copy(mparts, NULL), input,
+				hparser_flags, mparser_flags);
+	} else {
+		parser = message_parser_init(pool_datastack_create(),
+			input, hparser_flags, mparser_flags);
+	}
+	while ( !done && (ret=message_parser_parse_next_block
 		(parser, &block)) > 0 ) {
 		struct sieve_message_part **body_part_idx;
 		struct message_header_line *hdr = block.hdr;
@@ -1228,10 +1382,13 @@ static int sieve_message_parts_add_missing
 				if ( block.part->parent == prev_mpart &&
 					strcmp(body_part->content_type, "message/rfc822") == 0 ) {
 					message_rfc822 = TRUE;
-				} else {
-					if ( save_body ) {
+				} else if ( save_body ) {
+					if ( sink == NULL ) {
 						sieve_message_part_save
 							(renv, buf, body_part, extract_text);
+					} else if ( sieve_message_part_stream_end
+						(sink, body_part, &html2text) ) {
+						done = TRUE;
 					}
 				}
 				if ( iter_all && !array_is_created(&body_part->headers) &&
@@ -1307,6 +1464,8 @@ static int sieve_message_parts_add_missing
 			}
 
 			prev_mpart = block.part;
+			part_scanned = 0;
+			part_truncated = FALSE;
 			idx++;
 		}
 
@@ -1327,8 +1486,13 @@ static int sieve_message_parts_add_missing
 			if ( hdr == NULL ) {
 				/* Save headers for message/rfc822 part */
 				if ( header_part != NULL ) {
-					sieve_message_part_save
-						(renv, buf, header_part, FALSE);
+					if ( sink == NULL ) {
+						sieve_message_part_save
+							(renv, buf, header_part, FALSE);
+					} else if ( sieve_message_part_stream_headers
+						(sink, buf, header_part, content_types) ) {
+						done = TRUE;
+					}
 					header_part = NULL;
 				}
 
@@ -1336,6 +1500,11 @@ static int sieve_message_parts_add_missing
 				i_assert( body_part != NULL );
 				save_body = iter_all || _is_wanted_content_type
 					(content_types, body_part->content_type);
+
+				/* Extract text while streaming the body */
+				if ( sink != NULL && save_body && extract_text &&
+					mail_html2text_content_type_match(body_part->content_type) )
+					html2text = mail_html2text_init(0);
 				continue;
 			}
 
@@ -1453,19 +1622,58 @@ static int sieve_message_parts_add_missing
 
 		/* Reading body */
 		if ( save_body ) {
+			if ( max_scan_size > 0 && part_scanned >= max_scan_size ) {
+				/* Scan budget for this part is spent; skip decoding the rest */
+				if ( !part_truncated ) {
+					sieve_runtime_trace(renv, SIEVE_TRLVL_TESTS,
+						"%s body part truncated to %"PRIuSIZE_T" bytes",
+						body_part->content_type, max_scan_size);
+					part_truncated = TRUE;
+				}
+				continue;
+			}
+
 			(void)message_decoder_decode_next_block
 					(decoder, &block, &decoded);
-			buffer_append(buf, decoded.data, decoded.size);
+
+			if ( max_scan_size > 0 &&
+				decoded.size > max_scan_size - part_scanned ) {
+				decoded.size = max_scan_size - part_scanned;
+				sieve_runtime_trace(renv, SIEVE_TRLVL_TESTS,
+					"%s body part truncated to %"PRIuSIZE_T" bytes",
+					body_part->content_type, max_scan_size);
+				part_truncated = TRUE;
+			}
+			part_scanned += decoded.size;
+
+			if ( sink == NULL ) {
+				buffer_append(buf, decoded.data, decoded.size);
+			} else if ( decoded.size > 0 && sieve_message_part_stream
+				(sink, html2text, text_buf, decoded.data, decoded.size) ) {
+				done = TRUE;
+			}
 		}
 	}
 
 	/* Save last body part if necessary */
-	if ( header_part != NULL ) {
-		sieve_message_part_save
-			(renv, buf, header_part, FALSE);
+	if ( done ) {
+		/* Sink needs no more data */
+	} else if ( header_part != NULL ) {
+		if ( sink == NULL ) {
+			sieve_message_part_save
+				(renv, buf, header_part, FALSE);
+		} else {
+			(void)sieve_message_part_stream_headers
+				(sink, buf, header_part, content_types);
+		}
 	} else if ( body_part != NULL && save_body ) {
-		sieve_message_part_save
-			(renv, buf, body_part, extract_text);
+		if ( sink == NULL ) {
+			sieve_message_part_save
+				(renv, buf, body_part, extract_text);
+		} else {
+			(void)sieve_message_part_stream_end
+				(sink, body_part, &html2text);
+		}
 	}
 	if ( iter_all && !array_is_created(&body_part->headers) &&
 		array_count(&headers) > 0 ) {
@@ -1474,16 +1682,19 @@ static int sieve_message_parts_add_missing
 			&headers.arr, 0, array_count(&headers));
 	}
 
-	/* Try to fill the return_body_parts array once more */
-	have_all = iter_all || sieve_message_body_get_return_parts
-		(renv, content_types, extract_text);
-
-	/* This time, failure is a bug */
-	i_assert(have_all);
+	/* Parsing stopped early when the sink needed no more data; the cached
+	   structure then lacks the remaining parts, and it is only verified for
+	   the part that was read */
+	msgctx->body_parts_partial = done;
 
 	/* Cleanup */
-	(void)message_parser_deinit(&parser, &mparts);
+	if ( message_parser_deinit(&parser, &mparts) < 0 && !done )
+		*parts_broken_r = TRUE;
 	message_decoder_deinit(&decoder);
+	if ( html2text != NULL )
+		mail_html2text_deinit(&html2text);
+	if ( text_buf != NULL )
+		buffer_free(&text_buf);
 	buffer_free(&buf);
 
 	/* Return status */
@@ -1495,9 +1706,94 @@ static int sieve_message_parts_add_missing
 			i_stream_get_error(input));
 		return SIEVE_EXEC_TEMP_FAILURE;
 	}
+
+	if ( sink == NULL && !*parts_broken_r ) {
+		/* Try to fill the return_body_parts array once more */
+		have_all = iter_all || sieve_message_body_get_return_parts
+			(renv, content_types, extract_text);
+
+		/* This time, failure is a bug */
+		i_assert(have_all);
+	}
 	return SIEVE_EXEC_OK;
 }
 
+/* sieve_message_parts_read():
+ *   Read the requested message body parts, either into the cache or into the
+ *   provided sink.
+ */
+static int sieve_message_parts_read
+(const struct sieve_runtime_env *renv,
+	const char *const *content_types,
+	bool extract_text, bool iter_all, struct sieve_message_body_sink *sink)
+	ATTR_NULL(2, 5)
+{
+	struct sieve_message_context *msgctx = renv->msgctx;
+	struct sieve_profile *profile = renv->svinst->profile;
+	struct mail *mail = sieve_message_get_mail(msgctx);
+	struct message_part *mparts = NULL;
+	long long start = 0, match_usecs = 0;
+	bool parts_broken;
+	int status;
+
+	if ( profile != NULL ) {
+		start = sieve_profile_usecs();
+		match_usecs = profile->match_usecs;
+	}
+
+	/* Reuse the MIME structure the mail storage already parsed (or cached).
+	   The part offsets known for an edited message refer to the original
+	   message, so an edited message is parsed from scratch. */
+	if ( !sieve_message_is_edited(msgctx) &&
+		mail_get_parts(mail, &mparts) < 0 ) {
+		return sieve_runtime_mail_error(renv, mail,
+			"failed to parse input message parts");
+	}
+
+	status = sieve_message_parts_parse(renv, mail, mparts,
+		content_types, extract_text, iter_all, sink, &parts_broken);
+	if ( status > 0 && parts_broken ) {
+		/* Cached MIME structure doesn't match the message */
+		mail_set_cache_corrupted(mail, MAIL_FETCH_MESSAGE_PARTS);
+		if ( sink != NULL )
+			sink->reset(sink);
+
+		/* Drop what was parsed along the broken structure; the tree links
+		   of those parts don't match the message either */
+		array_clear(&msgctx->cached_body_parts);
+		array_clear(&msgctx->return_body_parts);
+		status = sieve_message_parts_parse(renv, mail, NULL,
+			content_types, extract_text, iter_all, sink, &parts_broken);
+	}
+
+	if ( profile != NULL ) {
+		/* Leave out the matching of streamed parts */
+		profile->body_usecs += sieve_profile_usecs() - start -
+			(profile->match_usecs - match_usecs);
+	}
+	return status;
+}
+
+/* sieve_message_parts_add_missing():
+ *   Add requested message body parts to the cache that are missing.
+ */
+static int sieve_message_parts_add_missing
+(const struct sieve_runtime_env *renv,
+	const char *const *content_types,
+	bool extract_text, bool iter_all)
+	ATTR_NULL(2)
+{
+	/* First check whether any are missing */
+	if ( !iter_all && sieve_message_body_get_return_parts
+		(renv, content_types, extract_text) ) {
+		/* Cache hit; all are present */
+		return SIEVE_EXEC_OK;
+	}
+
+	return sieve_message_parts_read
+		(renv, content_types, extract_text, iter_all, NULL);
+}
+
 int sieve_message_body_get_content
 (const struct sieve_runtime_env *renv,
 	const char * const *content_types,
@@ -1569,10 +1865,16 @@ int sieve_message_body_get_raw
 		struct mail *mail = sieve_message_get_mail(renv->msgctx);
 		struct istream *input;
 		struct message_size hdr_size, body_size;
+		struct sieve_profile *profile = renv->svinst->profile;
+		size_t max_scan_size = renv->svinst->body_max_scan_size;
 		const unsigned char *data;
 		size_t size;
+		long long start = 0;
 		int ret;
 
+		if ( profile != NULL )
+			start = sieve_profile_usecs();
+
 		msgctx->raw_body = buf = buffer_create_dynamic
 			(msgctx->context_pool, 1024*64);
 
@@ -1587,6 +1889,14 @@ int sieve_message_body_get_raw
 
 		/* Read raw message body */
 		while ( (ret=i_stream_read_more(input, &data, &size)) > 0 ) {
+			if ( max_scan_size > 0 && size > max_scan_size - buf->used ) {
+				/* Stop reading once the scan budget is spent */
+				buffer_append(buf, data, max_scan_size - buf->used);
+				sieve_runtime_trace(renv, SIEVE_TRLVL_TESTS,
+					"raw body truncated to %"PRIuSIZE_T" bytes", max_scan_size);
+				ret = 0;
+				break;
+			}
 			buffer_append(buf, data, size);
 
 			i_stream_skip(input, size);
@@ -1604,6 +1914,9 @@ int sieve_message_body_get_raw
 		/* Add terminating NUL to the body part buffer */
 		buffer_append_c(buf, '\0');
 
+		if ( profile != NULL )
+			profile->body_usecs += sieve_profile_usecs() - start;
+
 	} else {
 		buf = msgctx->raw_body;
 	}
@@ -1630,6 +1943,145 @@ int sieve_message_body_get_raw
 	return SIEVE_EXEC_OK;
 }
 
+static void sieve_message_body_stream_cached
+(const struct sieve_runtime_env *renv, struct sieve_message_body_sink *sink)
+{
+	struct sieve_message_context *msgctx = renv->msgctx;
+	const struct sieve_message_part_data *parts;
+	unsigned int count, i;
+
+	parts = array_get(&msgctx->return_body_parts, &count);
+	for ( i = 0; i < count; i++ ) {
+		if ( sink->part_more(sink,
+			(const unsigned char *)parts[i].content, parts[i].size) ||
+			sink->part_end(sink) )
+			break;
+	}
+}
+
+static int sieve_message_body_stream_parts
+(const struct sieve_runtime_env *renv,
+	const char * const *content_types, bool extract_text,
+	struct sieve_message_body_sink *sink)
+{
+	int status;
+
+	/* Use the cached body parts when these are available already */
+	if ( sieve_message_body_get_return_parts
+		(renv, content_types, extract_text) ) {
+		sieve_message_body_stream_cached(renv, sink);
+		return SIEVE_EXEC_OK;
+	}
+
+	T_BEGIN {
+		status = sieve_message_parts_read
+			(renv, content_types, extract_text, FALSE, sink);
+	} T_END;
+
+	return status;
+}
+
+int sieve_message_body_stream_content
+(const struct sieve_runtime_env *renv,
+	const char * const *content_types,
+	struct sieve_message_body_sink *sink)
+{
+	return sieve_message_body_stream_parts
+		(renv, content_types, FALSE, sink);
+}
+
+int sieve_message_body_stream_text
+(const struct sieve_runtime_env *renv,
+	struct sieve_message_body_sink *sink)
+{
+	static const char * const _text_content_types[] =
+		{ "application/xhtml+xml", "text", NULL };
+
+	/* See sieve_message_body_get_text() */
+	return sieve_message_body_stream_parts
+		(renv, _text_content_types, TRUE, sink);
+}
+
+int sieve_message_body_stream_raw
+(const struct sieve_runtime_env *renv,
+	struct sieve_message_body_sink *sink)
+{
+	struct sieve_message_context *msgctx = renv->msgctx;
+	struct sieve_profile *profile = renv->svinst->profile;
+	struct mail *mail = sieve_message_get_mail(renv->msgctx);
+	struct istream *input;
+	struct message_size hdr_size;
+	size_t max_scan_size = renv->svinst->body_max_scan_size;
+	size_t scanned = 0;
+	const unsigned char *data;
+	size_t size;
+	long long start = 0, match_usecs = 0;
+	bool done = FALSE, have_body = FALSE;
+	int ret = 0;
+
+	/* Use the cached raw body when it is available already */
+	if ( msgctx->raw_body != NULL ) {
+		buffer_t *buf = msgctx->raw_body;
+
+		if ( buf->used > 1 &&
+			!sink->part_more(sink, buf->data, buf->used - 1) )
+			(void)sink->part_end(sink);
+		return SIEVE_EXEC_OK;
+	}
+
+	if ( profile != NULL ) {
+		start = sieve_profile_usecs();
+		match_usecs = profile->match_usecs;
+	}
+
+	/* Get stream for message */
+	if ( mail_get_stream(mail, &hdr_size, NULL, &input) < 0 ) {
+		return sieve_runtime_mail_error(renv, mail,
+			"failed to open input message");
+	}
+
+	/* Skip stream to beginning of body */
+	i_stream_skip(input, hdr_size.physical_size);
+
+	/* Pass raw message body */
+	while ( !done && (ret=i_stream_read_more(input, &data, &size)) > 0 ) {
+		if ( max_scan_size > 0 && size > max_scan_size - scanned ) {
+			/* Stop reading once the scan budget is spent */
+			done = sink->part_more(sink, data, max_scan_size - scanned);
+			sieve_runtime_trace(renv, SIEVE_TRLVL_TESTS,
+				"raw body truncated to %"PRIuSIZE_T" bytes", max_scan_size);
+			have_body = TRUE;
+			ret = 0;
+			break;
+		}
+		done = sink->part_more(sink, data, size);
+		scanned += size;
+		have_body = TRUE;
+
+		i_stream_skip(input, size);
+	}
+
+	if ( ret < 0 && input->stream_errno != 0 ) {
+		sieve_runtime_critical(renv, NULL,
+			"failed to read input message",
+			"read(%s) failed: %s",
+			i_stream_get_name(input),
+			i_stream_get_error(input));
+		return SIEVE_EXEC_TEMP_FAILURE;
+	}
+
+	/* An empty body is not included in the result */
+	if ( !done && have_body )
+		(void)sink->part_end(sink);
+
+	if ( profile != NULL ) {
+		/* Leave out the matching of the streamed body */
+		profile->body_usecs += sieve_profile_usecs() - start -
+			(profile->match_usecs - match_usecs);
+	}
+	return SIEVE_EXEC_OK;
+}
+
 /*
  * Message part iterator
  */
@@ -252,6 +252,35 @@ int sieve_message_body_get_raw
 	(const struct sieve_runtime_env *renv,
 		struct sieve_message_part_data **parts_r);
 
+/* Streaming alternative to the above: the body parts are passed to the sink
+   in chunks as these are read from the message, without adding them to the
+   body part cache. The callbacks return TRUE when no more data is needed.
+
+   Not caching the decoded parts is deliberate: that would need them in
+   memory as a whole, which is what streaming avoids. A script that tests the
+   same parts repeatedly thus decodes these again for each test. Parts that
+   are already in the cache are passed from there. */
+
+struct sieve_message_body_sink {
+	bool (*part_more)(struct sieve_message_body_sink *sink,
+		const unsigned char *data, size_t size);
+	bool (*part_end)(struct sieve_message_body_sink *sink);
+
+	/* Called when the parts need to be passed again from the start */
+	void (*reset)(struct sieve_message_body_sink *sink);
+};
+
+int sieve_message_body_stream_content
+	(const struct sieve_runtime_env *renv,
+		const char * const *content_types,
+		struct sieve_message_body_sink *sink);
+int sieve_message_body_stream_text
+	(const struct sieve_runtime_env *renv,
+		struct sieve_message_body_sink *sink);
+int sieve_message_body_stream_raw
+	(const struct sieve_runtime_env *renv,
+		struct sieve_message_body_sink *sink);
+
 /*
  * Message part iterator
  */
@@ -3,6 +3,7 @@
 
 #include "lib.h"
 #include "mempool.h"
+#include "array.h"
 #include "ostream.h"
 #include "hash.h"
 #include "str.h"
@@ -40,6 +41,9 @@ struct sieve_result_action {
 	struct sieve_side_effects_list *seffects;
 
 	struct sieve_result_action *prev, *next;
+
+	/* Position in the action list; see the action index below */
+	unsigned int index_seq;
 };
 
 struct sieve_side_effects_list {
@@ -60,6 +64,13 @@ struct sieve_result_action_context {
 	struct sieve_side_effects_list *seffects;
 };
 
+struct sieve_result_action_def_index {
+	unsigned int count;
+
+	/* First action with a particular duplicate key */
+	HASH_TABLE(const char *, struct sieve_result_action *) actions;
+};
+
 /*
  * Result object
  */
@@ -87,10 +98,21 @@ struct sieve_result {
 	HASH_TABLE(const struct sieve_action_def *,
 			   struct sieve_result_action_context *) action_contexts;
 
+	/* Index of the action list by action definition and duplicate key, which
+	   makes checking a new action for duplicates and conflicts independent of
+	   the number of actions already in the result. */
+	HASH_TABLE(const struct sieve_action_def *,
+			   struct sieve_result_action_def_index *) action_index;
+	ARRAY(struct sieve_result_action *) conflict_actions;
+	unsigned int action_index_seq;
+
 	bool executed:1;
+	bool action_index_dirty:1;
 	bool executed_delivery:1;
 };
 
+static void sieve_result_action_index_clear(struct sieve_result *result);
+
 struct sieve_result *sieve_result_create
 (struct sieve_instance *svinst,
 	const struct sieve_message_data *msgdata,
@@ -143,6 +165,8 @@ void sieve_result_unref(struct sieve_result **result)
 	if ( hash_table_is_created((*result)->action_contexts) )
         hash_table_destroy(&(*result)->action_contexts);
 
+	sieve_result_action_index_clear(*result);
+
 	if ( (*result)->action_env.ehandler != NULL )
 		sieve_error_handler_unref(&(*result)->action_env.ehandler);
 
@@ -448,6 +472,145 @@ static int sieve_result_side_effects_merge
 	return 1;
 }
 
+static void sieve_result_action_index_clear(struct sieve_result *result)
+{
+	struct hash_iterate_context *hctx;
+	const struct sieve_action_def *act_def;
+	struct sieve_result_action_def_index *defidx;
+
+	if ( !hash_table_is_created(result->action_index) )
+		return;
+
+	hctx = hash_table_iterate_init(result->action_index);
+	while ( hash_table_iterate(hctx, result->action_index, &act_def, &defidx) ) {
+		if ( hash_table_is_created(defidx->actions) )
+			hash_table_destroy(&defidx->actions);
+	}
+	hash_table_iterate_deinit(&hctx);
+
+	hash_table_destroy(&result->action_index);
+	array_free(&result->conflict_actions);
+}
+
+static void sieve_result_action_index_add
+(struct sieve_result *result, struct sieve_result_action *raction)
+{
+	const struct sieve_action_def *act_def = raction->action.def;
+	const struct sieve_script_env *senv = result->action_env.scriptenv;
+	struct sieve_result_action_def_index *defidx;
+
+	raction->index_seq = ++result->action_index_seq;
+
+	if ( act_def == NULL )
+		return;
+
+	if ( !hash_table_is_created(result->action_index) ) {
+		hash_table_create_direct(&result->action_index, default_pool, 0);
+		i_array_init(&result->conflict_actions, 8);
+	}
+
+	defidx = hash_table_lookup(result->action_index, act_def);
+	if ( defidx == NULL ) {
+		defidx = p_new(result->pool, struct sieve_result_action_def_index, 1);
+		hash_table_insert(result->action_index, act_def, defidx);
+	}
+	defidx->count++;
+
+	if ( act_def->duplicate_key != NULL ) {
+		const char *key;
+
+		if ( !hash_table_is_created(defidx->actions) ) {
+			hash_table_create(&defidx->actions, default_pool, 0,
+				str_hash, strcmp);
+		}
+
+		T_BEGIN {
+			key = act_def->duplicate_key(senv, &raction->action);
+			if ( hash_table_lookup(defidx->actions, key) == NULL ) {
+				hash_table_insert(defidx->actions,
+					p_strdup(result->pool, key), raction);
+			}
+		} T_END;
+	}
+
+	if ( act_def->check_conflict != NULL )
+		array_append(&result->conflict_actions, &raction, 1);
+}
+
+static void sieve_result_action_index_rebuild(struct sieve_result *result)
+{
+	struct sieve_result_action *raction;
+
+	sieve_result_action_index_clear(result);
+	result->action_index_seq = 0;
+
+	for ( raction = result->first_action; raction != NULL;
+		raction = raction->next )
+		sieve_result_action_index_add(result, raction);
+
+	result->action_index_dirty = FALSE;
+}
+
+/* Checks the new action for duplicates and conflicts using the action index,
+   with the same outcome as walking the action list. Returns FALSE when the
+   action is to be added; otherwise ret_r is the result of adding it. */
+static bool sieve_result_action_index_check
+(const struct sieve_runtime_env *renv, struct sieve_action *action,
+	struct sieve_side_effects_list *seffects, unsigned int *instance_count_r,
+	int *ret_r)
+{
+	struct sieve_result *result = renv->result;
+	const struct sieve_action_def *act_def = action->def;
+	struct sieve_result_action_def_index *defidx = NULL;
+	struct sieve_result_action *const *cactions;
+	struct sieve_result_action *dup = NULL;
+	unsigned int count, i;
+	int ret;
+
+	*instance_count_r = 0;
+	*ret_r = 0;
+
+	if ( result->action_index_dirty )
+		sieve_result_action_index_rebuild(result);
+	if ( !hash_table_is_created(result->action_index) )
+		return FALSE;
+
+	defidx = hash_table_lookup(result->action_index, act_def);
+	if ( defidx != NULL ) {
+		*instance_count_r = defidx->count;
+
+		if ( hash_table_is_created(defidx->actions) ) {
+			T_BEGIN {
+				dup = hash_table_lookup(defidx->actions,
+					act_def->duplicate_key(renv->scriptenv, action));
+			} T_END;
+		}
+	}
+
+	/* The list is checked in order, so only conflicts with actions that
+	   precede the duplicate are relevant */
+	cactions = array_get(&result->conflict_actions, &count);
+	for ( i = 0; i < count; i++ ) {
+		struct sieve_action *oact = &cactions[i]->action;
+
+		if ( dup != NULL && cactions[i]->index_seq > dup->index_seq )
+			break;
+
+		if ( !oact->executed && (ret=oact->def->check_conflict
+			(renv, oact, action)) != 0 ) {
+			*ret_r = ret;
+			return TRUE;
+		}
+	}
+
+	if ( dup != NULL ) {
+		/* Merge side-effects, but don't add new action */
+		*ret_r = sieve_result_side_effects_merge(renv, action, dup, seffects);
+		return TRUE;
+	}
+	return FALSE;
+}
+
 static void sieve_result_action_detach
 (struct sieve_result *result, struct sieve_result_action *raction)
 {
@@ -468,6 +631,8 @@ static void sieve_result_action_detach
 
 	if ( result->action_count > 0 )
 		result->action_count--;
+
+	result->action_index_dirty = TRUE;
 }
 
 static int _sieve_result_add_action
@@ -490,7 +655,16 @@ static int _sieve_result_add_action
 	action.executed = FALSE;
 
 	/* First, check for duplicates or conflicts */
-	raction = result->first_action;
+	if ( !keep && act_def != NULL && act_def->duplicate_key != NULL &&
+		act_def->check_conflict == NULL ) {
+		/* Only needs to consult the action index */
+		if ( sieve_result_action_index_check
+			(renv, &action, seffects, &instance_count, &ret) )
+			return ret;
+		raction = NULL;
+	} else {
+		raction = result->first_action;
+	}
 	while ( raction != NULL ) {
 		const struct sieve_action *oact = &raction->action;
 
@@ -628,6 +802,9 @@ static int _sieve_result_add_action
 		}
 		result->action_count++;
 
+		if ( !keep && !result->action_index_dirty )
+			sieve_result_action_index_add(result, raction);
+
 		/* Apply any implicit side effects */
 		if ( hash_table_is_created(result->action_contexts) ) {
 			struct sieve_result_action_context *actctx;
@@ -674,6 +851,10 @@ static int _sieve_result_add_action
 		}
 	}
 
+	/* Keep may have taken over or moved existing actions */
+	if ( keep )
+		result->action_index_dirty = TRUE;
+
 	if ( preserve_mail ) {
 		raction->action.mail = sieve_message_get_mail(renv->msgctx);
 		sieve_message_snapshot(renv->msgctx);
@@ -1519,6 +1700,8 @@ void sieve_result_iterate_delete
 	else
 		rac->next->prev = rac->prev;
 
+	result->action_index_dirty = TRUE;
+
 	/* Skip to next action in iteration */
 
 	rictx->current_action = NULL;
@@ -564,6 +564,9 @@ int sieve_script_rename
 		i_assert( script->v.rename != NULL );
 		ret = script->v.rename(script, newname);
 
+		if ( ret >= 0 )
+			sieve_storage_bump_generation(storage);
+
 		/* rename INBOX mailbox attribute */
 		if ( ret >= 0 && oldname != NULL )
 			(void)sieve_storage_sync_script_rename(storage, oldname, newname);
@@ -655,8 +658,10 @@ int sieve_script_delete(struct sieve_script *script,
 	ret = script->v.delete(script);
 
 	/* unset INBOX mailbox attribute */
-	if ( ret >= 0 )
+	if ( ret >= 0 ) {
+		sieve_storage_bump_generation(storage);
 		(void)sieve_storage_sync_script_delete(storage, script->name);
+	}
 	return ret;
 }
 
@@ -226,6 +226,12 @@ void sieve_settings_load
 		svinst->max_redirects = (unsigned int) uint_setting;
 	}
 
+	svinst->body_max_scan_size = 0;
+	if ( sieve_setting_get_size_value
+		(svinst, "sieve_body_max_scan_size", &size_setting) ) {
+		svinst->body_max_scan_size = size_setting;
+	}
+
 	(void)sieve_address_source_parse_from_setting(svinst,
 		svinst->pool, "sieve_redirect_envelope_from",
 		&svinst->redirect_from);
@@ -239,6 +245,44 @@ void sieve_settings_load
 			svinst->redirect_duplicate_period = (unsigned int)period;
 	}
 
+	svinst->threaded_interpreter = FALSE;
+	str_setting = sieve_setting_get(svinst, "sieve_interpreter_dispatch");
+	if ( str_setting != NULL && *str_setting != '\0' ) {
+		if ( strcasecmp(str_setting, "threaded") == 0 ) {
+			svinst->threaded_interpreter = TRUE;
+		} else if ( strcasecmp(str_setting, "classic") != 0 ) {
+			sieve_sys_warning(svinst,
+				"Invalid value for setting "
+				"`sieve_interpreter_dispatch': `%s'", str_setting);
+		}
+	}
+
+	svinst->binary_cache_size = SIEVE_DEFAULT_BINARY_CACHE_SIZE;
+	if ( sieve_setting_get_uint_value
+		(svinst, "sieve_binary_cache_size", &uint_setting) ) {
+		svinst->binary_cache_size = (unsigned int) uint_setting;
+	}
+
+	svinst->binary_shared_dir = NULL;
+	str_setting = sieve_setting_get(svinst, "sieve_binary_shared_dir");
+	if ( str_setting != NULL && *str_setting != '\0' ) {
+		if ( *str_setting != '/' ) {
+			sieve_sys_warning(svinst,
+				"Setting `sieve_binary_shared_dir' must be an absolute path: "
+				"`%s'", str_setting);
+		} else {
+			svinst->binary_shared_dir = p_strdup(svinst->pool, str_setting);
+		}
+	}
+
+	svinst->storage_generation = FALSE;
+	(void)sieve_setting_get_bool_value
+		(svinst, "sieve_storage_generation", &svinst->storage_generation);
+
+	svinst->binary_mmap = TRUE;
+	(void)sieve_setting_get_bool_value
+		(svinst, "sieve_binary_mmap", &svinst->binary_mmap);
+
 	str_setting = sieve_setting_get(svinst, "sieve_user_email");
 	if ( str_setting != NULL && *str_setting != '\0' ) {
 		svinst->user_email =
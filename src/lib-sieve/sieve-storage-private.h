@@ -35,6 +35,10 @@ struct sieve_storage_vfuncs {
 	void (*set_modified)
 		(struct sieve_storage *storage, time_t mtime);
 
+	int (*get_generation)
+		(struct sieve_storage *storage, const char **generation_r);
+	void (*bump_generation)(struct sieve_storage *storage);
+
 	int (*is_singular)(struct sieve_storage *storage);
 
 	/* script access */
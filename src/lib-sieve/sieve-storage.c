@@ -688,6 +688,27 @@ void sieve_storage_set_modified
 	storage->v.set_modified(storage, mtime);
 }
 
+int sieve_storage_get_generation
+(struct sieve_storage *storage, const char **generation_r)
+{
+	*generation_r = NULL;
+
+	if ( !storage->svinst->storage_generation ||
+		storage->v.get_generation == NULL )
+		return 0;
+
+	return storage->v.get_generation(storage, generation_r);
+}
+
+void sieve_storage_bump_generation(struct sieve_storage *storage)
+{
+	if ( !storage->svinst->storage_generation ||
+		storage->v.bump_generation == NULL )
+		return;
+
+	storage->v.bump_generation(storage);
+}
+
 /*
  * Script access
  */
@@ -1206,6 +1227,7 @@ int sieve_storage_save_commit(struct sieve_storage_save_context **_sctx)
 
 	/* set INBOX mailbox attribute */
 	if ( ret >= 0 ) {
+		sieve_storage_bump_generation(storage);
 		(void)sieve_storage_sync_script_save(storage, scriptname);
 	}
 
@@ -1233,16 +1255,28 @@ int sieve_storage_save_as_active
 (struct sieve_storage *storage, struct istream *input,
 	time_t mtime)
 {
+	int ret;
+
 	i_assert( storage->v.save_as_active != NULL );
-	return storage->v.save_as_active(storage, input, mtime);
+	ret = storage->v.save_as_active(storage, input, mtime);
+
+	if ( ret >= 0 )
+		sieve_storage_bump_generation(storage);
+	return ret;
 }
 
 int sieve_storage_save_as
 (struct sieve_storage *storage, struct istream *input,
 	const char *name)
 {
+	int ret;
+
 	i_assert( storage->v.save_as != NULL );
-	return storage->v.save_as(storage, input, name);
+	ret = storage->v.save_as(storage, input, name);
+
+	if ( ret >= 0 )
+		sieve_storage_bump_generation(storage);
+	return ret;
 }
 
 /*
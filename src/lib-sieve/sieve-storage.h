@@ -194,4 +194,11 @@ int sieve_storage_get_last_change
 void sieve_storage_set_modified
 	(struct sieve_storage *storage, time_t mtime);
 
+/* Storage generation: changes whenever a script is saved, renamed or deleted
+   through this API. Returns 0 when the storage has no generation (yet) or when
+   it is not enabled by the sieve_storage_generation setting. */
+int sieve_storage_get_generation
+	(struct sieve_storage *storage, const char **generation_r);
+void sieve_storage_bump_generation(struct sieve_storage *storage);
+
 #endif
@@ -118,7 +118,9 @@ enum sieve_compile_flags {
 	/* Script is being activated (usually through ManageSieve) */
 	SIEVE_COMPILE_FLAG_ACTIVATED = (1<<2),
 	/* Compiled for environment with no access to envelope */
-	SIEVE_COMPILE_FLAG_NO_ENVELOPE = (1<<3)
+	SIEVE_COMPILE_FLAG_NO_ENVELOPE = (1<<3),
+	/* Thread jumps and drop unreachable code while generating */
+	SIEVE_COMPILE_FLAG_OPTIMIZE = (1<<4)
 };
 
 /*
@@ -225,6 +227,10 @@ struct sieve_script_env {
 	int (*reject_mail)(const struct sieve_script_env *senv,
 		const char *recipient, const char *reason);
 
+	/* Mailboxes kept open across messages (optional; see
+	   sieve_store_cache_create()) */
+	struct sieve_store_cache *store_cache;
+
 	/* Execution status record */
 	struct sieve_exec_status *exec_status;
 
@@ -250,6 +256,20 @@ struct sieve_exec_status {
 	bool store_failed:1;
 };
 
+/*
+ * Execution profile
+ */
+
+/* Time spent in the message-dependent phases of script execution. These
+   accumulate over all executions while the profile is set. Matching that
+   happens while body parts are streamed is accounted as matching, not as
+   body extraction. */
+struct sieve_profile {
+	long long header_usecs; /* fetching header fields */
+	long long body_usecs;   /* extracting body parts */
+	long long match_usecs;  /* matching values against keys */
+};
+
 /*
  * Execution exit codes
  */
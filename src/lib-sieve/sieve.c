@@ -3,6 +3,7 @@
 
 #include "lib.h"
 #include "str.h"
+#include "array.h"
 #include "istream.h"
 #include "ostream.h"
 #include "buffer.h"
@@ -16,10 +17,12 @@
 #include "sieve-plugins.h"
 
 #include "sieve-address.h"
-#include "sieve-script.h"
+#include "sieve-script-private.h"
 #include "sieve-storage-private.h"
 #include "sieve-ast.h"
 #include "sieve-binary.h"
+#include "sieve-binary-cache.h"
+#include "sieve-binary-shared.h"
 #include "sieve-actions.h"
 #include "sieve-result.h"
 
@@ -38,6 +41,7 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <stdio.h>
+#include <time.h>
 #include <dirent.h>
 
 /*
@@ -102,6 +106,8 @@ struct sieve_instance *sieve_init
 
 	sieve_settings_load(svinst);
 
+	sieve_binary_cache_init(svinst);
+
 	/* Initialize extensions */
 	if ( !sieve_extensions_init(svinst) ) {
 		sieve_deinit(&svinst);
@@ -124,6 +130,7 @@ void sieve_deinit(struct sieve_instance **_svinst)
 {
 	struct sieve_instance *svinst = *_svinst;
 
+	sieve_binary_cache_instance_deinit(svinst);
 	sieve_plugins_unload(svinst);
 	sieve_storages_deinit(svinst);
 	sieve_extensions_deinit(svinst);
@@ -133,6 +140,12 @@ void sieve_deinit(struct sieve_instance **_svinst)
 	*_svinst = NULL;
 }
 
+void sieve_process_deinit(void)
+{
+	sieve_extensions_process_deinit();
+	sieve_binary_cache_deinit();
+}
+
 void sieve_set_extensions
 (struct sieve_instance *svinst, const char *extensions)
 {
@@ -368,9 +381,10 @@ struct sieve_binary *sieve_open_script
 {
 	struct sieve_instance *svinst = sieve_script_svinst(script);
 	struct sieve_binary *sbin;
+	const char *shared_digest;
 
 	T_BEGIN {
-		/* Then try to open the matching binary */
+		/* First try to open the matching binary */
 		sbin = sieve_script_binary_load(script, error_r);
 
 		if (sbin != NULL) {
@@ -393,18 +407,46 @@ struct sieve_binary *sieve_open_script
 		if ( sbin != NULL ) {
 			if ( svinst->debug ) {
 				sieve_sys_debug(svinst,
-					"Script binary %s successfully loaded",
-					sieve_binary_path(sbin));
+					"Script binary %s successfully loaded%s",
+					sieve_binary_path(sbin),
+					( sieve_binary_cached(sbin) ? " from cache" : "" ));
 			}
 
 		} else {
-			sbin = sieve_compile_script(script, ehandler, flags, error_r);
+			/* Users with the same script may share a single binary */
+			shared_digest = sieve_binary_shared_get_digest(script, flags);
+			if ( shared_digest != NULL )
+				sbin = sieve_binary_shared_open(script, shared_digest);
 
 			if ( sbin != NULL ) {
 				if ( svinst->debug ) {
 					sieve_sys_debug(svinst,
-						"Script `%s' from %s successfully compiled",
-						sieve_script_name(script), sieve_script_location(script));
+						"Shared script binary %s successfully loaded",
+						sieve_binary_path(sbin));
+				}
+			} else {
+				sbin = sieve_compile_script(script, ehandler, flags, error_r);
+
+				if ( sbin != NULL ) {
+					if ( svinst->debug ) {
+						sieve_sys_debug(svinst,
+							"Script `%s' from %s successfully compiled",
+							sieve_script_name(script), sieve_script_location(script));
+					}
+
+					/* Store it for others and use the stored copy, so that no
+					 * per-user binary needs to be saved.
+					 */
+					if ( shared_digest != NULL &&
+						sieve_binary_shared_save(sbin, shared_digest) > 0 ) {
+						struct sieve_binary *shared_sbin =
+							sieve_binary_shared_open(script, shared_digest);
+
+						if ( shared_sbin != NULL ) {
+							sieve_binary_unref(&sbin);
+							sbin = shared_sbin;
+						}
+					}
 				}
 			}
 		}
@@ -458,6 +500,30 @@ bool sieve_is_loaded(struct sieve_binary *sbin)
 	return sieve_binary_loaded(sbin);
 }
 
+bool sieve_get_header_names
+(struct sieve_binary *sbin, ARRAY_TYPE(const_string) *header_names)
+{
+	const char *const *names, *const *hdrp;
+	unsigned int count, i;
+
+	if ( !sieve_binary_get_header_names(sbin, &names, &count) )
+		return FALSE;
+
+	for ( i = 0; i < count; i++ ) {
+		bool found = FALSE;
+
+		array_foreach(header_names, hdrp) {
+			if ( strcasecmp(*hdrp, names[i]) == 0 ) {
+				found = TRUE;
+				break;
+			}
+		}
+		if ( !found )
+			array_append(header_names, &names[i], 1);
+	}
+	return TRUE;
+}
+
 int sieve_save_as
 (struct sieve_binary *sbin, const char *bin_path, bool update,
 	mode_t save_mode, enum sieve_error *error_r)
@@ -473,6 +539,10 @@ int sieve_save
 {
 	struct sieve_script *script = sieve_binary_script(sbin);
 
+	/* Binaries from the shared store are not bound to any script storage */
+	if ( sieve_binary_shared(sbin) )
+		return 0;
+
 	if ( script == NULL ) {
 		return sieve_binary_save(sbin, NULL, update, 0600, error_r);
 	}
@@ -480,6 +550,46 @@ int sieve_save
 	return sieve_script_binary_save(script, sbin, update, error_r);
 }
 
+static int sieve_precompile_script_binary
+(struct sieve_script *script, struct sieve_error_handler *ehandler,
+	enum sieve_compile_flags flags, enum sieve_error *error_r)
+{
+	struct sieve_binary *sbin;
+	int ret;
+
+	if ( (sbin=sieve_open_script(script, ehandler, flags, error_r)) == NULL )
+		return -1;
+
+	ret = sieve_save(sbin, FALSE, error_r);
+	sieve_close(&sbin);
+	return ret;
+}
+
+int sieve_precompile_script
+(struct sieve_script *script, struct sieve_error_handler *ehandler,
+	enum sieve_compile_flags flags, enum sieve_error *error_r)
+{
+	struct sieve_storage *storage = script->storage;
+	struct sieve_script *active;
+	int ret;
+
+	ret = sieve_precompile_script_binary(script, ehandler, flags, error_r);
+	if ( ret < 0 || sieve_script_is_active(script) != 0 )
+		return ret;
+
+	/* The active script may include this one, in which case its binary is now
+	 * outdated. Opening it detects that and compiles it anew. Other scripts
+	 * are only executed through the active one, so their binaries are
+	 * brought up to date once they are activated or executed.
+	 */
+	if ( (active=sieve_storage_active_script_open(storage, NULL)) == NULL )
+		return ret;
+
+	(void)sieve_precompile_script_binary(active, ehandler, flags, NULL);
+	sieve_script_unref(&active);
+	return ret;
+}
+
 void sieve_close(struct sieve_binary **sbin)
 {
 	sieve_binary_unref(sbin);
@@ -824,6 +934,25 @@ int sieve_multiscript_finish(struct sieve_multiscript **_mscript,
 	return ret;
 }
 
+/*
+ * Profiling
+ */
+
+void sieve_set_profile
+(struct sieve_instance *svinst, struct sieve_profile *profile)
+{
+	svinst->profile = profile;
+}
+
+long long sieve_profile_usecs(void)
+{
+	struct timespec ts;
+
+	if ( clock_gettime(CLOCK_MONOTONIC, &ts) < 0 )
+		i_fatal("clock_gettime(CLOCK_MONOTONIC) failed: %m");
+	return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
 /*
  * Configured Limits
  */
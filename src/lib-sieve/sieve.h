@@ -28,6 +28,13 @@ struct sieve_instance *sieve_init
  */
 void sieve_deinit(struct sieve_instance **_svinst);
 
+/* sieve_process_deinit():
+ *   Frees the state that is shared by all Sieve instances in the process, such
+ *   as caches that need to survive the per-delivery instances of LDA and LMTP.
+ *   Call this once when the process or plugin is done with Sieve.
+ */
+void sieve_process_deinit(void);
+
 /* sieve_get_capabilities():
  *
  */
@@ -113,6 +120,19 @@ int sieve_save_as
 int sieve_save
 	(struct sieve_binary *sbin, bool update, enum sieve_error *error_r);
 
+/* sieve_precompile_script:
+ *
+ *  Opens or compiles the script the way it is done when it is executed and
+ *  saves the resulting binary to its default location, so that the script is
+ *  not compiled anew at its first execution. When the script is not the
+ *  active script of its storage, the binary of the active script is brought
+ *  up to date as well, because it may include this script.
+ */
+int sieve_precompile_script
+	(struct sieve_script *script, struct sieve_error_handler *ehandler,
+		enum sieve_compile_flags flags, enum sieve_error *error_r)
+		ATTR_NULL(2, 4);
+
 /* sieve_close:
  *
  *   Closes a compiled/opened sieve binary.
@@ -132,6 +152,17 @@ const char *sieve_get_source(struct sieve_binary *sbin);
  */
 bool sieve_is_loaded(struct sieve_binary *sbin);
 
+/*
+ * sieve_get_header_names:
+ *
+ *   Adds the names of the header fields the binary can access to the array,
+ *   so that these can be prefetched before execution. Returns FALSE when the
+ *   binary can access any header field, e.g. because a header name is only
+ *   known at runtime.
+ */
+bool sieve_get_header_names
+	(struct sieve_binary *sbin, ARRAY_TYPE(const_string) *header_names);
+
 /*
  * Debugging
  */
@@ -213,6 +244,18 @@ int sieve_multiscript_finish
 		struct sieve_error_handler *action_ehandler,
 		enum sieve_execute_flags flags, bool *keep);
 
+/*
+ * Profiling
+ */
+
+/* sieve_set_profile():
+ *   Starts accumulating execution timings into the provided profile (see
+ *   sieve-types.h); NULL stops profiling.
+ */
+void sieve_set_profile
+	(struct sieve_instance *svinst, struct sieve_profile *profile)
+	ATTR_NULL(2);
+
 /*
  * Configured limits
  */
@@ -2,12 +2,14 @@
  */
 
 #include "lib.h"
+#include "str.h"
 #include "path-util.h"
 #include "home-expand.h"
 #include "ioloop.h"
 #include "mkdir-parents.h"
 #include "eacces-error.h"
 #include "unlink-old-files.h"
+#include "safe-mkstemp.h"
 #include "mail-storage-private.h"
 
 #include "sieve.h"
@@ -863,6 +865,72 @@ static void sieve_file_storage_set_modified
 	}
 }
 
+/*
+ * Generation
+ */
+
+static int sieve_file_storage_get_generation
+(struct sieve_storage *storage, const char **generation_r)
+{
+	struct sieve_file_storage *fstorage =
+		(struct sieve_file_storage *)storage;
+	const char *path = sieve_file_storage_path_extend
+		(fstorage, SIEVE_FILE_STORAGE_GENERATION_FILE);
+	struct stat st;
+
+	if ( stat(path, &st) < 0 ) {
+		if ( errno == ENOENT )
+			return 0;
+		sieve_storage_sys_error(storage,
+			"stat(%s) failed: %m", path);
+		return -1;
+	}
+
+	/* The file is replaced rather than modified, so its inode changes even
+	   when the mtime resolution is too coarse to tell saves apart */
+	*generation_r = t_strdup_printf("%llu.%lld.%lu",
+		(unsigned long long)st.st_ino, (long long)st.st_mtime,
+		(unsigned long)ST_MTIME_NSEC(st));
+	return 1;
+}
+
+static void sieve_file_storage_bump_generation
+(struct sieve_storage *storage)
+{
+	struct sieve_file_storage *fstorage =
+		(struct sieve_file_storage *)storage;
+	const char *path = sieve_file_storage_path_extend
+		(fstorage, SIEVE_FILE_STORAGE_GENERATION_FILE);
+	string_t *temp_path;
+	int fd;
+
+	temp_path = t_str_new(256);
+	str_append(temp_path, path);
+	str_append_c(temp_path, '.');
+	fd = safe_mkstemp_hostpid(temp_path, fstorage->file_create_mode,
+		(uid_t)-1, (gid_t)-1);
+	if ( fd < 0 ) {
+		if ( errno == EACCES ) {
+			sieve_storage_sys_error(storage, "%s",
+				eacces_error_get_creating("open", str_c(temp_path)));
+		} else {
+			sieve_storage_sys_error(storage,
+				"open(%s) failed: %m", str_c(temp_path));
+		}
+		return;
+	}
+	if ( close(fd) < 0 ) {
+		sieve_storage_sys_error(storage,
+			"close(%s) failed: %m", str_c(temp_path));
+	}
+
+	if ( rename(str_c(temp_path), path) < 0 ) {
+		sieve_storage_sys_error(storage,
+			"rename(%s, %s) failed: %m", str_c(temp_path), path);
+		i_unlink(str_c(temp_path));
+	}
+}
+
 /*
  * Script access
  */
@@ -895,6 +963,8 @@ const struct sieve_storage sieve_file_storage = {
 
 		.get_last_change = sieve_file_storage_get_last_change,
 		.set_modified = sieve_file_storage_set_modified,
+		.get_generation = sieve_file_storage_get_generation,
+		.bump_generation = sieve_file_storage_bump_generation,
 
 		.is_singular = sieve_file_storage_is_singular,
 
@@ -23,6 +23,9 @@
 /* Delete files having ctime older than this from tmp/. 36h is standard. */
 #define SIEVE_FILE_STORAGE_TMP_DELETE_SECS (36*60*60)
 
+/* Replaced whenever a script is changed through the storage, when enabled */
+#define SIEVE_FILE_STORAGE_GENERATION_FILE ".dovecot-sieve-generation"
+
 /*
  * Storage class
  */
@@ -55,8 +55,6 @@ const struct sieve_command_def tst_address = {
 
 static bool tst_address_operation_dump
 	(const struct sieve_dumptime_env *denv, sieve_size_t *address);
-static int tst_address_operation_execute
-	(const struct sieve_runtime_env *renv, sieve_size_t *address);
 
 const struct sieve_operation_def tst_address_operation = {
 	.mnemonic = "ADDRESS",
@@ -200,6 +198,9 @@ static bool tst_address_generate
 {
 	sieve_operation_emit(cgenv->sblock, NULL, &tst_address_operation);
 
+	/* Record the accessed header fields */
+	sieve_generate_header_names(cgenv, tst->first_positional);
+
 	/* Generate arguments */
 	return sieve_generate_arguments(cgenv, tst, NULL);
 }
@@ -227,7 +228,7 @@ static bool tst_address_operation_dump
  * Code execution
  */
 
-static int tst_address_operation_execute
+int tst_address_operation_execute
 (const struct sieve_runtime_env *renv, sieve_size_t *address)
 {
 	struct sieve_comparator cmp =
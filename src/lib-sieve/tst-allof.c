@@ -91,8 +91,8 @@ static bool tst_allof_generate
 
 		if ( jump_true ) {
 			/* All tests succeeded, jump to case TRUE */
-			sieve_operation_emit(cgenv->sblock, NULL, &sieve_jmp_operation);
-			sieve_jumplist_add(jumps, sieve_binary_emit_offset(sblock, 0));
+			sieve_jumplist_add(jumps,
+				sieve_generate_jump(cgenv, &sieve_jmp_operation));
 
 			/* All false exits jump here */
 			sieve_jumplist_resolve(&false_jumps);
@@ -91,8 +91,8 @@ static bool tst_anyof_generate
 
 		if ( !jump_true ) {
 			/* All tests failed, jump to case FALSE */
-			sieve_operation_emit(sblock, NULL, &sieve_jmp_operation);
-			sieve_jumplist_add(jumps, sieve_binary_emit_offset(sblock, 0));
+			sieve_jumplist_add(jumps,
+				sieve_generate_jump(cgenv, &sieve_jmp_operation));
 
 			/* All true exits jump here */
 			sieve_jumplist_resolve(&true_jumps);
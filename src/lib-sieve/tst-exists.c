@@ -43,8 +43,6 @@ const struct sieve_command_def tst_exists = {
 
 static bool tst_exists_operation_dump
 	(const struct sieve_dumptime_env *denv, sieve_size_t *address);
-static int tst_exists_operation_execute
-	(const struct sieve_runtime_env *renv, sieve_size_t *address);
 
 const struct sieve_operation_def tst_exists_operation = {
 	.mnemonic = "EXISTS",
@@ -82,6 +80,9 @@ static bool tst_exists_generate
 {
 	sieve_operation_emit(cgenv->sblock, NULL, &tst_exists_operation);
 
+	/* Record the accessed header fields */
+	sieve_generate_header_names(cgenv, tst->first_positional);
+
  	/* Generate arguments */
     return sieve_generate_arguments(cgenv, tst, NULL);
 }
@@ -107,7 +108,7 @@ static bool tst_exists_operation_dump
  * Code execution
  */
 
-static int tst_exists_operation_execute
+int tst_exists_operation_execute
 (const struct sieve_runtime_env *renv, sieve_size_t *address)
 {
 	struct sieve_stringlist *hdr_list;
@@ -49,8 +49,6 @@ const struct sieve_command_def tst_size = {
 
 static bool tst_size_operation_dump
 	(const struct sieve_dumptime_env *denv, sieve_size_t *address);
-static int tst_size_operation_execute
-	(const struct sieve_runtime_env *renv, sieve_size_t *address);
 
 const struct sieve_operation_def tst_size_over_operation = {
 	.mnemonic = "SIZE-OVER",
@@ -241,7 +239,7 @@ static inline bool tst_size_get
 	return TRUE;
 }
 
-static int tst_size_operation_execute
+int tst_size_operation_execute
 (const struct sieve_runtime_env *renv, sieve_size_t *address)
 {
 	sieve_number_t mail_size, limit;
@@ -82,8 +82,8 @@ static bool tst_false_generate
 	struct sieve_jumplist *jumps, bool jump_true)
 {
 	if ( !jump_true ) {
-		sieve_operation_emit(cgenv->sblock, NULL, &sieve_jmp_operation);
-		sieve_jumplist_add(jumps, sieve_binary_emit_offset(cgenv->sblock, 0));
+		sieve_jumplist_add(jumps,
+			sieve_generate_jump(cgenv, &sieve_jmp_operation));
 	}
 
 	return TRUE;
@@ -95,8 +95,8 @@ static bool tst_true_generate
 	struct sieve_jumplist *jumps, bool jump_true)
 {
 	if ( jump_true ) {
-		sieve_operation_emit(cgenv->sblock, NULL, &sieve_jmp_operation);
-		sieve_jumplist_add(jumps, sieve_binary_emit_offset(cgenv->sblock, 0));
+		sieve_jumplist_add(jumps,
+			sieve_generate_jump(cgenv, &sieve_jmp_operation));
 	}
 
 	return TRUE;
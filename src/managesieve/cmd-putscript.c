@@ -143,6 +143,22 @@ static bool cmd_putscript_cancel(struct cmd_putscript_context *ctx, bool skip)
 	return cmd_putscript_continue_cancel(ctx->cmd);
 }
 
+static void cmd_putscript_precompile(struct cmd_putscript_context *ctx)
+{
+	struct sieve_script *script;
+
+	/* Store the binary the way delivery compiles the script, so that
+	 * deliveries need not compile it; failure only means they will.
+	 */
+	script = sieve_storage_open_script(ctx->storage, ctx->scriptname, NULL);
+	if ( script == NULL )
+		return;
+
+	(void)sieve_precompile_script
+		(script, NULL, SIEVE_COMPILE_FLAG_NOGLOBAL, NULL);
+	sieve_script_unref(&script);
+}
+
 static bool cmd_putscript_finish_parsing(struct client_command_context *cmd)
 {
 	struct client *client = cmd->client;
@@ -244,6 +260,8 @@ static bool cmd_putscript_finish_parsing(struct client_command_context *cmd)
 					if (ret < 0) {
 						client_send_storage_error(client, ctx->storage);
 						success = FALSE;
+					} else {
+						cmd_putscript_precompile(ctx);
 					}
 				}
 			}
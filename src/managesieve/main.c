@@ -19,6 +19,8 @@
 #include "mail-user.h"
 #include "mail-storage-service.h"
 
+#include "sieve.h"
+
 #include "managesieve-common.h"
 #include "managesieve-commands.h"
 #include "managesieve-capabilities.h"
@@ -342,6 +344,7 @@ int main(int argc, char *argv[])
 	mail_storage_service_deinit(&storage_service);
 
 	commands_deinit();
+	sieve_process_deinit();
 
 	master_service_deinit(&master_service);
 	return 0;
@@ -113,6 +113,20 @@ static int cmd_sieve_put_run
 	if ( save_ctx != NULL )
 		sieve_storage_save_cancel(&save_ctx);
 
+	/* Store the binary the way delivery compiles the script, so that
+	 * deliveries need not compile it; failure only means they will.
+	 */
+	if ( ret == 0 ) {
+		struct sieve_script *script = sieve_storage_open_script
+			(storage, ctx->scriptname, NULL);
+
+		if ( script != NULL ) {
+			(void)sieve_precompile_script
+				(script, NULL, SIEVE_COMPILE_FLAG_NOGLOBAL, NULL);
+			sieve_script_unref(&script);
+		}
+	}
+
 	if ( ctx->activate && ret == 0 ) {
 		struct sieve_script *script = sieve_storage_open_script
 			(storage, ctx->scriptname, NULL);
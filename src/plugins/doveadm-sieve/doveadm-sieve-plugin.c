@@ -21,4 +21,6 @@ void doveadm_sieve_plugin_deinit(void)
 {
 	/* the hooks array is freed already */
 	/*mail_storage_hooks_remove(&doveadm_sieve_mail_storage_hooks);*/
+
+	sieve_process_deinit();
 }
@@ -570,8 +570,17 @@ imap_sieve_mailbox_run_copy_source(
 
 	i_assert(ismt->src_mail_trans->box == src_box);
 
-	if (*src_mail == NULL)
-		*src_mail = mail_alloc(ismt->src_mail_trans, 0, NULL);
+	if (*src_mail == NULL) {
+		enum mail_fetch_field wanted_fields;
+		struct mailbox_header_lookup_ctx *headers_ctx;
+
+		imap_sieve_run_get_wanted_fields
+			(isrun, src_box, &wanted_fields, &headers_ctx);
+		*src_mail = mail_alloc(ismt->src_mail_trans,
+			wanted_fields, headers_ctx);
+		if (headers_ctx != NULL)
+			mailbox_header_lookup_unref(&headers_ctx);
+	}
 
 	/* Select source message */
 	if (!mail_set_uid(*src_mail, mevent->src_mail_uid)) {
@@ -599,14 +608,11 @@ imap_sieve_mailbox_transaction_run(
 	struct mailbox *dest_box,
 	struct mail_transaction_commit_changes *changes)
 {
-	static const char *wanted_headers[] = {
-		"From", "To", "Message-ID", "Subject", "Return-Path",
-		NULL
-	};
 	struct mailbox *src_box = ismt->src_box;
 	struct mail_user *user = dest_box->storage->user;
 	struct imap_sieve_user *isuser = 	IMAP_SIEVE_USER_CONTEXT(user);
 	const struct imap_sieve_mailbox_event *mevent;
+	enum mail_fetch_field wanted_fields;
 	struct mailbox_header_lookup_ctx *headers_ctx;
 	struct mailbox_transaction_context *st;
 	struct mailbox *sbox;
@@ -723,9 +729,11 @@ imap_sieve_mailbox_transaction_run(
 
 	/* Create transaction for event messages */
 	st = mailbox_transaction_begin(sbox, 0);
-	headers_ctx = mailbox_header_lookup_init(sbox, wanted_headers);
-	mail = mail_alloc(st, 0, headers_ctx);
-	mailbox_header_lookup_unref(&headers_ctx);
+	imap_sieve_run_get_wanted_fields
+		(isrun, sbox, &wanted_fields, &headers_ctx);
+	mail = mail_alloc(st, wanted_fields, headers_ctx);
+	if (headers_ctx != NULL)
+		mailbox_header_lookup_unref(&headers_ctx);
 
 	/* Iterate through all events */
 	seq_range_array_iter_init(&siter, &changes->saved_uids);
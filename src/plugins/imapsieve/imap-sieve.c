@@ -2,6 +2,7 @@
  */
 
 #include "lib.h"
+#include "array.h"
 #include "home-expand.h"
 #include "mail-storage.h"
 #include "mail-user.h"
@@ -482,6 +483,65 @@ imap_sieve_run_open_script(
 	return sbin;
 }
 
+static bool
+imap_sieve_run_get_header_names(struct imap_sieve_run *isrun,
+	ARRAY_TYPE(const_string) *header_names)
+{
+	enum sieve_compile_flags cpflags;
+	unsigned int i;
+
+	for (i = 0; i < isrun->scripts_count; i++) {
+		struct imap_sieve_run_script *script = &isrun->scripts[i];
+
+		/* Open the binary ahead of execution */
+		if (script->binary == NULL) {
+			if (script->compile_error != SIEVE_ERROR_NONE)
+				break;
+
+			if (script->script == isrun->user_script)
+				cpflags = SIEVE_COMPILE_FLAG_NOGLOBAL;
+			else
+				cpflags = SIEVE_COMPILE_FLAG_NO_ENVELOPE;
+			script->binary = imap_sieve_run_open_script(isrun,
+				script->script, cpflags, FALSE, &script->compile_error);
+
+			/* Execution stops at this script anyway */
+			if (script->binary == NULL)
+				break;
+		}
+
+		if (!sieve_get_header_names(script->binary, header_names))
+			return FALSE;
+	}
+	return TRUE;
+}
+
+void imap_sieve_run_get_wanted_fields(struct imap_sieve_run *isrun,
+	struct mailbox *box, enum mail_fetch_field *fields_r,
+	struct mailbox_header_lookup_ctx **headers_r)
+{
+	*fields_r = 0;
+	*headers_r = NULL;
+
+	T_BEGIN {
+		ARRAY_TYPE(const_string) header_names;
+		const char *message_id = "Message-ID";
+
+		/* The Message-ID is always read for the message data */
+		t_array_init(&header_names, 16);
+		array_append(&header_names, &message_id, 1);
+
+		if (!imap_sieve_run_get_header_names(isrun, &header_names)) {
+			/* A script can access any header field */
+			*fields_r = MAIL_FETCH_STREAM_HEADER;
+		} else {
+			(void)array_append_space(&header_names);
+			*headers_r = mailbox_header_lookup_init(box,
+				array_idx(&header_names, 0));
+		}
+	} T_END;
+}
+
 static int imap_sieve_handle_exec_status
 (struct imap_sieve_run *isrun,
 	struct sieve_script *script, int status, bool keep,
@@ -54,6 +54,12 @@ int imap_sieve_run_init(struct imap_sieve *isieve,
 	struct imap_sieve_run **isrun_r)
 	ATTR_NULL(4, 5, 6);
 
+/* Opens the scripts and determines which parts of the message they need; the
+   returned header lookup context (if any) must be unreferenced by the caller. */
+void imap_sieve_run_get_wanted_fields(struct imap_sieve_run *isrun,
+	struct mailbox *box, enum mail_fetch_field *fields_r,
+	struct mailbox_header_lookup_ctx **headers_r);
+
 int imap_sieve_run_mail
 (struct imap_sieve_run *isrun, struct mail *mail,
 	const char *changed_flags);
@@ -408,6 +408,30 @@ static int lda_sieve_handle_exec_status
 	return ret;
 }
 
+static void lda_sieve_prefetch_headers
+(struct lda_sieve_run_context *srctx, struct sieve_binary *sbin)
+{
+	struct mail *mail = srctx->msgdata->mail;
+
+	T_BEGIN {
+		ARRAY_TYPE(const_string) header_names;
+		struct mailbox_header_lookup_ctx *headers_ctx;
+
+		t_array_init(&header_names, 16);
+		if ( !sieve_get_header_names(sbin, &header_names) ) {
+			/* Script can access any header field */
+			mail_add_temp_wanted_fields
+				(mail, MAIL_FETCH_STREAM_HEADER, NULL);
+		} else if ( array_count(&header_names) > 0 ) {
+			(void)array_append_space(&header_names);
+			headers_ctx = mailbox_header_lookup_init
+				(mail->box, array_idx(&header_names, 0));
+			mail_add_temp_wanted_fields(mail, 0, headers_ctx);
+			mailbox_header_lookup_unref(&headers_ctx);
+		}
+	} T_END;
+}
+
 static int lda_sieve_execute_scripts
 (struct lda_sieve_run_context *srctx)
 {
@@ -485,6 +509,10 @@ static int lda_sieve_execute_scripts
 			break;
 		}
 
+		/* Prefetch the header fields used by the script */
+
+		lda_sieve_prefetch_headers(srctx, sbin);
+
 		/* Execute */
 
 		if ( debug ) {
@@ -942,4 +970,7 @@ void sieve_plugin_deinit(void)
 {
 	/* Remove hook */
 	mail_deliver_hook_set(next_deliver_mail);
+
+	/* Free caches shared by the per-delivery Sieve instances */
+	sieve_process_deinit();
 }
@@ -3,6 +3,7 @@
 
 #include "lib.h"
 #include "array.h"
+#include "ostream.h"
 #include "master-service.h"
 #include "master-service-settings.h"
 #include "mail-storage-service.h"
@@ -27,11 +28,52 @@
 static void print_help(void)
 {
 	printf(
-"Usage: sieve-dump [-c <config-file>] [-D] [-h] [-P <plugin>] [-x <extensions>]\n"
-"                  <sieve-binary> [<out-file>]\n"
+"Usage: sieve-dump [-c <config-file>] [-D] [-h] [-O] [-P <plugin>]\n"
+"                  [-x <extensions>] <sieve-binary> [<out-file>]\n"
 	);
 }
 
+/*
+ * Optimizer comparison
+ */
+
+static int dump_optimized
+(struct sieve_instance *svinst, const char *scriptfile, const char *outfile)
+{
+	static const struct {
+		const char *title;
+		enum sieve_compile_flags flags;
+	} passes[] = {
+		{ "Unoptimized", 0 },
+		{ "Optimized", SIEVE_COMPILE_FLAG_OPTIMIZE }
+	};
+	struct ostream *dumpstream;
+	struct sieve_binary *sbin;
+	unsigned int i;
+
+	dumpstream = sieve_tool_open_output_stream(outfile);
+	if ( dumpstream == NULL )
+		i_fatal("Failed to create stream for sieve code dump.");
+
+	for ( i = 0; i < N_ELEMENTS(passes); i++ ) {
+		sbin = sieve_tool_script_compile
+			(svinst, scriptfile, NULL, passes[i].flags);
+
+		o_stream_nsend_str(dumpstream, t_strdup_printf(
+			"%s## %s code:\n\n", (i > 0 ? "\n" : ""), passes[i].title));
+		(void)sieve_dump(sbin, dumpstream, FALSE);
+
+		sieve_close(&sbin);
+	}
+
+	if (o_stream_nfinish(dumpstream) < 0) {
+		i_fatal("write(%s) failed: %s", outfile,
+			o_stream_get_error(dumpstream));
+	}
+	o_stream_destroy(&dumpstream);
+	return EXIT_SUCCESS;
+}
+
 /*
  * Tool implementation
  */
@@ -41,11 +83,11 @@ int main(int argc, char **argv)
 	struct sieve_instance *svinst;
 	struct sieve_binary *sbin;
 	const char *binfile, *outfile;
-	bool hexdump = FALSE;
+	bool hexdump = FALSE, optimize = FALSE;
 	int exit_status = EXIT_SUCCESS;
 	int c;
 
-	sieve_tool = sieve_tool_init("sieve-dump", &argc, &argv, "DhP:x:", FALSE);
+	sieve_tool = sieve_tool_init("sieve-dump", &argc, &argv, "DhOP:x:", FALSE);
 
 	outfile = NULL;
 
@@ -55,6 +97,10 @@ int main(int argc, char **argv)
 			/* produce hexdump */
 			hexdump = TRUE;
 			break;
+		case 'O':
+			/* compare code before and after optimization */
+			optimize = TRUE;
+			break;
 		default:
 			print_help();
 			i_fatal_status(EX_USAGE, "Unknown argument: %c", c);
@@ -79,6 +125,15 @@ int main(int argc, char **argv)
         /* Enable debug extension */
         sieve_enable_debug_extension(svinst);
 
+	if ( optimize ) {
+		/* The argument is a script; dump its code before and after
+		   optimization */
+		exit_status = dump_optimized
+			(svinst, binfile, outfile == NULL ? "-" : outfile);
+		sieve_tool_deinit(&sieve_tool);
+		return exit_status;
+	}
+
 	/* Dump binary */
 	sbin = sieve_load(svinst, binfile, NULL);
 	if ( sbin != NULL ) {
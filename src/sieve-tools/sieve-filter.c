@@ -7,8 +7,15 @@
 #include "env-util.h"
 #include "str.h"
 #include "str-sanitize.h"
+#include "strnum.h"
+#include "istream.h"
 #include "ostream.h"
+#include "read-full.h"
+#include "write-full.h"
 #include "array.h"
+#include "seq-range-array.h"
+#include "safe-mkstemp.h"
+#include "mail-user.h"
 #include "mail-namespace.h"
 #include "mail-storage.h"
 #include "mail-search-build.h"
@@ -17,6 +24,7 @@
 #include "sieve.h"
 #include "sieve-extensions.h"
 #include "sieve-binary.h"
+#include "sieve-actions.h"
 
 #include "sieve-tool.h"
 
@@ -25,6 +33,7 @@
 #include <fcntl.h>
 #include <pwd.h>
 #include <sysexits.h>
+#include <sys/wait.h>
 
 /*
  * Print help
@@ -33,7 +42,8 @@
 static void print_help(void)
 {
 	printf(
-"Usage: sieve-filter [-c <config-file>] [-C] [-D] [-e] [-m <default-mailbox>]\n"
+"Usage: sieve-filter [-b <batch-size>] [-c <config-file>] [-C] [-D] [-e]\n"
+"                    [-i <state-file>] [-j <jobs>] [-m <default-mailbox>]\n"
 "                    [-P <plugin>] [-q <output-mailbox>] [-Q <mail-command>]\n"
 "                    [-s <script-file>] [-u <user>] [-v] [-W] [-x <extensions>]\n"
 "                    <script-file> <source-mailbox> [<discard-action>]\n"
@@ -55,17 +65,37 @@ struct sieve_filter_data {
 	struct sieve_binary *main_sbin;
 	struct sieve_error_handler *ehandler;
 
+	/* Number of stored messages committed at once */
+	unsigned int store_batch_size;
+
+	/* Parallel workers open the mailboxes themselves */
+	unsigned int jobs;
+	struct mail_user *mail_user;
+	const char *src_mailbox_name, *move_mailbox_name;
+	enum mailbox_flags open_flags;
+
 	bool execute:1;
 	bool source_write:1;
 	bool default_move:1;
 };
 
+struct sieve_filter_stats {
+	unsigned int messages;
+	unsigned int failed;
+	unsigned int discarded;
+
+	/* Lowest UID of the messages that failed; 0 if none */
+	uint32_t first_failed_uid;
+};
+
 struct sieve_filter_context {
 	const struct sieve_filter_data *data;
 
 	struct mailbox_transaction_context *move_trans;
 
 	struct ostream *teststream;
+
+	struct sieve_filter_stats stats;
 };
 
 static int filter_message
@@ -165,6 +195,7 @@ static int filter_message
 				mail_expunge(mail);
 
 		} else {
+			sfctx->stats.discarded++;
 
 			switch ( discard_action ) {
 			/* Leave it there */
@@ -263,8 +294,23 @@ static void mail_search_build_add_flags
 	args->args = arg;
 }
 
+static void mail_search_build_add_uidset
+(struct mail_search_args *args, uint32_t uid1, uint32_t uid2)
+{
+	struct mail_search_arg *arg;
+
+	arg = p_new(args->pool, struct mail_search_arg, 1);
+	arg->type = SEARCH_UIDSET;
+	p_array_init(&arg->value.seqset, args->pool, 1);
+	seq_range_array_add_range(&arg->value.seqset, uid1, uid2);
+
+	arg->next = args->args;
+	args->args = arg;
+}
+
 static int filter_mailbox
-(const struct sieve_filter_data *sfdata, struct mailbox *src_box)
+(const struct sieve_filter_data *sfdata, struct mailbox *src_box,
+	uint32_t uid_first, uint32_t uid_last, struct sieve_filter_stats *stats_r)
 {
 	struct sieve_filter_context sfctx;
 	struct mailbox *move_box = sfdata->move_mailbox;
@@ -273,6 +319,8 @@ static int filter_mailbox
 	struct mailbox_transaction_context *t;
 	struct mail_search_context *search_ctx;
 	struct mail *mail;
+	const char *error;
+	bool store_failed = FALSE;
 	int ret = 1;
 
 	/* Sync source mailbox */
@@ -293,6 +341,12 @@ static int filter_mailbox
 		o_stream_set_no_error_handling(sfctx.teststream, TRUE);
 	}
 
+	/* Keep target mailboxes open across messages */
+	if ( sfdata->execute ) {
+		sfdata->senv->store_cache =
+			sieve_store_cache_create(sfdata->store_batch_size);
+	}
+
 	/* Start move mailbox transaction */
 
 	if ( move_box != NULL ) {
@@ -304,6 +358,8 @@ static int filter_mailbox
 
 	search_args = mail_search_build_init();
 	mail_search_build_add_flags(search_args, MAIL_DELETED, TRUE);
+	if ( uid_last > 0 )
+		mail_search_build_add_uidset(search_args, uid_first, uid_last);
 
 	t = mailbox_transaction_begin(src_box, 0);
 	search_ctx = mailbox_search_init(t, search_args, NULL, 0, NULL);
@@ -313,6 +369,22 @@ static int filter_mailbox
 
 	while ( ret >= 0 && mailbox_search_next(search_ctx, &mail) ) {
 		ret = filter_message(&sfctx, mail);
+
+		sfctx.stats.messages++;
+		if ( ret == 0 ) {
+			sfctx.stats.failed++;
+			if ( sfctx.stats.first_failed_uid == 0 ||
+				mail->uid < sfctx.stats.first_failed_uid )
+				sfctx.stats.first_failed_uid = mail->uid;
+		}
+
+		if ( sfdata->senv->store_cache != NULL &&
+			sieve_store_cache_message_finished
+				(sfdata->senv->store_cache, &error) < 0 ) {
+			sieve_error(ehandler, NULL, "%s", error);
+			store_failed = TRUE;
+			ret = -1;
+		}
 	}
 
 	/* Cleanup */
@@ -321,19 +393,37 @@ static int filter_mailbox
 		ret = -1;
 	}
 
+	if ( sfdata->senv->store_cache != NULL ) {
+		if ( !store_failed && sieve_store_cache_commit
+			(sfdata->senv->store_cache, &error) < 0 ) {
+			sieve_error(ehandler, NULL, "%s", error);
+			store_failed = TRUE;
+			ret = -1;
+		}
+		sieve_store_cache_destroy(&sfdata->senv->store_cache);
+	}
+
 	if ( sfctx.move_trans != NULL ) {
 		if ( mailbox_transaction_commit(&sfctx.move_trans) < 0 ) {
 			ret = -1;
 		}
 	}
 
-	if ( mailbox_transaction_commit(&t) < 0 ) {
+	if ( store_failed ) {
+		/* Messages may not have been stored elsewhere; leave all of them in
+		   the source mailbox */
+		sieve_error(ehandler, NULL,
+			"storing messages failed; source mailbox left unchanged");
+		mailbox_transaction_rollback(&t);
+	} else if ( mailbox_transaction_commit(&t) < 0 ) {
 		ret = -1;
 	}
 
 	if ( sfctx.teststream != NULL )
 		o_stream_destroy(&sfctx.teststream);
 
+	*stats_r = sfctx.stats;
+
 	if ( ret < 0 ) return ret;
 
 	/* Sync mailbox */
@@ -358,6 +448,341 @@ static const char *mailbox_name_to_mutf7(const char *mailbox_utf8)
 		return str_c(str);
 }
 
+static struct mailbox *filter_open_mailbox
+(struct mail_user *mail_user, const char *mailbox, enum mailbox_flags flags)
+{
+	struct mail_namespace *ns;
+	struct mailbox *box;
+	enum mail_error error;
+
+	ns = mail_namespace_find(mail_user->namespaces, mailbox);
+	if ( ns == NULL )
+		i_fatal("Unknown namespace for mailbox '%s'", mailbox);
+
+	box = mailbox_alloc(ns->list, mailbox, flags);
+	if ( mailbox_open(box) < 0 ) {
+		i_fatal("Couldn't open mailbox '%s': %s",
+			mailbox, mailbox_get_last_error(box, &error));
+	}
+	return box;
+}
+
+/*
+ * Parallel filtering
+ */
+
+struct sieve_filter_worker {
+	pid_t pid;
+	int fd;
+	uint32_t uid_first, uid_last;
+};
+
+/* Splits the messages of the source mailbox into at most sfdata->jobs UID
+   ranges of roughly equal size. Unless uid_last is given, the last range is
+   left open, so that it also covers messages that arrive while filtering. */
+static int filter_get_uid_partitions
+(const struct sieve_filter_data *sfdata, struct mailbox *src_box,
+	uint32_t uid_first, uint32_t uid_last, ARRAY_TYPE(seq_range) *parts)
+{
+	struct mailbox_status status;
+	struct mailbox_transaction_context *t;
+	struct mail *mail;
+	uint32_t seq1, seq2, messages;
+	unsigned int jobs = sfdata->jobs, i;
+
+	if ( mailbox_sync(src_box, MAILBOX_SYNC_FLAG_FULL_READ) < 0 ) {
+		sieve_error(sfdata->ehandler, NULL, "failed to sync source mailbox");
+		return -1;
+	}
+
+	if ( uid_last > 0 ) {
+		mailbox_get_seq_range(src_box, uid_first, uid_last, &seq1, &seq2);
+		if ( seq1 == 0 )
+			return 0;
+	} else {
+		mailbox_get_open_status(src_box, STATUS_MESSAGES, &status);
+		if ( status.messages == 0 )
+			return 0;
+		seq1 = 1;
+		seq2 = status.messages;
+	}
+
+	messages = seq2 - seq1 + 1;
+	if ( jobs > messages )
+		jobs = messages;
+
+	t = mailbox_transaction_begin(src_box, 0);
+	mail = mail_alloc(t, 0, NULL);
+	for ( i = 0; i < jobs; i++ ) {
+		struct seq_range *range = array_append_space(parts);
+
+		mail_set_seq(mail, seq1 + (uint64_t)i * messages / jobs);
+		range->seq1 = mail->uid;
+
+		if ( i == jobs - 1 ) {
+			range->seq2 = ( uid_last > 0 ? uid_last : (uint32_t)-1 );
+		} else {
+			mail_set_seq(mail, seq1 + (uint64_t)(i + 1) * messages / jobs - 1);
+			range->seq2 = mail->uid;
+		}
+	}
+	mail_free(&mail);
+	mailbox_transaction_rollback(&t);
+	return 0;
+}
+
+static struct mail_user *filter_worker_mail_user_create
+(struct mail_user *parent_user)
+{
+	struct mail_user *mail_user;
+	const char *home, *errstr;
+
+	mail_user = mail_user_alloc(parent_user->username,
+		parent_user->set_info, parent_user->unexpanded_set);
+	if ( mail_user_get_home(parent_user, &home) > 0 )
+		mail_user_set_home(mail_user, home);
+
+	if ( mail_user_init(mail_user, &errstr) < 0 ) {
+		i_error("Worker user initialization failed: %s", errstr);
+		mail_user_unref(&mail_user);
+		return NULL;
+	}
+	if ( mail_namespaces_init(mail_user, &errstr) < 0 ) {
+		i_error("Worker namespace initialization failed: %s", errstr);
+		mail_user_unref(&mail_user);
+		return NULL;
+	}
+	return mail_user;
+}
+
+static int filter_worker
+(const struct sieve_filter_data *sfdata, uint32_t uid_first,
+	uint32_t uid_last, struct sieve_filter_stats *stats_r)
+{
+	struct sieve_filter_data wdata = *sfdata;
+	struct sieve_script_env wsenv = *sfdata->senv;
+	struct mail_user *mail_user;
+	struct mailbox *src_box;
+	int ret;
+
+	/* The storages of the parent's mail user hold index and cache state of
+	   the parent process; the worker uses its own mail user instead */
+	if ( (mail_user=filter_worker_mail_user_create(sfdata->mail_user))
+		== NULL )
+		return -1;
+	wsenv.user = mail_user;
+	wdata.senv = &wsenv;
+	wdata.mail_user = mail_user;
+
+	src_box = filter_open_mailbox
+		(mail_user, sfdata->src_mailbox_name, sfdata->open_flags);
+	if ( sfdata->move_mailbox_name != NULL ) {
+		wdata.move_mailbox = filter_open_mailbox
+			(mail_user, sfdata->move_mailbox_name, sfdata->open_flags);
+	}
+
+	ret = filter_mailbox(&wdata, src_box, uid_first, uid_last, stats_r);
+
+	mailbox_free(&src_box);
+	if ( wdata.move_mailbox != NULL )
+		mailbox_free(&wdata.move_mailbox);
+	mail_user_unref(&mail_user);
+	return ret;
+}
+
+static void ATTR_NORETURN filter_worker_run
+(const struct sieve_filter_data *sfdata,
+	const struct sieve_filter_worker *worker, int fd)
+{
+	struct sieve_filter_stats stats;
+	int ret;
+
+	i_zero(&stats);
+	ret = filter_worker(sfdata, worker->uid_first, worker->uid_last, &stats);
+
+	if ( write_full(fd, &stats, sizeof(stats)) < 0 )
+		i_error("write(stats pipe) failed: %m");
+
+	/* Leave the cleanup of the inherited state to the parent */
+	_exit( ret < 0 ? EXIT_FAILURE : EXIT_SUCCESS );
+}
+
+static int filter_mailbox_parallel
+(const struct sieve_filter_data *sfdata, struct mailbox **_src_box,
+	struct mailbox **_move_box, uint32_t uid_first, uint32_t uid_last,
+	struct sieve_filter_stats *stats_r)
+{
+	struct sieve_error_handler *ehandler = sfdata->ehandler;
+	ARRAY_TYPE(seq_range) parts;
+	const struct seq_range *part;
+	struct sieve_filter_worker *workers;
+	unsigned int count, i, j;
+	int ret = 1;
+
+	i_zero(stats_r);
+
+	t_array_init(&parts, sfdata->jobs);
+	if ( filter_get_uid_partitions
+		(sfdata, *_src_box, uid_first, uid_last, &parts) < 0 )
+		return -1;
+
+	/* Mailbox handles are not shared with the workers */
+	mailbox_free(_src_box);
+	if ( *_move_box != NULL )
+		mailbox_free(_move_box);
+
+	part = array_get(&parts, &count);
+	workers = t_new(struct sieve_filter_worker, count);
+
+	for ( i = 0; i < count; i++ ) {
+		int fd[2];
+
+		workers[i].fd = -1;
+		workers[i].uid_first = part[i].seq1;
+		workers[i].uid_last = part[i].seq2;
+
+		if ( pipe(fd) < 0 ) {
+			i_error("pipe() failed: %m");
+			ret = -1;
+			break;
+		}
+
+		if ( (workers[i].pid=fork()) < 0 ) {
+			i_error("fork() failed: %m");
+			i_close_fd(&fd[0]);
+			i_close_fd(&fd[1]);
+			workers[i].pid = 0;
+			ret = -1;
+			break;
+		}
+
+		if ( workers[i].pid == 0 ) {
+			/* Worker */
+			i_close_fd(&fd[0]);
+			for ( j = 0; j < i; j++ )
+				i_close_fd(&workers[j].fd);
+			filter_worker_run(sfdata, &workers[i], fd[1]);
+		}
+
+		i_close_fd(&fd[1]);
+		workers[i].fd = fd[0];
+	}
+
+	/* Merge the results of all workers */
+	for ( i = 0; i < count && workers[i].pid > 0; i++ ) {
+		struct sieve_filter_stats stats;
+		int status;
+
+		if ( read_full(workers[i].fd, &stats, sizeof(stats)) <= 0 )
+			i_zero(&stats);
+		i_close_fd(&workers[i].fd);
+
+		if ( waitpid(workers[i].pid, &status, 0) < 0 ) {
+			i_error("waitpid() failed: %m");
+			ret = -1;
+		} else if ( !WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS ) {
+			sieve_error(ehandler, NULL,
+				"filtering messages with UIDs %u:%u failed",
+				workers[i].uid_first, workers[i].uid_last);
+			ret = -1;
+		}
+
+		stats_r->messages += stats.messages;
+		stats_r->failed += stats.failed;
+		stats_r->discarded += stats.discarded;
+		if ( stats.first_failed_uid > 0 && (stats_r->first_failed_uid == 0 ||
+			stats.first_failed_uid < stats_r->first_failed_uid) )
+			stats_r->first_failed_uid = stats.first_failed_uid;
+	}
+
+	return ret;
+}
+
+/*
+ * Incremental filtering
+ */
+
+/* The state file contains a single line: "<uidvalidity> <last-uid> <digest>",
+   where <digest> identifies the compiled script */
+
+struct sieve_filter_state {
+	uint32_t uid_validity;
+	uint32_t last_uid;
+	const char *digest;
+};
+
+static int filter_state_read
+(const char *path, struct sieve_filter_state *state_r)
+{
+	struct istream *input;
+	const char *line, *const *args;
+	int fd, ret = 0;
+
+	i_zero(state_r);
+
+	if ( (fd=open(path, O_RDONLY)) < 0 ) {
+		if ( errno == ENOENT )
+			return 0;
+		i_error("open(%s) failed: %m", path);
+		return -1;
+	}
+
+	input = i_stream_create_fd(fd, 1024);
+	if ( (line=i_stream_read_next_line(input)) != NULL ) {
+		args = t_strsplit_spaces(line, " ");
+		if ( str_array_length(args) == 3 &&
+			str_to_uint32(args[0], &state_r->uid_validity) == 0 &&
+			str_to_uint32(args[1], &state_r->last_uid) == 0 ) {
+			state_r->digest = t_strdup(args[2]);
+			ret = 1;
+		}
+	}
+	if ( ret == 0 )
+		i_warning("Ignoring invalid state file %s", path);
+
+	i_stream_destroy(&input);
+	i_close_fd(&fd);
+	return ret;
+}
+
+static int filter_state_write
+(const char *path, const struct sieve_filter_state *state)
+{
+	string_t *temp_path;
+	const char *data;
+	int fd, ret = 0;
+
+	/* Replace the state file atomically */
+	temp_path = t_str_new(256);
+	str_append(temp_path, path);
+	str_append_c(temp_path, '.');
+	fd = safe_mkstemp_hostpid(temp_path, 0600, (uid_t)-1, (gid_t)-1);
+	if ( fd < 0 ) {
+		i_error("safe_mkstemp(%s) failed: %m", str_c(temp_path));
+		return -1;
+	}
+
+	data = t_strdup_printf("%u %u %s\n",
+		state->uid_validity, state->last_uid, state->digest);
+	if ( write_full(fd, data, strlen(data)) < 0 ) {
+		i_error("write(%s) failed: %m", str_c(temp_path));
+		ret = -1;
+	}
+	if ( close(fd) < 0 ) {
+		i_error("close(%s) failed: %m", str_c(temp_path));
+		ret = -1;
+	}
+
+	if ( ret == 0 && rename(str_c(temp_path), path) < 0 ) {
+		i_error("rename(%s, %s) failed: %m", str_c(temp_path), path);
+		ret = -1;
+	}
+
+	if ( ret < 0 && unlink(str_c(temp_path)) < 0 && errno != ENOENT )
+		i_error("unlink(%s) failed: %m", str_c(temp_path));
+	return ret;
+}
+
 /*
  * Tool implementation
  */
@@ -367,6 +792,9 @@ int main(int argc, char **argv)
 	struct sieve_instance *svinst;
 	ARRAY_TYPE (const_string) scriptfiles;
 	const char *scriptfile,	*src_mailbox, *dst_mailbox, *move_mailbox;
+	const char *state_file = NULL, *digest = NULL;
+	struct sieve_filter_state state;
+	uint32_t uid_first = 0, uid_last = 0;
 	struct sieve_filter_data sfdata;
 	enum sieve_filter_discard_action discard_action = SIEVE_FILTER_DACT_KEEP;
 	struct mail_user *mail_user;
@@ -374,14 +802,14 @@ int main(int argc, char **argv)
 	struct sieve_script_env scriptenv;
 	struct sieve_error_handler *ehandler;
 	bool force_compile, execute, source_write, verbose, default_move;
-	struct mail_namespace *ns;
 	struct mailbox *src_box = NULL, *move_box = NULL;
 	enum mailbox_flags open_flags = MAILBOX_FLAG_IGNORE_ACLS;
-	enum mail_error error;
-	int c;
+	unsigned int store_batch_size = 100, jobs = 1;
+	struct sieve_filter_stats stats;
+	int c, ret;
 
 	sieve_tool = sieve_tool_init("sieve-filter", &argc, &argv,
-		"m:s:x:P:u:q:Q:DCevW", FALSE);
+		"b:i:j:m:s:x:P:u:q:Q:DCevW", FALSE);
 
 	t_array_init(&scriptfiles, 16);
 
@@ -391,6 +819,26 @@ int main(int argc, char **argv)
 	verbose = FALSE;	
 	while ((c = sieve_tool_getopt(sieve_tool)) > 0) {
 		switch (c) {
+		case 'b':
+			/* store batch size */
+			if ( str_to_uint(optarg, &store_batch_size) < 0 ) {
+				print_help();
+				i_fatal_status(EX_USAGE,
+					"Invalid <batch-size> argument: %s", optarg);
+			}
+			break;
+		case 'i':
+			/* incremental filtering state */
+			state_file = optarg;
+			break;
+		case 'j':
+			/* number of parallel workers */
+			if ( str_to_uint(optarg, &jobs) < 0 || jobs == 0 ) {
+				print_help();
+				i_fatal_status(EX_USAGE,
+					"Invalid <jobs> argument: %s", optarg);
+			}
+			break;
 		case 'm':
 			/* default mailbox (keep box) */
 			dst_mailbox = optarg;
@@ -487,6 +935,12 @@ int main(int argc, char **argv)
 		i_fatal_status(EX_USAGE, "Unknown argument: %s", argv[optind]);
 	}
 
+	if ( jobs > 1 && !execute ) {
+		print_help();
+		i_fatal_status(EX_USAGE,
+			"The -j argument is only supported in execution mode (-e)");
+	}
+
 	if ( dst_mailbox == NULL ) {
 		dst_mailbox = src_mailbox;
 	} else {
@@ -508,7 +962,7 @@ int main(int argc, char **argv)
 
 	/* Compile main sieve script */
 	if ( force_compile ) {
-		main_sbin = sieve_tool_script_compile(svinst, scriptfile, NULL);
+		main_sbin = sieve_tool_script_compile(svinst, scriptfile, NULL, 0);
 		if ( main_sbin != NULL )
 			(void) sieve_save(main_sbin, TRUE, NULL);
 	} else {
@@ -521,33 +975,18 @@ int main(int argc, char **argv)
 	/* Open the source mailbox */
 
 	src_mailbox = mailbox_name_to_mutf7(src_mailbox);
-	ns = mail_namespace_find(mail_user->namespaces, src_mailbox);
-	if ( ns == NULL )
-		i_fatal("Unknown namespace for source mailbox '%s'", src_mailbox);
 
 	if ( !source_write || !execute )
 		open_flags |= MAILBOX_FLAG_READONLY;
 
-	src_box = mailbox_alloc(ns->list, src_mailbox, open_flags);
-	if ( mailbox_open(src_box) < 0 ) {
-		i_fatal("Couldn't open source mailbox '%s': %s",
-			src_mailbox, mailbox_get_last_error(src_box, &error));
-	}
+	src_box = filter_open_mailbox(mail_user, src_mailbox, open_flags);
 
 	/* Open move box if necessary */
 
 	if ( execute && discard_action == SIEVE_FILTER_DACT_MOVE &&
 		move_mailbox != NULL ) {
 		move_mailbox = mailbox_name_to_mutf7(move_mailbox);
-		ns = mail_namespace_find(mail_user->namespaces, move_mailbox);
-		if ( ns == NULL )
-			i_fatal("Unknown namespace for mailbox '%s'", move_mailbox);
-
-		move_box = mailbox_alloc(ns->list, move_mailbox, open_flags);
-		if ( mailbox_open(move_box) < 0 ) {
-			i_fatal("Couldn't open mailbox '%s': %s",
-				move_mailbox, mailbox_get_last_error(move_box, &error));
-		}
+		move_box = filter_open_mailbox(mail_user, move_mailbox, open_flags);
 
 		if ( mailbox_backends_equal(src_box, move_box) ) {
 			i_fatal("Source mailbox and mailbox for move action are identical.");
@@ -568,12 +1007,79 @@ int main(int argc, char **argv)
 	sfdata.move_mailbox = move_box;
 	sfdata.main_sbin = main_sbin;
 	sfdata.ehandler = ehandler;
+	sfdata.store_batch_size = store_batch_size;
 	sfdata.execute = execute;
 	sfdata.source_write = source_write;
 	sfdata.default_move = default_move;
+	sfdata.jobs = jobs;
+	sfdata.mail_user = mail_user;
+	sfdata.src_mailbox_name = src_mailbox;
+	sfdata.move_mailbox_name = ( move_box == NULL ? NULL : move_mailbox );
+	sfdata.open_flags = open_flags;
+
+	/* Only filter messages that arrived since the previous run */
+	if ( state_file != NULL ) {
+		struct mailbox_status status;
+		struct sieve_filter_state old_state;
+
+		if ( mailbox_sync(src_box, MAILBOX_SYNC_FLAG_FULL_READ) < 0 ) {
+			i_fatal("Couldn't sync source mailbox '%s': %s",
+				src_mailbox, mailbox_get_last_error(src_box, NULL));
+		}
+		mailbox_get_open_status
+			(src_box, STATUS_UIDVALIDITY | STATUS_UIDNEXT, &status);
+
+		if ( main_sbin != NULL )
+			digest = sieve_binary_get_digest(main_sbin);
+
+		uid_first = 1;
+		if ( filter_state_read(state_file, &old_state) > 0 &&
+			digest != NULL && old_state.uid_validity == status.uidvalidity &&
+			strcmp(old_state.digest, digest) == 0 ) {
+			uid_first = old_state.last_uid + 1;
+		} else {
+			sieve_info(ehandler, NULL,
+				"script or source mailbox changed since last run; "
+				"filtering all messages");
+		}
+		uid_last = status.uidnext - 1;
+
+		i_zero(&state);
+		state.uid_validity = status.uidvalidity;
+		state.last_uid = uid_last;
+		state.digest = digest;
+	}
 
 	/* Apply Sieve filter to all messages found */
-	(void) filter_mailbox(&sfdata, src_box);
+	if ( state_file != NULL && uid_first > uid_last ) {
+		sieve_info(ehandler, NULL, "no new messages to filter");
+		i_zero(&stats);
+		ret = 1;
+	} else if ( jobs > 1 ) {
+		ret = filter_mailbox_parallel
+			(&sfdata, &src_box, &move_box, uid_first, uid_last, &stats);
+	} else {
+		ret = filter_mailbox
+			(&sfdata, src_box, uid_first, uid_last, &stats);
+	}
+
+	if ( ret >= 0 ) {
+		sieve_info(ehandler, NULL,
+			"filtered %u messages (%u failed, %u discarded)",
+			stats.messages, stats.failed, stats.discarded);
+
+		/* Record progress; simulation runs change nothing. Messages that
+		   failed are filtered again by the next run, along with all messages
+		   that follow these. */
+		if ( stats.first_failed_uid > 0 )
+			state.last_uid = stats.first_failed_uid - 1;
+		if ( state_file != NULL && execute && digest != NULL &&
+			filter_state_write(state_file, &state) < 0 ) {
+			sieve_error(ehandler, NULL,
+				"failed to update state file %s; "
+				"the next run filters these messages again", state_file);
+		}
+	}
 
 	/* Close the source mailbox */
 	if ( src_box != NULL )
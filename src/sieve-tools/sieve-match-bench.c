@@ -0,0 +1,419 @@
+/* Copyright (c) 2002-2017 Pigeonhole authors, see the included COPYING file
+ */
+
+#include "lib.h"
+#include "str.h"
+#include "strnum.h"
+#include "array.h"
+#include "safe-mkstemp.h"
+#include "write-full.h"
+
+#include "sieve.h"
+#include "sieve-common.h"
+#include "sieve-extensions.h"
+#include "sieve-stringlist.h"
+#include "sieve-code.h"
+#include "sieve-comparators.h"
+#include "sieve-match-types.h"
+#include "sieve-match.h"
+#include "sieve-message.h"
+#include "sieve-interpreter.h"
+
+#include "sieve-tool.h"
+
+#include <stdio.h>
+#include <unistd.h>
+#include <sysexits.h>
+#include <time.h>
+
+/*
+ * Matching benchmark
+ *
+ *   Drives the matcher directly with synthetic values for all combinations of
+ *   match type, comparator, value size, key count and hit ratio. The keys are
+ *   the literal key list of a header test in a compiled script, so that these
+ *   are matched exactly as during script execution. Results are written to
+ *   stdout as tab-separated values with a header line, so that runs before and
+ *   after a matcher change can be compared.
+ */
+
+#define BENCH_VALUE_COUNT 16
+
+static const char *const bench_match_types[] =
+	{ "is", "contains", "matches", "regex" };
+static const char *const bench_comparators[] =
+	{ "i;octet", "i;ascii-casemap", "i;ascii-numeric" };
+
+static const unsigned int bench_value_sizes[] = { 16, 256, 4096 };
+static const unsigned int bench_key_counts[] = { 1, 10, 100 };
+static const unsigned int bench_hit_pcts[] = { 0, 50, 100 };
+
+/*
+ * Print help
+ */
+
+static void print_help(void)
+{
+	printf(
+"Usage: sieve-match-bench [-c <config-file>] [-n <iterations>]\n"
+"                         [-P <plugin>] [-x <extensions>]\n"
+	);
+}
+
+/*
+ * Workloads
+ */
+
+struct bench_workload {
+	/* Names as used in the script */
+	const char *mcht, *cmp;
+
+	unsigned int value_size;
+	unsigned int key_count;
+	unsigned int hit_pct;
+};
+
+static unsigned int bench_seed;
+
+static char bench_random_char(void)
+{
+	/* Deterministic, so that runs are comparable */
+	bench_seed = bench_seed * 1103515245 + 12345;
+	return 'a' + (bench_seed >> 16) % 26;
+}
+
+static void bench_fill(string_t *str, unsigned int size)
+{
+	while ( str_len(str) < size )
+		str_append_c(str, bench_random_char());
+}
+
+static bool bench_is_numeric(const struct bench_workload *wl)
+{
+	return ( strcmp(wl->cmp, "i;ascii-numeric") == 0 );
+}
+
+static bool bench_is_exact(const struct bench_workload *wl)
+{
+	return ( strcmp(wl->mcht, "is") == 0 );
+}
+
+static string_t *bench_create_key
+(const struct bench_workload *wl, unsigned int index)
+{
+	string_t *key = t_str_new(wl->value_size + 16);
+
+	if ( bench_is_numeric(wl) ) {
+		str_printfa(key, "%u", 1000000 + index);
+	} else if ( bench_is_exact(wl) ) {
+		str_printfa(key, "key%u-", index);
+		bench_fill(key, wl->value_size);
+	} else if ( strcmp(wl->mcht, "matches") == 0 ) {
+		str_printfa(key, "*needle%u*", index);
+	} else {
+		str_printfa(key, "needle%u", index);
+	}
+	return key;
+}
+
+static string_t *bench_create_value
+(const struct bench_workload *wl, const ARRAY_TYPE(string) *keys,
+	unsigned int index, bool hit)
+{
+	unsigned int key_index = index % wl->key_count;
+	string_t *value = t_str_new(wl->value_size + 16);
+
+	if ( bench_is_numeric(wl) ) {
+		str_printfa(value, "%u", ( hit ? 1000000 + key_index : 2000000 + index ));
+	} else if ( bench_is_exact(wl) ) {
+		if ( hit ) {
+			string_t *const *key = array_idx(keys, key_index);
+
+			str_append_str(value, *key);
+		} else {
+			str_printfa(value, "val%u-", index);
+			bench_fill(value, wl->value_size);
+		}
+	} else {
+		/* Place the needle (or a near miss) in the middle of the value */
+		bench_fill(value, wl->value_size / 2);
+		str_printfa(value, ( hit ? "needle%u" : "needlx%u" ), key_index);
+		bench_fill(value, wl->value_size);
+	}
+	return value;
+}
+
+/*
+ * Benchmark script
+ */
+
+static struct sieve_binary *bench_compile
+(struct sieve_instance *svinst, struct sieve_error_handler *ehandler,
+	const struct bench_workload *wl, const ARRAY_TYPE(string) *keys)
+{
+	struct sieve_binary *sbin;
+	string_t *script, *path;
+	string_t *const *key;
+	int fd;
+
+	/* The generated keys contain no characters that need escaping */
+	script = t_str_new(1024);
+	if ( bench_is_numeric(wl) )
+		str_append(script, "require \"comparator-i;ascii-numeric\";\n");
+	if ( strcmp(wl->mcht, "regex") == 0 )
+		str_append(script, "require \"regex\";\n");
+	str_printfa(script, "if header :%s :comparator \"%s\" \"x-bench\" [",
+		wl->mcht, wl->cmp);
+	array_foreach(keys, key) {
+		if ( key != array_idx(keys, 0) )
+			str_append_c(script, ',');
+		str_printfa(script, "\n\t\"%s\"", str_c(*key));
+	}
+	str_append(script, "\n] {\n\tstop;\n}\n");
+
+	path = t_str_new(256);
+	str_append(path, ( svinst->temp_dir == NULL ? "/tmp" : svinst->temp_dir ));
+	str_append(path, "/sieve-match-bench.");
+	fd = safe_mkstemp_hostpid(path, 0600, (uid_t)-1, (gid_t)-1);
+	if ( fd < 0 )
+		i_fatal("safe_mkstemp(%s) failed: %m", str_c(path));
+	if ( write_full(fd, str_data(script), str_len(script)) < 0 )
+		i_fatal("write(%s) failed: %m", str_c(path));
+	i_close_fd(&fd);
+
+	sbin = sieve_compile(svinst, str_c(path), "bench", ehandler, 0, NULL);
+	i_unlink_if_exists(str_c(path));
+
+	if ( sbin == NULL )
+		i_fatal("Failed to compile benchmark script");
+	return sbin;
+}
+
+/* Reads the operands of the header test that starts the program, just like
+   its execution would */
+static void bench_read_test
+(const struct sieve_runtime_env *renv, struct sieve_match_type *mcht_r,
+	struct sieve_comparator *cmp_r, struct sieve_stringlist **key_list_r)
+{
+	struct sieve_operation oprtn;
+	struct sieve_stringlist *hdr_list;
+	ARRAY_TYPE(sieve_message_override) svmos;
+	sieve_size_t address = renv->pc;
+	int ret;
+
+	if ( !sieve_operation_read(renv->sblock, &address, &oprtn) ||
+		oprtn.def->ext_def != NULL ||
+		oprtn.def->code != SIEVE_OPERATION_HEADER )
+		i_fatal("Benchmark script doesn't start with a header test");
+
+	i_zero(&svmos);
+	if ( sieve_message_opr_optional_read
+		(renv, &address, NULL, &ret, NULL, mcht_r, cmp_r, &svmos) < 0 ||
+		sieve_opr_stringlist_read
+			(renv, &address, "header-list", &hdr_list) <= 0 ||
+		sieve_opr_stringlist_read
+			(renv, &address, "key-list", key_list_r) <= 0 )
+		i_fatal("Failed to read header test operands");
+}
+
+/*
+ * Benchmark
+ */
+
+static long long bench_usecs(void)
+{
+	struct timespec ts;
+
+	if ( clock_gettime(CLOCK_MONOTONIC, &ts) < 0 )
+		i_fatal("clock_gettime(CLOCK_MONOTONIC) failed: %m");
+	return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void bench_run_workload
+(struct sieve_instance *svinst, struct sieve_error_handler *ehandler,
+	const struct sieve_script_env *senv, const struct bench_workload *wl,
+	unsigned int iterations)
+{
+	struct sieve_match_type mcht =
+		SIEVE_MATCH_TYPE_DEFAULT(is_match_type);
+	struct sieve_comparator cmp =
+		SIEVE_COMPARATOR_DEFAULT(i_ascii_casemap_comparator);
+	ARRAY_TYPE(string) keys, values;
+	struct sieve_binary *sbin;
+	struct sieve_interpreter *interp;
+	const struct sieve_runtime_env *renv;
+	struct sieve_stringlist *key_list;
+	unsigned int i, matched = 0;
+	long long start, usecs;
+
+	bench_seed = 1;
+
+	t_array_init(&keys, wl->key_count);
+	for ( i = 0; i < wl->key_count; i++ ) {
+		string_t *key = bench_create_key(wl, i);
+
+		array_append(&keys, &key, 1);
+	}
+
+	/* One value list per iteration; the hits are spread over it */
+	t_array_init(&values, BENCH_VALUE_COUNT);
+	for ( i = 0; i < BENCH_VALUE_COUNT; i++ ) {
+		bool hit = ( (i * 100) / BENCH_VALUE_COUNT < wl->hit_pct );
+		string_t *value = bench_create_value(wl, &keys, i, hit);
+
+		array_append(&values, &value, 1);
+	}
+
+	sbin = bench_compile(svinst, ehandler, wl, &keys);
+	interp = sieve_interpreter_create(sbin, NULL, NULL, senv, ehandler, 0);
+	if ( interp == NULL )
+		i_fatal("Failed to create interpreter");
+	sieve_interpreter_reset(interp);
+	renv = sieve_interpreter_get_runtime_env(interp);
+
+	bench_read_test(renv, &mcht, &cmp, &key_list);
+
+	start = bench_usecs();
+
+	for ( i = 0; i < iterations; i++ ) {
+		unsigned int j;
+
+		/* Match each value separately, so that every value is evaluated */
+		for ( j = 0; j < BENCH_VALUE_COUNT; j++ ) {
+			struct sieve_match_context *mctx;
+			string_t *const *value = array_idx(&values, j);
+			int exec_status, match;
+
+			if ( (mctx=sieve_match_begin(renv, &mcht, &cmp)) == NULL )
+				i_fatal("Failed to start match");
+
+			match = sieve_match_value
+				(mctx, str_c(*value), str_len(*value), key_list);
+			if ( sieve_match_end(&mctx, &exec_status) < 0 || match < 0 )
+				i_fatal("Match failed");
+			if ( match > 0 )
+				matched++;
+		}
+	}
+
+	usecs = bench_usecs() - start;
+
+	printf("%s\t%s\t%u\t%u\t%u\t%u\t%u\t%lld\t%.1f\n",
+		wl->mcht, wl->cmp, wl->value_size, wl->key_count, wl->hit_pct,
+		iterations, matched / iterations, usecs,
+		usecs * 1000.0 / ((double)iterations * BENCH_VALUE_COUNT));
+
+	sieve_interpreter_free(&interp);
+	sieve_close(&sbin);
+}
+
+static void bench_run
+(struct sieve_instance *svinst, struct sieve_error_handler *ehandler,
+	const struct sieve_script_env *senv, const char *mcht, const char *cmp,
+	unsigned int iterations)
+{
+	struct bench_workload wl;
+	unsigned int i, j, k;
+
+	i_zero(&wl);
+	wl.mcht = mcht;
+	wl.cmp = cmp;
+
+	for ( i = 0; i < N_ELEMENTS(bench_value_sizes); i++ ) {
+		for ( j = 0; j < N_ELEMENTS(bench_key_counts); j++ ) {
+			for ( k = 0; k < N_ELEMENTS(bench_hit_pcts); k++ ) T_BEGIN {
+				wl.value_size = bench_value_sizes[i];
+				wl.key_count = bench_key_counts[j];
+				wl.hit_pct = bench_hit_pcts[k];
+
+				bench_run_workload(svinst, ehandler, senv, &wl, iterations);
+			} T_END;
+		}
+	}
+}
+
+/*
+ * Tool implementation
+ */
+
+int main(int argc, char **argv)
+{
+	struct sieve_instance *svinst;
+	struct sieve_error_handler *ehandler;
+	struct sieve_script_env scriptenv;
+	bool have_regex, have_numeric;
+	unsigned int iterations = 1000, i, j;
+	int c;
+
+	sieve_tool = sieve_tool_init
+		("sieve-match-bench", &argc, &argv, "n:DP:x:", FALSE);
+
+	while ((c = sieve_tool_getopt(sieve_tool)) > 0) {
+		switch (c) {
+		case 'n':
+			/* number of iterations per workload */
+			if ( str_to_uint(optarg, &iterations) < 0 || iterations == 0 ) {
+				print_help();
+				i_fatal_status(EX_USAGE,
+					"Invalid <iterations> argument: %s", optarg);
+			}
+			break;
+		default:
+			print_help();
+			i_fatal_status(EX_USAGE, "Unknown argument: %c", c);
+			break;
+		}
+	}
+
+	if ( optind != argc ) {
+		print_help();
+		i_fatal_status(EX_USAGE, "Unknown argument: %s", argv[optind]);
+	}
+
+	svinst = sieve_tool_init_finish(sieve_tool, FALSE, FALSE);
+
+	ehandler = sieve_stderr_ehandler_create(svinst, 0);
+	sieve_system_ehandler_set(ehandler);
+
+	i_zero(&scriptenv);
+	scriptenv.user = sieve_tool_get_mail_user(sieve_tool);
+
+	have_regex = ( sieve_extension_get_by_name(svinst, "regex") != NULL );
+	if ( !have_regex ) {
+		i_warning("regex extension not enabled; skipping :regex "
+			"(use -x \"+regex\")");
+	}
+	have_numeric = ( sieve_extension_get_by_name
+		(svinst, "comparator-i;ascii-numeric") != NULL );
+	if ( !have_numeric ) {
+		i_warning("comparator-i;ascii-numeric extension not enabled; "
+			"skipping i;ascii-numeric");
+	}
+
+	printf("match\tcomparator\tvalue_size\tkeys\thit_pct\titerations"
+		"\tmatches\tusecs\tns_per_value\n");
+
+	for ( i = 0; i < N_ELEMENTS(bench_match_types); i++ ) {
+		const char *mcht = bench_match_types[i];
+
+		if ( strcmp(mcht, "regex") == 0 && !have_regex )
+			continue;
+
+		for ( j = 0; j < N_ELEMENTS(bench_comparators); j++ ) {
+			const char *cmp = bench_comparators[j];
+
+			/* Only combinations that a script could use */
+			if ( strcmp(cmp, "i;ascii-numeric") == 0 &&
+				(!have_numeric || strcmp(mcht, "is") != 0) )
+				continue;
+
+			bench_run(svinst, ehandler, &scriptenv, mcht, cmp, iterations);
+		}
+	}
+
+	sieve_error_handler_unref(&ehandler);
+
+	sieve_tool_deinit(&sieve_tool);
+
+	return 0;
+}
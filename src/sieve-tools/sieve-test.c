@@ -6,8 +6,11 @@
 #include "ioloop.h"
 #include "env-util.h"
 #include "str.h"
+#include "strnum.h"
 #include "ostream.h"
+#include "mempool.h"
 #include "array.h"
+#include "read-full.h"
 #include "mail-namespace.h"
 #include "mail-storage.h"
 #include "master-service.h"
@@ -25,7 +28,9 @@
 #include <fcntl.h>
 #include <pwd.h>
 #include <sysexits.h>
-
+#include <dirent.h>
+#include <sys/stat.h>
+#include <time.h>
 
 /*
  * Configuration
@@ -41,8 +46,8 @@
 static void print_help(void)
 {
 	printf(
-"Usage: sieve-test [-a <orig-recipient-address] [-c <config-file>]\n"
-"                  [-C] [-D] [-d <dump-filename>] [-e]\n"
+"Usage: sieve-test [-a <orig-recipient-address] [-B <iterations>]\n"
+"                  [-c <config-file>] [-C] [-D] [-d <dump-filename>] [-e]\n"
 "                  [-f <envelope-sender>] [-l <mail-location>]\n"
 "                  [-m <default-mailbox>] [-P <plugin>]\n"
 "                  [-r <recipient-address>] [-s <script-file>]\n"
@@ -125,6 +130,383 @@ static void duplicate_mark
 	i_info("marked duplicate for user %s.\n", senv->user->username);
 }
 
+/*
+ * Script environment
+ */
+
+static void script_env_init
+(struct sieve_script_env *senv, const char *mailbox,
+	struct sieve_exec_status *estatus)
+{
+	i_zero(senv);
+	senv->default_mailbox = mailbox;
+	senv->user = sieve_tool_get_mail_user(sieve_tool);
+	senv->postmaster_address = "postmaster@example.com";
+	senv->smtp_start = sieve_smtp_start;
+	senv->smtp_add_rcpt = sieve_smtp_add_rcpt;
+	senv->smtp_send = sieve_smtp_send;
+	senv->smtp_abort = sieve_smtp_abort;
+	senv->smtp_finish = sieve_smtp_finish;
+	senv->duplicate_mark = duplicate_mark;
+	senv->duplicate_check = duplicate_check;
+	senv->exec_status = estatus;
+}
+
+/*
+ * Benchmark
+ *
+ *   Runs the script over a corpus of messages for a number of iterations. The
+ *   corpus is either a directory with one message per file, an mbox file or a
+ *   single message. It is read into memory beforehand, so that only opening
+ *   the message and running the script is measured.
+ */
+
+static long long benchmark_usecs(void)
+{
+	struct timespec ts;
+
+	if ( clock_gettime(CLOCK_MONOTONIC, &ts) < 0 )
+		i_fatal("clock_gettime(CLOCK_MONOTONIC) failed: %m");
+	return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* Allocations made through default_pool (i_malloc() and friends) are counted
+   by temporarily replacing it with this pool, which passes them on to the
+   original one */
+
+static pool_t benchmark_parent_pool;
+static unsigned long long benchmark_allocs;
+
+static const char *benchmark_pool_get_name(pool_t pool ATTR_UNUSED)
+{
+	return "benchmark";
+}
+
+static void benchmark_pool_ref(pool_t pool ATTR_UNUSED)
+{
+}
+
+static void benchmark_pool_unref(pool_t *pool ATTR_UNUSED)
+{
+}
+
+static void *benchmark_pool_malloc(pool_t pool ATTR_UNUSED, size_t size)
+{
+	benchmark_allocs++;
+	return p_malloc(benchmark_parent_pool, size);
+}
+
+static void benchmark_pool_free(pool_t pool ATTR_UNUSED, void *mem)
+{
+	p_free(benchmark_parent_pool, mem);
+}
+
+static void *benchmark_pool_realloc
+(pool_t pool ATTR_UNUSED, void *mem, size_t old_size, size_t new_size)
+{
+	benchmark_allocs++;
+	return p_realloc(benchmark_parent_pool, mem, old_size, new_size);
+}
+
+static void benchmark_pool_clear(pool_t pool ATTR_UNUSED)
+{
+	i_unreached();
+}
+
+static size_t benchmark_pool_get_max_easy_alloc_size(pool_t pool ATTR_UNUSED)
+{
+	return 0;
+}
+
+static struct pool_vfuncs benchmark_pool_vfuncs = {
+	.get_name = benchmark_pool_get_name,
+	.ref = benchmark_pool_ref,
+	.unref = benchmark_pool_unref,
+	.malloc = benchmark_pool_malloc,
+	.free = benchmark_pool_free,
+	.realloc = benchmark_pool_realloc,
+	.clear = benchmark_pool_clear,
+	.get_max_easy_alloc_size = benchmark_pool_get_max_easy_alloc_size
+};
+
+static struct pool benchmark_pool = {
+	.v = &benchmark_pool_vfuncs,
+	.alloconly_pool = FALSE,
+	.datastack_pool = FALSE
+};
+
+struct sieve_test_benchmark {
+	struct sieve_instance *svinst;
+	struct sieve_binary *sbin;
+	struct sieve_error_handler *ehandler;
+	const char *mailbox;
+	const char *recipient, *final_recipient, *sender;
+	unsigned int iterations;
+	long long load_usecs;
+	bool execute;
+
+	struct sieve_script_env senv;
+	struct sieve_exec_status estatus;
+	struct ostream *output;
+
+	ARRAY(string_t *) messages;
+	ARRAY(long long) latencies;
+	long long open_usecs, exec_usecs;
+	struct sieve_profile profile;
+	unsigned long long allocs;
+	unsigned int failures;
+};
+
+static void benchmark_add_message
+(struct sieve_test_benchmark *bench, const void *data, size_t size)
+{
+	string_t *msg;
+
+	msg = str_new(default_pool, size + 1);
+	str_append_data(msg, data, size);
+	array_append(&bench->messages, &msg, 1);
+}
+
+static void benchmark_read_file(const char *path, buffer_t *buf)
+{
+	struct stat st;
+	int fd, ret;
+
+	if ( (fd=open(path, O_RDONLY)) < 0 )
+		i_fatal("open(%s) failed: %m", path);
+	if ( fstat(fd, &st) < 0 )
+		i_fatal("fstat(%s) failed: %m", path);
+
+	buffer_set_used_size(buf, 0);
+	if ( st.st_size > 0 ) {
+		ret = read_full
+			(fd, buffer_append_space_unsafe(buf, st.st_size), st.st_size);
+		if ( ret < 0 )
+			i_fatal("read(%s) failed: %m", path);
+		if ( ret == 0 )
+			i_fatal("read(%s) failed: file was truncated", path);
+	}
+	i_close_fd(&fd);
+}
+
+static void benchmark_add_mbox
+(struct sieve_test_benchmark *bench, const unsigned char *data, size_t size)
+{
+	const unsigned char *end = data + size, *line, *line_end, *msg = NULL;
+
+	/* Each message starts after its From_ line */
+	for ( line = data; line < end; line = line_end ) {
+		const unsigned char *nl = memchr(line, '\n', end - line);
+
+		line_end = ( nl == NULL ? end : nl + 1 );
+		if ( end - line >= 5 && memcmp(line, "From ", 5) == 0 ) {
+			if ( msg != NULL )
+				benchmark_add_message(bench, msg, line - msg);
+			msg = line_end;
+		}
+	}
+	if ( msg != NULL && msg < end )
+		benchmark_add_message(bench, msg, end - msg);
+}
+
+static int benchmark_name_cmp(const char *const *name1, const char *const *name2)
+{
+	return strcmp(*name1, *name2);
+}
+
+static void benchmark_load_corpus
+(struct sieve_test_benchmark *bench, const char *path)
+{
+	buffer_t *buf = buffer_create_dynamic(default_pool, 8192);
+	struct stat st;
+
+	if ( stat(path, &st) < 0 )
+		i_fatal("stat(%s) failed: %m", path);
+
+	if ( S_ISDIR(st.st_mode) ) {
+		ARRAY_TYPE(const_string) files;
+		const char *const *file;
+		struct dirent *dp;
+		DIR *dirp;
+
+		if ( (dirp=opendir(path)) == NULL )
+			i_fatal("opendir(%s) failed: %m", path);
+
+		t_array_init(&files, 256);
+		while ( (dp=readdir(dirp)) != NULL ) {
+			const char *fpath;
+
+			if ( dp->d_name[0] == '.' )
+				continue;
+
+			fpath = t_strconcat(path, "/", dp->d_name, NULL);
+			if ( stat(fpath, &st) < 0 || !S_ISREG(st.st_mode) )
+				continue;
+			array_append(&files, &fpath, 1);
+		}
+		if ( closedir(dirp) < 0 )
+			i_error("closedir(%s) failed: %m", path);
+
+		/* Process the messages in a predictable order */
+		array_sort(&files, benchmark_name_cmp);
+		array_foreach(&files, file) {
+			benchmark_read_file(*file, buf);
+			benchmark_add_message(bench, buf->data, buf->used);
+		}
+	} else {
+		benchmark_read_file(path, buf);
+		if ( buf->used >= 5 && memcmp(buf->data, "From ", 5) == 0 )
+			benchmark_add_mbox(bench, buf->data, buf->used);
+		else
+			benchmark_add_message(bench, buf->data, buf->used);
+	}
+
+	buffer_free(&buf);
+}
+
+static void benchmark_run_message
+(struct sieve_test_benchmark *bench, string_t *data)
+{
+	struct sieve_message_data msgdata;
+	const char *recipient = bench->recipient, *sender = bench->sender;
+	long long start, opened, end, latency;
+	struct mail *mail;
+	int ret;
+
+	/* Each message starts with a clean execution status */
+	i_zero(&bench->estatus);
+
+	benchmark_allocs = 0;
+	benchmark_parent_pool = default_pool;
+	default_pool = &benchmark_pool;
+
+	start = benchmark_usecs();
+
+	mail = sieve_tool_open_data_as_mail(sieve_tool, data);
+	sieve_tool_get_envelope_data(mail, &recipient, &sender);
+
+	i_zero(&msgdata);
+	msgdata.mail = mail;
+	msgdata.return_path = sender;
+	msgdata.orig_envelope_to = recipient;
+	msgdata.final_envelope_to = ( bench->final_recipient == NULL ?
+		recipient : bench->final_recipient );
+	msgdata.auth_user = sieve_tool_get_username(sieve_tool);
+	(void)mail_get_first_header(mail, "Message-ID", &msgdata.id);
+
+	opened = benchmark_usecs();
+
+	if ( bench->execute ) {
+		ret = sieve_execute(bench->sbin, &msgdata, &bench->senv,
+			bench->ehandler, bench->ehandler, 0, NULL);
+	} else {
+		ret = sieve_test(bench->sbin, &msgdata, &bench->senv,
+			bench->ehandler, bench->output, 0, NULL);
+	}
+
+	end = benchmark_usecs();
+
+	default_pool = benchmark_parent_pool;
+	bench->allocs += benchmark_allocs;
+
+	if ( ret != SIEVE_EXEC_OK )
+		bench->failures++;
+
+	bench->open_usecs += opened - start;
+	bench->exec_usecs += end - opened;
+	latency = end - start;
+	array_append(&bench->latencies, &latency, 1);
+}
+
+static int benchmark_latency_cmp(const long long *l1, const long long *l2)
+{
+	if ( *l1 < *l2 )
+		return -1;
+	return ( *l1 > *l2 ? 1 : 0 );
+}
+
+static long long benchmark_percentile
+(const long long *latencies, unsigned int count, unsigned int pct)
+{
+	return latencies[(unsigned long long)(count - 1) * pct / 100];
+}
+
+static void benchmark_report(struct sieve_test_benchmark *bench)
+{
+	const long long *latencies;
+	unsigned int count;
+	long long total;
+
+	array_sort(&bench->latencies, benchmark_latency_cmp);
+	latencies = array_get(&bench->latencies, &count);
+	total = bench->open_usecs + bench->exec_usecs;
+
+	printf("messages:   %u (%u in corpus, %u iterations)\n", count,
+		array_count(&bench->messages), bench->iterations);
+	printf("failures:   %u\n", bench->failures);
+	printf("load:       %lld usecs\n", bench->load_usecs);
+	if ( count == 0 )
+		return;
+	printf("throughput: %.1f messages/s\n",
+		( total == 0 ? 0.0 : count * 1000000.0 / total ));
+	printf("latency:    p50=%lld p90=%lld p99=%lld max=%lld usecs\n",
+		benchmark_percentile(latencies, count, 50),
+		benchmark_percentile(latencies, count, 90),
+		benchmark_percentile(latencies, count, 99),
+		latencies[count - 1]);
+	printf("phases:     open=%lld exec=%lld usecs\n",
+		bench->open_usecs, bench->exec_usecs);
+	printf("execution:  header=%lld body=%lld match=%lld usecs\n",
+		bench->profile.header_usecs, bench->profile.body_usecs,
+		bench->profile.match_usecs);
+	printf("allocs:     %llu (%.1f per message)\n",
+		bench->allocs, (double)bench->allocs / count);
+}
+
+static int sieve_test_benchmark
+(struct sieve_test_benchmark *bench, const char *path)
+{
+	string_t **msgp;
+	unsigned int i;
+	int fd;
+
+	i_array_init(&bench->messages, 256);
+	benchmark_load_corpus(bench, path);
+	if ( array_count(&bench->messages) == 0 )
+		i_fatal("No messages found in %s", path);
+
+	i_array_init(&bench->latencies,
+		array_count(&bench->messages) * bench->iterations);
+
+	script_env_init(&bench->senv, bench->mailbox, &bench->estatus);
+	sieve_set_profile(bench->svinst, &bench->profile);
+
+	/* Discard the test output */
+	if ( (fd=open("/dev/null", O_WRONLY)) < 0 )
+		i_fatal("open(/dev/null) failed: %m");
+	bench->output = o_stream_create_fd(fd, 0);
+	o_stream_set_no_error_handling(bench->output, TRUE);
+
+	for ( i = 0; i < bench->iterations; i++ ) {
+		array_foreach_modifiable(&bench->messages, msgp) T_BEGIN {
+			benchmark_run_message(bench, *msgp);
+		} T_END;
+	}
+
+	sieve_set_profile(bench->svinst, NULL);
+	o_stream_destroy(&bench->output);
+	i_close_fd(&fd);
+
+	benchmark_report(bench);
+
+	array_foreach_modifiable(&bench->messages, msgp)
+		str_free(msgp);
+	array_free(&bench->messages);
+	array_free(&bench->latencies);
+
+	return ( bench->failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE );
+}
+
 /*
  * Tool implementation
  */
@@ -145,11 +527,13 @@ int main(int argc, char **argv)
 	struct ostream *teststream = NULL;
 	struct sieve_trace_log *trace_log = NULL;
 	bool force_compile = FALSE, execute = FALSE;
+	unsigned int bench_iterations = 0;
+	long long load_start, load_end;
 	int exit_status = EXIT_SUCCESS;
 	int ret, c;
 
 	sieve_tool = sieve_tool_init
-		("sieve-test", &argc, &argv, "r:a:f:m:d:l:s:eCt:T:DP:x:u:", FALSE);
+		("sieve-test", &argc, &argv, "r:a:B:f:m:d:l:s:eCt:T:DP:x:u:", FALSE);
 
 	ehandler = action_ehandler = NULL;
 	t_array_init(&scriptfiles, 16);
@@ -169,6 +553,15 @@ int main(int argc, char **argv)
 			/* original recipient address */
 			recipient = optarg;
 			break;
+		case 'B':
+			/* benchmark iterations */
+			if ( str_to_uint(optarg, &bench_iterations) < 0 ||
+				bench_iterations == 0 ) {
+				print_help();
+				i_fatal_status(EX_USAGE,
+					"Invalid <iterations> argument: %s", optarg);
+			}
+			break;
 		case 'f':
 			/* envelope sender address */
 			sender = optarg;
@@ -237,6 +630,11 @@ int main(int argc, char **argv)
 		i_fatal_status(EX_USAGE, "Unknown argument: %s", argv[optind]);
 	}
 
+	if ( bench_iterations > 0 && array_count(&scriptfiles) > 0 ) {
+		i_fatal_status(EX_USAGE,
+			"The -s argument is not supported in benchmark mode (-B)");
+	}
+
 	/* Finish tool initialization */
 	svinst = sieve_tool_init_finish(sieve_tool, mailloc == NULL, FALSE);
 
@@ -250,16 +648,44 @@ int main(int argc, char **argv)
 	sieve_error_handler_accept_debuglog(ehandler, svinst->debug);
 
 	/* Compile main sieve script */
+	load_start = benchmark_usecs();
 	if ( force_compile ) {
-		main_sbin = sieve_tool_script_compile(svinst, scriptfile, NULL);
+		main_sbin = sieve_tool_script_compile(svinst, scriptfile, NULL, 0);
 		if ( main_sbin != NULL )
 			(void) sieve_save(main_sbin, TRUE, NULL);
 	} else {
 		main_sbin = sieve_tool_script_open(svinst, scriptfile);
 	}
+	load_end = benchmark_usecs();
+
+	if ( mailbox == NULL )
+		mailbox = "INBOX";
 
 	if ( main_sbin == NULL ) {
 		exit_status = EXIT_FAILURE;
+	} else if ( bench_iterations > 0 ) {
+		struct sieve_test_benchmark bench;
+
+		/* Obtain mail namespaces from -l argument */
+		if ( mailloc != NULL ) {
+			sieve_tool_init_mail_user(sieve_tool, mailloc);
+		}
+
+		i_zero(&bench);
+		bench.svinst = svinst;
+		bench.sbin = main_sbin;
+		bench.ehandler = ehandler;
+		bench.mailbox = mailbox;
+		bench.recipient = recipient;
+		bench.final_recipient = final_recipient;
+		bench.sender = sender;
+		bench.iterations = bench_iterations;
+		bench.load_usecs = load_end - load_start;
+		bench.execute = execute;
+
+		exit_status = sieve_test_benchmark(&bench, mailfile);
+
+		sieve_close(&main_sbin);
 	} else {
 		/* Dump script */
 		sieve_tool_dump_binary_to(main_sbin, dumpfile, FALSE);
@@ -274,9 +700,6 @@ int main(int argc, char **argv)
 
 		sieve_tool_get_envelope_data(mail, &recipient, &sender);
 
-		if ( mailbox == NULL )
-			mailbox = "INBOX";
-
 		/* Collect necessary message data */
 		i_zero(&msgdata);
 		msgdata.mail = mail;
@@ -306,20 +729,9 @@ int main(int argc, char **argv)
 		}
 
 		/* Compose script environment */
-		i_zero(&scriptenv);
-		scriptenv.default_mailbox = mailbox;
-		scriptenv.user = sieve_tool_get_mail_user(sieve_tool);
-		scriptenv.postmaster_address = "postmaster@example.com";
-		scriptenv.smtp_start = sieve_smtp_start;
-		scriptenv.smtp_add_rcpt = sieve_smtp_add_rcpt;
-		scriptenv.smtp_send = sieve_smtp_send;
-		scriptenv.smtp_abort = sieve_smtp_abort;
-		scriptenv.smtp_finish = sieve_smtp_finish;
-		scriptenv.duplicate_mark = duplicate_mark;
-		scriptenv.duplicate_check = duplicate_check;
+		script_env_init(&scriptenv, mailbox, &estatus);
 		scriptenv.trace_log = trace_log;
 		scriptenv.trace_config = trace_config;
-		scriptenv.exec_status = &estatus;
 
 		/* Run the test */
 		ret = 1;
@@ -364,7 +776,8 @@ int main(int argc, char **argv)
 
 				/* Compile sieve script */
 				if ( force_compile ) {
-					sbin = sieve_tool_script_compile(svinst, sfiles[i], sfiles[i]);
+					sbin = sieve_tool_script_compile
+						(svinst, sfiles[i], sfiles[i], 0);
 					if ( sbin != NULL )
 						(void) sieve_save(sbin, FALSE, NULL);
 				} else {
@@ -29,7 +29,8 @@
 static void print_help(void)
 {
 	printf(
-"Usage: sievec  [-c <config-file>] [-d] [-D] [-P <plugin>] [-x <extensions>] \n"
+"Usage: sievec  [-c <config-file>] [-d] [-D] [-O] [-P <plugin>]\n"
+"              [-x <extensions>]\n"
 "              <script-file> [<out-file>]\n"
 	);
 }
@@ -43,12 +44,13 @@ int main(int argc, char **argv)
 	struct sieve_instance *svinst;
 	struct stat st;
 	struct sieve_binary *sbin;
+	enum sieve_compile_flags cpflags = 0;
 	bool dump = FALSE;
 	const char *scriptfile, *outfile;
 	int exit_status = EXIT_SUCCESS;
 	int c;
 
-	sieve_tool = sieve_tool_init("sievec", &argc, &argv, "DdP:x:u:", FALSE);
+	sieve_tool = sieve_tool_init("sievec", &argc, &argv, "DdOP:x:u:", FALSE);
 
 	outfile = NULL;
 	while ((c = sieve_tool_getopt(sieve_tool)) > 0) {
@@ -57,6 +59,10 @@ int main(int argc, char **argv)
 			/* dump file */
 			dump = TRUE;
 			break;
+		case 'O':
+			/* optimize code */
+			cpflags |= SIEVE_COMPILE_FLAG_OPTIMIZE;
+			break;
 		default:
 			print_help();
 			i_fatal_status(EX_USAGE, "Unknown argument: %c", c);
@@ -119,7 +125,8 @@ int main(int argc, char **argv)
 				else
 					file = t_strconcat(scriptfile, "/", dp->d_name, NULL);
 
-				sbin = sieve_tool_script_compile(svinst, file, NULL);
+				sbin = sieve_tool_script_compile
+					(svinst, file, NULL, cpflags);
 
 				if ( sbin != NULL ) {
 					sieve_save(sbin, TRUE, NULL);
@@ -136,7 +143,8 @@ int main(int argc, char **argv)
 		 *
 		 *   NOTE: For consistency, stat errors are handled here as well
 		 */
-		sbin = sieve_tool_script_compile(svinst, scriptfile, NULL);
+		sbin = sieve_tool_script_compile
+			(svinst, scriptfile, NULL, cpflags);
 
 		if ( sbin != NULL ) {
 			if ( dump )
@@ -57,6 +57,45 @@ const struct sieve_command_def cmd_test_binary_save = {
 	.generate = cmd_test_binary_generate,
 };
 
+/* Test_binary_touch command
+ *
+ * Syntax:
+ *   test_binary_touch <binary-name: string>
+ *
+ * Changes the modification time of a saved binary, as if it were rewritten.
+ */
+
+const struct sieve_command_def cmd_test_binary_touch = {
+	.identifier = "test_binary_touch",
+	.type = SCT_COMMAND,
+	.positional_args = 1,
+	.subtests = 0,
+	.block_allowed = FALSE,
+	.block_required = FALSE,
+	.validate = cmd_test_binary_validate,
+	.generate = cmd_test_binary_generate,
+};
+
+/* Test_binary_share command
+ *
+ * Syntax:
+ *   test_binary_share <script-name: string>
+ *
+ * Stores the current binary in the shared binary store under the name that
+ * belongs to the given script, whatever script it was compiled from.
+ */
+
+const struct sieve_command_def cmd_test_binary_share = {
+	.identifier = "test_binary_share",
+	.type = SCT_COMMAND,
+	.positional_args = 1,
+	.subtests = 0,
+	.block_allowed = FALSE,
+	.block_required = FALSE,
+	.validate = cmd_test_binary_validate,
+	.generate = cmd_test_binary_generate,
+};
+
 /*
  * Operations
  */
@@ -86,6 +125,26 @@ const struct sieve_operation_def test_binary_save_operation = {
 	.execute = cmd_test_binary_operation_execute
 };
 
+/* test_binary_touch operation */
+
+const struct sieve_operation_def test_binary_touch_operation = {
+	.mnemonic = "TEST_BINARY_TOUCH",
+	.ext_def = &testsuite_extension,
+	.code = TESTSUITE_OPERATION_TEST_BINARY_TOUCH,
+	.dump = cmd_test_binary_operation_dump,
+	.execute = cmd_test_binary_operation_execute
+};
+
+/* test_binary_share operation */
+
+const struct sieve_operation_def test_binary_share_operation = {
+	.mnemonic = "TEST_BINARY_SHARE",
+	.ext_def = &testsuite_extension,
+	.code = TESTSUITE_OPERATION_TEST_BINARY_SHARE,
+	.dump = cmd_test_binary_operation_dump,
+	.execute = cmd_test_binary_operation_execute
+};
+
 /*
  * Validation
  */
@@ -115,6 +174,10 @@ static bool cmd_test_binary_generate
 		sieve_operation_emit(cgenv->sblock, cmd->ext, &test_binary_load_operation);
 	else if ( sieve_command_is(cmd, cmd_test_binary_save) )
 		sieve_operation_emit(cgenv->sblock, cmd->ext, &test_binary_save_operation);
+	else if ( sieve_command_is(cmd, cmd_test_binary_touch) )
+		sieve_operation_emit(cgenv->sblock, cmd->ext, &test_binary_touch_operation);
+	else if ( sieve_command_is(cmd, cmd_test_binary_share) )
+		sieve_operation_emit(cgenv->sblock, cmd->ext, &test_binary_share_operation);
 	else
 		i_unreached();
 
@@ -199,6 +262,30 @@ static int cmd_test_binary_operation_execute
 				"no compiled binary to save as %s", str_c(binary_name));
 			return SIEVE_EXEC_FAILURE;
 		}
+	} else if ( sieve_operation_is(oprtn, test_binary_touch_operation) ) {
+		if ( sieve_runtime_trace_active(renv, SIEVE_TRLVL_COMMANDS) ) {
+			sieve_runtime_trace(renv, 0, "testsuite: test_binary_touch command");
+			sieve_runtime_trace_descend(renv);
+			sieve_runtime_trace(renv, 0, "touch binary `%s'", str_c(binary_name));
+		}
+
+		if ( !testsuite_binary_touch(str_c(binary_name)) ) {
+			sieve_sys_error(testsuite_sieve_instance,
+				"failed to touch binary %s", str_c(binary_name));
+			return SIEVE_EXEC_FAILURE;
+		}
+	} else if ( sieve_operation_is(oprtn, test_binary_share_operation) ) {
+		if ( sieve_runtime_trace_active(renv, SIEVE_TRLVL_COMMANDS) ) {
+			sieve_runtime_trace(renv, 0, "testsuite: test_binary_share command");
+			sieve_runtime_trace_descend(renv);
+			sieve_runtime_trace(renv, 0, "share binary as `%s'", str_c(binary_name));
+		}
+
+		if ( !testsuite_script_share(renv, str_c(binary_name)) ) {
+			sieve_sys_error(testsuite_sieve_instance,
+				"failed to share binary as %s", str_c(binary_name));
+			return SIEVE_EXEC_FAILURE;
+		}
 	} else {
 		i_unreached();
 	}
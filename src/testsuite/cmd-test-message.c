@@ -3,6 +3,7 @@
 
 #include "lib.h"
 #include "istream.h"
+#include "message-parser.h"
 #include "mail-storage.h"
 
 #include "sieve-common.h"
@@ -68,6 +69,28 @@ const struct sieve_command_def cmd_test_message_print = {
 	.generate = cmd_test_message_print_generate
 };
 
+/* Test_message_corrupt_parts command
+ *
+ * Syntax:
+ *   test_message_corrupt_parts
+ *
+ * Damages the MIME structure the mail storage keeps for the current message,
+ * like a corrupted cache would, so that it no longer matches the message.
+ */
+
+static bool cmd_test_message_corrupt_parts_generate
+	(const struct sieve_codegen_env *cgenv, struct sieve_command *cmd);
+
+const struct sieve_command_def cmd_test_message_corrupt_parts = {
+	.identifier = "test_message_corrupt_parts",
+	.type = SCT_COMMAND,
+	.positional_args = 0,
+	.subtests = 0,
+	.block_allowed = FALSE,
+	.block_required = FALSE,
+	.generate = cmd_test_message_corrupt_parts_generate
+};
+
 /*
  * Operations
  */
@@ -117,6 +140,21 @@ const struct sieve_operation_def test_message_print_operation = {
 	.execute = cmd_test_message_print_operation_execute
 };
 
+/* Test_message_corrupt_parts operation */
+
+static bool cmd_test_message_corrupt_parts_operation_dump
+	(const struct sieve_dumptime_env *denv, sieve_size_t *address);
+static int cmd_test_message_corrupt_parts_operation_execute
+	(const struct sieve_runtime_env *renv, sieve_size_t *address);
+
+const struct sieve_operation_def test_message_corrupt_parts_operation = {
+	.mnemonic = "TEST_MESSAGE_CORRUPT_PARTS",
+	.ext_def = &testsuite_extension,
+	.code = TESTSUITE_OPERATION_TEST_MESSAGE_CORRUPT_PARTS,
+	.dump = cmd_test_message_corrupt_parts_operation_dump,
+	.execute = cmd_test_message_corrupt_parts_operation_execute
+};
+
 /*
  * Compiler context data
  */
@@ -302,6 +340,15 @@ static bool cmd_test_message_print_generate
 	return TRUE;
 }
 
+static bool cmd_test_message_corrupt_parts_generate
+(const struct sieve_codegen_env *cgenv, struct sieve_command *cmd)
+{
+	/* Emit operation */
+	sieve_operation_emit
+		(cgenv->sblock, cmd->ext, &test_message_corrupt_parts_operation);
+	return TRUE;
+}
+
 /*
  * Code dump
  */
@@ -348,6 +395,14 @@ static bool cmd_test_message_print_operation_dump
 	return TRUE;
 }
 
+static bool cmd_test_message_corrupt_parts_operation_dump
+(const struct sieve_dumptime_env *denv, sieve_size_t *address ATTR_UNUSED)
+{
+	sieve_code_dumpf(denv, "TEST_MESSAGE_CORRUPT_PARTS");
+
+	return TRUE;
+}
+
 
 /*
  * Intepretation
@@ -510,8 +565,28 @@ static int cmd_test_message_print_operation_execute
 	return SIEVE_EXEC_OK;
 }
 
+static int cmd_test_message_corrupt_parts_operation_execute
+(const struct sieve_runtime_env *renv, sieve_size_t *address ATTR_UNUSED)
+{
+	struct mail *mail = sieve_message_get_mail(renv->msgctx);
+	struct message_part *parts;
 
+	sieve_runtime_trace(renv, SIEVE_TRLVL_COMMANDS,
+		"testsuite: corrupt MIME structure of current message");
 
+	if ( mail_get_parts(mail, &parts) < 0 ) {
+		testsuite_test_failf
+			("test_message_corrupt_parts: failed to parse current message");
+		return SIEVE_EXEC_OK;
+	}
+	if ( parts == NULL || parts->children == NULL ) {
+		testsuite_test_failf
+			("test_message_corrupt_parts: current message is not multipart");
+		return SIEVE_EXEC_OK;
+	}
 
-
-
+	/* Claim the header of the first child part ends before it really does */
+	parts->children->header_size.physical_size = 0;
+	parts->children->header_size.virtual_size = 0;
+	return SIEVE_EXEC_OK;
+}
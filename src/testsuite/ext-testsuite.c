@@ -75,7 +75,14 @@ const struct sieve_operation_def *testsuite_operations[] = {
 	&test_mailbox_delete_operation,
 	&test_binary_load_operation,
 	&test_binary_save_operation,
-	&test_imap_metadata_set_operation
+	&test_imap_metadata_set_operation,
+	&test_script_headers_operation,
+	&test_message_corrupt_parts_operation,
+	&test_binary_touch_operation,
+	&test_binary_cached_operation,
+	&test_script_open_operation,
+	&test_binary_share_operation,
+	&test_binary_shared_operation
 };
 
 /*
@@ -131,16 +138,24 @@ static bool ext_testsuite_validator_load
 	sieve_validator_register_command(valdtr, ext, &cmd_test_result_reset);
 	sieve_validator_register_command(valdtr, ext, &cmd_test_message);
 	sieve_validator_register_command(valdtr, ext, &cmd_test_message_print);
+	sieve_validator_register_command
+		(valdtr, ext, &cmd_test_message_corrupt_parts);
 	sieve_validator_register_command(valdtr, ext, &cmd_test_mailbox_create);
 	sieve_validator_register_command(valdtr, ext, &cmd_test_mailbox_delete);
 	sieve_validator_register_command(valdtr, ext, &cmd_test_binary_load);
 	sieve_validator_register_command(valdtr, ext, &cmd_test_binary_save);
+	sieve_validator_register_command(valdtr, ext, &cmd_test_binary_touch);
+	sieve_validator_register_command(valdtr, ext, &cmd_test_binary_share);
 	sieve_validator_register_command(valdtr, ext, &cmd_test_imap_metadata_set);
 
 	sieve_validator_register_command(valdtr, ext, &tst_test_script_compile);
+	sieve_validator_register_command(valdtr, ext, &tst_test_script_open);
 	sieve_validator_register_command(valdtr, ext, &tst_test_script_run);
 	sieve_validator_register_command(valdtr, ext, &tst_test_multiscript);
 	sieve_validator_register_command(valdtr, ext, &tst_test_error);
+	sieve_validator_register_command(valdtr, ext, &tst_test_script_headers);
+	sieve_validator_register_command(valdtr, ext, &tst_test_binary_cached);
+	sieve_validator_register_command(valdtr, ext, &tst_test_binary_shared);
 	sieve_validator_register_command(valdtr, ext, &tst_test_result_action);
 	sieve_validator_register_command(valdtr, ext, &tst_test_result_execute);
 
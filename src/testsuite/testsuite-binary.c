@@ -19,6 +19,7 @@
 
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <utime.h>
 
 /*
  * State
@@ -80,3 +81,25 @@ struct sieve_binary *testsuite_binary_load(const char *name)
 
 
 
+
+bool testsuite_binary_touch(const char *name)
+{
+	const char *path = t_strdup_printf
+		("%s/%s", testsuite_binary_tmp, sieve_binfile_from_name(name));
+	struct utimbuf times;
+	struct stat st;
+
+	if ( stat(path, &st) < 0 ) {
+		i_error("stat(%s) failed: %m", path);
+		return FALSE;
+	}
+
+	/* Move it back in time, so that the change never goes unnoticed */
+	times.actime = st.st_atime;
+	times.modtime = st.st_mtime - 60;
+	if ( utime(path, &times) < 0 ) {
+		i_error("utime(%s) failed: %m", path);
+		return FALSE;
+	}
+	return TRUE;
+}
@@ -16,5 +16,6 @@ void testsuite_binary_reset(void);
 
 bool testsuite_binary_save(struct sieve_binary *sbin, const char *name);
 struct sieve_binary *testsuite_binary_load(const char *name);
+bool testsuite_binary_touch(const char *name);
 
 #endif /* __TESTSUITE_BINARY_H */
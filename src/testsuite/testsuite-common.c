@@ -46,6 +46,7 @@
 
 struct sieve_instance *testsuite_sieve_instance = NULL;
 char *testsuite_test_path = NULL;
+enum sieve_compile_flags testsuite_compile_flags = 0;
 
 /* Test context */
 
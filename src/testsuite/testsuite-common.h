@@ -22,6 +22,9 @@ extern const struct sieve_script_env *testsuite_scriptenv;
 
 extern char *testsuite_test_path;
 
+/* Flags for compiling the test script and the scripts it compiles */
+extern enum sieve_compile_flags testsuite_compile_flags;
+
 
 /*
  * Validator context
@@ -73,11 +76,14 @@ extern const struct sieve_command_def cmd_test_result_reset;
 extern const struct sieve_command_def cmd_test_result_print;
 extern const struct sieve_command_def cmd_test_message;
 extern const struct sieve_command_def cmd_test_message_print;
+extern const struct sieve_command_def cmd_test_message_corrupt_parts;
 extern const struct sieve_command_def cmd_test_mailbox;
 extern const struct sieve_command_def cmd_test_mailbox_create;
 extern const struct sieve_command_def cmd_test_mailbox_delete;
 extern const struct sieve_command_def cmd_test_binary_load;
 extern const struct sieve_command_def cmd_test_binary_save;
+extern const struct sieve_command_def cmd_test_binary_touch;
+extern const struct sieve_command_def cmd_test_binary_share;
 extern const struct sieve_command_def cmd_test_imap_metadata_set;
 
 /*
@@ -85,9 +91,13 @@ extern const struct sieve_command_def cmd_test_imap_metadata_set;
  */
 
 extern const struct sieve_command_def tst_test_script_compile;
+extern const struct sieve_command_def tst_test_script_open;
 extern const struct sieve_command_def tst_test_script_run;
 extern const struct sieve_command_def tst_test_multiscript;
 extern const struct sieve_command_def tst_test_error;
+extern const struct sieve_command_def tst_test_script_headers;
+extern const struct sieve_command_def tst_test_binary_cached;
+extern const struct sieve_command_def tst_test_binary_shared;
 extern const struct sieve_command_def tst_test_result_action;
 extern const struct sieve_command_def tst_test_result_execute;
 
@@ -118,7 +128,14 @@ enum testsuite_operation_code {
 	TESTSUITE_OPERATION_TEST_MAILBOX_DELETE,
 	TESTSUITE_OPERATION_TEST_BINARY_LOAD,
 	TESTSUITE_OPERATION_TEST_BINARY_SAVE,
-	TESTSUITE_OPERATION_TEST_IMAP_METADATA_SET
+	TESTSUITE_OPERATION_TEST_IMAP_METADATA_SET,
+	TESTSUITE_OPERATION_TEST_SCRIPT_HEADERS,
+	TESTSUITE_OPERATION_TEST_MESSAGE_CORRUPT_PARTS,
+	TESTSUITE_OPERATION_TEST_BINARY_TOUCH,
+	TESTSUITE_OPERATION_TEST_BINARY_CACHED,
+	TESTSUITE_OPERATION_TEST_SCRIPT_OPEN,
+	TESTSUITE_OPERATION_TEST_BINARY_SHARE,
+	TESTSUITE_OPERATION_TEST_BINARY_SHARED
 };
 
 extern const struct sieve_operation_def test_operation;
@@ -144,6 +161,13 @@ extern const struct sieve_operation_def test_mailbox_delete_operation;
 extern const struct sieve_operation_def test_binary_load_operation;
 extern const struct sieve_operation_def test_binary_save_operation;
 extern const struct sieve_operation_def test_imap_metadata_set_operation;
+extern const struct sieve_operation_def test_script_headers_operation;
+extern const struct sieve_operation_def test_message_corrupt_parts_operation;
+extern const struct sieve_operation_def test_binary_touch_operation;
+extern const struct sieve_operation_def test_binary_cached_operation;
+extern const struct sieve_operation_def test_script_open_operation;
+extern const struct sieve_operation_def test_binary_share_operation;
+extern const struct sieve_operation_def test_binary_shared_operation;
 
 /*
  * Operands
@@ -7,6 +7,7 @@
 #include "sieve-common.h"
 #include "sieve-script.h"
 #include "sieve-binary.h"
+#include "sieve-binary-shared.h"
 #include "sieve-interpreter.h"
 #include "sieve-runtime-trace.h"
 #include "sieve-result.h"
@@ -30,6 +31,33 @@ void testsuite_script_deinit(void)
 {
 }
 
+static const char *_testsuite_script_path
+(const struct sieve_runtime_env *renv, const char *script)
+{
+	const char *script_path;
+
+	script_path = sieve_file_script_get_dirpath(renv->script);
+	if ( script_path == NULL )
+		return NULL;
+
+	return t_strconcat(script_path, "/", script, NULL);
+}
+
+/* Scripts are opened with their binaries and other files placed in the
+   temporary directory, rather than next to the scripts in the source tree */
+static const char *_testsuite_script_location
+(const struct sieve_runtime_env *renv, const char *script)
+{
+	const char *script_path;
+
+	script_path = _testsuite_script_path(renv, script);
+	if ( script_path == NULL )
+		return NULL;
+
+	return t_strconcat(script_path,
+		";bindir=", testsuite_tmp_dir_get(), "/bin", NULL);
+}
+
 static struct sieve_binary *_testsuite_script_compile
 (const struct sieve_runtime_env *renv, const char *script)
 {
@@ -39,14 +67,13 @@ static struct sieve_binary *_testsuite_script_compile
 
 	sieve_runtime_trace(renv, SIEVE_TRLVL_TESTS, "compile script `%s'", script);
 
-	script_path = sieve_file_script_get_dirpath(renv->script);
+	script_path = _testsuite_script_path(renv, script);
 	if ( script_path == NULL )
 		return NULL;
 
-	script_path = t_strconcat(script_path, "/", script, NULL);
-
 	if ( (sbin = sieve_compile
-		(svinst, script_path, NULL, testsuite_log_ehandler, 0, NULL)) == NULL )
+		(svinst, script_path, NULL, testsuite_log_ehandler,
+			testsuite_compile_flags, NULL)) == NULL )
 		return NULL;
 
 	return sbin;
@@ -73,6 +100,67 @@ bool testsuite_script_compile
 	return TRUE;
 }
 
+bool testsuite_script_open
+(const struct sieve_runtime_env *renv, const char *script)
+{
+	struct testsuite_interpreter_context *ictx =
+		testsuite_interpreter_context_get(renv->interp, testsuite_ext);
+	struct sieve_instance *svinst = testsuite_sieve_instance;
+	struct sieve_binary *sbin;
+	const char *script_location;
+
+	i_assert(ictx != NULL);
+	testsuite_log_clear_messages();
+
+	sieve_runtime_trace(renv, SIEVE_TRLVL_TESTS, "open script `%s'", script);
+
+	script_location = _testsuite_script_location(renv, script);
+	if ( script_location == NULL )
+		return FALSE;
+
+	/* Unlike compiling, opening uses any binary that is available */
+	if ( (sbin = sieve_open
+		(svinst, script_location, NULL, testsuite_log_ehandler,
+			testsuite_compile_flags, NULL)) == NULL )
+		return FALSE;
+
+	if ( ictx->compiled_script != NULL ) {
+		sieve_binary_unref(&ictx->compiled_script);
+	}
+
+	ictx->compiled_script = sbin;
+	return TRUE;
+}
+
+bool testsuite_script_share
+(const struct sieve_runtime_env *renv, const char *script)
+{
+	struct sieve_instance *svinst = testsuite_sieve_instance;
+	struct sieve_binary *sbin = testsuite_script_get_binary(renv);
+	struct sieve_script *sscript;
+	const char *script_location, *digest;
+	bool result;
+
+	if ( sbin == NULL )
+		return FALSE;
+
+	script_location = _testsuite_script_location(renv, script);
+	if ( script_location == NULL )
+		return FALSE;
+
+	if ( (sscript=sieve_script_create_open
+		(svinst, script_location, NULL, NULL)) == NULL )
+		return FALSE;
+
+	/* Stored as is, so the binary keeps the source digest it has */
+	digest = sieve_binary_shared_get_digest(sscript, testsuite_compile_flags);
+	result = ( digest != NULL && sieve_save_as(sbin,
+		sieve_binary_shared_get_path(svinst, digest), TRUE, 0600, NULL) > 0 );
+
+	sieve_script_unref(&sscript);
+	return result;
+}
+
 bool testsuite_script_is_subtest(const struct sieve_runtime_env *renv)
 {
 	struct testsuite_interpreter_context *ictx =
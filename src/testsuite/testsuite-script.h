@@ -13,6 +13,10 @@ bool testsuite_script_is_subtest(const struct sieve_runtime_env *renv);
 
 bool testsuite_script_compile
 	(const struct sieve_runtime_env *renv, const char *script);
+bool testsuite_script_open
+	(const struct sieve_runtime_env *renv, const char *script);
+bool testsuite_script_share
+	(const struct sieve_runtime_env *renv, const char *script);
 bool testsuite_script_run
 	(const struct sieve_runtime_env *renv);
 bool testsuite_script_multiscript
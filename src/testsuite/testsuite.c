@@ -3,6 +3,7 @@
 
 #include "lib.h"
 #include "lib-signals.h"
+#include "array.h"
 #include "ioloop.h"
 #include "env-util.h"
 #include "ostream.h"
@@ -50,6 +51,7 @@ static void print_help(void)
 	printf(
 "Usage: testsuite [-D] [-E] [-d <dump-filename>]\n"
 "                 [-t <trace-filename>] [-T <trace-option>]\n"
+"                 [-s <setting>=<value>] [-O]\n"
 "                 [-P <plugin>] [-x <extensions>]\n"
 "                 <scriptfile>\n"
 	);
@@ -83,7 +85,9 @@ static int testsuite_run
 int main(int argc, char **argv)
 {
 	struct sieve_instance *svinst;
-	const char *scriptfile, *dumpfile, *tracefile;
+	const char *scriptfile, *dumpfile, *tracefile, *setting;
+	ARRAY_TYPE(const_string) settings;
+	const char *const *setp;
 	struct sieve_trace_config trace_config;
 	struct sieve_binary *sbin;
 	const char *sieve_dir, *cwd, *error;
@@ -91,10 +95,11 @@ int main(int argc, char **argv)
 	int ret, c;
 
 	sieve_tool = sieve_tool_init
-		("testsuite", &argc, &argv, "d:t:T:EDP:", TRUE);
+		("testsuite", &argc, &argv, "d:t:T:s:OEDP:", TRUE);
 
 	/* Parse arguments */
 	dumpfile = tracefile = NULL;
+	t_array_init(&settings, 4);
 	i_zero(&trace_config);
 	trace_config.level = SIEVE_TRLVL_ACTIONS;
 	while ((c = sieve_tool_getopt(sieve_tool)) > 0) {
@@ -110,6 +115,15 @@ int main(int argc, char **argv)
 		case 'T':
 			sieve_tool_parse_trace_option(&trace_config, optarg);
 			break;
+		case 's':
+			/* setting override */
+			setting = t_strdup(optarg);
+			array_append(&settings, &setting, 1);
+			break;
+		case 'O':
+			/* optimize compiled scripts */
+			testsuite_compile_flags |= SIEVE_COMPILE_FLAG_OPTIMIZE;
+			break;
 		case 'E':
 			log_stdout = TRUE;
 			break;
@@ -154,6 +168,17 @@ int main(int argc, char **argv)
 	testsuite_setting_set
 		("sieve_global_dir", t_strconcat(sieve_dir, "included-global", NULL));
 
+	array_foreach(&settings, setp) {
+		const char *value = strchr(*setp, '=');
+
+		if ( value == NULL ) {
+			i_fatal_status(EX_USAGE,
+				"Invalid setting override: %s", *setp);
+		}
+		testsuite_setting_set
+			(t_strdup_until(*setp, value), value + 1);
+	}
+
 	/* Finish testsuite initialization */
 	svinst = sieve_tool_init_finish(sieve_tool, FALSE, FALSE);
 	testsuite_init(svinst, sieve_dir, log_stdout);
@@ -162,7 +187,8 @@ int main(int argc, char **argv)
 
 	/* Compile sieve script */
 	if ( (sbin = sieve_compile
-		(svinst, scriptfile, NULL, testsuite_log_main_ehandler, 0, NULL))
+		(svinst, scriptfile, NULL, testsuite_log_main_ehandler,
+			testsuite_compile_flags, NULL))
 			!= NULL ) {
 		struct sieve_trace_log *trace_log = NULL;
 		struct sieve_script_env scriptenv;
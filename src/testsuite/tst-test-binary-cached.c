@@ -0,0 +1,142 @@
+/* Copyright (c) 2002-2017 Pigeonhole authors, see the included COPYING file
+ */
+
+#include "sieve-common.h"
+#include "sieve-commands.h"
+#include "sieve-validator.h"
+#include "sieve-generator.h"
+#include "sieve-interpreter.h"
+#include "sieve-code.h"
+#include "sieve-binary.h"
+#include "sieve-dump.h"
+
+#include "testsuite-common.h"
+#include "testsuite-script.h"
+
+/*
+ * Tests
+ */
+
+static bool tst_test_binary_cached_generate
+	(const struct sieve_codegen_env *cgenv, struct sieve_command *cmd);
+
+/* Test_binary_cached test
+ *
+ * Syntax:
+ *   test_binary_cached
+ *
+ * Succeeds when the last loaded binary was served from the loaded binary
+ * cache rather than read from storage.
+ */
+
+const struct sieve_command_def tst_test_binary_cached = {
+	.identifier = "test_binary_cached",
+	.type = SCT_TEST,
+	.positional_args = 0,
+	.subtests = 0,
+	.block_allowed = FALSE,
+	.block_required = FALSE,
+	.generate = tst_test_binary_cached_generate
+};
+
+/* Test_binary_shared test
+ *
+ * Syntax:
+ *   test_binary_shared
+ *
+ * Succeeds when the last loaded binary was opened from the shared binary
+ * store.
+ */
+
+const struct sieve_command_def tst_test_binary_shared = {
+	.identifier = "test_binary_shared",
+	.type = SCT_TEST,
+	.positional_args = 0,
+	.subtests = 0,
+	.block_allowed = FALSE,
+	.block_required = FALSE,
+	.generate = tst_test_binary_cached_generate
+};
+
+/*
+ * Operation
+ */
+
+static int tst_test_binary_cached_operation_execute
+	(const struct sieve_runtime_env *renv, sieve_size_t *address);
+
+const struct sieve_operation_def test_binary_cached_operation = {
+	.mnemonic = "TEST_BINARY_CACHED",
+	.ext_def = &testsuite_extension,
+	.code = TESTSUITE_OPERATION_TEST_BINARY_CACHED,
+	.execute = tst_test_binary_cached_operation_execute
+};
+
+const struct sieve_operation_def test_binary_shared_operation = {
+	.mnemonic = "TEST_BINARY_SHARED",
+	.ext_def = &testsuite_extension,
+	.code = TESTSUITE_OPERATION_TEST_BINARY_SHARED,
+	.execute = tst_test_binary_cached_operation_execute
+};
+
+/*
+ * Code generation
+ */
+
+static bool tst_test_binary_cached_generate
+(const struct sieve_codegen_env *cgenv, struct sieve_command *tst)
+{
+	if ( sieve_command_is(tst, tst_test_binary_cached) ) {
+		sieve_operation_emit
+			(cgenv->sblock, tst->ext, &test_binary_cached_operation);
+	} else if ( sieve_command_is(tst, tst_test_binary_shared) ) {
+		sieve_operation_emit
+			(cgenv->sblock, tst->ext, &test_binary_shared_operation);
+	} else {
+		i_unreached();
+	}
+
+	return TRUE;
+}
+
+/*
+ * Intepretation
+ */
+
+static int tst_test_binary_cached_operation_execute
+(const struct sieve_runtime_env *renv, sieve_size_t *address ATTR_UNUSED)
+{
+	struct sieve_binary *sbin;
+	const char *state;
+	bool result;
+
+	/*
+	 * Perform operation
+	 */
+
+	sbin = testsuite_script_get_binary(renv);
+
+	if ( sieve_operation_is(renv->oprtn, test_binary_shared_operation) ) {
+		sieve_runtime_trace(renv, SIEVE_TRLVL_TESTS,
+			"testsuite: test_binary_shared test");
+
+		result = ( sbin != NULL && sieve_binary_shared(sbin) );
+		state = "shared";
+	} else {
+		sieve_runtime_trace(renv, SIEVE_TRLVL_TESTS,
+			"testsuite: test_binary_cached test");
+
+		result = ( sbin != NULL && sieve_binary_cached(sbin) );
+		state = "cached";
+	}
+
+	if ( sieve_runtime_trace_active(renv, SIEVE_TRLVL_TESTS) ) {
+		sieve_runtime_trace_descend(renv);
+		sieve_runtime_trace(renv, 0, "binary %s %s",
+			( result ? "is" : "is not" ), state);
+	}
+
+	/* Set result */
+	sieve_interpreter_set_test_result(renv->interp, result);
+	return SIEVE_EXEC_OK;
+}
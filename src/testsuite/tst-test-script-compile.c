@@ -16,10 +16,7 @@
 #include "testsuite-script.h"
 
 /*
- * Test_script_compile command
- *
- * Syntax:
- *   test_script_compile <scriptpath: string>
+ * Tests
  */
 
 static bool tst_test_script_compile_validate
@@ -27,6 +24,12 @@ static bool tst_test_script_compile_validate
 static bool tst_test_script_compile_generate
 	(const struct sieve_codegen_env *cgenv, struct sieve_command *cmd);
 
+/* Test_script_compile test
+ *
+ * Syntax:
+ *   test_script_compile <scriptpath: string>
+ */
+
 const struct sieve_command_def tst_test_script_compile = {
 	.identifier = "test_script_compile",
 	.type = SCT_TEST,
@@ -38,6 +41,26 @@ const struct sieve_command_def tst_test_script_compile = {
 	.generate = tst_test_script_compile_generate
 };
 
+/* Test_script_open test
+ *
+ * Syntax:
+ *   test_script_open <scriptpath: string>
+ *
+ * Opens the script the way deliveries do, using an existing binary when
+ * there is one.
+ */
+
+const struct sieve_command_def tst_test_script_open = {
+	.identifier = "test_script_open",
+	.type = SCT_TEST,
+	.positional_args = 1,
+	.subtests = 0,
+	.block_allowed = FALSE,
+	.block_required = FALSE,
+	.validate = tst_test_script_compile_validate,
+	.generate = tst_test_script_compile_generate
+};
+
 /*
  * Operation
  */
@@ -55,6 +78,14 @@ const struct sieve_operation_def test_script_compile_operation = {
 	.execute = tst_test_script_compile_operation_execute
 };
 
+const struct sieve_operation_def test_script_open_operation = {
+	.mnemonic = "TEST_SCRIPT_OPEN",
+	.ext_def = &testsuite_extension,
+	.code = TESTSUITE_OPERATION_TEST_SCRIPT_OPEN,
+	.dump = tst_test_script_compile_operation_dump,
+	.execute = tst_test_script_compile_operation_execute
+};
+
 /*
  * Validation
  */
@@ -79,7 +110,15 @@ static bool tst_test_script_compile_validate
 static bool tst_test_script_compile_generate
 (const struct sieve_codegen_env *cgenv, struct sieve_command *tst)
 {
-	sieve_operation_emit(cgenv->sblock, tst->ext, &test_script_compile_operation);
+	if ( sieve_command_is(tst, tst_test_script_compile) ) {
+		sieve_operation_emit
+			(cgenv->sblock, tst->ext, &test_script_compile_operation);
+	} else if ( sieve_command_is(tst, tst_test_script_open) ) {
+		sieve_operation_emit
+			(cgenv->sblock, tst->ext, &test_script_open_operation);
+	} else {
+		i_unreached();
+	}
 
 	/* Generate arguments */
 	return sieve_generate_arguments(cgenv, tst, NULL);
@@ -92,7 +131,7 @@ static bool tst_test_script_compile_generate
 static bool tst_test_script_compile_operation_dump
 (const struct sieve_dumptime_env *denv, sieve_size_t *address)
 {
-	sieve_code_dumpf(denv, "TEST_SCRIPT_COMPILE:");
+	sieve_code_dumpf(denv, "%s:", sieve_operation_mnemonic(denv->oprtn));
 	sieve_code_descend(denv);
 
 	if ( !sieve_opr_string_dump(denv, address, "script-name") )
@@ -124,14 +163,25 @@ static int tst_test_script_compile_operation_execute
 	 * Perform operation
 	 */
 
-	if ( sieve_runtime_trace_active(renv, SIEVE_TRLVL_TESTS) ) {
-		sieve_runtime_trace(renv, 0, "testsuite: test_script_compile test");
-		sieve_runtime_trace_descend(renv);
-	}
+	if ( sieve_operation_is(renv->oprtn, test_script_open_operation) ) {
+		if ( sieve_runtime_trace_active(renv, SIEVE_TRLVL_TESTS) ) {
+			sieve_runtime_trace(renv, 0, "testsuite: test_script_open test");
+			sieve_runtime_trace_descend(renv);
+		}
+
+		/* Attempt script open */
 
-	/* Attempt script compile */
+		result = testsuite_script_open(renv, str_c(script_name));
+	} else {
+		if ( sieve_runtime_trace_active(renv, SIEVE_TRLVL_TESTS) ) {
+			sieve_runtime_trace(renv, 0, "testsuite: test_script_compile test");
+			sieve_runtime_trace_descend(renv);
+		}
 
-	result = testsuite_script_compile(renv, str_c(script_name));
+		/* Attempt script compile */
+
+		result = testsuite_script_compile(renv, str_c(script_name));
+	}
 
 	/* Set result */
 	sieve_interpreter_set_test_result(renv->interp, result);
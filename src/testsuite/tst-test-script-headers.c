@@ -0,0 +1,252 @@
+/* Copyright (c) 2002-2017 Pigeonhole authors, see the included COPYING file
+ */
+
+#include "sieve-common.h"
+#include "sieve.h"
+#include "sieve-stringlist.h"
+#include "sieve-commands.h"
+#include "sieve-comparators.h"
+#include "sieve-match-types.h"
+#include "sieve-validator.h"
+#include "sieve-generator.h"
+#include "sieve-interpreter.h"
+#include "sieve-code.h"
+#include "sieve-binary.h"
+#include "sieve-dump.h"
+#include "sieve-match.h"
+
+#include "testsuite-common.h"
+#include "testsuite-script.h"
+
+/*
+ * Test_script_headers command
+ *
+ * Syntax:
+ *   test_script_headers [MATCH-TYPE] [COMPARATOR] <key-list: string-list>
+ *
+ * Matches the names of the header fields that the last compiled script was
+ * found to access. When the script can access any header field, the only
+ * value is the empty string, which is not a valid header field name.
+ */
+
+static bool tst_test_script_headers_registered
+	(struct sieve_validator *valdtr, const struct sieve_extension *ext,
+		struct sieve_command_registration *cmd_reg);
+static bool tst_test_script_headers_validate
+	(struct sieve_validator *valdtr, struct sieve_command *cmd);
+static bool tst_test_script_headers_generate
+	(const struct sieve_codegen_env *cgenv, struct sieve_command *ctx);
+
+const struct sieve_command_def tst_test_script_headers = {
+	.identifier = "test_script_headers",
+	.type = SCT_TEST,
+	.positional_args = 1,
+	.subtests = 0,
+	.block_allowed = FALSE,
+	.block_required = FALSE,
+	.registered = tst_test_script_headers_registered,
+	.validate = tst_test_script_headers_validate,
+	.generate = tst_test_script_headers_generate
+};
+
+/*
+ * Operation
+ */
+
+static bool tst_test_script_headers_operation_dump
+	(const struct sieve_dumptime_env *denv, sieve_size_t *address);
+static int tst_test_script_headers_operation_execute
+	(const struct sieve_runtime_env *renv, sieve_size_t *address);
+
+const struct sieve_operation_def test_script_headers_operation = {
+	.mnemonic = "TEST_SCRIPT_HEADERS",
+	.ext_def = &testsuite_extension,
+	.code = TESTSUITE_OPERATION_TEST_SCRIPT_HEADERS,
+	.dump = tst_test_script_headers_operation_dump,
+	.execute = tst_test_script_headers_operation_execute
+};
+
+/*
+ * Command registration
+ */
+
+static bool tst_test_script_headers_registered
+(struct sieve_validator *valdtr, const struct sieve_extension *ext ATTR_UNUSED,
+	struct sieve_command_registration *cmd_reg)
+{
+	/* The order of these is not significant */
+	sieve_comparators_link_tag(valdtr, cmd_reg, SIEVE_MATCH_OPT_COMPARATOR);
+	sieve_match_types_link_tags(valdtr, cmd_reg, SIEVE_MATCH_OPT_MATCH_TYPE);
+
+	return TRUE;
+}
+
+/*
+ * Validation
+ */
+
+static bool tst_test_script_headers_validate
+(struct sieve_validator *valdtr, struct sieve_command *tst)
+{
+	struct sieve_ast_argument *arg = tst->first_positional;
+	struct sieve_comparator cmp_default =
+		SIEVE_COMPARATOR_DEFAULT(i_ascii_casemap_comparator);
+	struct sieve_match_type mcht_default =
+		SIEVE_COMPARATOR_DEFAULT(is_match_type);
+
+	if ( !sieve_validate_positional_argument
+		(valdtr, tst, arg, "key list", 1, SAAT_STRING_LIST) ) {
+		return FALSE;
+	}
+
+	if ( !sieve_validator_argument_activate(valdtr, tst, arg, FALSE) )
+		return FALSE;
+
+	/* Validate the key argument to a specified match type */
+	return sieve_match_type_validate
+		(valdtr, tst, arg, &mcht_default, &cmp_default);
+}
+
+/*
+ * Code generation
+ */
+
+static bool tst_test_script_headers_generate
+(const struct sieve_codegen_env *cgenv, struct sieve_command *tst)
+{
+	sieve_operation_emit(cgenv->sblock, tst->ext, &test_script_headers_operation);
+
+	/* Generate arguments */
+	return sieve_generate_arguments(cgenv, tst, NULL);
+}
+
+/*
+ * Code dump
+ */
+
+static bool tst_test_script_headers_operation_dump
+(const struct sieve_dumptime_env *denv, sieve_size_t *address)
+{
+	sieve_code_dumpf(denv, "TEST_SCRIPT_HEADERS:");
+	sieve_code_descend(denv);
+
+	/* Handle any optional arguments */
+	if ( sieve_match_opr_optional_dump(denv, address, NULL) != 0 )
+		return FALSE;
+
+	return sieve_opr_stringlist_dump(denv, address, "key list");
+}
+
+/*
+ * Header names stringlist
+ */
+
+struct testsuite_headers_stringlist {
+	struct sieve_stringlist strlist;
+
+	const char *const *names;
+	unsigned int count, index;
+};
+
+static int testsuite_headers_stringlist_next_item
+(struct sieve_stringlist *_strlist, string_t **str_r)
+{
+	struct testsuite_headers_stringlist *strlist =
+		(struct testsuite_headers_stringlist *)_strlist;
+
+	if ( strlist->index >= strlist->count ) {
+		*str_r = NULL;
+		return 0;
+	}
+
+	*str_r = t_str_new_const(strlist->names[strlist->index],
+		strlen(strlist->names[strlist->index]));
+	strlist->index++;
+	return 1;
+}
+
+static void testsuite_headers_stringlist_reset
+(struct sieve_stringlist *_strlist)
+{
+	struct testsuite_headers_stringlist *strlist =
+		(struct testsuite_headers_stringlist *)_strlist;
+
+	strlist->index = 0;
+}
+
+static struct sieve_stringlist *testsuite_headers_stringlist_create
+(const struct sieve_runtime_env *renv, struct sieve_binary *sbin)
+{
+	struct testsuite_headers_stringlist *strlist;
+	ARRAY_TYPE(const_string) names;
+
+	t_array_init(&names, 8);
+	if ( !sieve_get_header_names(sbin, &names) ) {
+		const char *any = "";
+
+		array_clear(&names);
+		array_append(&names, &any, 1);
+	}
+
+	strlist = t_new(struct testsuite_headers_stringlist, 1);
+	strlist->strlist.runenv = renv;
+	strlist->strlist.exec_status = SIEVE_EXEC_OK;
+	strlist->strlist.next_item = testsuite_headers_stringlist_next_item;
+	strlist->strlist.reset = testsuite_headers_stringlist_reset;
+	strlist->names = array_get(&names, &strlist->count);
+
+	return &strlist->strlist;
+}
+
+/*
+ * Intepretation
+ */
+
+static int tst_test_script_headers_operation_execute
+(const struct sieve_runtime_env *renv, sieve_size_t *address)
+{
+	struct sieve_comparator cmp =
+		SIEVE_COMPARATOR_DEFAULT(i_ascii_casemap_comparator);
+	struct sieve_match_type mcht = SIEVE_COMPARATOR_DEFAULT(is_match_type);
+	struct sieve_stringlist *value_list, *key_list;
+	struct sieve_binary *sbin;
+	int match, ret;
+
+	/*
+	 * Read operands
+	 */
+
+	/* Read optional operands */
+	if ( sieve_match_opr_optional_read
+		(renv, address, NULL, &ret, &cmp, &mcht) < 0 )
+		return ret;
+
+	/* Read key-list */
+	if ( (ret=sieve_opr_stringlist_read(renv, address, "key_list", &key_list))
+		<= 0 )
+		return ret;
+
+	/*
+	 * Perform operation
+	 */
+
+	sieve_runtime_trace(renv, SIEVE_TRLVL_TESTS,
+		"testsuite: test_script_headers test; "
+		"match header names accessed by compiled script");
+
+	if ( (sbin=testsuite_script_get_binary(renv)) == NULL ) {
+		sieve_interpreter_set_test_result(renv->interp, FALSE);
+		return SIEVE_EXEC_OK;
+	}
+
+	/* Create value stringlist */
+	value_list = testsuite_headers_stringlist_create(renv, sbin);
+
+	/* Perform match */
+	if ( (match=sieve_match(renv, &mcht, &cmp, value_list, key_list, &ret)) < 0 )
+		return ret;
+
+	/* Set test result for subsequent conditional jump */
+	sieve_interpreter_set_test_result(renv->interp, match > 0);
+	return SIEVE_EXEC_OK;
+}